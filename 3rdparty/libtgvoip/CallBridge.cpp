@@ -0,0 +1,82 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include "CallBridge.h"
+#include "VoIPController.h"
+#include "logging.h"
+
+using namespace tgvoip;
+
+CallBridge* CallBridge::Create(VoIPController* a, VoIPController* b){
+	CallBridge* bridge=new CallBridge();
+	if(!a->ClaimExternalAudioSource(bridge)){
+		LOGW("Bridge: the outgoing audio of the first call is already fed by something else");
+		delete bridge;
+		return NULL;
+	}
+	if(!b->ClaimExternalAudioSource(bridge)){
+		LOGW("Bridge: the outgoing audio of the second call is already fed by something else");
+		a->ReleaseExternalAudioSource(bridge);
+		delete bridge;
+		return NULL;
+	}
+	bridge->Attach(bridge->aToB, a, b);
+	bridge->Attach(bridge->bToA, b, a);
+	return bridge;
+}
+
+CallBridge::~CallBridge(){
+	if(!aToB.from)
+		return;
+	Detach(aToB);
+	Detach(bToA);
+	aToB.from->ReleaseExternalAudioSource(this);
+	bToA.from->ReleaseExternalAudioSource(this);
+}
+
+void CallBridge::Attach(Direction& d, VoIPController* from, VoIPController* to){
+	d.from=from;
+	d.to=to;
+	d.tapID=from->AddIncomingAudioTap([&d](const unsigned char* data, size_t len, uint32_t pts){
+		HandleFrame(d, data, len);
+	});
+}
+
+void CallBridge::Detach(Direction& d){
+	d.from->RemoveIncomingAudioTap(d.tapID);
+	if(d.forwarding){
+		d.forwarding=false;
+		d.from->SetAudioDecodingEnabled(true);
+		d.to->SetExternalAudioSource(false);
+	}
+}
+
+void CallBridge::HandleFrame(Direction& d, const unsigned char* data, size_t len){
+	// This runs on the receive thread of d.from, holding its tap lock. It only hands the frame to d.to's packetizer;
+	// the mode switches below just set flags and leave starting and stopping audio I/O to each call's message thread
+	// The frame duration of either stream can only change when the call is (re)initialized, so check it on every frame
+	uint16_t inDuration=d.from->GetIncomingAudioFrameDuration();
+	uint16_t outDuration=d.to->GetOutgoingAudioFrameDuration();
+	if(inDuration!=outDuration){
+		if(d.forwarding){
+			LOGI("Bridge: frame durations changed to %u/%u ms, falling back to transcoding", (unsigned int)inDuration, (unsigned int)outDuration);
+			d.forwarding=false;
+			d.from->SetAudioDecodingEnabled(true);
+			d.to->SetExternalAudioSource(false);
+		}else if(!d.mismatchLogged){
+			LOGI("Bridge: frame durations differ (%u/%u ms), transcoding", (unsigned int)inDuration, (unsigned int)outDuration);
+			d.mismatchLogged=true;
+		}
+		return;
+	}
+	if(!d.forwarding){
+		LOGI("Bridge: forwarding %u ms Opus frames without transcoding", (unsigned int)inDuration);
+		d.to->SetExternalAudioSource(true);
+		d.from->SetAudioDecodingEnabled(false);
+		d.forwarding=true;
+	}
+	d.to->SendEncodedAudioFrame(data, len);
+}
@@ -0,0 +1,66 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_CALLBRIDGE_H
+#define LIBTGVOIP_CALLBRIDGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "utils.h"
+
+namespace tgvoip{
+
+	class VoIPController;
+
+	/**
+	 * Connects the audio of two calls without transcoding: Opus frames received by one controller are handed as-is to the
+	 * other one's packetizer, so neither side runs the decoder, the echo canceller or the encoder for bridged audio.
+	 * A direction is only forwarded when the incoming and outgoing frame durations match. Otherwise it's left alone and
+	 * audio has to go through PCM (decode, then encode again) like before.
+	 * The bridge owns the outgoing audio of both calls for its whole lifetime, so nothing else (an EncoderGroup, an
+	 * RtpBridge) can feed them meanwhile. Both controllers must outlive the bridge.
+	 */
+	class CallBridge{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(CallBridge);
+		/**
+		 * @return NULL if something else already feeds the outgoing audio of either call
+		 */
+		static CallBridge* Create(VoIPController* a, VoIPController* b);
+		~CallBridge();
+		/**
+		 * @return whether audio from a to b is currently forwarded without transcoding
+		 */
+		bool IsForwardingAToB() const{
+			return aToB.forwarding;
+		}
+		/**
+		 * @return whether audio from b to a is currently forwarded without transcoding
+		 */
+		bool IsForwardingBToA() const{
+			return bToA.forwarding;
+		}
+
+	private:
+		struct Direction{
+			VoIPController* from=NULL;
+			VoIPController* to=NULL;
+			uint32_t tapID;
+			std::atomic<bool> forwarding{false};
+			bool mismatchLogged=false;
+		};
+		CallBridge(){}
+		void Attach(Direction& d, VoIPController* from, VoIPController* to);
+		void Detach(Direction& d);
+		static void HandleFrame(Direction& d, const unsigned char* data, size_t len);
+
+		Direction aToB;
+		Direction bToA;
+	};
+}
+
+#endif //LIBTGVOIP_CALLBRIDGE_H
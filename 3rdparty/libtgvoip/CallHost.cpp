@@ -0,0 +1,344 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <assert.h>
+#include <float.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "CallHost.h"
+#include "VoIPController.h"
+#include "logging.h"
+
+using namespace tgvoip;
+
+// A strand gives up its worker after this many tasks so that one busy call can't starve the others
+#define STRAND_TASK_BUDGET 16
+
+class CallHost::Strand{
+public:
+	Strand(const char* name) : name(name){}
+	const char* name;
+	std::mutex mutex;
+	std::condition_variable idleCond;  // notified when running goes back to false
+	std::deque<Timer> tasks;
+	bool scheduled=false;
+	bool closed=false;
+	bool running=false;
+};
+
+namespace{
+	thread_local CallHost* currentHost=NULL;
+	thread_local unsigned int currentWorker=0;
+	thread_local const void* currentStrand=NULL;
+	thread_local std::atomic<bool>* currentTimerCancelled=NULL;
+}
+
+CallHost::CallHost(unsigned int numWorkers){
+	if(numWorkers==0){
+		numWorkers=std::max(1U, std::thread::hardware_concurrency());
+	}
+	LOGI("Starting CallHost with %u workers", numWorkers);
+	for(unsigned int i=0;i<numWorkers;i++){
+		Worker* w=new Worker();
+		w->thread=new Thread(std::bind(&CallHost::RunWorker, this, i));
+		w->thread->SetName("CallHost");
+		workers.push_back(w);
+	}
+	for(Worker* w:workers){
+		w->thread->Start();
+	}
+}
+
+CallHost::~CallHost(){
+	Stop();
+	for(Worker* w:workers){
+		delete w->thread;
+		delete w;
+	}
+}
+
+void CallHost::Stop(){
+	if(!running.exchange(false))
+		return;
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		workEpoch++;
+	}
+	sleepCond.notify_all();
+	for(Worker* w:workers){
+		w->thread->Join();
+	}
+	MutexGuard m(timersMutex);
+	timers.clear();
+	activeTimers.clear();
+}
+
+std::shared_ptr<CallHost::Strand> CallHost::CreateStrand(const char* name){
+	activeStrands++;
+	return std::make_shared<Strand>(name);
+}
+
+void CallHost::CloseStrand(const std::shared_ptr<Strand>& strand){
+	{
+		std::lock_guard<std::mutex> m(strand->mutex);
+		if(strand->closed)
+			return;
+		strand->closed=true;
+		strand->tasks.clear();
+	}
+	{
+		MutexGuard m(timersMutex);
+		for(std::vector<Timer>::iterator t=timers.begin();t!=timers.end();){
+			if(t->strand==strand){
+				t->state->cancelled=true;
+				activeTimers.erase(t->state->id);
+				t=timers.erase(t);
+			}else{
+				++t;
+			}
+		}
+	}
+	if(currentStrand!=strand.get()){
+		std::unique_lock<std::mutex> l(strand->mutex);
+		strand->idleCond.wait(l, [&strand]{
+			return !strand->running;
+		});
+	}
+	activeStrands--;
+}
+
+uint32_t CallHost::Post(const std::shared_ptr<Strand>& strand, std::function<void()> func, double delay, double interval){
+	assert(delay>=0);
+	std::shared_ptr<TimerState> state=std::make_shared<TimerState>();
+	Timer t{delay==0.0 ? 0.0 : (VoIPController::GetCurrentTime()+delay), interval, strand, state, std::move(func)};
+	{
+		MutexGuard m(timersMutex);
+		state->id=lastTimerID++;
+		if(lastTimerID==INVALID_ID)
+			lastTimerID=1;
+		activeTimers[state->id]=state;
+		if(delay!=0.0){
+			InsertTimerInternal(t);
+		}
+	}
+	if(delay==0.0){
+		Enqueue(t);
+	}else{
+		WakeWorker();
+	}
+	return state->id;
+}
+
+void CallHost::Cancel(uint32_t id){
+	MutexGuard m(timersMutex);
+	std::unordered_map<uint32_t, std::shared_ptr<TimerState>>::iterator st=activeTimers.find(id);
+	if(st==activeTimers.end())
+		return;
+	st->second->cancelled=true;
+	activeTimers.erase(st);
+	for(std::vector<Timer>::iterator t=timers.begin();t!=timers.end();++t){
+		if(t->state->id==id){
+			timers.erase(t);
+			break;
+		}
+	}
+}
+
+void CallHost::CancelSelf(){
+	assert(currentTimerCancelled);
+	*currentTimerCancelled=true;
+}
+
+bool CallHost::IsCurrent(const std::shared_ptr<Strand>& strand) const{
+	return currentHost==this && currentStrand==strand.get();
+}
+
+CallHost::Stats CallHost::GetStats() const{
+	return Stats{tasksExecuted.load(), tasksStolen.load(), activeStrands.load()};
+}
+
+void CallHost::InsertTimerInternal(Timer& timer){
+	std::vector<Timer>::iterator pos=std::upper_bound(timers.begin(), timers.end(), timer.deliverAt, [](double deliverAt, const Timer& t){
+		return deliverAt<t.deliverAt;
+	});
+	timers.insert(pos, std::move(timer));
+}
+
+void CallHost::Enqueue(Timer& timer){
+	std::shared_ptr<Strand> strand=std::move(timer.strand);
+	bool needSchedule;
+	{
+		std::lock_guard<std::mutex> m(strand->mutex);
+		if(strand->closed){
+			MutexGuard tm(timersMutex);
+			activeTimers.erase(timer.state->id);
+			return;
+		}
+		needSchedule=!strand->scheduled;
+		strand->scheduled=true;
+		strand->tasks.push_back(std::move(timer));
+	}
+	if(needSchedule)
+		Schedule(strand);
+}
+
+void CallHost::Schedule(const std::shared_ptr<Strand>& strand){
+	// Tasks spawned by a worker stay on that worker's deque while it's hot, everything else is spread round-robin
+	unsigned int index=currentHost==this ? currentWorker : (nextWorker++ % (unsigned int)workers.size());
+	Worker* w=workers[index];
+	{
+		MutexGuard m(w->dequeMutex);
+		w->deque.push_back(strand);
+	}
+	WakeWorker();
+}
+
+void CallHost::WakeWorker(){
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		workEpoch++;
+	}
+	sleepCond.notify_one();
+}
+
+double CallHost::DispatchDueTimers(){
+	std::vector<Timer> due;
+	double next=DBL_MAX;
+	{
+		MutexGuard m(timersMutex);
+		double now=VoIPController::GetCurrentTime();
+		std::vector<Timer>::iterator t=timers.begin();
+		while(t!=timers.end() && t->deliverAt<=now){
+			++t;
+		}
+		std::move(timers.begin(), t, std::back_inserter(due));
+		timers.erase(timers.begin(), t);
+		if(!timers.empty())
+			next=timers[0].deliverAt;
+	}
+	for(Timer& t:due){
+		if(!t.state->cancelled)
+			Enqueue(t);
+	}
+	return next;
+}
+
+std::shared_ptr<CallHost::Strand> CallHost::PopLocal(unsigned int index){
+	Worker* w=workers[index];
+	MutexGuard m(w->dequeMutex);
+	if(w->deque.empty())
+		return nullptr;
+	std::shared_ptr<Strand> s=std::move(w->deque.back());
+	w->deque.pop_back();
+	return s;
+}
+
+std::shared_ptr<CallHost::Strand> CallHost::Steal(unsigned int index){
+	for(unsigned int i=1;i<workers.size();i++){
+		Worker* w=workers[(index+i)%workers.size()];
+		MutexGuard m(w->dequeMutex);
+		if(!w->deque.empty()){
+			std::shared_ptr<Strand> s=std::move(w->deque.front());
+			w->deque.pop_front();
+			return s;
+		}
+	}
+	return nullptr;
+}
+
+void CallHost::RunStrand(unsigned int index, std::shared_ptr<Strand> strand){
+	currentStrand=strand.get();
+	for(int i=0;i<STRAND_TASK_BUDGET;i++){
+		Timer t;
+		{
+			std::lock_guard<std::mutex> m(strand->mutex);
+			if(strand->closed || strand->tasks.empty()){
+				strand->scheduled=false;
+				strand->running=false;
+				strand->idleCond.notify_all();
+				currentStrand=NULL;
+				return;
+			}
+			strand->running=true;
+			t=std::move(strand->tasks.front());
+			strand->tasks.pop_front();
+		}
+		if(t.state->cancelled)
+			continue;
+		if(t.deliverAt==0.0)
+			t.deliverAt=VoIPController::GetCurrentTime();
+		currentTimerCancelled=&t.state->cancelled;
+		if(t.func)
+			t.func();
+		currentTimerCancelled=NULL;
+		tasksExecuted++;
+
+		MutexGuard m(timersMutex);
+		if(t.interval>0.0 && !t.state->cancelled){
+			t.deliverAt+=t.interval;
+			t.strand=strand;
+			InsertTimerInternal(t);
+		}else{
+			activeTimers.erase(t.state->id);
+		}
+	}
+	currentStrand=NULL;
+	{
+		std::lock_guard<std::mutex> m(strand->mutex);
+		strand->running=false;
+		strand->idleCond.notify_all();
+		if(strand->closed || strand->tasks.empty()){
+			strand->scheduled=false;
+			return;
+		}
+	}
+	// Out of budget but still has work: put it back so that it can be picked up by an idle worker
+	Worker* w=workers[index];
+	{
+		MutexGuard m(w->dequeMutex);
+		w->deque.push_front(strand);
+	}
+	WakeWorker();
+}
+
+void CallHost::RunWorker(unsigned int index){
+	currentHost=this;
+	currentWorker=index;
+	while(running){
+		uint64_t epoch;
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			epoch=workEpoch;
+		}
+		double nextDeadline=DispatchDueTimers();
+		std::shared_ptr<Strand> strand=PopLocal(index);
+		if(!strand){
+			strand=Steal(index);
+			if(strand)
+				tasksStolen++;
+		}
+		if(strand){
+			RunStrand(index, std::move(strand));
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		if(!running)
+			break;
+		if(workEpoch!=epoch)
+			continue;
+		if(nextDeadline==DBL_MAX){
+			sleepCond.wait(lock);
+		}else{
+			double timeout=Clock::ToRealDuration(nextDeadline-VoIPController::GetCurrentTime());
+			if(timeout>0.0)
+				sleepCond.wait_for(lock, std::chrono::duration<double>(timeout));
+		}
+	}
+	currentHost=NULL;
+}
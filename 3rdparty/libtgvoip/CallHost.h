@@ -0,0 +1,119 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_CALLHOST_H
+#define LIBTGVOIP_CALLHOST_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "threading.h"
+#include "utils.h"
+
+namespace tgvoip{
+
+	/**
+	 * A fixed pool of worker threads shared by any number of calls.
+	 * Work is submitted to strands: tasks posted to the same strand never run concurrently and run in
+	 * the order they became due, so code written for a dedicated MessageThread keeps working unchanged.
+	 * Runnable strands sit in per-worker deques; idle workers steal from the other end of their neighbours'.
+	 */
+	class CallHost{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(CallHost);
+		class Strand;
+		struct Stats{
+			uint64_t tasksExecuted;
+			uint64_t tasksStolen;
+			uint32_t activeStrands;
+		};
+
+		/**
+		 * @param numWorkers number of worker threads, 0 to use the number of CPU cores
+		 */
+		CallHost(unsigned int numWorkers=0);
+		~CallHost();
+		std::shared_ptr<Strand> CreateStrand(const char* name);
+		/**
+		 * Closes the strand: drops its pending tasks, cancels its timers and waits for a task that's
+		 * currently running on it to return (unless called from that task).
+		 */
+		void CloseStrand(const std::shared_ptr<Strand>& strand);
+		/**
+		 * Same semantics as MessageThread::Post.
+		 * @return an id that can be passed to Cancel()
+		 */
+		uint32_t Post(const std::shared_ptr<Strand>& strand, std::function<void()> func, double delay=0, double interval=0);
+		void Cancel(uint32_t id);
+		/**
+		 * Cancels the periodic task that is currently running on the calling worker.
+		 */
+		void CancelSelf();
+		bool IsCurrent(const std::shared_ptr<Strand>& strand) const;
+		unsigned int GetWorkerCount() const{
+			return (unsigned int)workers.size();
+		}
+		Stats GetStats() const;
+		void Stop();
+
+		enum{
+			INVALID_ID=0
+		};
+
+	private:
+		struct TimerState{
+			uint32_t id;
+			std::atomic<bool> cancelled{false};
+		};
+		struct Timer{
+			double deliverAt;
+			double interval;
+			std::shared_ptr<Strand> strand;
+			std::shared_ptr<TimerState> state;
+			std::function<void()> func;
+		};
+		struct Worker{
+			Thread* thread;
+			Mutex dequeMutex;
+			std::deque<std::shared_ptr<Strand>> deque;
+		};
+
+		void RunWorker(unsigned int index);
+		std::shared_ptr<Strand> PopLocal(unsigned int index);
+		std::shared_ptr<Strand> Steal(unsigned int index);
+		void RunStrand(unsigned int index, std::shared_ptr<Strand> strand);
+		void Schedule(const std::shared_ptr<Strand>& strand);
+		void Enqueue(Timer& timer);
+		void InsertTimerInternal(Timer& timer);
+		double DispatchDueTimers();
+		void WakeWorker();
+
+		std::vector<Worker*> workers;
+		std::atomic<bool> running{true};
+		std::atomic<unsigned int> nextWorker{0};
+
+		Mutex timersMutex;
+		std::vector<Timer> timers;
+		std::unordered_map<uint32_t, std::shared_ptr<TimerState>> activeTimers;
+		uint32_t lastTimerID=1;
+
+		std::mutex sleepMutex;
+		std::condition_variable sleepCond;
+		uint64_t workEpoch=0;
+
+		std::atomic<uint64_t> tasksExecuted{0};
+		std::atomic<uint64_t> tasksStolen{0};
+		std::atomic<uint32_t> activeStrands{0};
+	};
+}
+
+#endif //LIBTGVOIP_CALLHOST_H
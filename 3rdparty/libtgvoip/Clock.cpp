@@ -0,0 +1,58 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <assert.h>
+#include <atomic>
+
+#include "Clock.h"
+#include "VoIPController.h"
+#include "threading.h"
+
+using namespace tgvoip;
+
+static std::atomic<Clock*> installedClock{nullptr};
+
+void Clock::Install(Clock* clock){
+	installedClock.store(clock);
+}
+
+Clock* Clock::GetInstalled(){
+	return installedClock.load(std::memory_order_relaxed);
+}
+
+double Clock::ToRealDuration(double duration){
+	Clock* clock=GetInstalled();
+	return clock ? duration/clock->GetRate() : duration;
+}
+
+void Clock::Sleep(double duration){
+	Thread::Sleep(ToRealDuration(duration));
+}
+
+ScaledClock::ScaledClock(double rate) : rate(rate){
+	assert(rate>0.0);
+	// Starts out equal to the system clock so that installing it doesn't make time jump
+	realAnchor=clockAnchor=VoIPController::GetMonotonicTime();
+}
+
+double ScaledClock::GetTime(){
+	MutexGuard m(mutex);
+	return clockAnchor+(VoIPController::GetMonotonicTime()-realAnchor)*rate;
+}
+
+double ScaledClock::GetRate(){
+	MutexGuard m(mutex);
+	return rate;
+}
+
+void ScaledClock::SetRate(double rate){
+	assert(rate>0.0);
+	MutexGuard m(mutex);
+	double now=VoIPController::GetMonotonicTime();
+	clockAnchor+=(now-realAnchor)*this->rate;
+	realAnchor=now;
+	this->rate=rate;
+}
@@ -0,0 +1,72 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_CLOCK_H
+#define LIBTGVOIP_CLOCK_H
+
+#include "threading.h"
+#include "utils.h"
+
+namespace tgvoip{
+
+	/**
+	 * Time source behind VoIPController::GetCurrentTime(). Timers, the jitter buffer, congestion control
+	 * and the callback audio I/O pacing all read time through it, so replacing it changes the speed of the whole library.
+	 */
+	class Clock{
+	public:
+		virtual ~Clock()=default;
+		virtual double GetTime()=0;
+		/**
+		 * @return clock seconds that pass per real second
+		 */
+		virtual double GetRate(){
+			return 1.0;
+		}
+
+		/**
+		 * Install a process-wide clock, or NULL to go back to the monotonic system clock.
+		 * Running controllers only tolerate a clock that continues from the current time, like a new ScaledClock;
+		 * anything else must be installed before creating any controllers. The caller keeps ownership, and the clock
+		 * must outlive all controllers.
+		 */
+		static void Install(Clock* clock);
+		static Clock* GetInstalled();
+		/**
+		 * Convert an interval of the installed clock to real seconds, for passing to OS waits
+		 */
+		static double ToRealDuration(double duration);
+		/**
+		 * Sleep for an interval of the installed clock
+		 */
+		static void Sleep(double duration);
+	};
+
+	/**
+	 * Runs at a multiple of the system clock, e.g. 20.0 to run calls 20 times faster than realtime in tests.
+	 * It starts out equal to the system clock and never goes backwards, so it can be installed and its rate changed
+	 * while calls are running.
+	 */
+	class ScaledClock : public Clock{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(ScaledClock);
+		ScaledClock(double rate);
+		virtual ~ScaledClock()=default;
+		virtual double GetTime() override;
+		virtual double GetRate() override;
+		/**
+		 * Continue from the current time at a different rate
+		 */
+		void SetRate(double rate);
+	private:
+		Mutex mutex;
+		double rate;
+		double realAnchor;   // system time of the last rate change
+		double clockAnchor;  // this clock's time at that moment
+	};
+}
+
+#endif //LIBTGVOIP_CLOCK_H
@@ -0,0 +1,172 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <algorithm>
+#include <chrono>
+
+#include "CpuGovernor.h"
+#include "logging.h"
+
+using namespace tgvoip;
+
+// Seconds of reports the load is averaged over; also the minimum time between two adjustments
+#define GOVERNOR_WINDOW 1.0
+// A call is restored only once the load drops below this fraction of the budget, so that restoring doesn't immediately overshoot
+#define RESTORE_THRESHOLD 0.7
+
+namespace{
+	struct Step{
+		int maxComplexity;
+		bool secondaryEncoderDisabled;
+		bool nsDisabled;
+		bool aecDisabled;
+	};
+
+	// Cheapest losses first: complexity costs the least audible quality per CPU saved, AEC goes last
+	const Step steps[]={
+		{10, false, false, false},
+		{7, false, false, false},
+		{5, false, false, false},
+		{5, true, false, false},
+		{2, true, false, false},
+		{2, true, true, false},
+		{2, true, true, true},
+		{0, true, true, true},
+	};
+	const int maxLevel=sizeof(steps)/sizeof(steps[0])-1;
+
+	double GetMonotonicTime(){
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+class CpuGovernor::Client{
+public:
+	std::function<void(const Degradation&)> onChange;
+	int level=0;
+	double windowTime=0.0;
+	double lastCost=0.0;
+};
+
+CpuGovernor::CpuGovernor(){
+}
+
+CpuGovernor* CpuGovernor::GetSharedInstance(){
+	static CpuGovernor* instance=new CpuGovernor();
+	return instance;
+}
+
+CpuGovernor::Degradation CpuGovernor::DegradationForLevel(int level){
+	const Step& s=steps[level];
+	return Degradation{level, s.maxComplexity, s.secondaryEncoderDisabled, s.nsDisabled, s.aecDisabled};
+}
+
+void CpuGovernor::SetBudget(double cores){
+	MutexGuard m(mutex);
+	budget=std::max(0.0, cores);
+	LOGI("CPU budget for audio processing set to %.2f cores", budget);
+	if(budget==0.0){
+		for(Client* c:clients){
+			if(c->level>0)
+				SetLevel(c, 0);
+		}
+	}
+}
+
+double CpuGovernor::GetBudget(){
+	MutexGuard m(mutex);
+	return budget;
+}
+
+CpuGovernor::Stats CpuGovernor::GetStats(){
+	MutexGuard m(mutex);
+	uint32_t degraded=0;
+	for(Client* c:clients){
+		if(c->level>0)
+			degraded++;
+	}
+	return Stats{budget, lastLoad, (uint32_t)clients.size(), degraded, degradations, restorations};
+}
+
+CpuGovernor::Client* CpuGovernor::AddClient(std::function<void(const Degradation&)> onChange){
+	Client* c=new Client();
+	c->onChange=std::move(onChange);
+	MutexGuard m(mutex);
+	clients.push_back(c);
+	return c;
+}
+
+void CpuGovernor::RemoveClient(Client* client){
+	if(!client)
+		return;
+	MutexGuard m(mutex);
+	clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+	delete client;
+}
+
+void CpuGovernor::ReportProcessingTime(Client* client, double seconds){
+	if(!client)
+		return;
+	double now=GetMonotonicTime();
+	MutexGuard m(mutex);
+	client->windowTime+=seconds;
+	if(windowStart==0.0)
+		windowStart=now;
+	if(now-windowStart>=GOVERNOR_WINDOW)
+		Evaluate(now);
+}
+
+CpuGovernor::Degradation CpuGovernor::GetDegradation(Client* client){
+	MutexGuard m(mutex);
+	// the caller might race with RemoveClient
+	if(std::find(clients.begin(), clients.end(), client)==clients.end())
+		return DegradationForLevel(0);
+	return DegradationForLevel(client->level);
+}
+
+void CpuGovernor::Evaluate(double now){
+	double elapsed=now-windowStart;
+	double total=0.0;
+	for(Client* c:clients){
+		c->lastCost=c->windowTime/elapsed;
+		total+=c->lastCost;
+		c->windowTime=0.0;
+	}
+	windowStart=now;
+	lastLoad=total;
+	if(budget==0.0 || clients.empty())
+		return;
+
+	if(total>budget){
+		Client* heaviest=NULL;
+		for(Client* c:clients){
+			if(c->level<maxLevel && (!heaviest || c->lastCost>heaviest->lastCost))
+				heaviest=c;
+		}
+		if(heaviest){
+			LOGW("Audio processing load %.3f exceeds CPU budget %.3f, degrading a call to level %d", total, budget, heaviest->level+1);
+			degradations++;
+			SetLevel(heaviest, heaviest->level+1);
+		}
+	}else if(total<budget*RESTORE_THRESHOLD){
+		Client* mostDegraded=NULL;
+		for(Client* c:clients){
+			if(c->level>0 && (!mostDegraded || c->level>mostDegraded->level || (c->level==mostDegraded->level && c->lastCost<mostDegraded->lastCost)))
+				mostDegraded=c;
+		}
+		if(mostDegraded){
+			LOGI("Audio processing load %.3f is within CPU budget %.3f, restoring a call to level %d", total, budget, mostDegraded->level-1);
+			restorations++;
+			SetLevel(mostDegraded, mostDegraded->level-1);
+		}
+	}
+}
+
+void CpuGovernor::SetLevel(Client* client, int level){
+	client->level=level;
+	if(client->onChange)
+		client->onChange(DegradationForLevel(level));
+}
@@ -0,0 +1,79 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_CPUGOVERNOR_H
+#define LIBTGVOIP_CPUGOVERNOR_H
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "threading.h"
+#include "utils.h"
+
+namespace tgvoip{
+
+	/**
+	 * Keeps the audio processing of all calls in the process within a CPU budget.
+	 * Every call reports how long it spent processing each captured packet (APM, effects and encoding). Once a second the governor
+	 * compares the total with the budget: when it's exceeded, the most expensive call is degraded by one step (lower Opus complexity,
+	 * then no secondary encoder, then no NS, then no AEC); when there's enough headroom again, the most degraded call gets one step back.
+	 */
+	class CpuGovernor{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(CpuGovernor);
+		struct Degradation{
+			int level;                      // 0 when the call runs at full quality
+			int maxComplexity;              // Opus complexity cap
+			bool secondaryEncoderDisabled;
+			bool nsDisabled;
+			bool aecDisabled;
+		};
+		struct Stats{
+			double budget;                  // 0 when the governor is off
+			double load;                    // CPU cores' worth of processing over the last window
+			uint32_t clients;
+			uint32_t degradedClients;
+			uint64_t degradations;          // steps taken down since the process started
+			uint64_t restorations;          // steps taken back up
+		};
+		class Client;
+
+		static CpuGovernor* GetSharedInstance();
+		/**
+		 * @param cores processing time allowed per second of wall time, e.g. 0.5 for half a core. 0 turns the governor off and
+		 * restores every call to full quality.
+		 */
+		void SetBudget(double cores);
+		double GetBudget();
+		Stats GetStats();
+		/**
+		 * @param onChange called, with the governor's lock held, whenever the client's degradation changes. Must not call back into the governor.
+		 */
+		Client* AddClient(std::function<void(const Degradation&)> onChange);
+		/**
+		 * After this returns, onChange is never called again for this client.
+		 */
+		void RemoveClient(Client* client);
+		void ReportProcessingTime(Client* client, double seconds);
+		Degradation GetDegradation(Client* client);
+
+	private:
+		CpuGovernor();
+		void Evaluate(double now);
+		void SetLevel(Client* client, int level);
+		static Degradation DegradationForLevel(int level);
+
+		Mutex mutex;
+		std::vector<Client*> clients;
+		double budget=0.0;
+		double windowStart=0.0;
+		double lastLoad=0.0;
+		uint64_t degradations=0;
+		uint64_t restorations=0;
+	};
+}
+
+#endif //LIBTGVOIP_CPUGOVERNOR_H
@@ -7,6 +7,7 @@
 #ifndef TGVOIP_NO_DSP
 #include "webrtc_dsp/modules/audio_processing/include/audio_processing.h"
 #include "webrtc_dsp/api/audio/audio_frame.h"
+#include "webrtc_dsp/common_audio/include/audio_util.h"
 #endif
 
 #include "EchoCanceller.h"
@@ -20,7 +21,14 @@
 
 using namespace tgvoip;
 
-EchoCanceller::EchoCanceller(bool enableAEC, bool enableNS, bool enableAGC){
+namespace{
+	// Rates the AudioFrame interface of APM accepts; anything else goes through the float interface, which resamples internally
+	bool IsNativeApmRate(unsigned int rate){
+		return rate==8000 || rate==16000 || rate==32000 || rate==48000;
+	}
+}
+
+EchoCanceller::EchoCanceller(bool enableAEC, bool enableNS, bool enableAGC, unsigned int sampleRate, bool asyncFarend) : sampleRate(sampleRate){
 #ifndef TGVOIP_NO_DSP
 	this->enableAEC=enableAEC;
 	this->enableAGC=enableAGC;
@@ -34,16 +42,7 @@ EchoCanceller::EchoCanceller(bool enableAEC, bool enableNS, bool enableAGC){
 
 	apm=webrtc::AudioProcessingBuilder().Create(extraConfig);
 
-	webrtc::AudioProcessing::Config config;
-	config.echo_canceller.enabled = enableAEC;
-#ifndef TGVOIP_USE_DESKTOP_DSP
-	config.echo_canceller.mobile_mode = true;
-#else
-	config.echo_canceller.mobile_mode = false;
-#endif
-	config.high_pass_filter.enabled = enableAEC;
-	config.gain_controller2.enabled = enableAGC;
-	apm->ApplyConfig(config);
+	ApplyProcessingConfig();
 
 	webrtc::NoiseSuppression::Level nsLevel;
 #ifdef __APPLE__
@@ -66,7 +65,6 @@ EchoCanceller::EchoCanceller(bool enableAEC, bool enableNS, bool enableAGC){
 			break;
 	}
 	apm->noise_suppression()->set_level(nsLevel);
-	apm->noise_suppression()->Enable(enableNS);
 	if(enableAGC){
 		apm->gain_control()->set_mode(webrtc::GainControl::Mode::kAdaptiveDigital);
 		apm->gain_control()->set_target_level_dbfs(ServerConfig::GetSharedInstance()->GetInt("webrtc_agc_target_level", 9));
@@ -76,15 +74,20 @@ EchoCanceller::EchoCanceller(bool enableAEC, bool enableNS, bool enableAGC){
 	apm->voice_detection()->set_likelihood(webrtc::VoiceDetection::Likelihood::kVeryLowLikelihood);
 
 	audioFrame=new webrtc::AudioFrame();
-	audioFrame->samples_per_channel_=480;
-	audioFrame->sample_rate_hz_=48000;
+	audioFrame->samples_per_channel_=sampleRate/100;
+	audioFrame->sample_rate_hz_=sampleRate;
 	audioFrame->num_channels_=1;
+	if(sampleRate!=48000)
+		LOGI("Audio processing at %u Hz", sampleRate);
 
 	farendQueue=new BlockingQueue<int16_t*>(11);
 	farendBufferPool=new BufferPool(960*2, 10);
 	running=true;
-	bufferFarendThread=new Thread(std::bind(&EchoCanceller::RunBufferFarendThread, this));
-	bufferFarendThread->Start();
+	this->asyncFarend=asyncFarend;
+	if(asyncFarend){
+		bufferFarendThread=new Thread(std::bind(&EchoCanceller::RunBufferFarendThread, this));
+		bufferFarendThread->Start();
+	}
 
 #else
 	this->enableAEC=this->enableAGC=enableAGC=this->enableNS=enableNS=false;
@@ -104,6 +107,23 @@ EchoCanceller::~EchoCanceller(){
 #endif
 }
 
+#ifndef TGVOIP_NO_DSP
+void EchoCanceller::ApplyProcessingConfig(){
+	bool aec=enableAEC && !appliedAECSuspended;
+	webrtc::AudioProcessing::Config config;
+	config.echo_canceller.enabled = aec;
+#ifndef TGVOIP_USE_DESKTOP_DSP
+	config.echo_canceller.mobile_mode = true;
+#else
+	config.echo_canceller.mobile_mode = false;
+#endif
+	config.high_pass_filter.enabled = aec;
+	config.gain_controller2.enabled = enableAGC;
+	apm->ApplyConfig(config);
+	apm->noise_suppression()->Enable(enableNS && !appliedNSSuspended);
+}
+#endif
+
 void EchoCanceller::Start(){
 
 }
@@ -130,9 +150,14 @@ void EchoCanceller::Stop(){
 
 
 void EchoCanceller::SpeakerOutCallback(unsigned char* data, size_t len){
-    if(len!=960*2 || !enableAEC || !isOn)
+    if(len!=960*2 || !enableAEC || !isOn || aecSuspended)
 		return;
 #ifndef TGVOIP_NO_DSP
+	if(!asyncFarend){
+		if(running)
+			ProcessFarend(reinterpret_cast<int16_t*>(data));
+		return;
+	}
 	int16_t* buf=(int16_t*)farendBufferPool->Get();
 	if(buf){
 		memcpy(buf, data, 960*2);
@@ -143,10 +168,6 @@ void EchoCanceller::SpeakerOutCallback(unsigned char* data, size_t len){
 
 #ifndef TGVOIP_NO_DSP
 void EchoCanceller::RunBufferFarendThread(){
-	webrtc::AudioFrame frame;
-	frame.num_channels_=1;
-	frame.sample_rate_hz_=48000;
-	frame.samples_per_channel_=480;
 	while(running){
 		int16_t* samplesIn=farendQueue->GetBlocking();
         if(!samplesIn){
@@ -154,15 +175,23 @@ void EchoCanceller::RunBufferFarendThread(){
             break;
         }
 		if(samplesIn){
-			memcpy(frame.mutable_data(), samplesIn, 480*2);
-			apm->ProcessReverseStream(&frame);
-			memcpy(frame.mutable_data(), samplesIn+480, 480*2);
-			apm->ProcessReverseStream(&frame);
-			didBufferFarend=true;
+			ProcessFarend(samplesIn);
 			farendBufferPool->Reuse(reinterpret_cast<unsigned char*>(samplesIn));
 		}
 	}
 }
+
+void EchoCanceller::ProcessFarend(const int16_t* samples){
+	webrtc::AudioFrame frame;
+	frame.num_channels_=1;
+	frame.sample_rate_hz_=48000;
+	frame.samples_per_channel_=480;
+	memcpy(frame.mutable_data(), samples, 480*2);
+	apm->ProcessReverseStream(&frame);
+	memcpy(frame.mutable_data(), samples+480, 480*2);
+	apm->ProcessReverseStream(&frame);
+	didBufferFarend=true;
+}
 #endif
 
 void EchoCanceller::Enable(bool enabled){
@@ -174,24 +203,39 @@ void EchoCanceller::ProcessInput(int16_t* inOut, size_t numSamples, bool& hasVoi
 	if(!isOn || (!enableAEC && !enableAGC && !enableNS)){
 		return;
 	}
+	if(aecSuspended!=appliedAECSuspended || nsSuspended!=appliedNSSuspended){
+		appliedAECSuspended=aecSuspended;
+		appliedNSSuspended=nsSuspended;
+		LOGI("Audio processing: AEC %s, NS %s", enableAEC && !appliedAECSuspended ? "on" : "off", enableNS && !appliedNSSuspended ? "on" : "off");
+		ApplyProcessingConfig();
+	}
+	if(!enableAGC && !enableVAD && (!enableAEC || appliedAECSuspended) && (!enableNS || appliedNSSuspended))
+		return;
 	int delay=audio::AudioInput::GetEstimatedDelay()+audio::AudioOutput::GetEstimatedDelay();
-	assert(numSamples==960);
-
-	memcpy(audioFrame->mutable_data(), inOut, 480*2);
-	if(enableAEC)
-    	apm->set_stream_delay_ms(delay);
-	apm->ProcessStream(audioFrame);
-	if(enableVAD)
-    	hasVoice=apm->voice_detection()->stream_has_voice();
-	memcpy(inOut, audioFrame->data(), 480*2);
-	memcpy(audioFrame->mutable_data(), inOut+480, 480*2);
-	if(enableAEC)
-    	apm->set_stream_delay_ms(delay);
-	apm->ProcessStream(audioFrame);
-	if(enableVAD){
-    	hasVoice=hasVoice || apm->voice_detection()->stream_has_voice();
+	const size_t chunkSize=sampleRate/100;
+	assert(numSamples==chunkSize*2);
+
+	bool chunkHasVoice=false;
+	for(int16_t* chunk=inOut;chunk<inOut+numSamples;chunk+=chunkSize){
+		if(enableAEC)
+			apm->set_stream_delay_ms(delay);
+		if(IsNativeApmRate(sampleRate)){
+			memcpy(audioFrame->mutable_data(), chunk, chunkSize*2);
+			apm->ProcessStream(audioFrame);
+			memcpy(chunk, audioFrame->data(), chunkSize*2);
+		}else{
+			float floatBuf[480];
+			float* channels[]={floatBuf};
+			webrtc::StreamConfig streamConfig(sampleRate, 1);
+			webrtc::S16ToFloat(chunk, chunkSize, floatBuf);
+			apm->ProcessStream(channels, streamConfig, streamConfig, channels);
+			webrtc::FloatToS16(floatBuf, chunkSize, chunk);
+		}
+		if(enableVAD)
+			chunkHasVoice=chunkHasVoice || apm->voice_detection()->stream_has_voice();
 	}
-	memcpy(inOut+480, audioFrame->data(), 480*2);
+	if(enableVAD)
+		hasVoice=chunkHasVoice;
 #endif
 }
 
@@ -208,6 +252,17 @@ void EchoCanceller::SetAECStrength(int strength){
 #endif
 }
 
+void EchoCanceller::SetSuspended(bool suspendAEC, bool suspendNS){
+	aecSuspended=suspendAEC;
+	nsSuspended=suspendNS;
+}
+
+void EchoCanceller::Reset(){
+#ifndef TGVOIP_NO_DSP
+	apm->Initialize();
+#endif
+}
+
 void EchoCanceller::SetVoiceDetectionEnabled(bool enabled){
 	enableVAD=enabled;
 #ifndef TGVOIP_NO_DSP
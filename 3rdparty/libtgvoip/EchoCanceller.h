@@ -7,6 +7,7 @@
 #ifndef LIBTGVOIP_ECHOCANCELLER_H
 #define LIBTGVOIP_ECHOCANCELLER_H
 
+#include <atomic>
 #include "threading.h"
 #include "Buffers.h"
 #include "BlockingQueue.h"
@@ -23,7 +24,11 @@ class EchoCanceller{
 
 public:
 	TGVOIP_DISALLOW_COPY_AND_ASSIGN(EchoCanceller);
-	EchoCanceller(bool enableAEC, bool enableNS, bool enableAGC);
+	/**
+	 * @param sampleRate rate of the near-end (microphone) audio passed to ProcessInput. The far end is always 48 kHz.
+	 * @param asyncFarend buffer the far end on a dedicated thread, or on the thread that calls SpeakerOutCallback
+	 */
+	EchoCanceller(bool enableAEC, bool enableNS, bool enableAGC, unsigned int sampleRate=48000, bool asyncFarend=true);
 	virtual ~EchoCanceller();
 	virtual void Start();
 	virtual void Stop();
@@ -32,6 +37,15 @@ public:
 	void ProcessInput(int16_t* inOut, size_t numSamples, bool& hasVoice);
 	void SetAECStrength(int strength);
 	void SetVoiceDetectionEnabled(bool enabled);
+	/**
+	 * Temporarily turn off echo cancellation and/or noise suppression that were enabled in the constructor, e.g. to save CPU.
+	 * Takes effect on the next ProcessInput call.
+	 */
+	void SetSuspended(bool suspendAEC, bool suspendNS);
+	/**
+	 * Start the processing over with the current settings, e.g. after the input bypassed it for a while.
+	 */
+	void Reset();
 
 private:
 	bool enableAEC;
@@ -39,12 +53,20 @@ private:
 	bool enableNS;
 	bool enableVAD=false;
 	bool isOn;
+	unsigned int sampleRate;
+	std::atomic<bool> aecSuspended{false};
+	std::atomic<bool> nsSuspended{false};
 #ifndef TGVOIP_NO_DSP
+	void ApplyProcessingConfig();
+	bool appliedAECSuspended=false;
+	bool appliedNSSuspended=false;
 	webrtc::AudioProcessing* apm=NULL;
 	webrtc::AudioFrame* audioFrame=NULL;
 	void RunBufferFarendThread();
+	void ProcessFarend(const int16_t* samples);
 	bool didBufferFarend;
-	Thread* bufferFarendThread;
+	Thread* bufferFarendThread=NULL;
+	bool asyncFarend;
 	BlockingQueue<int16_t*>* farendQueue;
 	BufferPool* farendBufferPool;
 	bool running;
@@ -0,0 +1,200 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+
+#include "EncoderGroup.h"
+#include "VoIPController.h"
+#include "VoIPServerConfig.h"
+#include "logging.h"
+#if defined HAVE_CONFIG_H || defined TGVOIP_USE_INSTALLED_OPUS
+#include <opus/opus.h>
+#else
+#include "opus.h"
+#endif
+
+using namespace tgvoip;
+
+EncoderGroup::EncoderGroup(std::vector<uint32_t> bitrates, uint32_t frameDuration, int expectedLoss) : frameDuration(frameDuration){
+	assert(!bitrates.empty());
+	assert(frameDuration%20==0);
+	assert(expectedLoss>=0 && expectedLoss<=100);
+	std::sort(bitrates.begin(), bitrates.end());
+	bitrates.erase(std::unique(bitrates.begin(), bitrates.end()), bitrates.end());
+	// Same settings as the per-call OpusEncoder
+	for(uint32_t bitrate:bitrates){
+		::OpusEncoder* enc=opus_encoder_create(48000, 1, OPUS_APPLICATION_VOIP, NULL);
+		opus_encoder_ctl(enc, OPUS_SET_COMPLEXITY(10));
+		opus_encoder_ctl(enc, OPUS_SET_PACKET_LOSS_PERC(expectedLoss));
+		opus_encoder_ctl(enc, OPUS_SET_INBAND_FEC(1));
+		opus_encoder_ctl(enc, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+		opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(OPUS_BANDWIDTH_FULLBAND));
+		opus_encoder_ctl(enc, OPUS_SET_BITRATE(bitrate));
+		steps.push_back(Step{bitrate, enc});
+	}
+	int secondaryBandwidth=ServerConfig::GetSharedInstance()->GetInt("audio_extra_ec_bandwidth", 2);
+	secondaryEncoder=opus_encoder_create(48000, 1, OPUS_APPLICATION_VOIP, NULL);
+	opus_encoder_ctl(secondaryEncoder, OPUS_SET_COMPLEXITY(10));
+	opus_encoder_ctl(secondaryEncoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+	opus_encoder_ctl(secondaryEncoder, OPUS_SET_BITRATE(8000));
+	opus_encoder_ctl(secondaryEncoder, OPUS_SET_BANDWIDTH(OPUS_BANDWIDTH_NARROWBAND+std::min(4, std::max(0, secondaryBandwidth))));
+}
+
+EncoderGroup::~EncoderGroup(){
+	Stop();
+	MutexGuard m(callsMutex);
+	for(VoIPController* call:calls){
+		call->SetExternalAudioSource(false);
+		call->ReleaseExternalAudioSource(this);
+	}
+	calls.clear();
+	for(Step& step:steps){
+		opus_encoder_destroy(step.enc);
+	}
+	opus_encoder_destroy(secondaryEncoder);
+}
+
+void EncoderGroup::SetSource(std::function<void(int16_t*, size_t)> source){
+	assert(!running);
+	this->source=source;
+}
+
+void EncoderGroup::Start(){
+	if(running)
+		return;
+	running=true;
+	thread=new Thread(std::bind(&EncoderGroup::RunThread, this));
+	thread->SetName("EncoderGroup");
+	thread->Start();
+	thread->SetMaxPriority();
+}
+
+void EncoderGroup::Stop(){
+	if(!running)
+		return;
+	running=false;
+	thread->Join();
+	delete thread;
+	thread=NULL;
+}
+
+bool EncoderGroup::AddCall(VoIPController* call){
+	if(call->GetOutgoingAudioFrameDuration()!=frameDuration){
+		LOGW("EncoderGroup: call uses %u ms frames, group encodes %u ms", (unsigned int)call->GetOutgoingAudioFrameDuration(), frameDuration);
+		return false;
+	}
+	MutexGuard m(callsMutex);
+	if(std::find(calls.begin(), calls.end(), call)!=calls.end())
+		return true;
+	if(!call->ClaimExternalAudioSource(this)){
+		LOGW("EncoderGroup: the call's outgoing audio is already fed by something else");
+		return false;
+	}
+	call->SetExternalAudioSource(true);
+	calls.push_back(call);
+	return true;
+}
+
+void EncoderGroup::RemoveCall(VoIPController* call){
+	{
+		MutexGuard m(callsMutex);
+		std::vector<VoIPController*>::iterator c=std::find(calls.begin(), calls.end(), call);
+		if(c==calls.end())
+			return;
+		calls.erase(c);
+	}
+	// The frame being sent right now may still go to this call; the next one won't
+	{
+		MutexGuard m(sendMutex);
+	}
+	call->SetExternalAudioSource(false);
+	call->ReleaseExternalAudioSource(this);
+}
+
+EncoderGroup::Stats EncoderGroup::GetStats() const{
+	return Stats{framesEncoded.load(), framesSent.load()};
+}
+
+void EncoderGroup::RunThread(){
+	uint32_t packetsPerFrame=frameDuration/20;
+	std::vector<int16_t> frame(960*packetsPerFrame);
+	uint32_t bufferedCount=0;
+	double nextTick=VoIPController::GetCurrentTime();
+	while(running){
+		int16_t* packet=frame.data()+960*bufferedCount;
+		memset(packet, 0, 960*2);
+		if(source)
+			source(packet, 960);
+		bufferedCount++;
+		if(bufferedCount==packetsPerFrame){
+			EncodeAndSend(frame.data(), frame.size());
+			bufferedCount=0;
+		}
+
+		nextTick+=0.02;
+		double sl=nextTick-VoIPController::GetCurrentTime();
+		if(sl<-0.1){
+			// Fell too far behind (e.g. the process was suspended), don't try to catch up
+			nextTick=VoIPController::GetCurrentTime();
+		}
+		while(sl>0 && running){
+			Clock::Sleep(std::min(sl, 0.005));
+			sl=nextTick-VoIPController::GetCurrentTime();
+		}
+	}
+}
+
+void EncoderGroup::EncodeAndSend(int16_t* frame, size_t len){
+	// Sending only holds sendMutex, so a call that's slow to take its frame delays neither AddCall() nor the removal
+	// of other calls
+	MutexGuard s(sendMutex);
+	{
+		MutexGuard m(callsMutex);
+		sendingTo=calls;
+	}
+	if(sendingTo.empty())
+		return;
+	bool needSecondary=false;
+	for(Step& step:steps){
+		step.calls.clear();
+	}
+	for(VoIPController* call:sendingTo){
+		uint32_t target=call->GetAudioTargetBitrate();
+		size_t i=steps.size()-1;
+		while(i>0 && steps[i].bitrate>target){
+			i--;
+		}
+		steps[i].calls.push_back(call);
+		needSecondary=needSecondary || call->IsExtraAudioECEnabled();
+	}
+
+	unsigned char secondaryBuffer[128];
+	int32_t secondaryLen=0;
+	if(needSecondary){
+		secondaryLen=opus_encode(secondaryEncoder, frame, static_cast<int>(len), secondaryBuffer, sizeof(secondaryBuffer));
+		if(secondaryLen<0)
+			secondaryLen=0;
+	}
+	unsigned char buffer[4096];
+	for(Step& step:steps){
+		if(step.calls.empty())
+			continue;
+		int32_t r=opus_encode(step.enc, frame, static_cast<int>(len), buffer, sizeof(buffer));
+		framesEncoded++;
+		if(r<=0){
+			LOGE("EncoderGroup: error encoding: %d", r);
+			continue;
+		}else if(r==1){
+			continue; // DTX
+		}
+		for(VoIPController* call:step.calls){
+			call->SendEncodedAudioFrame(buffer, (size_t)r, secondaryBuffer, (size_t)secondaryLen);
+		}
+		framesSent+=step.calls.size();
+	}
+}
@@ -0,0 +1,87 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_ENCODERGROUP_H
+#define LIBTGVOIP_ENCODERGROUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "threading.h"
+#include "utils.h"
+
+struct OpusEncoder;
+
+namespace tgvoip{
+
+	class VoIPController;
+
+	/**
+	 * Encodes one audio source once and sends it into any number of calls.
+	 * Instead of one encoder per call there is one per step of a bitrate ladder; every frame is encoded only by the steps
+	 * that currently have calls on them, and each call gets the highest step that doesn't exceed the bitrate its own
+	 * congestion control asks for. Packetization and encryption stay per call.
+	 * Calls in the group don't capture or encode audio of their own.
+	 */
+	class EncoderGroup{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(EncoderGroup);
+		struct Stats{
+			uint64_t framesEncoded;  // summed over all ladder steps
+			uint64_t framesSent;     // summed over all calls
+		};
+
+		/**
+		 * @param bitrates the ladder, in bits per second
+		 * @param frameDuration in ms, must match the outgoing audio frame duration of the calls
+		 * @param expectedLoss percentage of packets the encoders expect to be lost, which sets how much in-band FEC they add
+		 */
+		EncoderGroup(std::vector<uint32_t> bitrates, uint32_t frameDuration=60, int expectedLoss=1);
+		~EncoderGroup();
+		/**
+		 * Set the function that supplies the audio. It's called from the group's thread every 20 ms to fill 960 samples of 48 kHz mono.
+		 */
+		void SetSource(std::function<void(int16_t*, size_t)> source);
+		void Start();
+		void Stop();
+		/**
+		 * @return false if the call's outgoing frame duration doesn't match the group's, or if something else (a bridge)
+		 * already feeds the call's outgoing audio
+		 */
+		bool AddCall(VoIPController* call);
+		/**
+		 * Remove a call and let it capture and encode audio on its own again. When this returns, the group no longer uses the call.
+		 */
+		void RemoveCall(VoIPController* call);
+		Stats GetStats() const;
+
+	private:
+		struct Step{
+			uint32_t bitrate;
+			::OpusEncoder* enc;
+			std::vector<VoIPController*> calls;
+		};
+		void RunThread();
+		void EncodeAndSend(int16_t* frame, size_t len);
+
+		std::vector<Step> steps;
+		::OpusEncoder* secondaryEncoder;
+		uint32_t frameDuration;
+		std::function<void(int16_t*, size_t)> source;
+		Mutex callsMutex;
+		std::vector<VoIPController*> calls;
+		Mutex sendMutex;  // held by the group's thread while it sends to a snapshot of calls
+		std::vector<VoIPController*> sendingTo;
+		Thread* thread=NULL;
+		std::atomic<bool> running{false};
+		std::atomic<uint64_t> framesEncoded{0};
+		std::atomic<uint64_t> framesSent{0};
+	};
+}
+
+#endif //LIBTGVOIP_ENCODERGROUP_H
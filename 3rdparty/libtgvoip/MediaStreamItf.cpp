@@ -7,6 +7,7 @@
 #include "logging.h"
 #include "MediaStreamItf.h"
 #include "EchoCanceller.h"
+#include "audio/MixerKernels.h"
 #include <stdint.h>
 #include <algorithm>
 #include <math.h>
@@ -14,6 +15,11 @@
 
 using namespace tgvoip;
 
+// An active input can't be replaced until it's been mixed for this many frames (20 ms each)
+#define MIN_ACTIVE_FRAMES 25
+// ...and only by an input this many times louder
+#define SWITCH_RATIO 1.5f
+
 void MediaStreamItf::SetCallback(size_t (*f)(unsigned char *, size_t, void*), void* param){
 	callback=f;
 	callbackParam=param;
@@ -74,13 +80,78 @@ size_t AudioMixer::OutputCallback(unsigned char *data, size_t length, void *arg)
 }
 
 void AudioMixer::AddInput(std::shared_ptr<MediaStreamItf> input){
+	AddInput(input, nullptr);
+}
+
+void AudioMixer::AddInput(std::shared_ptr<MediaStreamItf> input, std::function<float()> activity){
 	MutexGuard m(inputsMutex);
 	MixerInput in;
 	in.multiplier=1;
 	in.source=input;
+	in.activity=activity;
+	in.score=0;
+	in.active=false;
+	in.framesSinceChange=0;
 	inputs.push_back(in);
 }
 
+void AudioMixer::SetMaxActiveInputs(unsigned int count){
+	MutexGuard m(inputsMutex);
+	maxActiveInputs=count;
+}
+
+void AudioMixer::SelectActiveInputs(){
+	std::vector<MixerInput*> candidates;
+	unsigned int activeCount=0;
+	for(MixerInput& in:inputs){
+		if(!in.activity)
+			continue;
+		in.framesSinceChange++;
+		in.score=in.activity()*in.multiplier;
+		if(in.active && in.multiplier==0){
+			in.active=false;
+			in.framesSinceChange=0;
+		}
+		if(in.active)
+			activeCount++;
+		else if(in.score>0)
+			candidates.push_back(&in);
+	}
+	std::sort(candidates.begin(), candidates.end(), [](MixerInput* a, MixerInput* b){
+		return a->score>b->score;
+	});
+	// The quietest active input; if minHold, only among those that have been active long enough to be replaced
+	auto findWeakest=[this](bool minHold){
+		MixerInput* weakest=NULL;
+		for(MixerInput& in:inputs){
+			if(in.activity && in.active && (!minHold || in.framesSinceChange>=MIN_ACTIVE_FRAMES) && (!weakest || in.score<weakest->score))
+				weakest=&in;
+		}
+		return weakest;
+	};
+	while(activeCount>maxActiveInputs){
+		MixerInput* weakest=findWeakest(false);
+		weakest->active=false;
+		weakest->framesSinceChange=0;
+		activeCount--;
+	}
+	for(MixerInput* c:candidates){
+		if(activeCount<maxActiveInputs){
+			c->active=true;
+			c->framesSinceChange=0;
+			activeCount++;
+			continue;
+		}
+		MixerInput* weakest=findWeakest(true);
+		if(!weakest || c->score<=weakest->score*SWITCH_RATIO)
+			break;
+		weakest->active=false;
+		weakest->framesSinceChange=0;
+		c->active=true;
+		c->framesSinceChange=0;
+	}
+}
+
 void AudioMixer::RemoveInput(std::shared_ptr<MediaStreamItf> input){
 	MutexGuard m(inputsMutex);
 	for(std::vector<MixerInput>::iterator i=inputs.begin();i!=inputs.end();++i){
@@ -106,6 +177,7 @@ void AudioMixer::SetInputVolume(std::shared_ptr<MediaStreamItf> input, float vol
 
 void AudioMixer::RunThread(){
 	LOGV("AudioMixer thread started");
+	const audio::MixerKernels& kernels=audio::MixerKernels::Get();
 	while(running){
 		semaphore.Acquire();
 		if(!running)
@@ -123,33 +195,24 @@ void AudioMixer::RunThread(){
 		float out[960];
 		memset(out, 0, 960*4);
 		int usedInputs=0;
+		if(maxActiveInputs>0)
+			SelectActiveInputs();
 		for(std::vector<MixerInput>::iterator in=inputs.begin();in!=inputs.end();++in){
+			if(maxActiveInputs>0 && in->activity && !in->active){
+				// Keep its jitter buffer moving, but don't decode
+				in->source->InvokeCallback(NULL, 960*2);
+				continue;
+			}
 			size_t res=in->source->InvokeCallback(reinterpret_cast<unsigned char*>(input), 960*2);
 			if(!res || in->multiplier==0){
 				//LOGV("AudioMixer: skipping silent packet");
 				continue;
 			}
 			usedInputs++;
-			float k=in->multiplier;
-			if(k!=1){
-				for(size_t i=0; i<960; i++){
-					out[i]+=(float)input[i]*k;
-				}
-			}else{
-				for(size_t i=0;i<960;i++){
-					out[i]+=(float)input[i];
-				}
-			}
+			kernels.accumulate(out, input, in->multiplier, 960);
 		}
 		if(usedInputs>0){
-			for(size_t i=0; i<960; i++){
-				if(out[i]>32767.0f)
-					buf[i]=INT16_MAX;
-				else if(out[i]<-32768.0f)
-					buf[i]=INT16_MIN;
-				else
-					buf[i]=(int16_t)out[i];
-			}
+			kernels.store(buf, out, 960);
 		}else{
 			memset(data, 0, 960*2);
 		}
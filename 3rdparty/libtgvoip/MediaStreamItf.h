@@ -10,6 +10,7 @@
 #include <string.h>
 #include <vector>
 #include <memory>
+#include <functional>
 #include <stdint.h>
 #include "threading.h"
 #include "BlockingQueue.h"
@@ -41,15 +42,31 @@ private:
 		virtual void Start();
 		virtual void Stop();
 		void AddInput(std::shared_ptr<MediaStreamItf> input);
+		/**
+		 * Add an input that can be left out of the mix when SetMaxActiveInputs() is used.
+		 * @param activity returns how loud the input is at the moment, in any unit as long as all inputs use the same one
+		 * The input must treat InvokeCallback(NULL, length) as "drop the next frame without producing it".
+		 */
+		void AddInput(std::shared_ptr<MediaStreamItf> input, std::function<float()> activity);
 		void RemoveInput(std::shared_ptr<MediaStreamItf> input);
 		void SetInputVolume(std::shared_ptr<MediaStreamItf> input, float volumeDB);
 		void SetEchoCanceller(EchoCanceller* aec);
+		/**
+		 * Only pull and mix the count loudest of the inputs that have an activity function, the others are skipped
+		 * without being decoded. Inputs without one are always mixed. 0 (default) mixes everything.
+		 */
+		void SetMaxActiveInputs(unsigned int count);
 	private:
 		void RunThread();
 		struct MixerInput{
 			std::shared_ptr<MediaStreamItf> source;
 			float multiplier;
+			std::function<float()> activity;
+			float score;
+			bool active;
+			unsigned int framesSinceChange;
 		};
+		void SelectActiveInputs();
 		Mutex inputsMutex;
 		void DoCallback(unsigned char* data, size_t length);
 		static size_t OutputCallback(unsigned char* data, size_t length, void* arg);
@@ -60,6 +77,7 @@ private:
 		Semaphore semaphore;
 		EchoCanceller* echoCanceller;
 		bool running;
+		unsigned int maxActiveInputs=0;
 	};
 
 	class CallbackWrapper : public MediaStreamItf{
@@ -42,7 +42,41 @@ MessageThread::~MessageThread(){
 #endif
 }
 
+bool MessageThread::SetCallHost(CallHost* host){
+	if(this->host){
+		LOGE("MessageThread is already running on a CallHost");
+		return false;
+	}
+	if(started){
+		LOGE("MessageThread can't be moved to a CallHost after it was started");
+		return false;
+	}
+	this->host=host;
+	strand=host->CreateStrand("MessageThread");
+	return true;
+}
+
+void MessageThread::Start(){
+	if(started)
+		return;
+	started=true;
+	if(host)
+		return;
+	Thread::Start();
+}
+
+bool MessageThread::IsCurrent(){
+	if(host)
+		return host->IsCurrent(strand);
+	return Thread::IsCurrent();
+}
+
 void MessageThread::HardStop(){
+	if(host){
+		hardStopped.store(true, std::memory_order_release);
+		host->CloseStrand(strand);
+		return;
+	}
     queueMutex.Lock();
     running = false;
     hardStopped.store(true, std::memory_order_release);
@@ -56,6 +90,10 @@ void MessageThread::HardStop(){
 }
 
 void MessageThread::Stop(){
+	if(host){
+		host->CloseStrand(strand);
+		return;
+	}
         queueMutex.Lock();
         running=false;
         queue.clear();                      // <--- NEW: drop all pending messages
@@ -73,6 +111,8 @@ void MessageThread::Run(){
                 double currentTime=VoIPController::GetCurrentTime();
                 double waitTimeout=queue.empty() ? DBL_MAX : (queue[0].deliverAt-currentTime);
                 if(waitTimeout>0.0){
+                        if(waitTimeout!=DBL_MAX)
+                                waitTimeout=Clock::ToRealDuration(waitTimeout);
 #ifndef _WIN32
                         if(waitTimeout!=DBL_MAX){
                                 struct timeval now;
@@ -135,6 +175,11 @@ void MessageThread::Run(){
 uint32_t MessageThread::Post(std::function<void()> func, double delay, double interval){
 	assert(delay>=0);
 	//LOGI("MessageThread post [function] delay %f", delay);
+	if(host){
+		if(hardStopped.load(std::memory_order_acquire))
+			return INVALID_ID;
+		return host->Post(strand, func, delay, interval);
+	}
 	if(!IsCurrent()){
 		queueMutex.Lock();
 	}
@@ -172,6 +217,10 @@ void MessageThread::InsertMessageInternal(MessageThread::Message &m){
 }
 
 void MessageThread::Cancel(uint32_t id){
+	if(host){
+		host->Cancel(id);
+		return;
+	}
 	if(!IsCurrent()){
 		queueMutex.Lock();
 	}
@@ -191,5 +240,9 @@ void MessageThread::Cancel(uint32_t id){
 
 void MessageThread::CancelSelf(){
 	assert(IsCurrent());
+	if(host){
+		host->CancelSelf();
+		return;
+	}
 	cancelCurrent=true;
 }
@@ -10,6 +10,8 @@
 #include <atomic>
 #include <vector>
 #include <functional>
+#include <memory>
+#include "CallHost.h"
 
 namespace tgvoip{
 	class MessageThread : public Thread{
@@ -22,6 +24,14 @@ namespace tgvoip{
 		void CancelSelf();
 		void Stop();
 		void HardStop();  // new
+		/**
+		 * Run the messages on a strand of a shared CallHost instead of a dedicated thread.
+		 * Must be called before Start() and before anything is posted.
+		 * @return false if the thread was already started or attached to a host
+		 */
+		bool SetCallHost(CallHost* host);
+		void Start();
+		bool IsCurrent();
 		enum{
 			INVALID_ID=0
 		};
@@ -42,6 +52,9 @@ namespace tgvoip{
 		uint32_t lastMessageID=1;
 		bool cancelCurrent=false;
 		std::atomic<bool> hardStopped{false};  // new
+		bool started=false;
+		CallHost* host=NULL;
+		std::shared_ptr<CallHost::Strand> strand;
 
 #ifdef _WIN32
 		HANDLE event;
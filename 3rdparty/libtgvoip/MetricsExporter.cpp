@@ -0,0 +1,403 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "MetricsExporter.h"
+#include "VoIPController.h"
+#include "logging.h"
+
+using namespace tgvoip;
+
+#define MAX_REQUEST_SIZE 8192
+// Scrapers are local, a client that doesn't send its request in time is dropped
+#define REQUEST_TIMEOUT_MS 1000
+#define POLL_INTERVAL_MS 200
+#define CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+namespace{
+	enum Aggregation{
+		AGG_NONE,
+		AGG_SUM,
+		AGG_MAX
+	};
+
+	struct Metric{
+		const char* name;      // without the "tgvoip_call_" or "tgvoip_" prefix
+		const char* unit;      // NULL if it has none
+		const char* help;
+		std::atomic<uint64_t> CallMetrics::* intValue;
+		std::atomic<double> CallMetrics::* doubleValue;
+		double scale;
+		Aggregation aggregation;  // of gauges, counters are always summed
+	};
+
+	const Metric counters[]={
+		{"sent_bytes", "bytes", "Bytes sent to the network", &CallMetrics::bytesSent, NULL, 1.0, AGG_SUM},
+		{"received_bytes", "bytes", "Bytes received from the network", &CallMetrics::bytesReceived, NULL, 1.0, AGG_SUM},
+		{"sent_packets", NULL, "Packets sent to the network", &CallMetrics::packetsSent, NULL, 1.0, AGG_SUM},
+		{"received_packets", NULL, "Packets received from the network", &CallMetrics::packetsReceived, NULL, 1.0, AGG_SUM},
+		{"lost_packets", NULL, "Incoming audio packets that never arrived", &CallMetrics::packetsLost, NULL, 1.0, AGG_SUM},
+		{"send_lost_packets", NULL, "Outgoing packets the peer never acknowledged", &CallMetrics::packetsSendLost, NULL, 1.0, AGG_SUM},
+		{"encoded_frames", NULL, "Audio frames encoded", &CallMetrics::framesEncoded, NULL, 1.0, AGG_SUM},
+		{"ticks", NULL, "Runs of the jitter buffer and congestion control timer", &CallMetrics::ticks, NULL, 1.0, AGG_SUM},
+		{"tick_lateness_seconds", "seconds", "Total time the timer ran late", &CallMetrics::tickLatenessUs, NULL, 1e-6, AGG_SUM},
+	};
+
+	const Metric gauges[]={
+		{"state", NULL, "Call state, one of the STATE_* constants", &CallMetrics::state, NULL, 1.0, AGG_NONE},
+		{"signal_bars", NULL, "Signal quality from 1 to 4", &CallMetrics::signalBars, NULL, 1.0, AGG_NONE},
+		{"rtt_seconds", "seconds", "Average round-trip time", NULL, &CallMetrics::rtt, 1.0, AGG_MAX},
+		{"jitter_delay_seconds", "seconds", "Average delay of the jitter buffer", NULL, &CallMetrics::jitterDelay, 1.0, AGG_MAX},
+		{"jitter_seconds", "seconds", "Last measured jitter of incoming audio", NULL, &CallMetrics::jitter, 1.0, AGG_MAX},
+		{"audio_bitrate", NULL, "Current bitrate of the audio encoder in bits per second", &CallMetrics::audioBitrate, NULL, 1.0, AGG_SUM},
+		{"jitter_buffer_packets", NULL, "Packets waiting in the jitter buffer", &CallMetrics::jitterBufferPackets, NULL, 1.0, AGG_SUM},
+		{"encoder_queue_packets", NULL, "Audio frames waiting for the encoder", &CallMetrics::encoderQueuePackets, NULL, 1.0, AGG_SUM},
+		{"send_queue_packets", NULL, "Stream packets waiting to be sent", &CallMetrics::sendQueuePackets, NULL, 1.0, AGG_SUM},
+		{"inflight_bytes", "bytes", "Bytes sent but not acknowledged yet", &CallMetrics::inflightBytes, NULL, 1.0, AGG_SUM},
+		{"congestion_window_bytes", "bytes", "Congestion window", &CallMetrics::congestionWindow, NULL, 1.0, AGG_NONE},
+		{"last_tick_lateness_seconds", "seconds", "How late the last run of the timer was", NULL, &CallMetrics::lastTickLateness, 1.0, AGG_MAX},
+	};
+
+	const size_t counterCount=sizeof(counters)/sizeof(counters[0]);
+	const size_t gaugeCount=sizeof(gauges)/sizeof(gauges[0]);
+
+	double Load(const CallMetrics& m, const Metric& metric){
+		if(metric.intValue)
+			return (double)(m.*metric.intValue).load(std::memory_order_relaxed)*metric.scale;
+		return (m.*metric.doubleValue).load(std::memory_order_relaxed)*metric.scale;
+	}
+
+	void AppendValue(std::string& out, double value){
+		char buf[32];
+		// Integers are printed exactly, counters of bytes exceed the precision of %g quickly
+		if(value>=0.0 && value<1e18 && value==(double)(uint64_t)value)
+			snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+		else
+			snprintf(buf, sizeof(buf), "%.9g", value);
+		out+=buf;
+	}
+
+	void AppendFamily(std::string& out, const std::string& name, const char* type, const Metric& metric){
+		out+="# TYPE "+name+" "+type+"\n";
+		if(metric.unit)
+			out+="# UNIT "+name+" "+metric.unit+"\n";
+		out+="# HELP "+name+" "+metric.help+"\n";
+	}
+
+	std::string EscapeLabel(const std::string& value){
+		std::string result;
+		result.reserve(value.size());
+		for(char c:value){
+			if(c=='\\')
+				result+="\\\\";
+			else if(c=='"')
+				result+="\\\"";
+			else if(c=='\n')
+				result+="\\n";
+			else
+				result+=c;
+		}
+		return result;
+	}
+}
+
+MetricsExporter* MetricsExporter::GetSharedInstance(){
+	static MetricsExporter* instance=new MetricsExporter();
+	return instance;
+}
+
+MetricsExporter::MetricsExporter(){
+	finishedTotals.resize(counterCount, 0);
+}
+
+void MetricsExporter::AddCall(std::shared_ptr<CallMetrics> metrics){
+	MutexGuard m(mutex);
+	calls.push_back(Entry{metrics, std::to_string(nextCallID++)});
+}
+
+void MetricsExporter::RemoveCall(CallMetrics* metrics){
+	MutexGuard m(mutex);
+	for(std::vector<Entry>::iterator entry=calls.begin();entry!=calls.end();++entry){
+		if(entry->metrics.get()==metrics){
+			for(size_t i=0;i<counterCount;i++){
+				finishedTotals[i]+=(metrics->*counters[i].intValue).load(std::memory_order_relaxed);
+			}
+			calls.erase(entry);
+			return;
+		}
+	}
+}
+
+void MetricsExporter::SetCallLabel(CallMetrics* metrics, const std::string& label){
+	MutexGuard m(mutex);
+	for(Entry& entry:calls){
+		if(entry.metrics.get()==metrics){
+			entry.label=label;
+			return;
+		}
+	}
+}
+
+std::string MetricsExporter::Format(){
+	std::string out;
+	// Only AddCall, RemoveCall and SetCallLabel take the mutex, the calls themselves never wait for it
+	MutexGuard m(mutex);
+	std::vector<std::string> labels;
+	for(const Entry& entry:calls){
+		labels.push_back("{call=\""+EscapeLabel(entry.label)+"\"} ");
+	}
+
+	for(size_t i=0;i<counterCount;i++){
+		std::string name=std::string("tgvoip_call_")+counters[i].name;
+		AppendFamily(out, name, "counter", counters[i]);
+		for(size_t j=0;j<calls.size();j++){
+			out+=name+"_total"+labels[j];
+			AppendValue(out, Load(*calls[j].metrics, counters[i]));
+			out+="\n";
+		}
+	}
+	for(size_t i=0;i<gaugeCount;i++){
+		std::string name=std::string("tgvoip_call_")+gauges[i].name;
+		AppendFamily(out, name, "gauge", gauges[i]);
+		for(size_t j=0;j<calls.size();j++){
+			out+=name+labels[j];
+			AppendValue(out, Load(*calls[j].metrics, gauges[i]));
+			out+="\n";
+		}
+	}
+
+	out+="# TYPE tgvoip_calls gauge\n# HELP tgvoip_calls Calls in progress\ntgvoip_calls ";
+	AppendValue(out, (double)calls.size());
+	out+="\n";
+	for(size_t i=0;i<counterCount;i++){
+		std::string name=std::string("tgvoip_")+counters[i].name;
+		AppendFamily(out, name, "counter", counters[i]);
+		uint64_t total=finishedTotals[i];
+		for(const Entry& entry:calls){
+			total+=(entry.metrics.get()->*counters[i].intValue).load(std::memory_order_relaxed);
+		}
+		out+=name+"_total ";
+		AppendValue(out, (double)total*counters[i].scale);
+		out+="\n";
+	}
+	for(size_t i=0;i<gaugeCount;i++){
+		if(gauges[i].aggregation==AGG_NONE)
+			continue;
+		std::string name=std::string(gauges[i].aggregation==AGG_MAX ? "tgvoip_max_" : "tgvoip_")+gauges[i].name;
+		AppendFamily(out, name, "gauge", gauges[i]);
+		double value=0.0;
+		for(const Entry& entry:calls){
+			double v=Load(*entry.metrics, gauges[i]);
+			value=gauges[i].aggregation==AGG_MAX ? std::max(value, v) : value+v;
+		}
+		out+=name+" ";
+		AppendValue(out, value);
+		out+="\n";
+	}
+	out+="# EOF\n";
+	return out;
+}
+
+uint16_t MetricsExporter::StartHttpServer(const std::string& address, uint16_t port){
+#ifndef _WIN32
+	MutexGuard m(threadMutex);
+	if(httpThread){
+		LOGE("MetricsExporter: the HTTP server is already running");
+		return 0;
+	}
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype=SOCK_STREAM;
+	hints.ai_flags=AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+	struct addrinfo* local=NULL;
+	std::string portStr=std::to_string(port);
+	if(getaddrinfo(address.empty() ? NULL : address.c_str(), portStr.c_str(), &hints, &local)!=0 || !local){
+		LOGE("MetricsExporter: invalid address %s", address.c_str());
+		return 0;
+	}
+	int fd=socket(local->ai_family, SOCK_STREAM, 0);
+	int one=1;
+	if(fd>=0)
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if(fd<0 || bind(fd, local->ai_addr, local->ai_addrlen)!=0 || listen(fd, 16)!=0){
+		LOGE("MetricsExporter: can't listen on %s:%u: %s", address.c_str(), (unsigned int)port, strerror(errno));
+		if(fd>=0)
+			close(fd);
+		freeaddrinfo(local);
+		return 0;
+	}
+	freeaddrinfo(local);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	struct sockaddr_storage addr;
+	socklen_t addrLen=sizeof(addr);
+	if(getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &addrLen)==0){
+		if(addr.ss_family==AF_INET6)
+			port=ntohs(reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port);
+		else
+			port=ntohs(reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+	}
+	LOGI("MetricsExporter: serving metrics on %s:%u", address.c_str(), (unsigned int)port);
+	listenFD=fd;
+	httpRunning=true;
+	httpThread=new Thread(std::bind(&MetricsExporter::RunHttpServer, this));
+	httpThread->SetName("MetricsHttp");
+	httpThread->Start();
+	return port;
+#else
+	LOGE("MetricsExporter: the HTTP server isn't supported on Windows");
+	return 0;
+#endif
+}
+
+bool MetricsExporter::StartFileWriter(const std::string& path, double interval){
+	MutexGuard m(threadMutex);
+	if(fileThread){
+		LOGE("MetricsExporter: the file writer is already running");
+		return false;
+	}
+	if(path.empty() || interval<=0.0){
+		LOGE("MetricsExporter: invalid file writer configuration");
+		return false;
+	}
+	filePath=path;
+	fileInterval=interval;
+	// Fail right away if the file can't be written at all
+	if(!WriteFile())
+		return false;
+	fileRunning=true;
+	fileThread=new Thread(std::bind(&MetricsExporter::RunFileWriter, this));
+	fileThread->SetName("MetricsFile");
+	fileThread->Start();
+	return true;
+}
+
+void MetricsExporter::Stop(){
+	MutexGuard m(threadMutex);
+	if(httpThread){
+		httpRunning=false;
+		httpThread->Join();
+		delete httpThread;
+		httpThread=NULL;
+#ifndef _WIN32
+		close(listenFD);
+#endif
+		listenFD=-1;
+	}
+	if(fileThread){
+		fileRunning=false;
+		fileThread->Join();
+		delete fileThread;
+		fileThread=NULL;
+	}
+}
+
+void MetricsExporter::RunHttpServer(){
+#ifndef _WIN32
+	while(httpRunning){
+		struct pollfd pfd={listenFD, POLLIN, 0};
+		if(poll(&pfd, 1, POLL_INTERVAL_MS)<=0)
+			continue;
+		int client=accept(listenFD, NULL, NULL);
+		if(client<0)
+			continue;
+		struct timeval timeout={REQUEST_TIMEOUT_MS/1000, (REQUEST_TIMEOUT_MS%1000)*1000};
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+		int one=1;
+		setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+		// Only the request line matters, the headers are read and ignored
+		std::string request;
+		char buf[1024];
+		while(request.size()<MAX_REQUEST_SIZE && request.find("\r\n\r\n")==std::string::npos && request.find("\n\n")==std::string::npos){
+			ssize_t len=recv(client, buf, sizeof(buf), 0);
+			if(len<=0)
+				break;
+			request.append(buf, (size_t)len);
+		}
+		std::string response;
+		bool head=request.compare(0, 5, "HEAD ")==0;
+		if(request.compare(0, 4, "GET ")==0 || head){
+			std::string body=Format();
+			response="HTTP/1.0 200 OK\r\nContent-Type: " CONTENT_TYPE "\r\nContent-Length: "+std::to_string(body.size())+"\r\nConnection: close\r\n\r\n";
+			if(!head)
+				response+=body;
+		}else if(request.find('\n')!=std::string::npos){
+			response="HTTP/1.0 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		}
+		size_t offset=0;
+		while(offset<response.size()){
+			ssize_t sent=send(client, response.data()+offset, response.size()-offset, SEND_FLAGS);
+			if(sent<=0)
+				break;
+			offset+=(size_t)sent;
+		}
+		close(client);
+	}
+#endif
+}
+
+void MetricsExporter::RunFileWriter(){
+	double nextWrite=VoIPController::GetCurrentTime()+fileInterval;
+	while(fileRunning){
+		if(VoIPController::GetCurrentTime()>=nextWrite){
+			WriteFile();
+			nextWrite+=fileInterval;
+			// Don't try to catch up after the process was suspended
+			nextWrite=std::max(nextWrite, VoIPController::GetCurrentTime());
+		}
+		Thread::Sleep(std::min(0.1, std::max(0.0, nextWrite-VoIPController::GetCurrentTime())));
+	}
+}
+
+bool MetricsExporter::WriteFile(){
+	std::string text=Format();
+	// Written next to the target and renamed over it, so that readers never see a partial file
+	std::string tmpPath=filePath+".tmp";
+	FILE* f=fopen(tmpPath.c_str(), "wb");
+	if(!f){
+		LOGE("MetricsExporter: can't open %s: %s", tmpPath.c_str(), strerror(errno));
+		return false;
+	}
+	bool ok=fwrite(text.data(), 1, text.size(), f)==text.size();
+	ok=fclose(f)==0 && ok;
+	if(!ok){
+		LOGE("MetricsExporter: can't write %s", tmpPath.c_str());
+		remove(tmpPath.c_str());
+		return false;
+	}
+#ifdef _WIN32
+	remove(filePath.c_str());
+#endif
+	if(rename(tmpPath.c_str(), filePath.c_str())!=0){
+		LOGE("MetricsExporter: can't replace %s: %s", filePath.c_str(), strerror(errno));
+		remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
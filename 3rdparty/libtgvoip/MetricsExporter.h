@@ -0,0 +1,118 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_METRICSEXPORTER_H
+#define LIBTGVOIP_METRICSEXPORTER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "threading.h"
+#include "utils.h"
+
+namespace tgvoip{
+
+	/**
+	 * Counters and gauges of one call. The call's threads only update them with relaxed atomic operations and the
+	 * exporter only loads them, so a scrape never holds a lock that the media path waits on. Gauges are refreshed
+	 * once a second by the call's message thread.
+	 */
+	struct CallMetrics{
+		// Counters
+		std::atomic<uint64_t> bytesSent{0};
+		std::atomic<uint64_t> bytesReceived{0};
+		std::atomic<uint64_t> packetsSent{0};
+		std::atomic<uint64_t> packetsReceived{0};
+		std::atomic<uint64_t> packetsLost{0};          // incoming, found missing by the jitter buffer
+		std::atomic<uint64_t> packetsSendLost{0};      // outgoing, never acknowledged by the peer
+		std::atomic<uint64_t> framesEncoded{0};
+		std::atomic<uint64_t> ticks{0};                // of the jitter buffer and congestion control timer
+		std::atomic<uint64_t> tickLatenessUs{0};       // total time the ticks ran late
+		// Gauges
+		std::atomic<uint64_t> state{0};
+		std::atomic<uint64_t> signalBars{0};
+		std::atomic<double> rtt{0.0};
+		std::atomic<double> jitterDelay{0.0};
+		std::atomic<double> jitter{0.0};
+		std::atomic<uint64_t> audioBitrate{0};
+		std::atomic<uint64_t> jitterBufferPackets{0};
+		std::atomic<uint64_t> encoderQueuePackets{0};
+		std::atomic<uint64_t> sendQueuePackets{0};
+		std::atomic<uint64_t> inflightBytes{0};
+		std::atomic<uint64_t> congestionWindow{0};
+		std::atomic<double> lastTickLateness{0.0};
+	};
+
+	/**
+	 * Publishes the metrics of all live calls in the process in the OpenMetrics text format, for Prometheus and
+	 * compatible scrapers. Every VoIPController registers itself; the exporter either serves the text over HTTP or
+	 * rewrites a file periodically (e.g. for node_exporter's textfile collector), or both. Process-wide counters
+	 * include the calls that already ended.
+	 */
+	class MetricsExporter{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(MetricsExporter);
+		static MetricsExporter* GetSharedInstance();
+
+		void AddCall(std::shared_ptr<CallMetrics> metrics);
+		/**
+		 * The call's counters are added to the process-wide totals
+		 */
+		void RemoveCall(CallMetrics* metrics);
+		/**
+		 * @param label value of the call's "call" label, a sequential number by default
+		 */
+		void SetCallLabel(CallMetrics* metrics, const std::string& label);
+		/**
+		 * @return the current metrics, ending with "# EOF"
+		 */
+		std::string Format();
+		/**
+		 * Serve the metrics to HTTP GET requests on any path. Not available on Windows.
+		 * @param port 0 for any free port
+		 * @return the port, 0 if the socket can't be bound
+		 */
+		uint16_t StartHttpServer(const std::string& address, uint16_t port);
+		/**
+		 * Write the metrics to a file every interval seconds. The file is replaced atomically, so readers never see a
+		 * partial one.
+		 */
+		bool StartFileWriter(const std::string& path, double interval);
+		/**
+		 * Stop the HTTP server and the file writer
+		 */
+		void Stop();
+
+	private:
+		struct Entry{
+			std::shared_ptr<CallMetrics> metrics;
+			std::string label;
+		};
+
+		MetricsExporter();
+		void RunHttpServer();
+		void RunFileWriter();
+		bool WriteFile();
+
+		Mutex mutex;
+		std::vector<Entry> calls;
+		uint64_t nextCallID=1;
+		std::vector<uint64_t> finishedTotals;  // of the counters of calls that were removed
+
+		Mutex threadMutex;  // serializes starting and stopping
+		Thread* httpThread=NULL;
+		Thread* fileThread=NULL;
+		std::atomic<bool> httpRunning{false};
+		std::atomic<bool> fileRunning{false};
+		int listenFD=-1;
+		std::string filePath;
+		double fileInterval=0.0;
+	};
+}
+
+#endif //LIBTGVOIP_METRICSEXPORTER_H
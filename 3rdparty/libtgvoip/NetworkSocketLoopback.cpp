@@ -0,0 +1,331 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "NetworkSocketLoopback.h"
+#include "VoIPController.h"
+#include "PrivateDefines.h"
+#include "logging.h"
+
+using namespace tgvoip;
+
+#define CHANNEL_CAPACITY 128 // must be a power of 2
+#define MAX_PACKET_SIZE 1500
+// How long a packet chosen for reordering is held back at most while waiting for the next one to overtake it
+#define REORDER_HOLD 0.1
+
+/**
+ * One direction of the link: a bounded lock-free queue (any thread of the sending controller may produce,
+ * only the receive thread of the other one consumes) plus a descriptor that makes it selectable. The descriptor is
+ * only signaled when the consumer is about to wait on an empty queue, so a steady stream of packets costs no syscalls.
+ */
+class NetworkSocketLoopback::Channel{
+public:
+	struct Cell{
+		std::atomic<size_t> seq;
+		double deliverAt;
+		bool reorder;
+		size_t length;
+		unsigned char data[MAX_PACKET_SIZE];
+	};
+
+	Channel(){
+		for(size_t i=0;i<CHANNEL_CAPACITY;i++){
+			cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+#if defined(__linux__)
+		int fd=eventfd(0, EFD_NONBLOCK);
+		if(fd<0){
+			LOGE("Failed to create loopback eventfd");
+		}else{
+			readFd=writeFd=fd;
+		}
+#elif !defined(_WIN32)
+		int fds[2];
+		if(pipe(fds)!=0){
+			LOGE("Failed to create loopback pipe");
+		}else{
+			fcntl(fds[0], F_SETFL, O_NONBLOCK);
+			fcntl(fds[1], F_SETFL, O_NONBLOCK);
+			readFd=fds[0];
+			writeFd=fds[1];
+		}
+#endif
+	}
+
+	~Channel(){
+#ifndef _WIN32
+		if(readFd){
+			close(readFd);
+			if(writeFd!=readFd)
+				close(writeFd);
+		}
+#endif
+	}
+
+	bool Push(const unsigned char* data, size_t length, double deliverAt, bool reorder){
+		size_t pos=enqueuePos.load(std::memory_order_relaxed);
+		Cell* cell;
+		for(;;){
+			cell=&cells[pos & (CHANNEL_CAPACITY-1)];
+			size_t seq=cell->seq.load(std::memory_order_acquire);
+			intptr_t diff=(intptr_t)seq-(intptr_t)pos;
+			if(diff==0){
+				if(enqueuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+					break;
+			}else if(diff<0){
+				return false;
+			}else{
+				pos=enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		memcpy(cell->data, data, length);
+		cell->length=length;
+		cell->deliverAt=deliverAt;
+		cell->reorder=reorder;
+		cell->seq.store(pos+1, std::memory_order_release);
+		// Pairs with the fence in ArmWakeup(): either the consumer sees this packet or this sees that it waits
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(waiting.load(std::memory_order_relaxed) && waiting.exchange(false))
+			Signal();
+		return true;
+	}
+
+	Cell* Peek(){
+		Cell* cell=&cells[dequeuePos & (CHANNEL_CAPACITY-1)];
+		if(cell->seq.load(std::memory_order_acquire)!=dequeuePos+1)
+			return NULL;
+		return cell;
+	}
+
+	void Pop(){
+		Cell* cell=&cells[dequeuePos & (CHANNEL_CAPACITY-1)];
+		cell->seq.store(dequeuePos+CHANNEL_CAPACITY, std::memory_order_release);
+		dequeuePos++;
+	}
+
+	/**
+	 * Have the next Push() signal the descriptor. Only the consumer calls this, before waiting on an empty queue.
+	 * @return false if a packet arrived in the meantime, so there's nothing to wait for
+	 */
+	bool ArmWakeup(){
+		waiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(!Peek())
+			return true;
+		waiting.store(false, std::memory_order_relaxed);
+		return false;
+	}
+
+	void Signal(){
+#ifndef _WIN32
+		uint64_t one=1;
+		(void) write(writeFd, &one, sizeof(one));
+#endif
+	}
+
+	/**
+	 * Only called after select() found the descriptor readable
+	 */
+	void ConsumeSignal(){
+#ifndef _WIN32
+		unsigned char buf[64];
+		(void) read(readFd, buf, sizeof(buf));
+#endif
+	}
+
+	int readFd=0;
+	int writeFd=0;
+	std::atomic<bool> closed{false};
+
+private:
+	Cell cells[CHANNEL_CAPACITY];
+	std::atomic<size_t> enqueuePos{0};
+	size_t dequeuePos=0;
+	std::atomic<bool> waiting{false};
+};
+
+NetworkSocketLoopback::NetworkSocketLoopback(std::shared_ptr<Channel> in, std::shared_ptr<Channel> out, const IPv4Address& relayAddress, uint16_t relayPort)
+	: NetworkSocket(PROTO_UDP), in(in), out(out), relayAddress(relayAddress), relayPort(relayPort), heldPacket(MAX_PACKET_SIZE){
+}
+
+NetworkSocketLoopback::~NetworkSocketLoopback(){
+	Close();
+}
+
+void NetworkSocketLoopback::CreatePair(NetworkSocketLoopback** a, NetworkSocketLoopback** b, const IPv4Address& relayAddress, uint16_t relayPort){
+	std::shared_ptr<Channel> ab=std::make_shared<Channel>();
+	std::shared_ptr<Channel> ba=std::make_shared<Channel>();
+	*a=new NetworkSocketLoopback(ba, ab, relayAddress, relayPort);
+	*b=new NetworkSocketLoopback(ab, ba, relayAddress, relayPort);
+}
+
+void NetworkSocketLoopback::SetImpairment(const Impairment& impairment){
+	delay=impairment.delay;
+	jitter=impairment.jitter;
+	loss=impairment.loss;
+	reorder=impairment.reorder;
+}
+
+void NetworkSocketLoopback::Open(){
+	in->closed=false;
+	readyToSend=true;
+	failed=in->readFd==0;
+}
+
+void NetworkSocketLoopback::Close(){
+	if(in->closed.exchange(true))
+		return;
+	// Wake up a receive thread that might be waiting on this socket
+	in->Signal();
+}
+
+std::string NetworkSocketLoopback::GetLocalInterfaceInfo(IPv4Address* inet4addr, IPv6Address* inet6addr){
+	return "loopback";
+}
+
+int NetworkSocketLoopback::GetDescriptor(){
+	return in->readFd;
+}
+
+void NetworkSocketLoopback::Send(NetworkPacket* packet){
+	if(out->closed || packet->length<32 || packet->length>MAX_PACKET_SIZE)
+		return;
+	// Same rules as a reflector: relay pings aren't forwarded to the peer and self-info queries are answered
+	const int32_t* specialID=reinterpret_cast<const int32_t*>(packet->data+16);
+	if(specialID[0]==-1 && specialID[1]==-1 && specialID[2]==-1){
+		if(specialID[3]==-2)
+			ReplyToSelfInfoQuery(packet);
+		return;
+	}
+
+	thread_local std::minstd_rand rng(std::random_device{}());
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	double _loss=loss, _jitter=jitter, _reorder=reorder;
+	if(_loss>0.0 && uniform(rng)<_loss)
+		return;
+	double deliverAt=0.0;
+	double _delay=delay+(_jitter>0.0 ? uniform(rng)*_jitter : 0.0);
+	if(_delay>0.0)
+		deliverAt=VoIPController::GetCurrentTime()+_delay;
+	bool reorderThis=_reorder>0.0 && uniform(rng)<_reorder;
+
+	// The reflector flips the lowest bit of the peer tag so that it matches the receiver's tag
+	packet->data[15]^=1;
+	bool pushed=out->Push(packet->data, packet->length, deliverAt, reorderThis);
+	packet->data[15]^=1;
+	if(!pushed)
+		LOGV("Loopback queue full, dropping packet");
+}
+
+void NetworkSocketLoopback::ReplyToSelfInfoQuery(NetworkPacket* query){
+	if(query->length<40 || in->closed)
+		return;
+	int64_t queryID;
+	memcpy(&queryID, query->data+32, 8);
+	// IPv4-mapped 127.0.0.1; the controller only uses the reply to tell that UDP works
+	unsigned char myIP[16]={0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF, 127, 0, 0, 1};
+	unsigned char buf[64];
+	BufferOutputStream reply(buf, sizeof(buf));
+	reply.WriteBytes(query->data, 16);
+	reply.WriteInt64(-1);
+	reply.WriteInt32(-1);
+	reply.WriteInt32(TLID_UDP_REFLECTOR_SELF_INFO);
+	reply.WriteInt32((int32_t)time(NULL));
+	reply.WriteInt64(queryID);
+	reply.WriteBytes(myIP, 16);
+	reply.WriteInt32(relayPort);
+	in->Push(buf, reply.GetLength(), 0.0, false);
+}
+
+bool NetworkSocketLoopback::IsReady(double now, double* timeout){
+	if(in->closed)
+		return false;
+	if(heldReady)
+		return true;
+	Channel::Cell* head=in->Peek();
+	if(head && head->deliverAt>now){
+		if(timeout && (*timeout<0.0 || *timeout>head->deliverAt-now))
+			*timeout=head->deliverAt-now;
+		head=NULL;
+	}
+	if(head && head->reorder && !holding){
+		// Hold it back and see whether the next one shows up before heldUntil to overtake it
+		memcpy(*heldPacket, head->data, head->length);
+		heldLength=head->length;
+		holding=true;
+		heldUntil=now+REORDER_HOLD;
+		in->Pop();
+		return IsReady(now, timeout);
+	}
+	if(head)
+		return true;
+	if(holding){
+		if(now>=heldUntil)
+			return true;
+		if(timeout && (*timeout<0.0 || *timeout>heldUntil-now))
+			*timeout=heldUntil-now;
+	}
+	return false;
+}
+
+bool NetworkSocketLoopback::PrepareSelect(double& timeout){
+	double now=VoIPController::GetCurrentTime();
+	if(IsReady(now, &timeout))
+		return true;
+	// Packets behind a delayed head can't be due before it, so a wakeup is only needed when the queue is empty
+	if(!in->Peek() && !in->ArmWakeup())
+		return IsReady(now, &timeout);
+	return false;
+}
+
+bool NetworkSocketLoopback::FinishSelect(bool signaled){
+	if(signaled)
+		in->ConsumeSignal();
+	return IsReady(VoIPController::GetCurrentTime(), NULL);
+}
+
+void NetworkSocketLoopback::Receive(NetworkPacket* packet){
+	size_t capacity=packet->length;
+	packet->address=&relayAddress;
+	packet->port=relayPort;
+	packet->protocol=PROTO_UDP;
+	packet->length=0;
+	double now=VoIPController::GetCurrentTime();
+	if(!IsReady(now, NULL))
+		return;
+	if(heldReady){
+		heldReady=holding=false;
+		packet->length=std::min(heldLength, capacity);
+		memcpy(packet->data, *heldPacket, packet->length);
+		return;
+	}
+	Channel::Cell* head=in->Peek();
+	if(head && head->deliverAt<=now){
+		packet->length=std::min(head->length, capacity);
+		memcpy(packet->data, head->data, packet->length);
+		in->Pop();
+		// This one overtook the held packet, which goes next
+		heldReady=holding;
+		return;
+	}
+	// Nothing overtook the held packet in time
+	holding=false;
+	packet->length=std::min(heldLength, capacity);
+	memcpy(packet->data, *heldPacket, packet->length);
+}
@@ -0,0 +1,84 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_NETWORKSOCKETLOOPBACK_H
+#define LIBTGVOIP_NETWORKSOCKETLOOPBACK_H
+
+#include <atomic>
+#include <memory>
+#include "NetworkSocket.h"
+#include "Buffers.h"
+
+namespace tgvoip{
+
+	/**
+	 * A UDP socket that talks to its peer socket in the same process through lock-free queues.
+	 * The pair behaves like a UDP reflector at relayAddress:relayPort, so both controllers should be given a
+	 * UDP_RELAY endpoint with that address and peer tags that differ only in the lowest bit of the last byte.
+	 * Sending and receiving a packet takes no syscalls: the receive thread only waits on a descriptor when its queue
+	 * is empty, and select() times out when the next delayed packet is due.
+	 */
+	class NetworkSocketLoopback : public NetworkSocket{
+	public:
+		friend class NetworkSocketPosix;
+		struct Impairment{
+			double delay=0.0;   // seconds added to every packet
+			double jitter=0.0;  // seconds, uniformly distributed on top of delay
+			double loss=0.0;    // probability of dropping a packet, 0..1
+			double reorder=0.0; // probability of a packet being delivered after the one that follows it, 0..1
+		};
+
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(NetworkSocketLoopback);
+		virtual ~NetworkSocketLoopback();
+		static void CreatePair(NetworkSocketLoopback** a, NetworkSocketLoopback** b, const IPv4Address& relayAddress, uint16_t relayPort);
+		virtual void Send(NetworkPacket* packet) override;
+		virtual void Receive(NetworkPacket* packet) override;
+		virtual void Open() override;
+		virtual void Close() override;
+		virtual void Connect(const NetworkAddress* address, uint16_t port) override{};
+		virtual std::string GetLocalInterfaceInfo(IPv4Address* inet4addr, IPv6Address* inet6addr) override;
+		/**
+		 * Impair packets sent from this socket. Can be changed at any time.
+		 */
+		void SetImpairment(const Impairment& impairment);
+
+	private:
+		class Channel;
+		NetworkSocketLoopback(std::shared_ptr<Channel> in, std::shared_ptr<Channel> out, const IPv4Address& relayAddress, uint16_t relayPort);
+		int GetDescriptor();
+		/**
+		 * Called on the receive thread before it waits in select()
+		 * @param timeout lowered to the seconds until the next delayed packet is due; negative means none
+		 * @return true if a packet can be received right away, no waiting needed
+		 */
+		bool PrepareSelect(double& timeout);
+		/**
+		 * Called on the receive thread after select() returned
+		 * @param signaled whether select() found the descriptor readable
+		 * @return true if a packet can be received now
+		 */
+		bool FinishSelect(bool signaled);
+		bool IsReady(double now, double* timeout);
+		void ReplyToSelfInfoQuery(NetworkPacket* query);
+
+		std::shared_ptr<Channel> in;
+		std::shared_ptr<Channel> out;
+		IPv4Address relayAddress;
+		uint16_t relayPort;
+		std::atomic<double> delay{0.0};
+		std::atomic<double> jitter{0.0};
+		std::atomic<double> loss{0.0};
+		std::atomic<double> reorder{0.0};
+		// A packet chosen for reordering waits here until the next one overtakes it or until heldUntil
+		Buffer heldPacket;
+		size_t heldLength=0;
+		bool holding=false;
+		bool heldReady=false;  // the next one overtook it, deliver it now
+		double heldUntil=0.0;
+	};
+}
+
+#endif //LIBTGVOIP_NETWORKSOCKETLOOPBACK_H
@@ -113,6 +113,14 @@ size_t tgvoip::OpusDecoder::HandleCallback(unsigned char *data, size_t len){
 			lastDecoded=(unsigned char *) decodedQueue->GetBlocking();
 			if(!lastDecoded)
 				return 0;
+			if(!data){
+				// The decoder thread decodes regardless, all that can be saved here is the copy
+				bufferPool->Reuse(lastDecoded);
+				semaphore->Release();
+				if(silentPacketCount>0)
+					silentPacketCount--;
+				return 0;
+			}
 			memcpy(data, lastDecoded, PACKET_SIZE);
 			bufferPool->Reuse(lastDecoded);
 			semaphore->Release();
@@ -131,9 +139,34 @@ size_t tgvoip::OpusDecoder::HandleCallback(unsigned char *data, size_t len){
 		}
 	}else{
 		if(remainingDataLen==0 && silentPacketCount==0){
-			int duration=DecodeNextFrame();
+			int duration;
+			if(data){
+				if(frameSkipped){
+					// The decoder hasn't seen the skipped packets, start clean instead of concealing the gap
+					opus_decoder_ctl(dec, OPUS_RESET_STATE);
+					if(ecDec)
+						opus_decoder_ctl(ecDec, OPUS_RESET_STATE);
+					frameSkipped=false;
+				}
+				duration=DecodeNextFrame();
+			}else{
+				duration=SkipNextFrame();
+				frameSkipped=true;
+			}
 			remainingDataLen=(size_t) (duration/20*960*2);
 		}
+		if(!data || (frameSkipped && remainingDataLen>0)){
+			// Skipping, or the rest of a frame that was skipped: nothing was decoded for it
+			if(silentPacketCount>0)
+				silentPacketCount--;
+			else if(remainingDataLen>0)
+				remainingDataLen-=960*2;
+			if(data)
+				memset(data, 0, 960*2);
+			if(levelMeter)
+				levelMeter->Update(NULL, 0);
+			return 0;
+		}
 		if(silentPacketCount>0 || remainingDataLen==0 || !processedBuffer){
 			if(silentPacketCount>0)
 				silentPacketCount--;
@@ -147,6 +180,13 @@ size_t tgvoip::OpusDecoder::HandleCallback(unsigned char *data, size_t len){
 		if(remainingDataLen>0){
 			memmove(processedBuffer, processedBuffer+960*2, remainingDataLen);
 		}
+		// Same as the decoder thread and the audio callback do in async mode
+		for(effects::AudioEffect*& effect:postProcEffects){
+			effect->Process(reinterpret_cast<int16_t*>(data), 960);
+		}
+		if(echoCanceller){
+			echoCanceller->SpeakerOutCallback(data, PACKET_SIZE);
+		}
 	}
 	if(levelMeter)
 		levelMeter->Update(reinterpret_cast<int16_t *>(data), len/2);
@@ -214,6 +254,7 @@ int tgvoip::OpusDecoder::DecodeNextFrame(){
 		//if(len)
 		//	LOGV("Trying FEC...");
 	}
+	UpdateActivity(fec ? 0 : len);
 	int size;
 	if(len){
 		size=opus_decode(isEC ? ecDec : dec, buffer, len, (opus_int16 *) decodeBuffer, packetsPerFrame*960, fec ? 1 : 0);
@@ -260,6 +301,19 @@ int tgvoip::OpusDecoder::DecodeNextFrame(){
 	return playbackDuration;
 }
 
+int tgvoip::OpusDecoder::SkipNextFrame(){
+	int playbackDuration=0;
+	bool isEC=false;
+	size_t len=jitterBuffer->HandleOutput(buffer, 8192, 0, true, playbackDuration, isEC);
+	UpdateActivity(len);
+	return playbackDuration;
+}
+
+void tgvoip::OpusDecoder::UpdateActivity(size_t packetLen){
+	// 1 or 2 byte packets are DTX
+	float bytesPer20ms=packetLen>2 ? (float)packetLen/packetsPerFrame : 0.0f;
+	activity=activity*0.7f+bytesPer20ms*0.3f;
+}
 
 void tgvoip::OpusDecoder::SetFrameDuration(uint32_t duration){
 	frameDuration=duration;
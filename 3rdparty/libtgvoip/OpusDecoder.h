@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <vector>
 #include <memory>
+#include <atomic>
 
 struct OpusDecoder;
 
@@ -41,12 +42,22 @@ public:
 	void SetLevelMeter(AudioLevelMeter* levelMeter);
 	void AddAudioEffect(effects::AudioEffect* effect);
 	void RemoveAudioEffect(effects::AudioEffect* effect);
+	/**
+	 * Average Opus payload size in bytes per 20 ms over the last few frames, 0 for DTX and lost packets.
+	 * VBR speech packets are several times bigger than silence or background noise, so this works as a
+	 * loudness estimate that's available even for frames that were skipped without decoding.
+	 */
+	float GetActivity(){
+		return activity;
+	}
 
 private:
 	void Initialize(bool isAsync, bool needEC);
 	static size_t Callback(unsigned char* data, size_t len, void* param);
 	void RunThread();
 	int DecodeNextFrame();
+	int SkipNextFrame();
+	void UpdateActivity(size_t packetLen);
 	::OpusDecoder* dec;
 	::OpusDecoder* ecDec;
 	BlockingQueue<unsigned char*>* decodedQueue;
@@ -74,6 +85,8 @@ private:
 	ptrdiff_t remainingDataLen;
 	bool prevWasEC;
 	int16_t prevLastSample;
+	std::atomic<float> activity{0.0f};
+	bool frameSkipped=false;
 };
 }
 
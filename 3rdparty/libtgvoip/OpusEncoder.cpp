@@ -7,15 +7,99 @@
 #include "OpusEncoder.h"
 #include <assert.h>
 #include <algorithm>
+#include <chrono>
+#include <map>
 #include "logging.h"
 #include "VoIPServerConfig.h"
+#include "audio/CpuFeatures.h"
 #if defined HAVE_CONFIG_H || defined TGVOIP_USE_INSTALLED_OPUS
 #include <opus/opus.h>
 #else
 #include "opus.h"
 #endif
 
+// Packets whose samples all stay within this are treated as silence (about -72 dBFS)
+#define SILENCE_THRESHOLD 8
+// Silent packets that still go through APM and the encoder before the fast path kicks in, so that their tails fade out naturally
+#define SILENCE_HANGOVER_PACKETS 10
+
 namespace{
+	bool IsSilent(const int16_t* samples, size_t count){
+		size_t i=0;
+#if defined(TGVOIP_SIMD_SSE2)
+		__m128i vmax=_mm_set1_epi16(INT16_MIN);
+		__m128i vmin=_mm_set1_epi16(INT16_MAX);
+		for(;i+8<=count;i+=8){
+			__m128i v=_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples+i));
+			vmax=_mm_max_epi16(vmax, v);
+			vmin=_mm_min_epi16(vmin, v);
+		}
+		__m128i outside=_mm_or_si128(_mm_cmpgt_epi16(vmax, _mm_set1_epi16(SILENCE_THRESHOLD)), _mm_cmplt_epi16(vmin, _mm_set1_epi16(-SILENCE_THRESHOLD)));
+		if(_mm_movemask_epi8(outside))
+			return false;
+#elif defined(TGVOIP_SIMD_NEON)
+		int16x8_t vmax=vdupq_n_s16(INT16_MIN);
+		int16x8_t vmin=vdupq_n_s16(INT16_MAX);
+		for(;i+8<=count;i+=8){
+			int16x8_t v=vld1q_s16(samples+i);
+			vmax=vmaxq_s16(vmax, v);
+			vmin=vminq_s16(vmin, v);
+		}
+		int16x4_t max4=vpmax_s16(vget_low_s16(vmax), vget_high_s16(vmax));
+		int16x4_t min4=vpmin_s16(vget_low_s16(vmin), vget_high_s16(vmin));
+		max4=vpmax_s16(max4, max4);
+		min4=vpmin_s16(min4, min4);
+		max4=vpmax_s16(max4, max4);
+		min4=vpmin_s16(min4, min4);
+		if(vget_lane_s16(max4, 0)>SILENCE_THRESHOLD || vget_lane_s16(min4, 0)<-SILENCE_THRESHOLD)
+			return false;
+#endif
+		for(;i<count;i++){
+			if(samples[i]>SILENCE_THRESHOLD || samples[i]<-SILENCE_THRESHOLD)
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	 * The packet an encoder configured like the given one settles on for digital silence. Computed once per process
+	 * and configuration (sample rate, frame size, the bandwidth the encoder last used, its bitrate and FEC settings)
+	 * with a throwaway encoder, and sent in place of encoding silent frames. The bitrate picks the mode the frame is
+	 * coded in, so calls at different bitrates don't share a packet.
+	 */
+	const std::vector<unsigned char>& GetSilentPacket(unsigned int sampleRate, size_t frameSize, ::OpusEncoder* like){
+		static tgvoip::Mutex mutex;
+		static std::map<std::vector<int32_t>, std::vector<unsigned char>> cache;
+		opus_int32 bandwidth=0, fec=0, loss=0, bitrate=0;
+		opus_encoder_ctl(like, OPUS_GET_BANDWIDTH(&bandwidth));
+		opus_encoder_ctl(like, OPUS_GET_INBAND_FEC(&fec));
+		opus_encoder_ctl(like, OPUS_GET_PACKET_LOSS_PERC(&loss));
+		opus_encoder_ctl(like, OPUS_GET_BITRATE(&bitrate));
+		std::vector<int32_t> key={(int32_t)sampleRate, (int32_t)frameSize, bandwidth, bitrate, fec, loss};
+		tgvoip::MutexGuard m(mutex);
+		std::vector<unsigned char>& packet=cache[key];
+		if(packet.empty()){
+			::OpusEncoder* enc=opus_encoder_create(sampleRate, 1, OPUS_APPLICATION_VOIP, NULL);
+			opus_encoder_ctl(enc, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+			opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(bandwidth));
+			opus_encoder_ctl(enc, OPUS_SET_INBAND_FEC(fec));
+			opus_encoder_ctl(enc, OPUS_SET_PACKET_LOSS_PERC(loss));
+			opus_encoder_ctl(enc, OPUS_SET_BITRATE(bitrate));
+			std::vector<int16_t> zeros(frameSize, 0);
+			unsigned char buf[256];
+			int32_t len=0;
+			// the first few frames still carry the encoder's startup state
+			for(int i=0;i<5;i++){
+				len=opus_encode(enc, zeros.data(), static_cast<int>(frameSize), buf, sizeof(buf));
+			}
+			opus_encoder_destroy(enc);
+			if(len>0)
+				packet.assign(buf, buf+len);
+			LOGV("Cached %d-byte silent Opus packet for %u Hz x %u, bandwidth %d, %d bps, FEC %d, loss %d%%", len, sampleRate, (unsigned int)frameSize, bandwidth, bitrate, fec, loss);
+		}
+		return packet;
+	}
+
 	int serverConfigValueToBandwidth(int config){
 		switch(config){
 			case 0:
@@ -33,10 +117,12 @@ namespace{
 	}
 }
 
-tgvoip::OpusEncoder::OpusEncoder(MediaStreamItf *source, bool needSecondary):queue(11), bufferPool(960*2, 10){
+tgvoip::OpusEncoder::OpusEncoder(MediaStreamItf *source, bool needSecondary, unsigned int sampleRate):queue(11), bufferPool(sampleRate/50*2, 10){
 	this->source=source;
 	source->SetCallback(tgvoip::OpusEncoder::Callback, this);
-	enc=opus_encoder_create(48000, 1, OPUS_APPLICATION_VOIP, NULL);
+	this->sampleRate=sampleRate;
+	packetSize=sampleRate/50;
+	enc=opus_encoder_create(sampleRate, 1, OPUS_APPLICATION_VOIP, NULL);
 	opus_encoder_ctl(enc, OPUS_SET_COMPLEXITY(10));
 	opus_encoder_ctl(enc, OPUS_SET_PACKET_LOSS_PERC(1));
 	opus_encoder_ctl(enc, OPUS_SET_INBAND_FEC(1));
@@ -56,7 +142,7 @@ tgvoip::OpusEncoder::OpusEncoder(MediaStreamItf *source, bool needSecondary):que
 	secondaryEncoderEnabled=false;
 
 	if(needSecondary){
-		secondaryEncoder=opus_encoder_create(48000, 1, OPUS_APPLICATION_VOIP, NULL);
+		secondaryEncoder=opus_encoder_create(sampleRate, 1, OPUS_APPLICATION_VOIP, NULL);
 		opus_encoder_ctl(secondaryEncoder, OPUS_SET_COMPLEXITY(10));
 		opus_encoder_ctl(secondaryEncoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
 		//opus_encoder_ctl(secondaryEncoder, OPUS_SET_VBR(0));
@@ -68,6 +154,8 @@ tgvoip::OpusEncoder::OpusEncoder(MediaStreamItf *source, bool needSecondary):que
 }
 
 tgvoip::OpusEncoder::~OpusEncoder(){
+	if(frame)
+		free(frame);
 	opus_encoder_destroy(enc);
 	if(secondaryEncoder)
 		opus_encoder_destroy(secondaryEncoder);
@@ -76,7 +164,17 @@ tgvoip::OpusEncoder::~OpusEncoder(){
 void tgvoip::OpusEncoder::Start(){
 	if(running)
 		return;
+	packetsPerFrame=frameDuration/20;
+	LOGV("starting encoder, packets per frame=%d", packetsPerFrame);
+	if(packetsPerFrame>1)
+		frame=(int16_t*) malloc(packetSize*2*packetsPerFrame);
+	bufferedCount=0;
+	frameHasVoice=false;
+	frameIsSilent=true;
+	silentPacket=NULL;
 	running=true;
+	if(synchronous)
+		return;
 	thread=new Thread(std::bind(&tgvoip::OpusEncoder::RunThread, this));
 	thread->SetName("OpusEncoder");
 	thread->Start();
@@ -87,9 +185,19 @@ void tgvoip::OpusEncoder::Stop(){
 	if(!running)
 		return;
 	running=false;
-	queue.Put(NULL);
-	thread->Join();
-	delete thread;
+	if(!synchronous){
+		queue.Put(NULL);
+		thread->Join();
+		delete thread;
+	}
+	if(frame){
+		free(frame);
+		frame=NULL;
+	}
+}
+
+void tgvoip::OpusEncoder::SetSynchronous(bool synchronous){
+	this->synchronous=synchronous;
 }
 
 
@@ -103,11 +211,36 @@ void tgvoip::OpusEncoder::Encode(int16_t* data, size_t len){
 		currentBitrate=requestedBitrate;
 		LOGV("opus_encoder: setting bitrate to %u", currentBitrate);
 	}
+	int effectiveComplexity=GetComplexity();
+	if(effectiveComplexity!=appliedComplexity){
+		appliedComplexity=effectiveComplexity;
+		opus_encoder_ctl(enc, OPUS_SET_COMPLEXITY(appliedComplexity));
+		if(secondaryEncoder)
+			opus_encoder_ctl(secondaryEncoder, OPUS_SET_COMPLEXITY(appliedComplexity));
+		LOGV("opus_encoder: setting complexity to %d", appliedComplexity);
+	}
 	if(levelMeter)
 		levelMeter->Update(data, len);
-	if(secondaryEncoderEnabled!=wasSecondaryEncoderEnabled){
-		wasSecondaryEncoderEnabled=secondaryEncoderEnabled;
-		opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(secondaryEncoderEnabled ? secondaryEnabledBandwidth : OPUS_BANDWIDTH_FULLBAND));
+	if(preprocessedCallback)
+		preprocessedCallback(data, len);
+	if(encoderStale){
+		// The encoder last saw the audio from before the silence or the prompt. Start it over and let it settle on
+		// silence, like the cached packets were, so that the first real frame isn't predicted from stale state
+		encoderStale=false;
+		silentPacket=NULL;
+		secondarySilentPacket=NULL;
+		opus_encoder_ctl(enc, OPUS_RESET_STATE);
+		std::vector<int16_t> zeros(len, 0);
+		opus_encode(enc, zeros.data(), static_cast<int>(len), buffer, sizeof(buffer));
+		if(secondaryEncoder){
+			opus_encoder_ctl(secondaryEncoder, OPUS_RESET_STATE);
+			opus_encode(secondaryEncoder, zeros.data(), static_cast<int>(len), buffer, sizeof(buffer));
+		}
+	}
+	bool useSecondary=secondaryEncoderEnabled && secondaryEncoderAllowed;
+	if(useSecondary!=wasSecondaryEncoderEnabled){
+		wasSecondaryEncoderEnabled=useSecondary;
+		opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(useSecondary ? secondaryEnabledBandwidth : OPUS_BANDWIDTH_FULLBAND));
 	}
 	int32_t r=opus_encode(enc, data, static_cast<int>(len), buffer, 4096);
 	if(r<=0){
@@ -118,7 +251,7 @@ void tgvoip::OpusEncoder::Encode(int16_t* data, size_t len){
 		//LOGV("Packet size = %d", r);
 		int32_t secondaryLen=0;
 		unsigned char secondaryBuffer[128];
-		if(secondaryEncoderEnabled && secondaryEncoder){
+		if(useSecondary && secondaryEncoder){
 			secondaryLen=opus_encode(secondaryEncoder, data, static_cast<int>(len), secondaryBuffer, sizeof(secondaryBuffer));
 			//LOGV("secondaryLen %d", secondaryLen);
 		}
@@ -126,18 +259,60 @@ void tgvoip::OpusEncoder::Encode(int16_t* data, size_t len){
 	}
 }
 
+void tgvoip::OpusEncoder::SendSilence(int16_t* data, size_t len){
+	if(levelMeter)
+		levelMeter->Update(data, len);
+	if(preprocessedCallback)
+		preprocessedCallback(data, len);
+	// With DTX the encoder would have produced a 1-byte packet here, and those aren't sent
+	if(dtx || !running)
+		return;
+	// Looked up once per silent stretch, with the settings the encoders had when it started
+	if(!silentPacket){
+		silentPacket=&GetSilentPacket(sampleRate, len, enc);
+		if(secondaryEncoder)
+			secondarySilentPacket=&GetSilentPacket(sampleRate, len, secondaryEncoder);
+	}
+	if(silentPacket->empty())
+		return;
+	encoderStale=true;
+	silentFrames++;
+	memcpy(buffer, silentPacket->data(), silentPacket->size());
+	unsigned char secondaryBuffer[256];
+	size_t secondaryLen=0;
+	if(secondaryEncoderEnabled && secondaryEncoderAllowed && secondarySilentPacket && secondarySilentPacket->size()<=sizeof(secondaryBuffer)){
+		secondaryLen=secondarySilentPacket->size();
+		memcpy(secondaryBuffer, secondarySilentPacket->data(), secondaryLen);
+	}
+	InvokeCallback(buffer, silentPacket->size(), secondaryLen ? secondaryBuffer : NULL, secondaryLen);
+}
+
 size_t tgvoip::OpusEncoder::Callback(unsigned char *data, size_t len, void* param){
 	OpusEncoder* e=(OpusEncoder*)param;
+	if(e->synchronous){
+		// The packet is processed in place, the source's buffer is left alone
+		unsigned char* buf=e->bufferPool.Get();
+		if(buf && e->running){
+			assert(len==e->packetSize*2);
+			memcpy(buf, data, len);
+			e->ProcessPacket(reinterpret_cast<int16_t*>(buf));
+		}
+		if(buf)
+			e->bufferPool.Reuse(buf);
+		return 0;
+	}
 	unsigned char* buf=e->bufferPool.Get();
 	if(buf){
-		assert(len==960*2);
-		memcpy(buf, data, 960*2);
+		assert(len==e->packetSize*2);
+		memcpy(buf, data, len);
+		// Counted before it's queued so that the encoder thread never takes it out first
+		e->queuedPackets.fetch_add(1, std::memory_order_relaxed);
 		e->queue.Put(buf);
 	}else{
 		LOGW("opus_encoder: no buffer slots left");
+		// applied by the encoder thread before the next packet
 		if(e->complexity>1){
 			e->complexity--;
-			opus_encoder_ctl(e->enc, OPUS_SET_COMPLEXITY(e->complexity));
 		}
 	}
 	return 0;
@@ -148,77 +323,186 @@ uint32_t tgvoip::OpusEncoder::GetBitrate(){
 	return requestedBitrate;
 }
 
+void tgvoip::OpusEncoder::SetPreprocessedCallback(std::function<void(int16_t*, size_t)> callback){
+	preprocessedCallback=callback;
+}
+
 void tgvoip::OpusEncoder::SetEchoCanceller(EchoCanceller* aec){
 	echoCanceller=aec;
 }
 
 void tgvoip::OpusEncoder::RunThread(){
-	uint32_t bufferedCount=0;
-	uint32_t packetsPerFrame=frameDuration/20;
-	LOGV("starting encoder, packets per frame=%d", packetsPerFrame);
-	int16_t* frame;
-	if(packetsPerFrame>1)
-		frame=(int16_t*) malloc(960*2*packetsPerFrame);
-	else
-		frame=NULL;
-	bool frameHasVoice=false;
-	bool wasVadMode=false;
 	while(running){
 		int16_t* packet=(int16_t*)queue.GetBlocking();
 		if(packet){
-			bool hasVoice=true;
-			if(echoCanceller)
-				echoCanceller->ProcessInput(packet, 960, hasVoice);
-			if(!postProcEffects.empty()){
-				for(effects::AudioEffect* effect:postProcEffects){
-					effect->Process(packet, 960);
-				}
+			queuedPackets.fetch_sub(1, std::memory_order_relaxed);
+			ProcessPacket(packet);
+			bufferPool.Reuse(reinterpret_cast<unsigned char *>(packet));
+		}
+	}
+}
+
+void tgvoip::OpusEncoder::ProcessPacket(int16_t* packet){
+	std::chrono::steady_clock::time_point processingStart=std::chrono::steady_clock::now();
+	if(bufferedCount==0)
+		UpdatePrompt();
+	bool hasVoice=true;
+	if(IsSilent(packet, packetSize)){
+		if(silentPackets==SILENCE_HANGOVER_PACKETS)
+			LOGV("opus_encoder: input is silent, skipping processing");
+		silentPackets++;
+	}else{
+		if(silentPackets>SILENCE_HANGOVER_PACKETS)
+			LOGV("opus_encoder: input is no longer silent");
+		silentPackets=0;
+	}
+	// A silent packet is about to be replaced with the prompt, there's no tail to fade out
+	bool skipProcessing=silentPackets>SILENCE_HANGOVER_PACKETS || (prompt && silentPackets>0);
+	if(!skipProcessing){
+		if(echoCanceller){
+			if(processingStale)
+				echoCanceller->Reset();
+			echoCanceller->ProcessInput(packet, packetSize, hasVoice);
+		}
+		processingStale=false;
+		if(!postProcEffects.empty()){
+			for(effects::AudioEffect* effect:postProcEffects){
+				effect->Process(packet, packetSize);
 			}
-			if(packetsPerFrame==1){
-				Encode(packet, 960);
-			}else{
-				memcpy(frame+(960*bufferedCount), packet, 960*2);
-    			frameHasVoice=frameHasVoice || hasVoice;
-				bufferedCount++;
-				if(bufferedCount==packetsPerFrame){
-					if(vadMode){
-						if(frameHasVoice){
-							opus_encoder_ctl(enc, OPUS_SET_BITRATE(currentBitrate));
-							opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(vadModeVoiceBandwidth));
-							if(secondaryEncoder){
-								opus_encoder_ctl(secondaryEncoder, OPUS_SET_BITRATE(currentBitrate));
-								opus_encoder_ctl(secondaryEncoder, OPUS_SET_BANDWIDTH(vadModeVoiceBandwidth));
-							}
-						}else{
-							opus_encoder_ctl(enc, OPUS_SET_BITRATE(vadNoVoiceBitrate));
-							opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(vadModeNoVoiceBandwidth));
-							if(secondaryEncoder){
-								opus_encoder_ctl(secondaryEncoder, OPUS_SET_BITRATE(vadNoVoiceBitrate));
-								opus_encoder_ctl(secondaryEncoder, OPUS_SET_BANDWIDTH(vadModeNoVoiceBandwidth));
-							}
-						}
-						wasVadMode=true;
-					}else if(wasVadMode){
-						wasVadMode=false;
-						opus_encoder_ctl(enc, OPUS_SET_BITRATE(currentBitrate));
-						opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(secondaryEncoderEnabled ? secondaryEnabledBandwidth : OPUS_AUTO));
-						if(secondaryEncoder){
-							opus_encoder_ctl(secondaryEncoder, OPUS_SET_BITRATE(currentBitrate));
-							opus_encoder_ctl(secondaryEncoder, OPUS_SET_BANDWIDTH(secondaryEnabledBandwidth));
-						}
+		}
+	}
+	bool promptPlaying=prompt!=NULL;
+	if(packetsPerFrame==1){
+		if(promptPlaying && ProcessPromptFrame(packet, packetSize, skipProcessing)){
+			// sent pre-encoded
+		}else if(skipProcessing && !promptPlaying){
+			SendSilence(packet, packetSize);
+		}else{
+			Encode(packet, packetSize);
+		}
+	}else{
+		memcpy(frame+(packetSize*bufferedCount), packet, packetSize*2);
+		frameHasVoice=frameHasVoice || hasVoice;
+		frameIsSilent=frameIsSilent && skipProcessing;
+		bufferedCount++;
+		if(bufferedCount==packetsPerFrame && promptPlaying && ProcessPromptFrame(frame, packetSize*packetsPerFrame, frameIsSilent)){
+			bufferedCount=0;
+			frameHasVoice=false;
+		}else if(bufferedCount==packetsPerFrame && frameIsSilent && !promptPlaying){
+			SendSilence(frame, packetSize*packetsPerFrame);
+			bufferedCount=0;
+			frameHasVoice=false;
+		}else if(bufferedCount==packetsPerFrame){
+			if(vadMode){
+				if(frameHasVoice){
+					opus_encoder_ctl(enc, OPUS_SET_BITRATE(currentBitrate));
+					opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(vadModeVoiceBandwidth));
+					if(secondaryEncoder){
+						opus_encoder_ctl(secondaryEncoder, OPUS_SET_BITRATE(currentBitrate));
+						opus_encoder_ctl(secondaryEncoder, OPUS_SET_BANDWIDTH(vadModeVoiceBandwidth));
 					}
-					Encode(frame, 960*packetsPerFrame);
-					bufferedCount=0;
-					frameHasVoice=false;
+				}else{
+					opus_encoder_ctl(enc, OPUS_SET_BITRATE(vadNoVoiceBitrate));
+					opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(vadModeNoVoiceBandwidth));
+					if(secondaryEncoder){
+						opus_encoder_ctl(secondaryEncoder, OPUS_SET_BITRATE(vadNoVoiceBitrate));
+						opus_encoder_ctl(secondaryEncoder, OPUS_SET_BANDWIDTH(vadModeNoVoiceBandwidth));
+					}
+				}
+				wasVadMode=true;
+			}else if(wasVadMode){
+				wasVadMode=false;
+				opus_encoder_ctl(enc, OPUS_SET_BITRATE(currentBitrate));
+				opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(secondaryEncoderEnabled ? secondaryEnabledBandwidth : OPUS_AUTO));
+				if(secondaryEncoder){
+					opus_encoder_ctl(secondaryEncoder, OPUS_SET_BITRATE(currentBitrate));
+					opus_encoder_ctl(secondaryEncoder, OPUS_SET_BANDWIDTH(secondaryEnabledBandwidth));
 				}
 			}
-			bufferPool.Reuse(reinterpret_cast<unsigned char *>(packet));
+			Encode(frame, packetSize*packetsPerFrame);
+			bufferedCount=0;
+			frameHasVoice=false;
 		}
+		if(bufferedCount==0)
+			frameIsSilent=true;
 	}
-	if(frame)
-		free(frame);
+	CpuGovernor::Client* client=governorClient;
+	if(client)
+		CpuGovernor::GetSharedInstance()->ReportProcessingTime(client, std::chrono::duration<double>(std::chrono::steady_clock::now()-processingStart).count());
+}
+
+void tgvoip::OpusEncoder::PlayPrompt(std::shared_ptr<const audio::EncodedPrompt> prompt){
+	if(prompt->sampleRate!=sampleRate){
+		LOGW("opus_encoder: prompt %s is encoded at %u Hz, can't play it at %u Hz", prompt->path.c_str(), prompt->sampleRate, sampleRate);
+		return;
+	}
+	MutexGuard m(promptMutex);
+	queuedPrompts.push_back(prompt);
+	promptsChanged=true;
+}
+
+void tgvoip::OpusEncoder::ClearPrompts(){
+	MutexGuard m(promptMutex);
+	queuedPrompts.clear();
+	clearPrompt=true;
+	promptsChanged=true;
+}
+
+void tgvoip::OpusEncoder::UpdatePrompt(){
+	// Called at the start of every frame, the lock is only taken when there's something to pick up
+	if(!promptsChanged)
+		return;
+	MutexGuard m(promptMutex);
+	if(clearPrompt){
+		prompt.reset();
+		clearPrompt=false;
+	}
+	if(!prompt && !queuedPrompts.empty()){
+		prompt=queuedPrompts.front();
+		queuedPrompts.pop_front();
+		promptOffset=0;
+		LOGV("opus_encoder: playing prompt %s", prompt->path.c_str());
+	}
+	promptsChanged=!queuedPrompts.empty();
 }
 
+bool tgvoip::OpusEncoder::ProcessPromptFrame(int16_t* data, size_t len, bool inputIsSilent){
+	const int16_t* samples=prompt->samples.data()+promptOffset;
+	size_t count=std::min(len, prompt->samples.size()-promptOffset);
+	bool useSecondary=secondaryEncoderEnabled && secondaryEncoderAllowed && secondaryEncoder;
+	// The pre-encoded packet can only stand in for the whole frame if there's nothing to mix it with, its frames line up
+	// with the stream's and it doesn't take more bandwidth than congestion control currently allows
+	bool sent=false;
+	if(inputIsSilent && running && prompt->frameSize==len && promptOffset%len==0 && prompt->bitrate<=requestedBitrate && !useSecondary){
+		// What's sent is what gets metered and handed to the preprocessed callback
+		memcpy(data, samples, len*sizeof(int16_t));
+		if(levelMeter)
+			levelMeter->Update(data, len);
+		if(preprocessedCallback)
+			preprocessedCallback(data, len);
+		size_t index=promptOffset/len;
+		size_t length=prompt->offsets[index+1]-prompt->offsets[index];
+		memcpy(buffer, &prompt->packets[prompt->offsets[index]], length);
+		InvokeCallback(buffer, length, NULL, 0);
+		promptFrames++;
+		sent=true;
+		// The live input takes over from the prompt's own encoder, so neither this one's nor the echo canceller's
+		// state follows from what was sent
+		encoderStale=true;
+		processingStale=true;
+	}else{
+		for(size_t i=0;i<count;i++){
+			data[i]=(int16_t)std::max(INT16_MIN, std::min(INT16_MAX, (int32_t)data[i]+samples[i]));
+		}
+		mixedPromptFrames++;
+	}
+	promptOffset+=count;
+	if(promptOffset>=prompt->samples.size()){
+		LOGV("opus_encoder: prompt %s finished", prompt->path.c_str());
+		prompt.reset();
+	}
+	return sent;
+}
 
 void tgvoip::OpusEncoder::SetOutputFrameDuration(uint32_t duration){
 	frameDuration=duration;
@@ -236,6 +520,7 @@ int tgvoip::OpusEncoder::GetPacketLoss(){
 }
 
 void tgvoip::OpusEncoder::SetDTX(bool enable){
+	dtx=enable;
 	opus_encoder_ctl(enc, OPUS_SET_DTX(enable ? 1 : 0));
 }
 
@@ -249,6 +534,7 @@ void tgvoip::OpusEncoder::SetCallback(void (*f)(unsigned char *, size_t, unsigne
 }
 
 void tgvoip::OpusEncoder::InvokeCallback(unsigned char *data, size_t length, unsigned char *secondaryData, size_t secondaryLength){
+	encodedFrames.fetch_add(1, std::memory_order_relaxed);
 	callback(data, length, secondaryData, secondaryLength, callbackParam);
 }
 
@@ -256,6 +542,18 @@ void tgvoip::OpusEncoder::SetSecondaryEncoderEnabled(bool enabled){
 	secondaryEncoderEnabled=enabled;
 }
 
+void tgvoip::OpusEncoder::SetComplexityLimit(int limit){
+	complexityLimit=limit;
+}
+
+void tgvoip::OpusEncoder::SetSecondaryEncoderAllowed(bool allowed){
+	secondaryEncoderAllowed=allowed;
+}
+
+void tgvoip::OpusEncoder::SetCpuGovernorClient(CpuGovernor::Client* client){
+	governorClient=client;
+}
+
 void tgvoip::OpusEncoder::SetVadMode(bool vad){
 	vadMode=vad;
 }
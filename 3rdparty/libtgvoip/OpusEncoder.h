@@ -14,7 +14,14 @@
 #include "Buffers.h"
 #include "EchoCanceller.h"
 #include "utils.h"
+#include "CpuGovernor.h"
+#include "audio/OpusPromptCache.h"
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
 #include <stdint.h>
 
 struct OpusEncoder;
@@ -23,10 +30,18 @@ namespace tgvoip{
 class OpusEncoder{
 public:
 	TGVOIP_DISALLOW_COPY_AND_ASSIGN(OpusEncoder);
-	OpusEncoder(MediaStreamItf* source, bool needSecondary);
+	/**
+	 * @param sampleRate rate of the audio coming from source: 8000, 12000, 16000, 24000 or 48000. Source packets are 20 ms long.
+	 */
+	OpusEncoder(MediaStreamItf* source, bool needSecondary, unsigned int sampleRate=48000);
 	virtual ~OpusEncoder();
 	virtual void Start();
 	virtual void Stop();
+	/**
+	 * Encode on the thread that delivers the input, e.g. a CallHost worker, instead of a dedicated thread.
+	 * Must be called before Start().
+	 */
+	void SetSynchronous(bool synchronous);
 	void SetBitrate(uint32_t bitrate);
 	void SetEchoCanceller(EchoCanceller* aec);
 	void SetOutputFrameDuration(uint32_t duration);
@@ -41,14 +56,76 @@ public:
 	void AddAudioEffect(effects::AudioEffect* effect);
 	void RemoveAudioEffect(effects::AudioEffect* effect);
 	int GetComplexity(){
-		return complexity;
+		return std::min(complexity, complexityLimit.load());
+	}
+	/**
+	 * Cap the Opus complexity, on top of the automatic reduction when the encoder can't keep up
+	 */
+	void SetComplexityLimit(int limit);
+	/**
+	 * Lets the secondary encoder be turned off regardless of SetSecondaryEncoderEnabled
+	 */
+	void SetSecondaryEncoderAllowed(bool allowed);
+	/**
+	 * Report the time spent on each packet to a CpuGovernor client
+	 */
+	void SetCpuGovernorClient(CpuGovernor::Client* client);
+	/**
+	 * @return frames that were sent as a cached silent packet instead of being processed and encoded
+	 */
+	uint64_t GetSilentFrameCount(){
+		return silentFrames;
+	}
+	/**
+	 * Receives every frame right before it's encoded, after echo cancellation and the audio effects, at the
+	 * source sample rate. Must be set before Start().
+	 */
+	void SetPreprocessedCallback(std::function<void(int16_t*, size_t)> callback);
+	/**
+	 * Queue a pre-encoded prompt to be played after the ones already queued. While the input is silent, the prompt's
+	 * packets are sent as they are, without echo cancellation, effects or encoding. When the input isn't silent, or the
+	 * prompt doesn't fit the stream's frame duration, its current bitrate or extra EC, the prompt's samples are mixed
+	 * into the input and encoded live instead. The prompt must be at the source sample rate.
+	 */
+	void PlayPrompt(std::shared_ptr<const audio::EncodedPrompt> prompt);
+	/**
+	 * Stop the prompt that's playing and drop the queued ones
+	 */
+	void ClearPrompts();
+	/**
+	 * @return prompt frames that were sent pre-encoded
+	 */
+	uint64_t GetPromptFrameCount(){
+		return promptFrames;
+	}
+	/**
+	 * @return prompt frames that had to be mixed with the input and encoded live
+	 */
+	uint64_t GetMixedPromptFrameCount(){
+		return mixedPromptFrames;
+	}
+	/**
+	 * @return frames sent to the callback, encoded or not
+	 */
+	uint64_t GetEncodedFrameCount(){
+		return encodedFrames;
+	}
+	/**
+	 * @return input packets waiting for the encoder thread
+	 */
+	unsigned int GetQueuedPacketCount(){
+		return queuedPackets;
 	}
 
 private:
 	static size_t Callback(unsigned char* data, size_t len, void* param);
 	void RunThread();
+	void ProcessPacket(int16_t* packet);
 	void Encode(int16_t* data, size_t len);
+	void SendSilence(int16_t* data, size_t len);
 	void InvokeCallback(unsigned char* data, size_t length, unsigned char* secondaryData, size_t secondaryLength);
+	void UpdatePrompt();
+	bool ProcessPromptFrame(int16_t* data, size_t len, bool inputIsSilent);
 	MediaStreamItf* source;
 	::OpusEncoder* enc;
 	::OpusEncoder* secondaryEncoder;
@@ -62,6 +139,8 @@ private:
 	int complexity;
 	bool running;
 	uint32_t frameDuration;
+	unsigned int sampleRate;
+	size_t packetSize; // samples in one 20 ms packet from the source
 	int packetLossPercent;
 	AudioLevelMeter* levelMeter;
 	bool secondaryEncoderEnabled;
@@ -72,10 +151,45 @@ private:
 	int vadModeVoiceBandwidth;
 	int vadModeNoVoiceBandwidth;
 
+	bool synchronous=false;
+	// Only accessed by whichever thread runs ProcessPacket
+	uint32_t packetsPerFrame=1;
+	uint32_t bufferedCount=0;
+	int16_t* frame=NULL;
+	bool frameHasVoice=false;
+	bool frameIsSilent=true;
+	bool wasVadMode=false;
+	uint32_t silentPackets=0;
+	// Cached packets sent instead of encoding the current silent stretch, NULL while the encoders run
+	const std::vector<unsigned char>* silentPacket=NULL;
+	const std::vector<unsigned char>* secondarySilentPacket=NULL;
+	// Cached or pre-encoded packets were sent since the encoders or the echo canceller last ran
+	bool encoderStale=false;
+	bool processingStale=false;
+
 	bool wasSecondaryEncoderEnabled=false;
+	std::atomic<int> complexityLimit{10};
+	int appliedComplexity=10;
+	std::atomic<bool> secondaryEncoderAllowed{true};
+	std::atomic<CpuGovernor::Client*> governorClient{NULL};
+	bool dtx=false;
+	std::atomic<uint64_t> silentFrames{0};
+	std::atomic<uint64_t> encodedFrames{0};
+	std::atomic<unsigned int> queuedPackets{0};
+
+	Mutex promptMutex;
+	std::deque<std::shared_ptr<const audio::EncodedPrompt>> queuedPrompts;
+	bool clearPrompt=false;
+	std::atomic<bool> promptsChanged{false};
+	// Only accessed by the encoder thread
+	std::shared_ptr<const audio::EncodedPrompt> prompt;
+	size_t promptOffset=0;
+	std::atomic<uint64_t> promptFrames{0};
+	std::atomic<uint64_t> mixedPromptFrames{0};
 
 	void (*callback)(unsigned char*, size_t, unsigned char*, size_t, void*);
 	void* callbackParam;
+	std::function<void(int16_t*, size_t)> preprocessedCallback;
 };
 }
 
@@ -0,0 +1,184 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "OpusStreamRecorder.h"
+#include "VoIPController.h"
+#include "logging.h"
+#if defined HAVE_CONFIG_H || defined TGVOIP_USE_INSTALLED_OPUS
+#include <opus/opus.h>
+#else
+#include "opus.h"
+#endif
+
+using namespace tgvoip;
+
+// About 2.5 seconds of 20 ms frames
+#define RING_SLOTS 128
+#define DRAIN_INTERVAL std::chrono::milliseconds(50)
+// Frames are held back for this long (in stream time) so that ones that arrive out of order can be put in their place
+#define REORDER_WINDOW_MS 200
+// A larger jump in timestamps means the peer restarted its stream, it's recorded without filling the gap
+#define MAX_GAP_MS 60000
+// The lookahead of libopus at 48 kHz, which is what the peer's encoder runs at
+#define PRE_SKIP 312
+
+OpusStreamRecorder* OpusStreamRecorder::Create(VoIPController* controller, const std::string& path){
+	FILE* file=fopen(path.c_str(), "wb");
+	if(!file){
+		LOGE("Can't open %s for writing: %s", path.c_str(), strerror(errno));
+		return NULL;
+	}
+	return new OpusStreamRecorder(controller, file);
+}
+
+OpusStreamRecorder::OpusStreamRecorder(VoIPController* controller, FILE* file) : controller(controller), file(file), slots(RING_SLOTS){
+	uint32_t serial=(uint32_t)std::chrono::steady_clock::now().time_since_epoch().count();
+	ogg.reset(new audio::OggWriter(serial, [this](const unsigned char* data, size_t length){
+		WriteFile(data, length);
+	}));
+	audio::OpusHead head;
+	head.preSkip=PRE_SKIP;
+	ogg->WriteOpusHeaders(head);
+
+	thread=new Thread(std::bind(&OpusStreamRecorder::RunThread, this));
+	thread->SetName("OpusStreamRecorder");
+	thread->Start();
+	tapID=controller->AddIncomingAudioTap([this](const unsigned char* data, size_t length, uint32_t pts){
+		HandlePacket(data, length, pts);
+	});
+}
+
+OpusStreamRecorder::~OpusStreamRecorder(){
+	Close();
+}
+
+void OpusStreamRecorder::Close(){
+	if(closed)
+		return;
+	closed=true;
+	controller->RemoveIncomingAudioTap(tapID);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running=false;
+	}
+	cond.notify_all();
+	thread->Join();
+	delete thread;
+	ogg->Finish();
+	fclose(file);
+}
+
+OpusStreamRecorder::Stats OpusStreamRecorder::GetStats() const{
+	return Stats{packetsWritten, lostFrames, latePackets, packetsDropped, bytesWritten, writeErrors};
+}
+
+void OpusStreamRecorder::HandlePacket(const unsigned char* data, size_t length, uint32_t pts){
+	size_t w=writeIndex.load(std::memory_order_relaxed);
+	if(length==0 || length>sizeof(Slot::data) || w-readIndex.load(std::memory_order_acquire)>=slots.size()){
+		packetsDropped++;
+		return;
+	}
+	Slot& slot=slots[w%slots.size()];
+	slot.pts=pts;
+	slot.length=length;
+	memcpy(slot.data, data, length);
+	writeIndex.store(w+1, std::memory_order_release);
+}
+
+void OpusStreamRecorder::RunThread(){
+	bool stop=false;
+	while(!stop){
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait_for(lock, DRAIN_INTERVAL, [this]{ return !running; });
+			stop=!running;
+		}
+		Drain(stop);
+	}
+}
+
+void OpusStreamRecorder::Drain(bool flush){
+	size_t r=readIndex.load(std::memory_order_relaxed);
+	size_t w=writeIndex.load(std::memory_order_acquire);
+	for(;r!=w;r++){
+		const Slot& slot=slots[r%slots.size()];
+		Packet packet{slot.pts, std::vector<unsigned char>(slot.data, slot.data+slot.length)};
+		readIndex.store(r+1, std::memory_order_release);
+
+		// Frames almost always arrive in order, so the place for this one is found from the back
+		if(!reorderQueue.empty() && std::abs((int32_t)(packet.pts-reorderQueue.back().pts))>MAX_GAP_MS){
+			while(!reorderQueue.empty()){
+				Mux(reorderQueue.front());
+				reorderQueue.pop_front();
+			}
+		}
+		std::deque<Packet>::iterator pos=reorderQueue.end();
+		while(pos!=reorderQueue.begin() && (int32_t)(packet.pts-(pos-1)->pts)<0){
+			--pos;
+		}
+		if(pos!=reorderQueue.begin() && (pos-1)->pts==packet.pts){
+			latePackets++;
+			continue;
+		}
+		reorderQueue.insert(pos, std::move(packet));
+	}
+	while(!reorderQueue.empty() && (flush || (int32_t)(reorderQueue.back().pts-reorderQueue.front().pts)>REORDER_WINDOW_MS)){
+		Mux(reorderQueue.front());
+		reorderQueue.pop_front();
+	}
+}
+
+void OpusStreamRecorder::Mux(const Packet& packet){
+	int samples=opus_packet_get_nb_samples(packet.data.data(), (opus_int32)packet.data.size(), 48000);
+	if(samples<=0){
+		packetsDropped++;
+		return;
+	}
+	if(haveTimeline){
+		int32_t gap=(int32_t)(packet.pts-nextPts);
+		if(gap<0 && gap>-MAX_GAP_MS){
+			latePackets++;
+			return;
+		}
+		if(gap>0 && gap<=MAX_GAP_MS){
+			// A packet with just the TOC byte holds a single empty frame, decoders treat it as lost and conceal it.
+			// Keeping the TOC of the last packet keeps the mode and bandwidth, so the concealment matches.
+			unsigned char marker=(unsigned char)(lastToc & 0xFC);
+			int frameSamples=opus_packet_get_samples_per_frame(&marker, 48000);
+			int64_t count=((int64_t)gap*48+frameSamples/2)/frameSamples;
+			for(int64_t i=0;i<count;i++){
+				granule+=frameSamples;
+				ogg->WritePacket(&marker, 1, granule);
+			}
+			lostFrames+=(uint64_t)count;
+		}else if(gap!=0){
+			LOGW("OpusStreamRecorder: timestamps jumped by %d ms, not filling the gap", gap);
+		}
+	}
+	granule+=samples;
+	ogg->WritePacket(packet.data.data(), packet.data.size(), granule);
+	packetsWritten++;
+	haveTimeline=true;
+	nextPts=packet.pts+(uint32_t)(samples/48);
+	lastToc=packet.data[0];
+}
+
+void OpusStreamRecorder::WriteFile(const unsigned char* data, size_t length){
+	if(fwrite(data, 1, length, file)!=length){
+		if(writeErrors==0){
+			LOGE("Error writing recording: %s", strerror(errno));
+		}
+		writeErrors++;
+		clearerr(file);
+		return;
+	}
+	bytesWritten+=length;
+}
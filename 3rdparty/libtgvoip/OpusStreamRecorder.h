@@ -0,0 +1,111 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_OPUSSTREAMRECORDER_H
+#define LIBTGVOIP_OPUSSTREAMRECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "audio/OggOpus.h"
+#include "threading.h"
+#include "utils.h"
+
+namespace tgvoip{
+
+	class VoIPController;
+
+	/**
+	 * Records the audio a call receives into an Ogg/Opus file without decoding it. Opus frames are taken from the
+	 * controller's incoming audio tap, before the jitter buffer, and muxed as they are. Frames that never arrived are
+	 * replaced with empty packets of the same duration, which decoders conceal like any other loss, so the file stays in
+	 * sync with the call. Works the same whether the call decodes its audio, is send-only or is bridged.
+	 * The tap only copies the frame into a lock-free ring; reordering and writing the file happen on a background thread.
+	 * The controller must outlive the recorder.
+	 */
+	class OpusStreamRecorder{
+	public:
+		struct Stats{
+			uint64_t packetsWritten;
+			uint64_t lostFrames;      // replaced with empty packets
+			uint64_t latePackets;     // arrived after their place in the file was written, or duplicates
+			uint64_t packetsDropped;  // because the writer fell behind or the packet was invalid
+			uint64_t bytesWritten;
+			uint64_t writeErrors;
+		};
+
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(OpusStreamRecorder);
+		/**
+		 * Starts recording right away
+		 * @return NULL if the file can't be created
+		 */
+		static OpusStreamRecorder* Create(VoIPController* controller, const std::string& path);
+		/**
+		 * Closes the file if Close() wasn't called
+		 */
+		~OpusStreamRecorder();
+		/**
+		 * Stops recording, writes out everything that was received and closes the file
+		 */
+		void Close();
+		Stats GetStats() const;
+
+	private:
+		struct Slot{
+			uint32_t pts;
+			size_t length;
+			unsigned char data[2048];
+		};
+		struct Packet{
+			uint32_t pts;
+			std::vector<unsigned char> data;
+		};
+
+		OpusStreamRecorder(VoIPController* controller, FILE* file);
+		void HandlePacket(const unsigned char* data, size_t length, uint32_t pts);
+		void RunThread();
+		void Drain(bool flush);
+		void Mux(const Packet& packet);
+		void WriteFile(const unsigned char* data, size_t length);
+
+		VoIPController* controller;
+		uint32_t tapID=0;
+		FILE* file;
+		Thread* thread=NULL;
+		bool closed=false;
+		std::mutex mutex;
+		std::condition_variable cond;
+		bool running=true;
+
+		std::vector<Slot> slots;
+		std::atomic<size_t> writeIndex{0};
+		std::atomic<size_t> readIndex{0};
+
+		// Only accessed by the writer thread
+		std::deque<Packet> reorderQueue;  // sorted by pts
+		std::unique_ptr<audio::OggWriter> ogg;
+		bool haveTimeline=false;
+		uint32_t nextPts=0;
+		unsigned char lastToc=0;
+		int64_t granule=0;
+
+		std::atomic<uint64_t> packetsWritten{0};
+		std::atomic<uint64_t> lostFrames{0};
+		std::atomic<uint64_t> latePackets{0};
+		std::atomic<uint64_t> packetsDropped{0};
+		std::atomic<uint64_t> bytesWritten{0};
+		std::atomic<uint64_t> writeErrors{0};
+	};
+}
+
+#endif //LIBTGVOIP_OPUSSTREAMRECORDER_H
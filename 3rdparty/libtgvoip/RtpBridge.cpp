@@ -0,0 +1,654 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "RtpBridge.h"
+#include "VoIPController.h"
+#include "Clock.h"
+#include "logging.h"
+#if defined HAVE_CONFIG_H || defined TGVOIP_USE_INSTALLED_OPUS
+#include <opus/opus.h>
+#else
+#include "opus.h"
+#endif
+
+using namespace tgvoip;
+
+#define RTP_HEADER_SIZE 12
+#define MAX_PACKET_SIZE 4096
+// 120 ms at 48 kHz, the longest Opus packet
+#define MAX_DECODED_SAMPLES 5760
+// Keeps G.711 and L16 packets below the usual MTU
+#define MAX_PCM_PAYLOAD 1400
+// The peer is considered gone (or in a silence period) after this long without packets, playout stops until it's back
+#define UNDERRUN_TIMEOUT 0.5
+// Larger gaps in the call's audio aren't concealed, the RTP timestamps just jump ahead
+#define MAX_EGRESS_GAP_MS 1000
+// Timestamp jumps larger than this mean the peer restarted its stream
+#define MAX_TIMESTAMP_JUMP_S 10
+
+namespace{
+	// G.711 conversions as in the CCITT reference implementation
+	const int16_t segmentEndsA[8]={0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+	const int16_t segmentEndsU[8]={0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+
+	int FindSegment(int value, const int16_t* ends){
+		for(int i=0;i<8;i++){
+			if(value<=ends[i])
+				return i;
+		}
+		return 8;
+	}
+
+	unsigned char LinearToAlaw(int16_t sample){
+		int value=sample >> 3;
+		int mask;
+		if(value>=0){
+			mask=0xD5;
+		}else{
+			mask=0x55;
+			value=-value-1;
+		}
+		int segment=FindSegment(value, segmentEndsA);
+		if(segment>=8)
+			return (unsigned char)(0x7F ^ mask);
+		int alaw=segment << 4;
+		alaw|=segment<2 ? (value >> 1) & 0x0F : (value >> segment) & 0x0F;
+		return (unsigned char)(alaw ^ mask);
+	}
+
+	int16_t AlawToLinear(unsigned char alaw){
+		alaw^=0x55;
+		int value=(alaw & 0x0F) << 4;
+		int segment=(alaw & 0x70) >> 4;
+		switch(segment){
+			case 0:
+				value+=8;
+				break;
+			case 1:
+				value+=0x108;
+				break;
+			default:
+				value+=0x108;
+				value<<=segment-1;
+		}
+		return (int16_t)((alaw & 0x80) ? value : -value);
+	}
+
+	unsigned char LinearToUlaw(int16_t sample){
+		const int bias=0x84;
+		int value=sample >> 2;
+		int mask;
+		if(value<0){
+			value=-value;
+			mask=0x7F;
+		}else{
+			mask=0xFF;
+		}
+		value=std::min(value, 8159)+(bias >> 2);
+		int segment=FindSegment(value, segmentEndsU);
+		if(segment>=8)
+			return (unsigned char)(0x7F ^ mask);
+		int ulaw=(segment << 4) | ((value >> (segment+1)) & 0x0F);
+		return (unsigned char)(ulaw ^ mask);
+	}
+
+	int16_t UlawToLinear(unsigned char ulaw){
+		const int bias=0x84;
+		ulaw=(unsigned char)~ulaw;
+		int value=(((ulaw & 0x0F) << 3)+bias) << ((ulaw & 0x70) >> 4);
+		return (int16_t)((ulaw & 0x80) ? (bias-value) : (value-bias));
+	}
+
+	uint32_t RandomValue(){
+		return (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count()*2654435761U;
+	}
+}
+
+RtpBridge* RtpBridge::Create(VoIPController* controller, const Config& config){
+#ifndef _WIN32
+	unsigned int clockRate;
+	int defaultPayloadType;
+	switch(config.codec){
+		case CODEC_OPUS:
+			clockRate=48000;
+			defaultPayloadType=111;
+			break;
+		case CODEC_PCMU:
+			clockRate=8000;
+			defaultPayloadType=0;
+			break;
+		case CODEC_PCMA:
+			clockRate=8000;
+			defaultPayloadType=8;
+			break;
+		case CODEC_L16:
+			clockRate=config.sampleRate;
+			defaultPayloadType=96;
+			if(clockRate!=8000 && clockRate!=12000 && clockRate!=16000 && clockRate!=24000 && clockRate!=48000){
+				LOGE("RtpBridge: unsupported L16 sample rate %u", clockRate);
+				return NULL;
+			}
+			break;
+		default:
+			LOGE("RtpBridge: unknown codec %d", (int)config.codec);
+			return NULL;
+	}
+	int payloadType=config.payloadType<0 ? defaultPayloadType : config.payloadType;
+	if(payloadType>127){
+		LOGE("RtpBridge: invalid payload type %d", payloadType);
+		return NULL;
+	}
+	size_t bytesPerSample=config.codec==CODEC_L16 ? 2 : 1;
+	if(config.codec!=CODEC_OPUS && (config.packetDuration==0 || clockRate*config.packetDuration/1000*bytesPerSample>MAX_PCM_PAYLOAD)){
+		LOGE("RtpBridge: invalid packet duration %u ms", config.packetDuration);
+		return NULL;
+	}
+	if(config.jitterDelay>1000){
+		LOGE("RtpBridge: jitter delay of %u ms is too long", config.jitterDelay);
+		return NULL;
+	}
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype=SOCK_DGRAM;
+	hints.ai_flags=AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+	struct addrinfo* local=NULL;
+	std::string port=std::to_string(config.localPort);
+	if(getaddrinfo(config.localAddress.empty() ? NULL : config.localAddress.c_str(), port.c_str(), &hints, &local)!=0 || !local){
+		LOGE("RtpBridge: invalid local address %s", config.localAddress.c_str());
+		return NULL;
+	}
+	std::vector<unsigned char> remote;
+	if(!config.remoteAddress.empty()){
+		struct addrinfo* res=NULL;
+		hints.ai_flags=AI_NUMERICHOST | AI_NUMERICSERV;
+		hints.ai_family=local->ai_family;
+		port=std::to_string(config.remotePort);
+		if(getaddrinfo(config.remoteAddress.c_str(), port.c_str(), &hints, &res)!=0 || !res){
+			LOGE("RtpBridge: invalid remote address %s", config.remoteAddress.c_str());
+			freeaddrinfo(local);
+			return NULL;
+		}
+		remote.assign(reinterpret_cast<unsigned char*>(res->ai_addr), reinterpret_cast<unsigned char*>(res->ai_addr)+res->ai_addrlen);
+		freeaddrinfo(res);
+	}
+
+	int fd=socket(local->ai_family, SOCK_DGRAM, 0);
+	if(fd<0 || bind(fd, local->ai_addr, local->ai_addrlen)!=0){
+		LOGE("RtpBridge: can't bind to %s:%u: %s", config.localAddress.c_str(), (unsigned int)config.localPort, strerror(errno));
+		if(fd>=0)
+			close(fd);
+		freeaddrinfo(local);
+		return NULL;
+	}
+	freeaddrinfo(local);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	RtpBridge* bridge=new RtpBridge(controller, config, fd, clockRate);
+	bridge->payloadType=(uint8_t)payloadType;
+	bridge->remoteAddress=remote;
+	bridge->remoteFixed=!remote.empty();
+	struct sockaddr_storage addr;
+	socklen_t addrLen=sizeof(addr);
+	if(getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &addrLen)==0){
+		if(addr.ss_family==AF_INET6)
+			bridge->localPort=ntohs(reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port);
+		else
+			bridge->localPort=ntohs(reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+	}
+	if(!controller->ClaimExternalAudioSource(bridge)){
+		LOGW("RtpBridge: the call's outgoing audio is already fed by something else");
+		bridge->closed=true;
+		close(fd);
+		delete bridge;
+		return NULL;
+	}
+	LOGI("RtpBridge: exchanging audio on port %u, payload type %d at %u Hz", (unsigned int)bridge->localPort, payloadType, clockRate);
+
+	controller->SetExternalAudioSource(true);
+	controller->SetAudioDecodingEnabled(false);
+	bridge->thread=new Thread(std::bind(&RtpBridge::RunThread, bridge));
+	bridge->thread->SetName("RtpBridge");
+	bridge->thread->Start();
+	bridge->tapID=controller->AddIncomingAudioTap([bridge](const unsigned char* data, size_t length, uint32_t pts){
+		bridge->HandleCallFrame(data, length, pts);
+	});
+	return bridge;
+#else
+	LOGE("RtpBridge isn't supported on Windows");
+	return NULL;
+#endif
+}
+
+RtpBridge::RtpBridge(VoIPController* controller, const Config& config, int fd, unsigned int clockRate) : controller(controller), config(config),
+		fd(fd), clockRate(clockRate){
+	ssrc=RandomValue();
+	sequence=(uint16_t)RandomValue();
+	timestampBase=RandomValue();
+	egressTimestamp=timestampBase;
+	// The call's audio only has to be decoded when it's sent to the peer in another codec
+	if(config.codec!=CODEC_OPUS)
+		egressDecoder=opus_decoder_create((opus_int32)clockRate, 1, NULL);
+	if(config.codec==CODEC_OPUS){
+		ingressDecoder=opus_decoder_create(48000, 1, NULL);
+		repacketizer=opus_repacketizer_create();
+	}
+	encoder=opus_encoder_create((opus_int32)clockRate, 1, OPUS_APPLICATION_VOIP, NULL);
+	opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(10));
+	opus_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(1));
+	opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(1));
+	opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+}
+
+RtpBridge::~RtpBridge(){
+	Close();
+	if(egressDecoder)
+		opus_decoder_destroy(egressDecoder);
+	if(ingressDecoder)
+		opus_decoder_destroy(ingressDecoder);
+	if(repacketizer)
+		opus_repacketizer_destroy(repacketizer);
+	if(encoder)
+		opus_encoder_destroy(encoder);
+}
+
+void RtpBridge::Close(){
+	if(closed)
+		return;
+	closed=true;
+#ifndef _WIN32
+	controller->RemoveIncomingAudioTap(tapID);
+	running=false;
+	thread->Join();
+	delete thread;
+	controller->SetAudioDecodingEnabled(true);
+	controller->SetExternalAudioSource(false);
+	controller->ReleaseExternalAudioSource(this);
+	close(fd);
+	LOGI("RtpBridge: closed, sent %llu and received %llu packets", (unsigned long long)packetsSent.load(), (unsigned long long)packetsReceived.load());
+#endif
+}
+
+RtpBridge::Stats RtpBridge::GetStats() const{
+	return Stats{packetsSent, packetsReceived, packetsLate, packetsDropped, framesPassedThrough, framesTranscoded,
+		concealedSamples*1000/clockRate};
+}
+
+void RtpBridge::RunThread(){
+#ifndef _WIN32
+	double nextTick=VoIPController::GetCurrentTime();
+	while(running){
+		double now=VoIPController::GetCurrentTime();
+		if(now>=nextTick){
+			PlayOut();
+			nextTick+=controller->GetOutgoingAudioFrameDuration()/1000.0;
+			if(nextTick<now-0.1){
+				// Fell too far behind (e.g. the process was suspended), don't try to catch up
+				nextTick=now;
+			}
+			continue;
+		}
+		// Wake up at least every 20 ms to notice Close()
+		struct pollfd pfd={fd, POLLIN, 0};
+		int timeout=(int)ceil(Clock::ToRealDuration(std::min(nextTick-now, 0.02))*1000.0);
+		if(poll(&pfd, 1, timeout)>0)
+			ReceivePackets();
+	}
+#endif
+}
+
+void RtpBridge::ReceivePackets(){
+#ifndef _WIN32
+	unsigned char buffer[MAX_PACKET_SIZE];
+	while(true){
+		struct sockaddr_storage from;
+		socklen_t fromLength=sizeof(from);
+		ssize_t length=recvfrom(fd, buffer, sizeof(buffer), 0, reinterpret_cast<struct sockaddr*>(&from), &fromLength);
+		if(length<0)
+			break;
+		HandlePacket(buffer, (size_t)length, &from, fromLength);
+	}
+#endif
+}
+
+void RtpBridge::HandlePacket(const unsigned char* data, size_t length, const void* from, size_t fromLength){
+	if(length<RTP_HEADER_SIZE || (data[0] >> 6)!=2){
+		packetsDropped++;
+		return;
+	}
+	size_t offset=RTP_HEADER_SIZE+4*(data[0] & 0x0F);
+	if((data[0] & 0x10) && offset+4<=length)
+		offset+=4+4*(size_t)((data[offset+2] << 8) | data[offset+3]);
+	if((data[0] & 0x20) && length>offset)
+		length-=std::min((size_t)data[length-1], length-offset);
+	// RTCP sent to the same port ends up here too, its packet types don't match any payload type
+	if(offset>=length || (data[1] & 0x7F)!=payloadType){
+		packetsDropped++;
+		return;
+	}
+	uint32_t timestamp=((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | data[7];
+	uint32_t packetSsrc=((uint32_t)data[8] << 24) | ((uint32_t)data[9] << 16) | ((uint32_t)data[10] << 8) | data[11];
+	const unsigned char* payload=data+offset;
+	size_t payloadLength=length-offset;
+	packetsReceived++;
+
+	if(!remoteFixed){
+		// Symmetric RTP: reply to wherever the peer sends from
+		MutexGuard m(remoteMutex);
+		const unsigned char* addr=reinterpret_cast<const unsigned char*>(from);
+		if(remoteAddress.size()!=fromLength || memcmp(remoteAddress.data(), addr, fromLength)!=0){
+			if(remoteAddress.empty()){
+				LOGI("RtpBridge: peer found");
+			}
+			remoteAddress.assign(addr, addr+fromLength);
+		}
+	}
+
+	Unit unit;
+	if(config.codec==CODEC_OPUS){
+		unit.samples=opus_packet_get_nb_samples(payload, (opus_int32)payloadLength, 48000);
+		unit.payload.assign(payload, payload+payloadLength);
+	}else if(config.codec==CODEC_L16){
+		unit.samples=(int)(payloadLength/2);
+		unit.pcm.resize((size_t)unit.samples);
+		for(int i=0;i<unit.samples;i++){
+			unit.pcm[i]=(int16_t)((payload[i*2] << 8) | payload[i*2+1]);
+		}
+	}else{
+		unit.samples=(int)payloadLength;
+		unit.pcm.resize(payloadLength);
+		for(size_t i=0;i<payloadLength;i++){
+			unit.pcm[i]=config.codec==CODEC_PCMU ? UlawToLinear(payload[i]) : AlawToLinear(payload[i]);
+		}
+	}
+	if(unit.samples<=0){
+		packetsDropped++;
+		return;
+	}
+
+	int64_t extTimestamp=lastExtTimestamp+(int32_t)(timestamp-lastTimestamp);
+	int64_t nextTimestamp=playoutTimestamp+(int64_t)ingressPcm.size();
+	bool restarted=haveSource && (packetSsrc!=sourceSsrc || std::abs(extTimestamp-lastExtTimestamp)>(int64_t)clockRate*MAX_TIMESTAMP_JUMP_S);
+	if(!haveSource || restarted){
+		if(restarted){
+			LOGI("RtpBridge: the peer restarted its stream");
+		}
+		haveSource=true;
+		sourceSsrc=packetSsrc;
+		extTimestamp=timestamp;
+		jitterBuffer.clear();
+		ingressPcm.clear();
+		playing=false;
+		primeTime=0;
+	}else if(playing && extTimestamp<nextTimestamp){
+		packetsLate++;
+		return;
+	}
+	lastTimestamp=timestamp;
+	lastExtTimestamp=extTimestamp;
+	lastPacketTime=VoIPController::GetCurrentTime();
+	if(!playing && primeTime==0)
+		primeTime=lastPacketTime;
+	if(!jitterBuffer.insert(std::make_pair(extTimestamp, std::move(unit))).second)
+		packetsLate++; // duplicate
+}
+
+void RtpBridge::PlayOut(){
+	uint16_t duration=controller->GetOutgoingAudioFrameDuration();
+	size_t frameSamples=clockRate*duration/1000;
+	if(frameSamples==0)
+		return;
+	double now=VoIPController::GetCurrentTime();
+	if(!playing){
+		if(jitterBuffer.empty() || now-primeTime<config.jitterDelay/1000.0)
+			return;
+		playing=true;
+		playoutTimestamp=jitterBuffer.begin()->first;
+		ingressPcm.clear();
+	}
+
+	// Skip ahead when much more than the delay is buffered, because of a burst or because the peer's clock is faster
+	if(!jitterBuffer.empty()){
+		std::map<int64_t, Unit>::iterator last=std::prev(jitterBuffer.end());
+		int64_t end=last->first+last->second.samples;
+		int64_t delay=(int64_t)clockRate*config.jitterDelay/1000;
+		if(end-(playoutTimestamp+(int64_t)ingressPcm.size())>delay*2+(int64_t)frameSamples){
+			while(jitterBuffer.size()>1 && end-jitterBuffer.begin()->first>delay){
+				jitterBuffer.erase(jitterBuffer.begin());
+				packetsDropped++;
+			}
+			ingressPcm.clear();
+			playoutTimestamp=jitterBuffer.begin()->first;
+		}
+	}
+
+	if(config.codec==CODEC_OPUS && ingressPcm.empty() && PassThrough(frameSamples)){
+		passingThrough=true;
+		return;
+	}
+	if(passingThrough){
+		// Neither the decoder nor the encoder saw the frames that were passed through. Concealing or predicting from
+		// what they saw before would glitch, start them over instead
+		passingThrough=false;
+		opus_decoder_ctl(ingressDecoder, OPUS_RESET_STATE);
+		opus_encoder_ctl(encoder, OPUS_RESET_STATE);
+	}
+
+	unsigned char buffer[MAX_PACKET_SIZE];
+	int16_t decoded[MAX_DECODED_SAMPLES];
+	while(ingressPcm.size()<frameSamples){
+		int64_t next=playoutTimestamp+(int64_t)ingressPcm.size();
+		while(!jitterBuffer.empty() && jitterBuffer.begin()->first<next){
+			jitterBuffer.erase(jitterBuffer.begin());
+			packetsLate++;
+		}
+		if(!jitterBuffer.empty() && jitterBuffer.begin()->first==next){
+			Unit& unit=jitterBuffer.begin()->second;
+			if(config.codec==CODEC_OPUS){
+				int n=opus_decode(ingressDecoder, unit.payload.data(), (opus_int32)unit.payload.size(), decoded, MAX_DECODED_SAMPLES, 0);
+				if(n>0){
+					ingressPcm.insert(ingressPcm.end(), decoded, decoded+n);
+					// A packet that decodes to fewer samples than it said leaves a gap that's concealed next time around
+				}
+			}else{
+				ingressPcm.insert(ingressPcm.end(), unit.pcm.begin(), unit.pcm.end());
+			}
+			jitterBuffer.erase(jitterBuffer.begin());
+			continue;
+		}
+		size_t missing=frameSamples-ingressPcm.size();
+		if(!jitterBuffer.empty())
+			missing=std::min(missing, (size_t)(jitterBuffer.begin()->first-next));
+		Conceal(missing);
+	}
+
+	uint32_t bitrate=controller->GetAudioTargetBitrate();
+	if(bitrate!=encoderBitrate){
+		opus_encoder_ctl(encoder, OPUS_SET_BITRATE((opus_int32)bitrate));
+		encoderBitrate=bitrate;
+	}
+	opus_int32 length=opus_encode(encoder, ingressPcm.data(), (int)frameSamples, buffer, sizeof(buffer));
+	if(length>1){
+		controller->SendEncodedAudioFrame(buffer, (size_t)length);
+		framesTranscoded++;
+	}else if(length<0){
+		LOGE("RtpBridge: error encoding: %d", length);
+	}
+	ingressPcm.erase(ingressPcm.begin(), ingressPcm.begin()+frameSamples);
+	playoutTimestamp+=(int64_t)frameSamples;
+
+	if(jitterBuffer.empty() && now-lastPacketTime>UNDERRUN_TIMEOUT){
+		LOGI("RtpBridge: no audio from the peer, waiting for it");
+		playing=false;
+		primeTime=0;
+		ingressPcm.clear();
+	}
+}
+
+bool RtpBridge::PassThrough(size_t frameSamples){
+	// The peer's packets can only be combined as they are if they exactly cover the call's frame, anything else
+	// (loss, reordering past the delay, packets that straddle frames) is decoded and concealed instead
+	opus_repacketizer_init(repacketizer);
+	size_t total=0;
+	std::map<int64_t, Unit>::iterator it=jitterBuffer.begin();
+	for(;it!=jitterBuffer.end() && total<frameSamples;++it){
+		if(it->first!=playoutTimestamp+(int64_t)total)
+			return false;
+		if(opus_repacketizer_cat(repacketizer, it->second.payload.data(), (opus_int32)it->second.payload.size())!=OPUS_OK)
+			return false;
+		total+=(size_t)it->second.samples;
+	}
+	if(total!=frameSamples)
+		return false;
+	unsigned char buffer[MAX_PACKET_SIZE];
+	opus_int32 length=opus_repacketizer_out(repacketizer, buffer, sizeof(buffer));
+	if(length<=0)
+		return false;
+	controller->SendEncodedAudioFrame(buffer, (size_t)length);
+	jitterBuffer.erase(jitterBuffer.begin(), it);
+	playoutTimestamp+=(int64_t)frameSamples;
+	framesPassedThrough++;
+	return true;
+}
+
+void RtpBridge::Conceal(size_t samples){
+	concealedSamples+=samples;
+	if(config.codec!=CODEC_OPUS){
+		ingressPcm.insert(ingressPcm.end(), samples, 0);
+		return;
+	}
+	int16_t decoded[MAX_DECODED_SAMPLES];
+	while(samples>0){
+		// Opus conceals in multiples of 2.5 ms
+		size_t n=std::min((size_t)MAX_DECODED_SAMPLES, (samples+119)/120*120);
+		int r=opus_decode(ingressDecoder, NULL, 0, decoded, (int)n, 0);
+		if(r<=0){
+			memset(decoded, 0, n*sizeof(int16_t));
+			r=(int)n;
+		}
+		size_t used=std::min(samples, (size_t)r);
+		ingressPcm.insert(ingressPcm.end(), decoded, decoded+used);
+		samples-=used;
+	}
+}
+
+void RtpBridge::HandleCallFrame(const unsigned char* data, size_t length, uint32_t pts){
+	MutexGuard m(sendMutex);
+	if(config.codec==CODEC_OPUS){
+		if(opus_packet_get_nb_samples(data, (opus_int32)length, 48000)<=0){
+			packetsDropped++;
+			return;
+		}
+		SendRtp(data, length, timestampBase+pts*48, !sentFirst);
+		return;
+	}
+
+	bool marker=!egressStarted;
+	int16_t decoded[MAX_DECODED_SAMPLES];
+	if(egressStarted){
+		int32_t gap=(int32_t)(pts-egressPts);
+		if(gap<0){
+			packetsLate++;
+			return;
+		}
+		if(gap>MAX_EGRESS_GAP_MS){
+			egressTimestamp+=(uint32_t)((uint64_t)gap*clockRate/1000);
+			marker=true;
+		}else if(gap>0){
+			size_t missing=clockRate*(uint32_t)gap/1000;
+			while(missing>0){
+				int n=opus_decode(egressDecoder, NULL, 0, decoded, (int)std::min(missing, (size_t)MAX_DECODED_SAMPLES), 0);
+				if(n<=0)
+					break;
+				egressPcm.insert(egressPcm.end(), decoded, decoded+n);
+				missing-=std::min(missing, (size_t)n);
+			}
+		}
+	}
+	int n=opus_decode(egressDecoder, data, (opus_int32)length, decoded, MAX_DECODED_SAMPLES, 0);
+	if(n<=0){
+		packetsDropped++;
+		return;
+	}
+	egressPcm.insert(egressPcm.end(), decoded, decoded+n);
+	egressStarted=true;
+	egressPts=pts+(uint32_t)n*1000/clockRate;
+
+	size_t packetSamples=clockRate*config.packetDuration/1000;
+	unsigned char payload[MAX_PCM_PAYLOAD];
+	size_t offset=0;
+	while(egressPcm.size()-offset>=packetSamples){
+		const int16_t* pcm=egressPcm.data()+offset;
+		size_t payloadLength;
+		if(config.codec==CODEC_L16){
+			for(size_t i=0;i<packetSamples;i++){
+				payload[i*2]=(unsigned char)((uint16_t)pcm[i] >> 8);
+				payload[i*2+1]=(unsigned char)pcm[i];
+			}
+			payloadLength=packetSamples*2;
+		}else{
+			for(size_t i=0;i<packetSamples;i++){
+				payload[i]=config.codec==CODEC_PCMU ? LinearToUlaw(pcm[i]) : LinearToAlaw(pcm[i]);
+			}
+			payloadLength=packetSamples;
+		}
+		SendRtp(payload, payloadLength, egressTimestamp, marker);
+		marker=false;
+		egressTimestamp+=(uint32_t)packetSamples;
+		offset+=packetSamples;
+	}
+	egressPcm.erase(egressPcm.begin(), egressPcm.begin()+offset);
+}
+
+void RtpBridge::SendRtp(const unsigned char* payload, size_t length, uint32_t timestamp, bool marker){
+#ifndef _WIN32
+	// sendMutex must be held
+	unsigned char packet[RTP_HEADER_SIZE+MAX_PACKET_SIZE];
+	if(length>MAX_PACKET_SIZE){
+		packetsDropped++;
+		return;
+	}
+	packet[0]=0x80;
+	packet[1]=(unsigned char)((marker ? 0x80 : 0) | payloadType);
+	packet[2]=(unsigned char)(sequence >> 8);
+	packet[3]=(unsigned char)sequence;
+	packet[4]=(unsigned char)(timestamp >> 24);
+	packet[5]=(unsigned char)(timestamp >> 16);
+	packet[6]=(unsigned char)(timestamp >> 8);
+	packet[7]=(unsigned char)timestamp;
+	packet[8]=(unsigned char)(ssrc >> 24);
+	packet[9]=(unsigned char)(ssrc >> 16);
+	packet[10]=(unsigned char)(ssrc >> 8);
+	packet[11]=(unsigned char)ssrc;
+	memcpy(packet+RTP_HEADER_SIZE, payload, length);
+	sequence++;
+	sentFirst=true;
+
+	MutexGuard m(remoteMutex);
+	if(remoteAddress.empty())
+		return;
+	// The socket doesn't block, a packet that doesn't fit into its buffer is lost like on the network
+	if(sendto(fd, packet, RTP_HEADER_SIZE+length, 0, reinterpret_cast<const struct sockaddr*>(remoteAddress.data()), (socklen_t)remoteAddress.size())>=0)
+		packetsSent++;
+#endif
+}
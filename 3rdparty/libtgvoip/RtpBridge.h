@@ -0,0 +1,160 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_RTPBRIDGE_H
+#define LIBTGVOIP_RTPBRIDGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include "threading.h"
+#include "utils.h"
+
+struct OpusDecoder;
+struct OpusEncoder;
+struct OpusRepacketizer;
+
+namespace tgvoip{
+
+	class VoIPController;
+
+	/**
+	 * Exchanges the audio of a call with a local RTP peer over UDP, e.g. a PBX on the same host.
+	 * With Opus, frames are passed through in both directions whenever possible: the ones the call receives are sent as
+	 * RTP packets as they are, and the peer's packets are combined into frames of the call's duration without decoding.
+	 * The peer's audio is only decoded and encoded again to conceal loss or when its packets don't line up with the
+	 * call's frames. G.711 (PCMU, PCMA) and L16 are transcoded with an Opus encoder and decoder of the bridge's own.
+	 * Packets from the peer go through a jitter buffer with a fixed delay that drops late packets, conceals missing ones
+	 * and skips ahead when the peer's clock runs faster than the call's.
+	 * While the bridge runs, the call neither captures, decodes nor plays audio. The controller must outlive the bridge.
+	 * Not available on Windows.
+	 */
+	class RtpBridge{
+	public:
+		enum Codec{
+			CODEC_OPUS,
+			CODEC_PCMU,
+			CODEC_PCMA,
+			CODEC_L16  // 16-bit big-endian mono
+		};
+
+		struct Config{
+			Codec codec=CODEC_OPUS;
+			int payloadType=-1;            // -1 for the usual one: 111 for Opus, 0 for PCMU, 8 for PCMA, 96 for L16
+			unsigned int sampleRate=16000; // of L16: 8000, 12000, 16000, 24000 or 48000
+			uint32_t packetDuration=20;    // ms of G.711 and L16 packets sent to the peer
+			uint32_t jitterDelay=60;       // ms that packets from the peer are held back
+			std::string localAddress="127.0.0.1";
+			uint16_t localPort=0;          // 0 for any free port
+			std::string remoteAddress;     // empty to reply to wherever the first packet comes from
+			uint16_t remotePort=0;
+		};
+
+		struct Stats{
+			uint64_t packetsSent;
+			uint64_t packetsReceived;
+			uint64_t packetsLate;        // arrived after their audio was played out or concealed
+			uint64_t packetsDropped;     // invalid, of another payload type, or skipped because the buffer was too full
+			uint64_t framesPassedThrough;
+			uint64_t framesTranscoded;
+			uint64_t concealedMs;        // of the peer's audio that was missing
+		};
+
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(RtpBridge);
+		/**
+		 * Binds the socket and starts bridging right away
+		 * @return NULL if the configuration is invalid, the socket can't be bound or something else (a CallBridge, an
+		 * EncoderGroup) already feeds the call's outgoing audio
+		 */
+		static RtpBridge* Create(VoIPController* controller, const Config& config);
+		/**
+		 * Stops the bridge if Close() wasn't called
+		 */
+		~RtpBridge();
+		/**
+		 * Stops bridging and gives the call its own audio back
+		 */
+		void Close();
+		uint16_t GetLocalPort() const{
+			return localPort;
+		}
+		Stats GetStats() const;
+
+	private:
+		struct Unit{
+			std::vector<unsigned char> payload;  // Opus packets are kept as they are
+			std::vector<int16_t> pcm;            // G.711 and L16 are decoded when they arrive
+			int samples;
+		};
+
+		RtpBridge(VoIPController* controller, const Config& config, int fd, unsigned int clockRate);
+		void RunThread();
+		void ReceivePackets();
+		void HandlePacket(const unsigned char* data, size_t length, const void* from, size_t fromLength);
+		void PlayOut();
+		bool PassThrough(size_t frameSamples);
+		void Conceal(size_t samples);
+		void HandleCallFrame(const unsigned char* data, size_t length, uint32_t pts);
+		void SendRtp(const unsigned char* payload, size_t length, uint32_t timestamp, bool marker);
+
+		VoIPController* controller;
+		Config config;
+		int fd;
+		uint16_t localPort=0;
+		unsigned int clockRate;  // of RTP timestamps, and the rate the bridge transcodes at
+		uint8_t payloadType;
+		Thread* thread=NULL;
+		std::atomic<bool> running{true};
+		bool closed=false;
+		uint32_t tapID=0;
+
+		Mutex remoteMutex;
+		std::vector<unsigned char> remoteAddress;  // sockaddr of the peer, empty until it's known
+		bool remoteFixed;
+
+		// Sending, only accessed with sendMutex held (the call's receive thread, or Close)
+		Mutex sendMutex;
+		uint32_t ssrc;
+		uint16_t sequence;
+		bool sentFirst=false;
+		uint32_t timestampBase;
+		::OpusDecoder* egressDecoder=NULL;
+		bool egressStarted=false;
+		uint32_t egressPts=0;
+		std::vector<int16_t> egressPcm;
+		uint32_t egressTimestamp=0;
+
+		// Receiving and playout, only accessed by the bridge thread
+		std::map<int64_t, Unit> jitterBuffer;  // by extended timestamp
+		bool haveSource=false;
+		uint32_t sourceSsrc=0;
+		uint32_t lastTimestamp=0;
+		int64_t lastExtTimestamp=0;
+		bool playing=false;
+		double primeTime=0;
+		int64_t playoutTimestamp=0;  // of the first sample in ingressPcm, or of the next frame
+		std::vector<int16_t> ingressPcm;  // decoded but not sent yet
+		double lastPacketTime=0;
+		::OpusDecoder* ingressDecoder=NULL;
+		::OpusEncoder* encoder=NULL;
+		::OpusRepacketizer* repacketizer=NULL;
+		uint32_t encoderBitrate=0;
+		bool passingThrough=false;  // the last frame was passed through, the decoder and the encoder didn't see it
+
+		std::atomic<uint64_t> packetsSent{0};
+		std::atomic<uint64_t> packetsReceived{0};
+		std::atomic<uint64_t> packetsLate{0};
+		std::atomic<uint64_t> packetsDropped{0};
+		std::atomic<uint64_t> framesPassedThrough{0};
+		std::atomic<uint64_t> framesTranscoded{0};
+		std::atomic<uint64_t> concealedSamples{0};
+	};
+}
+
+#endif //LIBTGVOIP_RTPBRIDGE_H
@@ -185,6 +185,8 @@ VoIPController::VoIPController() : activeNetItfName(""),
 	stm->frameDuration=60;
 	outgoingStreams.push_back(stm);
 
+	metrics=make_shared<CallMetrics>();
+	MetricsExporter::GetSharedInstance()->AddCall(metrics);
 }
 
 VoIPController::~VoIPController(){
@@ -228,18 +230,13 @@ audioOutput = nullptr;
 	if(resolvedProxyAddress)
 		delete resolvedProxyAddress;
 	delete selectCanceller;
+	MetricsExporter::GetSharedInstance()->RemoveCall(metrics.get());
 	LOGD("Left VoIPController::~VoIPController");
 	if(tgvoipLogFile){
 		FILE* log=tgvoipLogFile;
 		tgvoipLogFile=NULL;
 		fclose(log);
 	}
-#if defined(TGVOIP_USE_CALLBACK_AUDIO_IO)
-	if (preprocDecoder) {
-        opus_decoder_destroy(preprocDecoder);
-        preprocDecoder=nullptr;
-	}
-#endif
 }
 
 void VoIPController::Stop() {
@@ -301,6 +298,9 @@ void VoIPController::Stop() {
         if (encoder) {
             encoder->Stop();
         }
+        // the encoder thread was the only one reporting to it
+        CpuGovernor::GetSharedInstance()->RemoveClient(cpuGovernorClient);
+        cpuGovernorClient = NULL;
         for (auto& _stm : incomingStreams) {
             auto stm = _stm;
             if (stm && stm->decoder) {
@@ -538,18 +538,27 @@ double VoIPController::GetAverageRTT(){
 void VoIPController::SetMicMute(bool mute){
 	if(micMuted==mute)
 		return;
-	micMuted=mute;
-	if(audioInput){
-		if(mute)
-			audioInput->Stop();
-		else
-			audioInput->Start();
-		if(!audioInput->IsInitialized()){
-			lastError=ERROR_AUDIO_IO;
-			SetState(STATE_FAILED);
-			return;
+	if(!mute && config.listenOnly){
+		LOGW("Can't unmute a listen-only call");
+		return;
+	}
+	bool inputFailed=false;
+	{
+		MutexGuard m(audioIOMutex);
+		micMuted=mute;
+		if(audioInput && audioInputCapturing){
+			if(mute)
+				audioInput->Stop();
+			else
+				audioInput->Start();
+			inputFailed=!audioInput->IsInitialized();
 		}
 	}
+	if(inputFailed){
+		lastError=ERROR_AUDIO_IO;
+		SetState(STATE_FAILED);
+		return;
+	}
 	if(echoCanceller)
 		echoCanceller->Enable(!mute);
 	if(state==STATE_ESTABLISHED){
@@ -609,6 +618,12 @@ string VoIPController::GetDebugString(){
 		snprintf(buffer, sizeof(buffer), "ShittyInternetMode: level %d\n", extraEcLevel);
 		r+=buffer;
 	}
+	CpuGovernor::Degradation degradation=GetCpuDegradation();
+	if(degradation.level>0){
+		snprintf(buffer, sizeof(buffer), "CPU degradation: level %d, complexity %d%s%s%s\n", degradation.level, degradation.maxComplexity,
+				 degradation.secondaryEncoderDisabled ? ", no extra EC" : "", degradation.nsDisabled ? ", no NS" : "", degradation.aecDisabled ? ", no AEC" : "");
+		r+=buffer;
+	}
 	double avgLate[3];
 	shared_ptr<Stream> stm=GetStreamByType(STREAM_TYPE_AUDIO, false);
 	shared_ptr<JitterBuffer> jitterBuffer;
@@ -668,6 +683,15 @@ void VoIPController::GetStats(TrafficStats *stats){
 	memcpy(stats, &this->stats, sizeof(TrafficStats));
 }
 
+void VoIPController::GetCallStats(CallStats *stats){
+	{
+		MutexGuard m(callStatsMutex);
+		*stats=callStatsSnapshot;
+	}
+	memcpy(&stats->traffic, &this->stats, sizeof(TrafficStats));
+	stats->state=state;
+}
+
 string VoIPController::GetDebugLog(){
 	map<string, json11::Json> network{
 			{"type", NetworkTypeToString(networkType)}
@@ -861,17 +885,42 @@ void VoIPController::SetEchoCancellationStrength(int strength){
 void VoIPController::SetAudioDataCallbacks(std::function<void(int16_t*, size_t)> input, std::function<void(int16_t*, size_t)> output, std::function<void(int16_t*, size_t)> preproc=nullptr){
 	audioInputDataCallback=input;
 	audioOutputDataCallback=output;
-    audioPreprocDataCallback=preproc;
-    preprocDecoder=preprocDecoder ? preprocDecoder : opus_decoder_create(48000, 1, NULL);
+	audioPreprocDataCallback=preproc;
 }
 #endif
 
+bool VoIPController::SetCallHost(CallHost* host){
+	if(!messageThread.SetCallHost(host))
+		return false;
+	callHost=host;
+	return true;
+}
+
+bool VoIPController::SetUdpSocket(NetworkSocket* socket){
+	if(recvThread){
+		LOGE("Can't replace the UDP socket of a started controller");
+		return false;
+	}
+	if(udpSocket!=realUdpSocket)
+		delete udpSocket;
+	delete realUdpSocket;
+	udpSocket=realUdpSocket=socket;
+	return true;
+}
+
 int VoIPController::GetConnectionState(){
 	return state;
 }
 
 void VoIPController::SetConfig(const Config& cfg){
 	config=cfg;
+	if(config.listenOnly){
+		// Announce the audio stream as disabled from the start, SetMicMute won't send anything if the state doesn't change later
+		SetMicMute(true);
+		shared_ptr<Stream> outgoingAudioStream=GetStreamByType(STREAM_TYPE_AUDIO, true);
+		if(outgoingAudioStream)
+			outgoingAudioStream->enabled=false;
+	}
 	if(tgvoipLogFile){
 		fclose(tgvoipLogFile);
 		tgvoipLogFile=NULL;
@@ -1016,6 +1065,7 @@ void VoIPController::RunSendThread(){
 
 void VoIPController::SetState(int state){
 	this->state=state;
+	metrics->state.store((uint64_t)state, std::memory_order_relaxed);
 	LOGV("Call state changed to %d", state);
 	stateChangeTime=GetCurrentTime();
 	messageThread.Post([this, state]{
@@ -1031,6 +1081,7 @@ void VoIPController::SetState(int state){
 			messageThread.Post(std::bind(&VoIPController::UpdateCongestion, this), 0.0, 1.0);
 			messageThread.Post(std::bind(&VoIPController::UpdateSignalBars, this), 1.0, 1.0);
 			messageThread.Post(std::bind(&VoIPController::TickJitterBufferAngCongestionControl, this), 0.0, 0.1);
+			messageThread.Post(std::bind(&VoIPController::UpdateMetrics, this), 0.0, 1.0);
 		}
 	}
 }
@@ -1083,7 +1134,126 @@ CellularCarrierInfo VoIPController::GetCarrierInfo(){
 
 #pragma mark - Audio I/O
 
+uint32_t VoIPController::AddIncomingAudioTap(std::function<void(const unsigned char*, size_t, uint32_t)> tap){
+	MutexGuard m(audioTapsMutex);
+	uint32_t id=++lastAudioTapID;
+	audioTaps.push_back(make_pair(id, std::move(tap)));
+	return id;
+}
+
+void VoIPController::RemoveIncomingAudioTap(uint32_t id){
+	MutexGuard m(audioTapsMutex);
+	for(vector<pair<uint32_t, std::function<void(const unsigned char*, size_t, uint32_t)>>>::iterator t=audioTaps.begin();t!=audioTaps.end();++t){
+		if(t->first==id){
+			audioTaps.erase(t);
+			return;
+		}
+	}
+}
+
+void VoIPController::SetAudioDecodingEnabled(bool enabled){
+	if(audioDecodingEnabled.exchange(enabled)==enabled)
+		return;
+	LOGI("Audio decoding %s", enabled ? "enabled" : "disabled");
+	// Stopping audio output joins its thread, which must not happen on the caller's thread: that's often the receive
+	// thread of another call holding its tap lock
+	messageThread.Post(std::bind(&VoIPController::UpdateAudioIOModes, this));
+}
+
+void VoIPController::SetExternalAudioSource(bool enabled){
+	if(externalAudioSource.exchange(enabled)==enabled)
+		return;
+	LOGI("External audio source %s", enabled ? "enabled" : "disabled");
+	messageThread.Post(std::bind(&VoIPController::UpdateAudioIOModes, this));
+}
+
+void VoIPController::UpdateAudioIOModes(){
+	// Looks at the current flags rather than at what the posting call set, so switches that race each other settle
+	// on the last one
+	MutexGuard m(audioIOMutex);
+	if(!audioDecodingEnabled && audioOutput && audioOutStarted){
+		audioOutput->Stop();
+		audioOutStarted=false;
+	}
+	// Output is started again when the next audio packet arrives with decoding enabled
+	bool capture=!externalAudioSource;
+	if(capture==audioInputCapturing)
+		return;
+	audioInputCapturing=capture;
+	if(!audioInput || micMuted)
+		return;
+	if(capture)
+		audioInput->Start();
+	else
+		audioInput->Stop();
+}
+
+bool VoIPController::ClaimExternalAudioSource(const void* owner){
+	const void* expected=NULL;
+	return externalAudioSourceOwner.compare_exchange_strong(expected, owner) || expected==owner;
+}
+
+void VoIPController::ReleaseExternalAudioSource(const void* owner){
+	externalAudioSourceOwner.compare_exchange_strong(owner, NULL);
+}
+
+void VoIPController::SendEncodedAudioFrame(const unsigned char* data, size_t len, const unsigned char* secondaryData, size_t secondaryLen){
+	if(!externalAudioSource || micMuted)
+		return;
+	HandleAudioInput(const_cast<unsigned char*>(data), len, const_cast<unsigned char*>(secondaryData), secondaryLen);
+}
+
+uint32_t VoIPController::GetAudioTargetBitrate(){
+	return encoder ? encoder->GetBitrate() : initAudioBitrate;
+}
+
+bool VoIPController::IsExtraAudioECEnabled(){
+	return shittyInternetMode;
+}
+
+uint16_t VoIPController::GetIncomingAudioFrameDuration(){
+	for(shared_ptr<Stream>& s:incomingStreams){
+		if(s->type==STREAM_TYPE_AUDIO)
+			return s->frameDuration;
+	}
+	return 0;
+}
+
+uint16_t VoIPController::GetOutgoingAudioFrameDuration(){
+	return outgoingStreams.empty() ? 0 : outgoingStreams[0]->frameDuration;
+}
+
+void VoIPController::PlayEncodedPrompt(shared_ptr<const audio::EncodedPrompt> prompt){
+	MutexGuard m(promptMutex);
+	if(promptEncoderReady){
+		if(encoder)
+			encoder->PlayPrompt(prompt);
+	}else{
+		pendingPrompts.push_back(prompt);
+	}
+}
+
+void VoIPController::ClearEncodedPrompts(){
+	MutexGuard m(promptMutex);
+	pendingPrompts.clear();
+	if(promptEncoderReady && encoder)
+		encoder->ClearPrompts();
+}
+
+VoIPController::EncodedPromptStats VoIPController::GetEncodedPromptStats(){
+	MutexGuard m(promptMutex);
+	if(!promptEncoderReady || !encoder)
+		return EncodedPromptStats{0, 0};
+	return EncodedPromptStats{encoder->GetPromptFrameCount(), encoder->GetMixedPromptFrameCount()};
+}
+
+CpuGovernor::Degradation VoIPController::GetCpuDegradation(){
+	return CpuGovernor::GetSharedInstance()->GetDegradation(cpuGovernorClient);
+}
+
 void VoIPController::AudioInputCallback(unsigned char* data, size_t length, unsigned char* secondaryData, size_t secondaryLength, void* param){
+	if(((VoIPController*)param)->externalAudioSource)
+		return;
 	((VoIPController*)param)->HandleAudioInput(data, length, secondaryData, secondaryLength);
 }
 
@@ -1174,13 +1344,6 @@ void VoIPController::HandleAudioInput(unsigned char *data, size_t len, unsigned
 	}
 
 	audioTimestampOut+=outgoingStreams[0]->frameDuration;
-
-#if defined(TGVOIP_USE_CALLBACK_AUDIO_IO)
-	if (audioPreprocDataCallback && preprocDecoder) {
-        int size=opus_decode(preprocDecoder, data, len, preprocBuffer, 4096, 0);
-        audioPreprocDataCallback(preprocBuffer, size);
-	}
-#endif
 }
 
 void VoIPController::InitializeAudio(){
@@ -1206,23 +1369,34 @@ void VoIPController::InitializeAudio(){
 #elif defined(__APPLE__) && TARGET_OS_OSX
 	SetAudioOutputDuckingEnabled(macAudioDuckingEnabled);
 #endif
-	LOGI("AEC: %d NS: %d AGC: %d", config.enableAEC, config.enableNS, config.enableAGC);
-	echoCanceller=new EchoCanceller(config.enableAEC, config.enableNS, config.enableAGC);
-	encoder=new OpusEncoder(audioInput, true);
-	encoder->SetCallback(AudioInputCallback, this);
-	encoder->SetOutputFrameDuration(outgoingAudioStream->frameDuration);
-	encoder->SetEchoCanceller(echoCanceller);
-	encoder->SetSecondaryEncoderEnabled(false);
-	if(config.enableVolumeControl){
-		encoder->AddAudioEffect(&inputVolume);
+	if(config.listenOnly){
+		LOGI("Listen-only call, not setting up audio capture");
+	}else{
+		InitializeAudioCapture(outgoingAudioStream->frameDuration);
+	}
+	{
+		MutexGuard m(promptMutex);
+		promptEncoderReady=true;
+		for(shared_ptr<const audio::EncodedPrompt>& prompt:pendingPrompts){
+			if(encoder)
+				encoder->PlayPrompt(prompt);
+		}
+		pendingPrompts.clear();
 	}
 
 #if defined(TGVOIP_USE_CALLBACK_AUDIO_IO)
-	dynamic_cast<audio::AudioInputCallback*>(audioInput)->SetDataCallback(audioInputDataCallback);
-	dynamic_cast<audio::AudioOutputCallback*>(audioOutput)->SetDataCallback(audioOutputDataCallback);
+	if(!config.listenOnly)
+		dynamic_cast<audio::AudioInputCallback*>(audioInput)->SetDataCallback(audioInputDataCallback);
+	if(!config.sendOnly)
+		dynamic_cast<audio::AudioOutputCallback*>(audioOutput)->SetDataCallback(audioOutputDataCallback);
+	if(callHost){
+		dynamic_cast<audio::AudioIOCallback*>(audioIO)->SetCallHost(callHost);
+	}
 #endif
 
-	if(!audioOutput->IsInitialized()){
+	if(config.sendOnly){
+		LOGI("Send-only call, audio output won't be used");
+	}else if(!audioOutput->IsInitialized()){
 		LOGE("Error initializing audio playback");
 		lastError=ERROR_AUDIO_IO;
 
@@ -1233,26 +1407,75 @@ void VoIPController::InitializeAudio(){
 	LOGI("Audio initialization took %f seconds", GetCurrentTime()-t);
 }
 
+void VoIPController::InitializeAudioCapture(uint32_t frameDuration){
+	unsigned int captureSampleRate=48000;
+#if defined(TGVOIP_USE_CALLBACK_AUDIO_IO)
+	switch(config.audioCaptureSampleRate){
+		case 8000:
+		case 16000:
+		case 24000:
+		case 48000:
+			captureSampleRate=config.audioCaptureSampleRate;
+			break;
+		default:
+			LOGW("Unsupported capture sample rate %u, using 48000", config.audioCaptureSampleRate);
+			break;
+	}
+	dynamic_cast<audio::AudioInputCallback*>(audioInput)->SetSampleRate(captureSampleRate);
+#endif
+	bool enableAEC=config.enableAEC && !config.sendOnly;
+	LOGI("AEC: %d NS: %d AGC: %d, capture rate %u", enableAEC, config.enableNS, config.enableAGC, captureSampleRate);
+	// On a CallHost, the far end is buffered, and packets are encoded and decoded, on the audio I/O strands
+	echoCanceller=new EchoCanceller(enableAEC, config.enableNS, config.enableAGC, captureSampleRate, callHost==NULL);
+	encoder=new OpusEncoder(audioInput, true, captureSampleRate);
+	encoder->SetSynchronous(callHost!=NULL);
+	encoder->SetCallback(AudioInputCallback, this);
+	encoder->SetOutputFrameDuration(frameDuration);
+	encoder->SetEchoCanceller(echoCanceller);
+	encoder->SetSecondaryEncoderEnabled(false);
+	if(config.enableVolumeControl){
+		encoder->AddAudioEffect(&inputVolume);
+	}
+#if defined(TGVOIP_USE_CALLBACK_AUDIO_IO)
+	if(audioPreprocDataCallback)
+		encoder->SetPreprocessedCallback(audioPreprocDataCallback);
+#endif
+	cpuGovernorClient=CpuGovernor::GetSharedInstance()->AddClient([this](const CpuGovernor::Degradation& d){
+		encoder->SetComplexityLimit(d.maxComplexity);
+		encoder->SetSecondaryEncoderAllowed(!d.secondaryEncoderDisabled);
+		echoCanceller->SetSuspended(d.aecDisabled, d.nsDisabled);
+	});
+	encoder->SetCpuGovernorClient(cpuGovernorClient);
+}
+
 void VoIPController::StartAudio(){
 	OnAudioOutputReady();
 
-	encoder->Start();
-	if(!micMuted){
-		audioInput->Start();
-		if(!audioInput->IsInitialized()){
-			LOGE("Erorr initializing audio capture");
-			lastError=ERROR_AUDIO_IO;
-
-			SetState(STATE_FAILED);
-			return;
+	if(encoder)
+		encoder->Start();
+	bool inputFailed=false;
+	{
+		MutexGuard m(audioIOMutex);
+		audioInputCapturing=!externalAudioSource;
+		if(!micMuted && audioInputCapturing){
+			audioInput->Start();
+			inputFailed=!audioInput->IsInitialized();
 		}
 	}
+	if(inputFailed){
+		LOGE("Erorr initializing audio capture");
+		lastError=ERROR_AUDIO_IO;
+
+		SetState(STATE_FAILED);
+	}
 }
 
 void VoIPController::OnAudioOutputReady(){
 	LOGI("Audio I/O ready");
+	if(config.sendOnly)
+		return;
 	shared_ptr<Stream>& stm=incomingStreams[0];
-	stm->decoder=make_shared<OpusDecoder>(audioOutput, true, peerVersion>=6);
+	stm->decoder=make_shared<OpusDecoder>(audioOutput, callHost==NULL, peerVersion>=6);
 	stm->decoder->SetEchoCanceller(echoCanceller);
 	if(config.enableVolumeControl){
 		stm->decoder->AddAudioEffect(&outputVolume);
@@ -1268,6 +1491,8 @@ void VoIPController::UpdateAudioOutputState(){
 		if((*s)->type==STREAM_TYPE_AUDIO && (*s)->enabled)
 			areAnyAudioStreamsEnabled=true;
 	}
+	if(!audioDecodingEnabled || config.sendOnly)
+		areAnyAudioStreamsEnabled=false;
 	if(audioOutput){
 		LOGV("New audio output state: %d", areAnyAudioStreamsEnabled);
 		if(audioOutput->IsPlaying()!=areAnyAudioStreamsEnabled){
@@ -1740,6 +1965,8 @@ void VoIPController::RunRecvThread(){
 				stats.bytesRecvdMobile+=(uint64_t) len;
 			else
 				stats.bytesRecvdWifi+=(uint64_t) len;
+			metrics->bytesReceived.fetch_add((uint64_t)len, std::memory_order_relaxed);
+			metrics->packetsReceived.fetch_add(1, std::memory_order_relaxed);
 			try{
 				ProcessIncomingPacket(packet, endpoints.at(srcEndpointID));
 			}catch(out_of_range& x){
@@ -2408,7 +2635,9 @@ simpleAudioBlock random_id:long random_bytes:string raw_data:string = DecryptedA
 					LOGV("Skipping video stream for old protocol version");
 					continue;
 				}
-				if(stm->type==STREAM_TYPE_AUDIO){
+				if(stm->type==STREAM_TYPE_AUDIO && config.sendOnly){
+					stm->decoder=NULL;
+				}else if(stm->type==STREAM_TYPE_AUDIO){
 					stm->jitterBuffer=make_shared<JitterBuffer>(nullptr, stm->frameDuration);
 					if(stm->frameDuration>50)
 						stm->jitterBuffer->SetMinPacketCount((uint32_t) ServerConfig::GetSharedInstance()->GetInt("jitter_initial_delay_60", 2));
@@ -2488,7 +2717,7 @@ simpleAudioBlock random_id:long random_bytes:string raw_data:string = DecryptedA
 			unsigned char fragmentIndex=0;
 			//LOGD("stream data, pts=%d, len=%d, rem=%d", pts, sdlen, in.Remaining());
 			audioTimestampIn=pts;
-			if(!audioOutStarted && audioOutput){
+			if(!audioOutStarted && audioOutput && audioDecodingEnabled && !config.sendOnly){
 				MutexGuard m(audioIOMutex);
 				audioOutput->Start();
 				audioOutStarted=true;
@@ -2512,7 +2741,13 @@ simpleAudioBlock random_id:long random_bytes:string raw_data:string = DecryptedA
 				}
 			}
 			if(stm && stm->type==STREAM_TYPE_AUDIO){
-				if(stm->jitterBuffer){
+				{
+					MutexGuard m(audioTapsMutex);
+					for(std::pair<uint32_t, std::function<void(const unsigned char*, size_t, uint32_t)>>& tap:audioTaps){
+						tap.second(buffer+in.GetOffset(), sdlen, pts);
+					}
+				}
+				if(stm->jitterBuffer && audioDecodingEnabled){
 					stm->jitterBuffer->HandleInput((unsigned char *) (buffer+in.GetOffset()), sdlen, pts, false);
 					if(extraFEC){
 						in.Seek(in.GetOffset()+sdlen);
@@ -2936,6 +3171,8 @@ void VoIPController::ActuallySendPacket(NetworkPacket &pkt, Endpoint& ep){
 		stats.bytesSentMobile+=(uint64_t)pkt.length;
 	else
 		stats.bytesSentWifi+=(uint64_t)pkt.length;
+	metrics->bytesSent.fetch_add((uint64_t)pkt.length, std::memory_order_relaxed);
+	metrics->packetsSent.fetch_add(1, std::memory_order_relaxed);
 	if(ep.type==Endpoint::Type::TCP_RELAY){
 		if(ep.socket && !ep.socket->IsFailed()){
 			ep.socket->Send(&pkt);
@@ -3079,6 +3316,13 @@ static void initMachTimestart() {
 #endif
 
 double VoIPController::GetCurrentTime(){
+	Clock* clock=Clock::GetInstalled();
+	if(clock)
+		return clock->GetTime();
+	return GetMonotonicTime();
+}
+
+double VoIPController::GetMonotonicTime(){
 #if defined(__linux__)
 	struct timespec ts;
 	clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -3704,12 +3948,15 @@ void VoIPController::UpdateRTT(){
 			int lostCount=(*stm)->jitterBuffer->GetAndResetLostPacketCount();
 			if(lostCount>0 || (lostCount<0 && recvLossCount>((uint32_t) -lostCount)))
 				recvLossCount+=lostCount;
+			// The jitter buffer takes back losses of packets that arrived late, a counter can't
+			if(lostCount>0)
+				metrics->packetsLost.fetch_add((uint64_t)lostCount, std::memory_order_relaxed);
 		}
 	}
 }
 
 void VoIPController::UpdateCongestion(){
-	if(conctl && encoder){
+	if(conctl){
 		uint32_t sendLossCount=conctl->GetSendLossCount();
 		sendLossCountHistory.Add(sendLossCount-prevSendLossCount);
 		prevSendLossCount=sendLossCount;
@@ -3746,7 +3993,8 @@ void VoIPController::UpdateCongestion(){
 		}else{
 			extraEcLevel=0;
 		}
-		encoder->SetPacketLoss((int)(avgSendLossCount*100.0));
+		if(encoder)
+			encoder->SetPacketLoss((int)(avgSendLossCount*100.0));
 		if(avgSendLossCount>rateMaxAcceptableSendLoss)
 			needRate=true;
 
@@ -3763,13 +4011,14 @@ void VoIPController::UpdateCongestion(){
 				encoder->SetSecondaryEncoderEnabled(false);
 			LOGW("Disabling extra EC");
 		}
-		if(!wasEncoderLaggy && encoder->GetComplexity()<10)
+		if(encoder && !wasEncoderLaggy && encoder->GetComplexity()<10)
 			wasEncoderLaggy=true;
 	}
 }
 
 void VoIPController::UpdateAudioBitrate(){
-	if(encoder && conctl){
+	// A listen-only call has no encoder, but still has to notice when the peer is gone
+	if(conctl){
 		double time=GetCurrentTime();
 		if((audioInput && !audioInput->IsInitialized()) || (audioOutput && !audioOutput->IsInitialized())){
 			LOGE("Audio I/O failed");
@@ -3777,17 +4026,19 @@ void VoIPController::UpdateAudioBitrate(){
 			SetState(STATE_FAILED);
 		}
 
-		int act=conctl->GetBandwidthControlAction();
-		if(shittyInternetMode){
-			encoder->SetBitrate(8000);
-		}else if(act==TGVOIP_CONCTL_ACT_DECREASE){
-			uint32_t bitrate=encoder->GetBitrate();
-			if(bitrate>8000)
-				encoder->SetBitrate(bitrate<(minAudioBitrate+audioBitrateStepDecr) ? minAudioBitrate : (bitrate-audioBitrateStepDecr));
-		}else if(act==TGVOIP_CONCTL_ACT_INCREASE){
-			uint32_t bitrate=encoder->GetBitrate();
-			if(bitrate<maxBitrate)
-				encoder->SetBitrate(bitrate+audioBitrateStepIncr);
+		if(encoder){
+			int act=conctl->GetBandwidthControlAction();
+			if(shittyInternetMode){
+				encoder->SetBitrate(8000);
+			}else if(act==TGVOIP_CONCTL_ACT_DECREASE){
+				uint32_t bitrate=encoder->GetBitrate();
+				if(bitrate>8000)
+					encoder->SetBitrate(bitrate<(minAudioBitrate+audioBitrateStepDecr) ? minAudioBitrate : (bitrate-audioBitrateStepDecr));
+			}else if(act==TGVOIP_CONCTL_ACT_INCREASE){
+				uint32_t bitrate=encoder->GetBitrate();
+				if(bitrate<maxBitrate)
+					encoder->SetBitrate(bitrate+audioBitrateStepIncr);
+			}
 		}
 
 		if(state==STATE_ESTABLISHED && time-lastRecvPacketTime>=reconnectingTimeout){
@@ -3948,6 +4199,14 @@ void VoIPController::SendPublicEndpointsRequest(){
 }
 
 void VoIPController::TickJitterBufferAngCongestionControl(){
+	double now=GetCurrentTime();
+	if(lastTickTime!=0){
+		double lateness=std::max(0.0, now-lastTickTime-0.1);
+		metrics->tickLatenessUs.fetch_add((uint64_t)(lateness*1000000.0), std::memory_order_relaxed);
+		metrics->lastTickLateness.store(lateness, std::memory_order_relaxed);
+	}
+	lastTickTime=now;
+	metrics->ticks.fetch_add(1, std::memory_order_relaxed);
 	// TODO get rid of this and update states of these things internally and retroactively
 	for(shared_ptr<Stream>& stm:incomingStreams){
 		if(stm->jitterBuffer){
@@ -3959,6 +4218,74 @@ void VoIPController::TickJitterBufferAngCongestionControl(){
 	}
 }
 
+void VoIPController::UpdateMetrics(){
+	// Gauges that can only be read on this thread, the counters are updated where the things they count happen.
+	// GetCallStats() gets the same snapshot.
+	CallStats s;
+	memset(&s, 0, sizeof(CallStats));
+	s.signalBars=GetSignalBarsCount();
+	if(conctl){
+		s.rtt=conctl->GetAverageRTT();
+		s.minRtt=conctl->GetMinimumRTT();
+		s.sendLossCount=conctl->GetSendLossCount();
+		s.inflightBytes=(uint32_t)conctl->GetInflightDataSize();
+		s.congestionWindow=(uint32_t)conctl->GetCongestionWindow();
+	}
+	shared_ptr<Stream> stm=GetStreamByType(STREAM_TYPE_AUDIO, false);
+	if(stm && stm->jitterBuffer){
+		s.jitterDelay=stm->jitterBuffer->GetAverageDelay()*stm->frameDuration/1000.0;
+		s.jitterMinPackets=stm->jitterBuffer->GetMinPacketCount();
+		s.jitter=stm->jitterBuffer->GetLastMeasuredJitter();
+		metrics->jitterBufferPackets.store(stm->jitterBuffer->GetCurrentDelay(), std::memory_order_relaxed);
+	}
+	s.packetsSent=lastSentSeq;
+	s.packetsReceived=packetsReceived;
+	s.recvLossCount=recvLossCount;
+	for(size_t i=0;i<sizeof(s.sendLossHistory)/sizeof(s.sendLossHistory[0]) && i<sendLossCountHistory.Size();i++){
+		s.sendLossHistory[i]=sendLossCountHistory[i];
+	}
+	if(encoder){
+		s.expectedLossPercent=encoder->GetPacketLoss();
+		s.audioBitrate=encoder->GetBitrate();
+		metrics->encoderQueuePackets.store(encoder->GetQueuedPacketCount(), std::memory_order_relaxed);
+		metrics->framesEncoded.store(encoder->GetEncodedFrameCount(), std::memory_order_relaxed);
+	}
+	s.unsentPackets=unsentStreamPackets;
+	s.extraEcLevel=shittyInternetMode ? extraEcLevel : 0;
+	{
+		MutexGuard m(endpointsMutex);
+		map<int64_t, Endpoint>::iterator endpoint=endpoints.find(currentEndpoint);
+		if(endpoint!=endpoints.end()){
+			s.currentEndpointID=endpoint->first;
+			s.currentEndpointType=endpoint->second.type;
+			s.currentEndpointRtt=endpoint->second.averageRTT;
+		}
+	}
+	{
+		MutexGuard m(callStatsMutex);
+		callStatsSnapshot=s;
+	}
+
+	metrics->signalBars.store((uint64_t)s.signalBars, std::memory_order_relaxed);
+	if(conctl){
+		metrics->rtt.store(s.rtt, std::memory_order_relaxed);
+		metrics->packetsSendLost.store(s.sendLossCount, std::memory_order_relaxed);
+		metrics->inflightBytes.store(s.inflightBytes, std::memory_order_relaxed);
+		metrics->congestionWindow.store(s.congestionWindow, std::memory_order_relaxed);
+	}
+	if(stm && stm->jitterBuffer){
+		metrics->jitterDelay.store(s.jitterDelay, std::memory_order_relaxed);
+		metrics->jitter.store(s.jitter, std::memory_order_relaxed);
+	}
+	if(encoder)
+		metrics->audioBitrate.store(s.audioBitrate, std::memory_order_relaxed);
+	metrics->sendQueuePackets.store(s.unsentPackets, std::memory_order_relaxed);
+}
+
+void VoIPController::SetMetricsLabel(std::string label){
+	MetricsExporter::GetSharedInstance()->SetCallLabel(metrics.get(), label);
+}
+
 #pragma mark - Endpoint
 
 Endpoint::Endpoint(int64_t id, uint16_t port, const IPv4Address& _address, const IPv6Address& _v6address, Type type, unsigned char peerTag[16]) : address(_address), v6address(_v6address){
@@ -38,6 +38,10 @@
 #include "Buffers.h"
 #include "PacketReassembler.h"
 #include "MessageThread.h"
+#include "CallHost.h"
+#include "CpuGovernor.h"
+#include "Clock.h"
+#include "MetricsExporter.h"
 #include "utils.h"
 
 #define LIBTGVOIP_VERSION "2.4.4"
@@ -213,6 +217,24 @@ namespace tgvoip{
 
 			bool logPacketStats=false;
 			bool enableVolumeControl=false;
+			/**
+			 * Rate of the captured audio: 8000, 16000, 24000 or 48000. Echo cancellation, noise suppression and the encoder
+			 * run at this rate, so narrowband sources don't have to be upsampled first. Only used with callback audio I/O,
+			 * other audio backends always capture at 48 kHz.
+			 */
+			unsigned int audioCaptureSampleRate=48000;
+			/**
+			 * Never send audio: no capture, echo cancellation or encoding is set up, the outgoing audio stream is
+			 * announced as disabled and only the NOP packets a muted call sends keep the connection alive. The mic
+			 * can't be unmuted.
+			 */
+			bool listenOnly=false;
+			/**
+			 * Never play audio: incoming audio packets are still acknowledged and passed to the taps, but no jitter
+			 * buffer, decoder or audio mixer is created and the audio output is never started. Echo cancellation
+			 * is turned off since there's no far end to cancel.
+			 */
+			bool sendOnly=false;
 
 			bool enableVideoSend=false;
 			bool enableVideoReceive=false;
@@ -225,6 +247,39 @@ namespace tgvoip{
 			uint64_t bytesRecvdMobile;
 		};
 
+		/**
+		 * Snapshot of a call's network and audio state with a fixed layout, for polling many calls cheaply.
+		 * Times are in seconds.
+		 */
+		struct CallStats{
+			TrafficStats traffic;
+			int state;
+			int signalBars;
+			double rtt;                   // average of the congestion controller
+			double minRtt;
+			double jitterDelay;           // average playout delay of the incoming audio
+			int jitterMinPackets;         // delay the jitter buffer aims for, in frames
+			double jitter;                // last measured network jitter
+			uint32_t packetsSent;
+			uint32_t packetsReceived;
+			uint32_t sendLossCount;
+			uint32_t recvLossCount;
+			uint32_t sendLossHistory[10]; // packets lost per second, most recent first
+			int expectedLossPercent;      // the encoder adds redundancy for this much loss
+			uint32_t audioBitrate;        // the encoder currently targets
+			uint32_t inflightBytes;
+			uint32_t congestionWindow;
+			uint32_t unsentPackets;       // stream packets waiting in the send queue
+			int extraEcLevel;             // 0 unless extra EC is on
+			int64_t currentEndpointID;    // 0 before the first endpoint was picked
+			int currentEndpointType;      // Endpoint::Type, 0 if unknown
+			double currentEndpointRtt;
+		};
+
+		struct EncodedPromptStats{
+			uint64_t framesSent;   // pre-encoded packets that were sent as they are
+			uint64_t framesMixed;  // frames that were mixed with the input and encoded live
+		};
 
 		VoIPController();
 		virtual ~VoIPController();
@@ -264,7 +319,11 @@ namespace tgvoip{
 		 * @return
 		 */
 		double GetAverageRTT();
+		/**
+		 * Current time in seconds as seen by the installed Clock, the monotonic system clock by default
+		 */
 		static double GetCurrentTime();
+		static double GetMonotonicTime();
 		/**
 		 * Use this field to store any of your context data associated with this call
 		 */
@@ -291,6 +350,16 @@ namespace tgvoip{
 		 * @param stats
 		 */
 		void GetStats(TrafficStats* stats);
+		/**
+		 * Fill in everything GetDebugString() shows, without formatting it. Safe to call from any thread: apart from
+		 * the traffic counters and the state, the values are those the message thread snapshotted in the last second
+		 * for MetricsExporter
+		 */
+		void GetCallStats(CallStats* stats);
+		/**
+		 * Set the value of the "call" label of this call's metrics in MetricsExporter
+		 */
+		void SetMetricsLabel(std::string label);
 		/**
 		 *
 		 * @return
@@ -400,8 +469,94 @@ namespace tgvoip{
 		 * Load the persistable state. Call this before starting the call.
 		 */
 		void SetPersistentState(std::vector<uint8_t> state);
+		/**
+		 * Run this call's timers, audio I/O ticks, encoding, decoding and echo cancellation on the worker threads of a
+		 * shared CallHost instead of per-call threads. Only the receive thread, which blocks in select() on the call's
+		 * sockets, stays per call. Call this before Start(). The host must outlive the controller.
+		 * @return false if the controller was already started or attached to a host
+		 */
+		bool SetCallHost(CallHost* host);
+		/**
+		 * Replace the UDP socket, e.g. with one end of an in-process NetworkSocketLoopback pair.
+		 * Call this before Start(). The controller takes ownership of the socket.
+		 * @return false if the controller was already started; the caller keeps ownership of the socket then
+		 */
+		bool SetUdpSocket(NetworkSocket* socket);
+		/**
+		 * Register a function that receives every incoming Opus frame (not FEC) of the audio stream as it arrives from the network,
+		 * before the jitter buffer. Called on the receive thread; it must not block.
+		 * @return an id to pass to RemoveIncomingAudioTap()
+		 */
+		uint32_t AddIncomingAudioTap(std::function<void(const unsigned char*, size_t, uint32_t)> tap);
+		/**
+		 * Unregister a tap. When this returns, the tap is not running and will not be called again.
+		 */
+		void RemoveIncomingAudioTap(uint32_t id);
+		/**
+		 * When disabled, incoming audio frames are no longer fed into the jitter buffer and audio output is stopped,
+		 * so nothing gets decoded or played back. Taps are still called.
+		 * Safe to call from any thread, including a tap: audio output is stopped later on this call's message thread.
+		 */
+		void SetAudioDecodingEnabled(bool enabled);
+		/**
+		 * When enabled, audio capture and encoding are stopped and the only outgoing audio is what's passed to SendEncodedAudioFrame().
+		 * Safe to call from any thread, including another call's tap: capture is stopped or started later on this call's
+		 * message thread. Outgoing audio switches over right away.
+		 */
+		void SetExternalAudioSource(bool enabled);
+		/**
+		 * Reserve this call's outgoing audio for one feeder of SendEncodedAudioFrame(), e.g. a CallBridge, an RtpBridge or
+		 * an EncoderGroup, so that two of them never drive SetExternalAudioSource() and SetAudioDecodingEnabled() at once.
+		 * It doesn't enable the external audio source by itself.
+		 * @return false if another owner holds it
+		 */
+		bool ClaimExternalAudioSource(const void* owner);
+		/**
+		 * Give up a claim made with ClaimExternalAudioSource(). Does nothing if owner doesn't hold it.
+		 */
+		void ReleaseExternalAudioSource(const void* owner);
+		/**
+		 * Packetize and send an Opus frame that is already encoded. It must be GetOutgoingAudioFrameDuration() ms long.
+		 * @param secondaryData optional low-bitrate copy of the same audio, sent as extra EC while IsExtraAudioECEnabled()
+		 */
+		void SendEncodedAudioFrame(const unsigned char* data, size_t len, const unsigned char* secondaryData=NULL, size_t secondaryLen=0);
+		/**
+		 * @return the bitrate congestion control currently wants the outgoing audio to be encoded at
+		 */
+		uint32_t GetAudioTargetBitrate();
+		/**
+		 * @return whether the connection is lossy enough that outgoing audio frames should carry a low-bitrate redundant copy
+		 */
+		bool IsExtraAudioECEnabled();
+		/**
+		 * @return the frame duration of the incoming audio stream in ms, 0 if it isn't known yet
+		 */
+		uint16_t GetIncomingAudioFrameDuration();
+		/**
+		 * @return the frame duration of the outgoing audio stream in ms
+		 */
+		uint16_t GetOutgoingAudioFrameDuration();
+		/**
+		 * Play a prompt that was encoded ahead of time with audio::OpusPromptCache, after the ones already queued.
+		 * See OpusEncoder::PlayPrompt() for when it's sent pre-encoded and when it's mixed with the input.
+		 * Prompts queued before the audio is initialized start with it. Listen-only calls don't play them.
+		 */
+		void PlayEncodedPrompt(std::shared_ptr<const audio::EncodedPrompt> prompt);
+		/**
+		 * Stop the prompt that's playing and drop the queued ones
+		 */
+		void ClearEncodedPrompts();
+		EncodedPromptStats GetEncodedPromptStats();
+		/**
+		 * @return what the process-wide CpuGovernor currently turned off or reduced for this call to stay within its CPU budget
+		 */
+		CpuGovernor::Degradation GetCpuDegradation();
 
 #if defined(TGVOIP_USE_CALLBACK_AUDIO_IO)
+		/**
+		 * @param preprocessed if set, receives the outgoing audio after echo cancellation and effects, right before it's
+		 * encoded, in whole frames at the capture sample rate. Must be set before the call is started.
+		 */
 		void SetAudioDataCallbacks(std::function<void(int16_t*, size_t)> input, std::function<void(int16_t*, size_t)> output, std::function<void(int16_t*, size_t)> preprocessed);
 #endif
 
@@ -598,7 +753,9 @@ namespace tgvoip{
 		uint32_t GenerateOutSeq();
 		void ActuallySendPacket(NetworkPacket& pkt, Endpoint& ep);
 		void InitializeAudio();
+		void InitializeAudioCapture(uint32_t frameDuration);
 		void StartAudio();
+		void UpdateAudioIOModes();
 		void ProcessAcknowledgedOutgoingExtra(UnacknowledgedExtraData& extra);
 		void AddIPv6Relays();
 		void AddTCPRelays();
@@ -611,6 +768,7 @@ namespace tgvoip{
 		void UpdateQueuedPackets();
 		void SendNopPacket();
 		void TickJitterBufferAngCongestionControl();
+		void UpdateMetrics();
 		void ResetUdpAvailability();
 		std::string GetPacketTypeString(unsigned char type);
 		void SetupOutgoingVideoStream();
@@ -638,6 +796,7 @@ namespace tgvoip{
 		OpusEncoder* encoder;
 		std::vector<PendingOutgoingPacket> sendQueue;
 		EchoCanceller* echoCanceller;
+		CpuGovernor::Client* cpuGovernorClient=NULL;
 		Mutex sendBufferMutex;
 		Mutex endpointsMutex;
 		Mutex socketSelectMutex;
@@ -728,10 +887,25 @@ namespace tgvoip{
 		bool didSendIPv6Endpoint;
 		int publicEndpointsReqCount=0;
 		MessageThread messageThread;
+		CallHost* callHost=NULL;
+		Mutex audioTapsMutex;
+		std::vector<std::pair<uint32_t, std::function<void(const unsigned char*, size_t, uint32_t)>>> audioTaps;
+		uint32_t lastAudioTapID=0;
+		std::atomic<bool> audioDecodingEnabled{true};
+		std::atomic<bool> externalAudioSource{false};
+		std::atomic<const void*> externalAudioSourceOwner{NULL};
+		bool audioInputCapturing=true;  // whether audio input was last set up for capture rather than an external source
+		Mutex promptMutex;
+		std::vector<std::shared_ptr<const audio::EncodedPrompt>> pendingPrompts;  // until the encoder is created
+		bool promptEncoderReady=false;
 		bool wasEstablished=false;
 		bool receivedFirstStreamPacket=false;
 		std::atomic<unsigned int> unsentStreamPackets;
 		HistoricBuffer<unsigned int, 5> unsentStreamPacketsHistory;
+		std::shared_ptr<CallMetrics> metrics;
+		Mutex callStatsMutex;
+		CallStats callStatsSnapshot{};  // taken with the metrics gauges, read by GetCallStats()
+		double lastTickTime=0;
 		bool needReInitUdpProxy=true;
 		bool needRate=false;
 		std::vector<DebugLoggedPacket> debugLoggedPackets;
@@ -750,8 +924,6 @@ namespace tgvoip{
 		std::function<void(int16_t*, size_t)> audioInputDataCallback;
 		std::function<void(int16_t*, size_t)> audioOutputDataCallback;
 		std::function<void(int16_t*, size_t)> audioPreprocDataCallback;
-		::OpusDecoder* preprocDecoder=nullptr;
-		int16_t preprocBuffer[4096];
 #endif
 #if defined(__APPLE__) && defined(TARGET_OS_OSX)
 		bool macAudioDuckingEnabled=true;
@@ -824,6 +996,11 @@ namespace tgvoip{
 		void AddGroupCallParticipant(int32_t userID, unsigned char* memberTagHash, unsigned char* serializedStreams, size_t streamsLength);
 		void RemoveGroupCallParticipant(int32_t userID);
 		float GetParticipantAudioLevel(int32_t userID);
+		/**
+		 * Only decode and mix the count participants that are currently the loudest, 0 (default) to mix everyone.
+		 * A speaker that gets in stays in for at least half a second and is only replaced by someone clearly louder.
+		 */
+		void SetMaxActiveSpeakers(unsigned int count);
 		virtual void SetMicMute(bool mute);
 		void SetParticipantVolume(int32_t userID, float volume);
 		void SetParticipantStreams(int32_t userID, unsigned char* serializedStreams, size_t length);
@@ -28,7 +28,8 @@ VoIPGroupController::~VoIPGroupController(){
 		audioOutput->Stop();
 	}
 	LOGD("before stop audio mixer");
-	audioMixer->Stop();
+	if(!config.sendOnly)
+		audioMixer->Stop();
 	delete audioMixer;
 
 	for(vector<GroupCallParticipant>::iterator p=participants.begin();p!=participants.end();p++){
@@ -97,6 +98,10 @@ void VoIPGroupController::AddGroupCallParticipant(int32_t userID, unsigned char
 		s->userID=userID;
 		if(s->type==STREAM_TYPE_AUDIO && s->codec==CODEC_OPUS && !audioStreamID){
 			audioStreamID=s->id;
+			if(config.sendOnly){
+				incomingStreams.push_back(s);
+				continue;
+			}
 			s->jitterBuffer=make_shared<JitterBuffer>(nullptr, s->frameDuration);
 			if(s->frameDuration>50)
 				s->jitterBuffer->SetMinPacketCount((uint32_t) ServerConfig::GetSharedInstance()->GetInt("jitter_initial_delay_60", 2));
@@ -110,7 +115,11 @@ void VoIPGroupController::AddGroupCallParticipant(int32_t userID, unsigned char
 			s->decoder->SetFrameDuration(s->frameDuration);
 			s->decoder->SetDTX(true);
 			s->decoder->SetLevelMeter(p.levelMeter);
-			audioMixer->AddInput(s->callbackWrapper);
+			std::weak_ptr<OpusDecoder> decoder=s->decoder;
+			audioMixer->AddInput(s->callbackWrapper, [decoder]{
+				std::shared_ptr<OpusDecoder> d=decoder.lock();
+				return d ? d->GetActivity() : 0.0f;
+			});
 		}
 		incomingStreams.push_back(s);
 	}
@@ -130,8 +139,10 @@ void VoIPGroupController::RemoveGroupCallParticipant(int32_t userID){
 	while(stm!=incomingStreams.end()){
 		if((*stm)->userID==userID){
 			LOGI("Removed stream %d belonging to user %d", (*stm)->id, userID);
-			audioMixer->RemoveInput((*stm)->callbackWrapper);
-			(*stm)->decoder->Stop();
+			if((*stm)->decoder){
+				audioMixer->RemoveInput((*stm)->callbackWrapper);
+				(*stm)->decoder->Stop();
+			}
 			//delete (*stm)->decoder;
 			//delete (*stm)->jitterBuffer;
 			//delete (*stm)->callbackWrapper;
@@ -544,13 +555,17 @@ void VoIPGroupController::SendRelayPings(){
 }
 
 void VoIPGroupController::OnAudioOutputReady(){
-	encoder->SetDTX(true);
+	if(encoder){
+		encoder->SetDTX(true);
+		encoder->SetLevelMeter(&selfLevelMeter);
+	}
+	if(config.sendOnly)
+		return;
 	audioMixer->SetOutput(audioOutput);
 	audioMixer->SetEchoCanceller(echoCanceller);
 	audioMixer->Start();
 	audioOutput->Start();
 	audioOutStarted=true;
-	encoder->SetLevelMeter(&selfLevelMeter);
 }
 
 void VoIPGroupController::WritePacketHeader(uint32_t seq, BufferOutputStream *s, unsigned char type, uint32_t length){
@@ -670,6 +685,10 @@ int32_t VoIPGroupController::GetCurrentUnixtime(){
 	return time(NULL)+timeDifference;
 }
 
+void VoIPGroupController::SetMaxActiveSpeakers(unsigned int count){
+	audioMixer->SetMaxActiveInputs(count);
+}
+
 float VoIPGroupController::GetParticipantAudioLevel(int32_t userID){
 	if(userID==userSelfID)
 		return selfLevelMeter.GetLevel();
@@ -0,0 +1,241 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include "AudioFilePlayer.h"
+#include "../logging.h"
+#include <string.h>
+#include <algorithm>
+
+using namespace tgvoip;
+using namespace tgvoip::audio;
+
+// The ring holds this many 10 ms chunks
+#define RING_SLOTS 12
+
+AudioFilePlayer::AudioFilePlayer(unsigned int sampleRate) : sampleRate(sampleRate), slots(RING_SLOTS), ringSpace(1, 0){
+}
+
+AudioFilePlayer::~AudioFilePlayer(){
+	if(thread){
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			running=false;
+		}
+		queueCond.notify_all();
+		ringSpace.Release();
+		thread->Join();
+		delete thread;
+	}
+}
+
+void AudioFilePlayer::Play(AudioFileReader* reader){
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queue.emplace_back(reader);
+		silentHoldFiles=0;
+		// A newly queued file interrupts the hold files without waiting for the ring to drain
+		if(playingHold){
+			playingHold=false;
+			epoch++;
+		}
+		StartThreadIfNeeded();
+	}
+	queueCond.notify_one();
+}
+
+void AudioFilePlayer::SetHold(std::vector<AudioFileReader*> readers){
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		hold.clear();
+		for(AudioFileReader* reader:readers){
+			hold.emplace_back(reader);
+		}
+		holdIndex=0;
+		silentHoldFiles=0;
+		if(playingHold)
+			epoch++;
+		if(!hold.empty())
+			StartThreadIfNeeded();
+	}
+	queueCond.notify_one();
+}
+
+void AudioFilePlayer::ClearQueue(){
+	std::lock_guard<std::mutex> lock(queueMutex);
+	queue.clear();
+	// Even if the hold files are back, the end of the last queued file may still be in the ring
+	epoch++;
+}
+
+void AudioFilePlayer::ClearHold(){
+	std::lock_guard<std::mutex> lock(queueMutex);
+	hold.clear();
+	holdIndex=0;
+	if(playingHold)
+		epoch++;
+}
+
+void AudioFilePlayer::SetSampleRate(unsigned int rate){
+	sampleRate=rate;
+}
+
+bool AudioFilePlayer::Read(int16_t* data, size_t count){
+	uint32_t currentEpoch=epoch.load(std::memory_order_acquire);
+	size_t produced=0;
+	size_t firstIndex=readIndex.load(std::memory_order_relaxed);
+	while(produced<count){
+		size_t r=readIndex.load(std::memory_order_relaxed);
+		if(r==writeIndex.load(std::memory_order_acquire))
+			break;
+		Slot& slot=slots[r%slots.size()];
+		if(slot.epoch==currentEpoch){
+			const int16_t* samples=slot.samples ? slot.samples->data()+slot.offset : slot.data;
+			size_t n=std::min(count-produced, slot.length-readOffset);
+			memcpy(data+produced, samples+readOffset, n*sizeof(int16_t));
+			produced+=n;
+			readOffset+=n;
+			if(readOffset<slot.length)
+				break;
+		}
+		readOffset=0;
+		readIndex.store(r+1, std::memory_order_release);
+	}
+	if(produced<count)
+		memset(data+produced, 0, (count-produced)*sizeof(int16_t));
+	if(readIndex.load(std::memory_order_relaxed)!=firstIndex){
+		// Pairs with the fence in WaitForRingSpace(): either the thread sees the freed slot or this sees it waiting
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(waitingForSpace.load(std::memory_order_relaxed) && waitingForSpace.exchange(false))
+			ringSpace.Release();
+	}
+	return produced>0;
+}
+
+void AudioFilePlayer::StartThreadIfNeeded(){
+	if(thread)
+		return;
+	running=true;
+	thread=new Thread(std::bind(&AudioFilePlayer::RunThread, this));
+	thread->SetName("AudioFilePlayer");
+	thread->Start();
+}
+
+bool AudioFilePlayer::IsRingFull(){
+	return writeIndex.load(std::memory_order_relaxed)-readIndex.load(std::memory_order_acquire)>=slots.size();
+}
+
+void AudioFilePlayer::WaitForRingSpace(){
+	waitingForSpace=true;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	// If Read() already took the flag, its Release() is on the way and has to be consumed
+	if(IsRingFull() || !waitingForSpace.exchange(false))
+		ringSpace.Acquire();
+}
+
+void AudioFilePlayer::RunThread(){
+	while(running){
+		if(IsRingFull()){
+			WaitForRingSpace();
+			continue;
+		}
+		std::shared_ptr<AudioFileReader> reader;
+		bool fromQueue;
+		uint32_t chunkEpoch;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			fromQueue=!queue.empty();
+			if(fromQueue){
+				reader=queue.front();
+			}else if(!hold.empty() && silentHoldFiles<hold.size()){
+				reader=hold[holdIndex];
+			}else{
+				if(running)
+					queueCond.wait(lock);
+				continue;
+			}
+			playingHold=!fromQueue;
+			chunkEpoch=epoch;
+		}
+		if(reader!=decoding){
+			// Whatever the resampler still holds belongs to a file that was interrupted
+			decoding=reader;
+			currentFileProduced=false;
+			tailFlushed=false;
+			if(resampler)
+				resampler->Reset();
+		}
+
+		// Decoding runs without the lock. A chunk decoded while the queue was cleared carries the old epoch and is skipped
+		size_t w=writeIndex.load(std::memory_order_relaxed);
+		Slot& slot=slots[w%slots.size()];
+		if(DecodeChunk(reader.get(), sampleRate, slot)){
+			slot.epoch=chunkEpoch;
+			writeIndex.store(w+1, std::memory_order_release);
+			currentFileProduced=true;
+			continue;
+		}
+		bool produced=currentFileProduced;
+		decoding.reset();
+		bool rewound=fromQueue || reader->Rewind();
+
+		std::lock_guard<std::mutex> lock(queueMutex);
+		if(fromQueue){
+			// Unless ClearQueue() already dropped it
+			if(!queue.empty() && queue.front()==reader)
+				queue.pop_front();
+			continue;
+		}
+		// SetHold() or ClearHold() may have replaced the files meanwhile
+		if(holdIndex>=hold.size() || hold[holdIndex]!=reader)
+			continue;
+		// Once every hold file ended without a single sample, wait for the files to change instead of spinning
+		if(produced)
+			silentHoldFiles=0;
+		else
+			silentHoldFiles++;
+		if(!rewound){
+			LOGW("Can't rewind hold file, removing it");
+			hold.erase(hold.begin()+holdIndex);
+		}else{
+			holdIndex++;
+		}
+		if(holdIndex>=hold.size())
+			holdIndex=0;
+	}
+}
+
+bool AudioFilePlayer::DecodeChunk(AudioFileReader* reader, unsigned int rate, Slot& slot){
+	const size_t maxLength=sizeof(slot.data)/sizeof(int16_t);
+	unsigned int inputRate=reader->GetSampleRate();
+	// Dropped here rather than in Read(), so that the audio thread never frees a file
+	slot.samples.reset();
+	if(inputRate==rate){
+		slot.samples=reader->ReadInPlace(slot.offset);
+		if(slot.samples){
+			slot.length=slot.samples->size()-slot.offset;
+			if(slot.length>0)
+				return true;
+			slot.samples.reset();
+			return false;
+		}
+		slot.length=reader->Read(slot.data, std::min((size_t)(rate/100), maxLength));
+		return slot.length>0;
+	}
+	if(!resampler || resampler->GetInputRate()!=inputRate || resampler->GetOutputRate()!=rate)
+		resampler.reset(new PolyphaseResampler(inputRate, rate));
+	decodeBuffer.resize(std::max(1U, inputRate/100));
+	size_t length=reader->Read(decodeBuffer.data(), decodeBuffer.size());
+	if(!length){
+		// The end of the file is still in the filter, and the next file must not start with it
+		if(tailFlushed)
+			return false;
+		tailFlushed=true;
+		slot.length=resampler->Flush(slot.data, maxLength);
+		return slot.length>0;
+	}
+	slot.length=resampler->Process(decodeBuffer.data(), length, slot.data, maxLength);
+	return true;
+}
@@ -0,0 +1,105 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_AUDIOFILEPLAYER_H
+#define LIBTGVOIP_AUDIOFILEPLAYER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "AudioFileReader.h"
+#include "PolyphaseResampler.h"
+#include "../threading.h"
+#include "../utils.h"
+
+namespace tgvoip{ namespace audio{
+	/**
+	 * Plays a queue of audio files, falling back to looping through a list of hold files when the queue is empty.
+	 * Files are decoded and resampled ahead of time on a background thread into a small ring, so Read() only copies
+	 * samples and never blocks. The thread only takes the queue lock to pick the next file, never while it decodes, and
+	 * sleeps while the ring is full until Read() frees a slot. It's started when the first file is added.
+	 * Files already decoded in memory at the right rate (see MediaCache) take a single slot that Read() plays straight
+	 * from the shared samples, so the thread only wakes up once per file for them.
+	 */
+	class AudioFilePlayer{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(AudioFilePlayer);
+		AudioFilePlayer(unsigned int sampleRate);
+		~AudioFilePlayer();
+		/**
+		 * Append a file to the play queue. Takes ownership of the reader.
+		 */
+		void Play(AudioFileReader* reader);
+		/**
+		 * Replace the hold files. Takes ownership of the readers.
+		 */
+		void SetHold(std::vector<AudioFileReader*> readers);
+		void ClearQueue();
+		void ClearHold();
+		/**
+		 * Takes effect for the audio decoded after the call
+		 */
+		void SetSampleRate(unsigned int rate);
+		/**
+		 * Fills data with the next count samples, padding with silence if nothing is playing or decoding fell behind.
+		 * @return false if there was nothing to play
+		 */
+		bool Read(int16_t* data, size_t count);
+
+	private:
+		struct Slot{
+			uint32_t epoch;
+			size_t length;
+			// A whole file in memory, played from offset instead of data
+			std::shared_ptr<const std::vector<int16_t>> samples;
+			size_t offset;
+			int16_t data[2048];
+		};
+
+		void StartThreadIfNeeded();
+		void RunThread();
+		bool IsRingFull();
+		void WaitForRingSpace();
+		bool DecodeChunk(AudioFileReader* reader, unsigned int rate, Slot& slot);
+
+		Thread* thread=NULL;
+		std::atomic<bool> running{false};
+		std::atomic<unsigned int> sampleRate;
+
+		// The decoding thread holds its own references to the readers, so they can be removed while it decodes
+		std::mutex queueMutex;
+		std::condition_variable queueCond;
+		std::deque<std::shared_ptr<AudioFileReader>> queue;
+		std::vector<std::shared_ptr<AudioFileReader>> hold;
+		size_t holdIndex=0;
+		size_t silentHoldFiles=0;
+		bool playingHold=false;
+
+		// Slots written before the last flush are skipped by the reader
+		std::atomic<uint32_t> epoch{0};
+		std::vector<Slot> slots;
+		std::atomic<size_t> writeIndex{0};
+		std::atomic<size_t> readIndex{0};
+		size_t readOffset=0;
+		// Set by the decoding thread before it sleeps on a full ring, Read() releases ringSpace when it clears it
+		std::atomic<bool> waitingForSpace{false};
+		Semaphore ringSpace;
+
+		// Only accessed by the decoding thread
+		std::shared_ptr<AudioFileReader> decoding;
+		bool currentFileProduced=false;
+		bool tailFlushed=false;
+		std::unique_ptr<PolyphaseResampler> resampler;
+		std::vector<int16_t> decodeBuffer;
+	};
+}}
+
+#endif //LIBTGVOIP_AUDIOFILEPLAYER_H
@@ -0,0 +1,312 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include "AudioFileReader.h"
+#include "OggOpus.h"
+#include "../logging.h"
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#if defined HAVE_CONFIG_H || defined TGVOIP_USE_INSTALLED_OPUS
+#include <opus/opus.h>
+#else
+#include "opus.h"
+#endif
+
+using namespace tgvoip::audio;
+
+// Longest Opus packet is 120 ms
+#define MAX_OPUS_PACKET_SAMPLES 5760
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+namespace{
+	class OggOpusFileReader : public AudioFileReader{
+	public:
+		virtual ~OggOpusFileReader(){
+			if(decoder)
+				opus_decoder_destroy(decoder);
+			if(ogg)
+				delete ogg;
+		}
+
+		virtual size_t Read(int16_t* data, size_t count) override{
+			size_t written=0;
+			while(written<count){
+				if(pendingOffset<pending.size()){
+					size_t n=std::min(count-written, pending.size()-pendingOffset);
+					memcpy(data+written, pending.data()+pendingOffset, n*2);
+					pendingOffset+=n;
+					written+=n;
+				}else if(!DecodeNextPacket()){
+					break;
+				}
+			}
+			return written;
+		}
+
+		virtual bool Rewind() override{
+			pending.clear();
+			pendingOffset=0;
+			position=0;
+			opus_decoder_ctl(decoder, OPUS_RESET_STATE);
+			return ogg->Rewind() && ReadHeaders();
+		}
+
+	protected:
+		virtual bool Initialize(FILE* file) override{
+			ogg=new OggReader(file);
+			if(!ReadHeaders())
+				return false;
+			if(head.channels>2 || head.streamCount!=1){
+				LOGE("Ogg/Opus files with %u channels in %u streams aren't supported", head.channels, head.streamCount);
+				return false;
+			}
+			int error;
+			decoder=opus_decoder_create(48000, (int)head.channels, &error);
+			if(!decoder){
+				LOGE("Error creating Opus decoder: %d", error);
+				return false;
+			}
+			if(head.outputGain)
+				opus_decoder_ctl(decoder, OPUS_SET_GAIN(head.outputGain));
+			decoded.resize(MAX_OPUS_PACKET_SAMPLES*head.channels);
+			sampleRate=48000;
+			return true;
+		}
+
+	private:
+		bool ReadHeaders(){
+			if(!ogg->ReadPacket(packet) || !head.Parse(packet.data(), packet.size())){
+				LOGE("Missing OpusHead packet");
+				return false;
+			}
+			if(!ogg->ReadPacket(packet) || packet.size()<8 || memcmp(packet.data(), "OpusTags", 8)!=0){
+				LOGE("Missing OpusTags packet");
+				return false;
+			}
+			return true;
+		}
+
+		bool DecodeNextPacket(){
+			int64_t granule;
+			if(!ogg->ReadPacket(packet, &granule))
+				return false;
+			pending.clear();
+			pendingOffset=0;
+			if(packet.empty())
+				return true;
+			int n=opus_decode(decoder, packet.data(), (opus_int32)packet.size(), decoded.data(), MAX_OPUS_PACKET_SAMPLES, 0);
+			if(n<0){
+				LOGW("Error decoding Ogg/Opus packet: %d", n);
+				return true;
+			}
+			// Positions include the pre-skip; the granule of the last page may cut the final packet short
+			int64_t start=position;
+			int64_t end=position+n;
+			position=end;
+			if(ogg->IsEndOfStream() && granule>=0 && granule<end)
+				end=std::max(start, granule);
+			for(int64_t i=std::max(start, (int64_t)head.preSkip);i<end;i++){
+				size_t index=(size_t)(i-start);
+				if(head.channels==2)
+					pending.push_back((int16_t)(((int32_t)decoded[index*2]+decoded[index*2+1])/2));
+				else
+					pending.push_back(decoded[index]);
+			}
+			return true;
+		}
+
+		OggReader* ogg=NULL;
+		::OpusDecoder* decoder=NULL;
+		OpusHead head;
+		std::vector<unsigned char> packet;
+		std::vector<int16_t> decoded;
+		std::vector<int16_t> pending;
+		size_t pendingOffset=0;
+		int64_t position=0;
+	};
+
+	class WavFileReader : public AudioFileReader{
+	public:
+		virtual ~WavFileReader(){
+			if(file)
+				fclose(file);
+		}
+
+		virtual size_t Read(int16_t* data, size_t count) override{
+			size_t frames=std::min(count, remaining/blockAlign);
+			buffer.resize(frames*blockAlign);
+			frames=fread(buffer.data(), blockAlign, frames, file);
+			remaining-=frames*blockAlign;
+			unsigned int bytesPerSample=bitsPerSample/8;
+			for(size_t i=0;i<frames;i++){
+				const unsigned char* frame=buffer.data()+i*blockAlign;
+				int32_t sum=0;
+				for(unsigned int c=0;c<channels;c++){
+					sum+=ToInt16(frame+c*bytesPerSample);
+				}
+				data[i]=(int16_t)(sum/(int32_t)channels);
+			}
+			return frames;
+		}
+
+		virtual bool Rewind() override{
+			remaining=dataSize;
+			return fseek(file, dataStart, SEEK_SET)==0;
+		}
+
+	protected:
+		virtual bool Initialize(FILE* file) override{
+			this->file=file;
+			unsigned char riff[12];
+			if(fread(riff, 1, 12, file)!=12)
+				return false;
+			bool haveFormat=false;
+			unsigned char chunk[8];
+			while(fread(chunk, 1, 8, file)==8){
+				uint32_t size=ReadLE32(chunk+4);
+				if(memcmp(chunk, "fmt ", 4)==0){
+					unsigned char fmt[40]={0};
+					size_t fmtSize=std::min((size_t)size, sizeof(fmt));
+					if(size<16 || fread(fmt, 1, fmtSize, file)!=fmtSize)
+						return false;
+					format=ReadLE16(fmt);
+					channels=ReadLE16(fmt+2);
+					sampleRate=ReadLE32(fmt+4);
+					blockAlign=ReadLE16(fmt+12);
+					bitsPerSample=ReadLE16(fmt+14);
+					// The actual format is in the first two bytes of the subformat GUID
+					if(format==WAVE_FORMAT_EXTENSIBLE && fmtSize>=26)
+						format=ReadLE16(fmt+24);
+					haveFormat=true;
+					if(fseek(file, (long)(size-fmtSize+(size & 1)), SEEK_CUR)!=0)
+						return false;
+				}else if(memcmp(chunk, "data", 4)==0){
+					if(!haveFormat){
+						LOGE("WAV data chunk before format chunk");
+						return false;
+					}
+					dataStart=ftell(file);
+					// Files written by streaming encoders may leave the size at 0 or 0xFFFFFFFF
+					dataSize=(size==0 || size==0xFFFFFFFFU) ? SIZE_MAX : size;
+					remaining=dataSize;
+					break;
+				}else if(fseek(file, (long)size+(size & 1), SEEK_CUR)!=0){
+					return false;
+				}
+			}
+			if(!haveFormat || dataStart<0){
+				LOGE("Invalid WAV file");
+				return false;
+			}
+			bool supported=(format==WAVE_FORMAT_PCM && (bitsPerSample==8 || bitsPerSample==16 || bitsPerSample==24 || bitsPerSample==32))
+						   || (format==WAVE_FORMAT_IEEE_FLOAT && bitsPerSample==32);
+			if(!supported || channels==0 || sampleRate==0 || blockAlign!=channels*bitsPerSample/8){
+				LOGE("Unsupported WAV format %u: %u channels, %u bits, %u Hz", format, channels, bitsPerSample, sampleRate);
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		static uint16_t ReadLE16(const unsigned char* p){
+			return (uint16_t)(p[0] | (p[1] << 8));
+		}
+
+		static uint32_t ReadLE32(const unsigned char* p){
+			return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		}
+
+		int32_t ToInt16(const unsigned char* p){
+			switch(bitsPerSample){
+				case 8:
+					return ((int32_t)p[0]-128) << 8;
+				case 16:
+					return (int16_t)ReadLE16(p);
+				case 24:
+					return (int16_t)ReadLE16(p+1);
+				default:
+					if(format==WAVE_FORMAT_IEEE_FLOAT){
+						float f;
+						uint32_t bits=ReadLE32(p);
+						memcpy(&f, &bits, 4);
+						return (int32_t)(std::min(1.0f, std::max(-1.0f, f))*32767.0f);
+					}
+					return (int16_t)ReadLE16(p+2);
+			}
+		}
+
+		FILE* file=NULL;
+		unsigned int format=0;
+		unsigned int channels=0;
+		unsigned int blockAlign=0;
+		unsigned int bitsPerSample=0;
+		long dataStart=-1;
+		size_t dataSize=0;
+		size_t remaining=0;
+		std::vector<unsigned char> buffer;
+	};
+
+	class RawFileReader : public AudioFileReader{
+	public:
+		explicit RawFileReader(unsigned int rate){
+			sampleRate=rate;
+		}
+
+		virtual ~RawFileReader(){
+			if(file)
+				fclose(file);
+		}
+
+		virtual size_t Read(int16_t* data, size_t count) override{
+			return fread(data, sizeof(int16_t), count, file);
+		}
+
+		virtual bool Rewind() override{
+			return fseek(file, 0, SEEK_SET)==0;
+		}
+
+	protected:
+		virtual bool Initialize(FILE* file) override{
+			this->file=file;
+			return true;
+		}
+
+	private:
+		FILE* file=NULL;
+	};
+}
+
+AudioFileReader::~AudioFileReader(){
+}
+
+AudioFileReader* AudioFileReader::Open(const std::string& path, unsigned int rawSampleRate){
+	FILE* file=fopen(path.c_str(), "rb");
+	if(!file){
+		LOGE("Can't open %s for reading", path.c_str());
+		return NULL;
+	}
+	unsigned char magic[12];
+	size_t magicLength=fread(magic, 1, sizeof(magic), file);
+	fseek(file, 0, SEEK_SET);
+	AudioFileReader* reader;
+	if(magicLength>=4 && memcmp(magic, "OggS", 4)==0)
+		reader=new OggOpusFileReader();
+	else if(magicLength==12 && memcmp(magic, "RIFF", 4)==0 && memcmp(magic+8, "WAVE", 4)==0)
+		reader=new WavFileReader();
+	else
+		reader=new RawFileReader(rawSampleRate);
+	// The reader owns the file from here on
+	if(!reader->Initialize(file)){
+		LOGE("Can't read audio file %s", path.c_str());
+		delete reader;
+		return NULL;
+	}
+	return reader;
+}
@@ -0,0 +1,62 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_AUDIOFILEREADER_H
+#define LIBTGVOIP_AUDIOFILEREADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../utils.h"
+
+namespace tgvoip{ namespace audio{
+	/**
+	 * Decodes an audio file to mono int16 samples at the file's own sample rate.
+	 * Ogg/Opus and WAV (PCM 8/16/24/32 bit and 32 bit float) are recognized by their headers; anything else is
+	 * read as raw 16-bit little-endian mono PCM.
+	 */
+	class AudioFileReader{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(AudioFileReader);
+		virtual ~AudioFileReader();
+		/**
+		 * @param rawSampleRate sample rate to assume for raw PCM files
+		 * @return NULL if the file can't be opened or its header is invalid
+		 */
+		static AudioFileReader* Open(const std::string& path, unsigned int rawSampleRate);
+		/**
+		 * @return number of samples written, less than count only at the end of the file
+		 */
+		virtual size_t Read(int16_t* data, size_t count)=0;
+		/**
+		 * Start over from the beginning of the file
+		 */
+		virtual bool Rewind()=0;
+		/**
+		 * For readers that hold the whole file in memory: the rest of the file, without copying it. The reader is then
+		 * at the end of the file.
+		 * @param offset set to the index of the first sample that wasn't read yet
+		 * @return NULL if the file is streamed and has to be read with Read()
+		 */
+		virtual std::shared_ptr<const std::vector<int16_t>> ReadInPlace(size_t& offset){
+			return NULL;
+		}
+		unsigned int GetSampleRate() const{
+			return sampleRate;
+		}
+
+	protected:
+		AudioFileReader(){}
+		virtual bool Initialize(FILE* file)=0;
+
+		unsigned int sampleRate=48000;
+	};
+}}
+
+#endif //LIBTGVOIP_AUDIOFILEREADER_H
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include "AudioIOCallback.h"
 #include "../VoIPController.h"
 #include "../logging.h"
@@ -27,6 +28,11 @@ AudioOutput* AudioIOCallback::GetOutput() {
     return output;
 }
 
+void AudioIOCallback::SetCallHost(CallHost* host) {
+    input->SetCallHost(host);
+    output->SetCallHost(host);
+}
+
 #pragma mark - Input
 
 AudioInputCallback::AudioInputCallback() {
@@ -37,6 +43,9 @@ AudioInputCallback::AudioInputCallback() {
 }
 
 AudioInputCallback::~AudioInputCallback() {
+    if (host) {
+        host->CloseStrand(strand);
+    }
     // Ensure thread exits and is joined once
     running   = false;
     recording = false;
@@ -49,8 +58,12 @@ AudioInputCallback::~AudioInputCallback() {
 
 void AudioInputCallback::Start() {
     if (!running) {
-        running   = true;
-        thread->Start();
+        running = true;
+        if (host) {
+            host->Post(strand, std::bind(&AudioInputCallback::Tick, this), 0, 0.02);
+        } else {
+            thread->Start();
+        }
     }
     recording = true;
 }
@@ -62,7 +75,10 @@ void AudioInputCallback::Stop(){
                 return;
         recording=false;
         running=false;    // make RunThread exit ASAP
-        if(thread){
+        if(host){
+                host->CloseStrand(strand);
+                strand=host->CreateStrand("AudioInputCallback");
+        }else if(thread){
                 thread->Join();
         }
 }
@@ -71,33 +87,60 @@ void AudioInputCallback::SetDataCallback(std::function<void(int16_t*, size_t)> c
     dataCallback = std::move(c);
 }
 
+void AudioInputCallback::SetSampleRate(unsigned int rate) {
+    assert(rate <= 48000);
+    sampleRate = rate;
+}
+
+void AudioInputCallback::SetCallHost(CallHost* host) {
+    this->host = host;
+    strand = host->CreateStrand("AudioInputCallback");
+}
+
 // PATCH 1: AudioInputCallback::RunThread
 
 void AudioInputCallback::RunThread(){
-        int16_t buf[960];
+        // Paced by deadline, so sleep overshoot doesn't accumulate; that matters most on a fast clock
+        double next=VoIPController::GetCurrentTime();
         while(running){
                 // --- added to re-check and avoid blocking if stop was requested ---
                 if (!running)
                         break;
 
-                double t=VoIPController::GetCurrentTime();
-                memset(buf, 0, sizeof(buf));
-                if(dataCallback){
-                        dataCallback(buf, 960);
+                Tick();
+                next+=0.02;
+                double now=VoIPController::GetCurrentTime();
+                if(now-next>0.2){
+                        // Fell too far behind to catch up without a burst of frames
+                        next=now;
                 }
-                InvokeCallback(reinterpret_cast<unsigned char*>(buf), 960*2);
-                double sl=0.02-(VoIPController::GetCurrentTime()-t);
+                double sl=next-now;
                 if(sl>0){
                         // Sleep in small chunks and re-check 'running'
                         const double step = 0.005;
                         while(sl>0 && running){
-                                Thread::Sleep(std::min(sl, step));
-                                sl-=step;
+                                Clock::Sleep(std::min(sl, step));
+                                sl=next-VoIPController::GetCurrentTime();
                         }
                 }
         }
 }
 
+void AudioInputCallback::Tick(){
+        if(!running){
+                if(host)
+                        host->CancelSelf();
+                return;
+        }
+        int16_t buf[960];
+        size_t frameSize=sampleRate/50;
+        memset(buf, 0, sizeof(buf));
+        if(dataCallback){
+                dataCallback(buf, frameSize);
+        }
+        InvokeCallback(reinterpret_cast<unsigned char*>(buf), frameSize*2);
+}
+
 #pragma mark - Output
 
 AudioOutputCallback::AudioOutputCallback() {
@@ -108,6 +151,9 @@ AudioOutputCallback::AudioOutputCallback() {
 }
 
 AudioOutputCallback::~AudioOutputCallback() {
+    if (host) {
+        host->CloseStrand(strand);
+    }
     running = false;
     playing = false;
     if (thread) {
@@ -120,7 +166,11 @@ AudioOutputCallback::~AudioOutputCallback() {
 void AudioOutputCallback::Start() {
     if (!running) {
         running = true;
-        thread->Start();
+        if (host) {
+            host->Post(strand, std::bind(&AudioOutputCallback::Tick, this), 0, 0.02);
+        } else {
+            thread->Start();
+        }
     }
     playing = true;
 }
@@ -132,7 +182,10 @@ void AudioOutputCallback::Stop(){
                 return;
         playing=false;
         running=false;     // make RunThread exit ASAP
-        if(thread){
+        if(host){
+                host->CloseStrand(strand);
+                strand=host->CreateStrand("AudioOutputCallback");
+        }else if(thread){
                 thread->Join();
         }
 }
@@ -145,29 +198,50 @@ void AudioOutputCallback::SetDataCallback(std::function<void(int16_t*, size_t)>
     dataCallback = std::move(c);
 }
 
+void AudioOutputCallback::SetCallHost(CallHost* host) {
+    this->host = host;
+    strand = host->CreateStrand("AudioOutputCallback");
+}
+
 // PATCH 2: AudioOutputCallback::RunThread
 
 void AudioOutputCallback::RunThread(){
-        int16_t buf[960];
+        // Paced by deadline, so sleep overshoot doesn't accumulate; that matters most on a fast clock
+        double next=VoIPController::GetCurrentTime();
         while(running){
                 // --- added to re-check and avoid blocking if stop was requested ---
                 if (!running)
                         break;
 
-                double t=VoIPController::GetCurrentTime();
-                memset(buf, 0, sizeof(buf));
-                InvokeCallback(reinterpret_cast<unsigned char*>(buf), 960*2);
-                if(dataCallback){
-                        dataCallback(buf, 960);
+                Tick();
+                next+=0.02;
+                double now=VoIPController::GetCurrentTime();
+                if(now-next>0.2){
+                        // Fell too far behind to catch up without a burst of frames
+                        next=now;
                 }
-                double sl=0.02-(VoIPController::GetCurrentTime()-t);
+                double sl=next-now;
                 if(sl>0){
                         // Sleep in small chunks and re-check 'running'
                         const double step = 0.005;
                         while(sl>0 && running){
-                                Thread::Sleep(std::min(sl, step));
-                                sl-=step;
+                                Clock::Sleep(std::min(sl, step));
+                                sl=next-VoIPController::GetCurrentTime();
                         }
                 }
         }
 }
+
+void AudioOutputCallback::Tick(){
+        if(!running){
+                if(host)
+                        host->CancelSelf();
+                return;
+        }
+        int16_t buf[960];
+        memset(buf, 0, sizeof(buf));
+        InvokeCallback(reinterpret_cast<unsigned char*>(buf), 960*2);
+        if(dataCallback){
+                dataCallback(buf, 960);
+        }
+}
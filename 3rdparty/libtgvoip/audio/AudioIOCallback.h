@@ -9,8 +9,10 @@
 
 #include "AudioIO.h"
 #include <functional>
+#include <memory>
 
 #include "../threading.h"
+#include "../CallHost.h"
 
 namespace tgvoip{
 	namespace audio{
@@ -21,12 +23,21 @@ namespace tgvoip{
 			virtual void Start() override;
 			virtual void Stop() override;
 			void SetDataCallback(std::function<void(int16_t*, size_t)> c);
+			void SetCallHost(CallHost* host);
+			/**
+			 * Rate of the audio the data callback provides, 48 kHz at most. Each tick asks for 20 ms of it.
+			 */
+			void SetSampleRate(unsigned int rate);
 			void RequestStop() { running = false; recording = false; }
 		private:
 			void RunThread();
+			void Tick();
 			bool running=false;
 			bool recording=false;
+			unsigned int sampleRate=48000;
 			Thread* thread;
+			CallHost* host=NULL;
+			std::shared_ptr<CallHost::Strand> strand;
 			std::function<void(int16_t*, size_t)> dataCallback;
 		};
 
@@ -38,12 +49,16 @@ namespace tgvoip{
 			virtual void Stop() override;
 			virtual bool IsPlaying() override;
 			void SetDataCallback(std::function<void(int16_t*, size_t)> c);
+			void SetCallHost(CallHost* host);
 			void RequestStop() { running = false; playing = false; }
 		private:
 			void RunThread();
+			void Tick();
 			bool running=false;
 			bool playing=false;
 			Thread* thread;
+			CallHost* host=NULL;
+			std::shared_ptr<CallHost::Strand> strand;
 			std::function<void(int16_t*, size_t)> dataCallback;
 		};
 
@@ -53,6 +68,10 @@ namespace tgvoip{
 			virtual ~AudioIOCallback();
 			virtual AudioInput* GetInput() override;
 			virtual AudioOutput* GetOutput() override;
+			/**
+			 * Drive the 20 ms input/output ticks from a shared CallHost instead of two dedicated threads.
+			 */
+			void SetCallHost(CallHost* host);
     // NEW: stop internal worker threads
     void Stop() {
         if (input) {
@@ -0,0 +1,319 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for O_DIRECT
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "AudioRecorder.h"
+#include "../logging.h"
+#if defined HAVE_CONFIG_H || defined TGVOIP_USE_INSTALLED_OPUS
+#include <opus/opus.h>
+#else
+#include "opus.h"
+#endif
+
+using namespace tgvoip;
+using namespace tgvoip::audio;
+
+// About 2.7 seconds of 48 kHz audio, must be a power of 2
+#define RING_SIZE (1 << 17)
+#define CHUNK_SIZE (64*1024)
+// O_DIRECT needs buffers and file offsets aligned to the logical block size, 4096 covers all common devices
+#define CHUNK_ALIGNMENT 4096
+#define DRAIN_INTERVAL std::chrono::milliseconds(50)
+#define WAV_HEADER_SIZE 44
+#define MAX_OPUS_PACKET_SIZE 4000
+
+namespace{
+	void WriteLE16(unsigned char* p, uint16_t value){
+		p[0]=(unsigned char)value;
+		p[1]=(unsigned char)(value >> 8);
+	}
+
+	void WriteLE32(unsigned char* p, uint32_t value){
+		WriteLE16(p, (uint16_t)value);
+		WriteLE16(p+2, (uint16_t)(value >> 16));
+	}
+}
+
+AudioRecorder* AudioRecorder::Create(const std::string& path, Format format, unsigned int sampleRate, int bitrate, bool directIO){
+	if(sampleRate<8000 || sampleRate>192000){
+		LOGE("Can't record at %u Hz", sampleRate);
+		return NULL;
+	}
+	FILE* file=NULL;
+#ifdef __linux__
+	if(directIO){
+		int fd=open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+		if(fd>=0){
+			file=fdopen(fd, "wb");
+			if(!file)
+				close(fd);
+		}else if(errno==EINVAL){
+			LOGW("O_DIRECT isn't supported for %s, using buffered writes", path.c_str());
+		}else{
+			LOGE("Can't open %s for writing: %s", path.c_str(), strerror(errno));
+			return NULL;
+		}
+	}
+#endif
+	if(!file){
+		directIO=false;
+		file=fopen(path.c_str(), "wb");
+		if(!file){
+			LOGE("Can't open %s for writing: %s", path.c_str(), strerror(errno));
+			return NULL;
+		}
+	}
+	// Chunks are passed straight to write() so that their alignment is preserved
+	setvbuf(file, NULL, _IONBF, 0);
+	AudioRecorder* recorder=new AudioRecorder(file, format, sampleRate, directIO);
+	if(format==FORMAT_OGG_OPUS && !recorder->InitializeOpus(bitrate)){
+		delete recorder;
+		return NULL;
+	}
+	recorder->thread=new Thread(std::bind(&AudioRecorder::RunThread, recorder));
+	recorder->thread->SetName("AudioRecorder");
+	recorder->thread->Start();
+	return recorder;
+}
+
+AudioRecorder::AudioRecorder(FILE* file, Format format, unsigned int sampleRate, bool directIO) : file(file), format(format),
+		sampleRate(sampleRate), directIO(directIO), thread(NULL), ring(RING_SIZE), chunkStorage(CHUNK_SIZE+CHUNK_ALIGNMENT){
+	uintptr_t base=reinterpret_cast<uintptr_t>(chunkStorage.data());
+	chunk=chunkStorage.data()+((CHUNK_ALIGNMENT-base%CHUNK_ALIGNMENT)%CHUNK_ALIGNMENT);
+	if(format==FORMAT_WAV){
+		// The sizes are filled in when the file is closed. Until then they're set to the maximum, which most players
+		// read as "until the end of the file", so a recording that was cut off is still playable.
+		unsigned char header[WAV_HEADER_SIZE];
+		memcpy(header, "RIFF", 4);
+		WriteLE32(header+4, 0xFFFFFFFFU);
+		memcpy(header+8, "WAVEfmt ", 8);
+		WriteLE32(header+16, 16);
+		WriteLE16(header+20, 1); // PCM
+		WriteLE16(header+22, 1); // mono
+		WriteLE32(header+24, sampleRate);
+		WriteLE32(header+28, sampleRate*2);
+		WriteLE16(header+32, 2);
+		WriteLE16(header+34, 16);
+		memcpy(header+36, "data", 4);
+		WriteLE32(header+40, 0xFFFFFFFFU);
+		AppendOutput(header, sizeof(header));
+	}
+}
+
+AudioRecorder::~AudioRecorder(){
+	Close();
+	if(opusEncoder)
+		opus_encoder_destroy(opusEncoder);
+}
+
+bool AudioRecorder::InitializeOpus(int bitrate){
+	switch(sampleRate){
+		case 8000:
+		case 12000:
+		case 16000:
+		case 24000:
+		case 48000:
+			opusSampleRate=sampleRate;
+			break;
+		default:
+			opusSampleRate=48000;
+			resampler.reset(new PolyphaseResampler(sampleRate, opusSampleRate));
+	}
+	int error;
+	opusEncoder=opus_encoder_create((opus_int32)opusSampleRate, 1, OPUS_APPLICATION_VOIP, &error);
+	if(!opusEncoder){
+		LOGE("Error creating Opus encoder: %d", error);
+		return false;
+	}
+	opus_encoder_ctl(opusEncoder, OPUS_SET_BITRATE(bitrate));
+	opus_encoder_ctl(opusEncoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+	opus_int32 lookahead=0;
+	opus_encoder_ctl(opusEncoder, OPUS_GET_LOOKAHEAD(&lookahead));
+	preSkip=(unsigned int)lookahead*(48000/opusSampleRate);
+	opusFrame.resize(opusSampleRate/50);
+	opusPacket.resize(MAX_OPUS_PACKET_SIZE);
+
+	uint32_t serial=(uint32_t)std::chrono::steady_clock::now().time_since_epoch().count();
+	ogg.reset(new OggWriter(serial, [this](const unsigned char* data, size_t length){
+		AppendOutput(data, length);
+	}));
+	OpusHead head;
+	head.preSkip=preSkip;
+	head.inputSampleRate=sampleRate;
+	ogg->WriteOpusHeaders(head);
+	return true;
+}
+
+void AudioRecorder::Close(){
+	if(closed)
+		return;
+	closed=true;
+	if(!thread){
+		// Initialization failed before anything could be written
+		fclose(file);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running=false;
+	}
+	cond.notify_all();
+	thread->Join();
+	delete thread;
+}
+
+bool AudioRecorder::Write(const int16_t* data, size_t count){
+	size_t w=writePos.load(std::memory_order_relaxed);
+	size_t r=readPos.load(std::memory_order_acquire);
+	if(RING_SIZE-(w-r)<count){
+		framesDropped++;
+		return false;
+	}
+	size_t offset=w & (RING_SIZE-1);
+	size_t first=std::min(count, (size_t)RING_SIZE-offset);
+	memcpy(&ring[offset], data, first*sizeof(int16_t));
+	memcpy(&ring[0], data+first, (count-first)*sizeof(int16_t));
+	writePos.store(w+count, std::memory_order_release);
+	framesWritten++;
+	return true;
+}
+
+AudioRecorder::Stats AudioRecorder::GetStats() const{
+	return Stats{framesWritten, framesDropped, bytesWritten, writeErrors};
+}
+
+void AudioRecorder::RunThread(){
+	bool stop=false;
+	while(!stop){
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait_for(lock, DRAIN_INTERVAL, [this]{ return !running; });
+			stop=!running;
+		}
+		Drain();
+	}
+	Finish();
+}
+
+void AudioRecorder::Drain(){
+	size_t r=readPos.load(std::memory_order_relaxed);
+	size_t w=writePos.load(std::memory_order_acquire);
+	while(r!=w){
+		size_t offset=r & (RING_SIZE-1);
+		size_t length=std::min(w-r, (size_t)RING_SIZE-offset);
+		Encode(&ring[offset], length);
+		r+=length;
+		readPos.store(r, std::memory_order_release);
+	}
+}
+
+void AudioRecorder::Encode(const int16_t* data, size_t count){
+	if(format!=FORMAT_OGG_OPUS){
+		AppendOutput(data, count*sizeof(int16_t));
+		dataSize+=count*sizeof(int16_t);
+		return;
+	}
+	if(resampler){
+		resampled.resize(resampler->GetMaxOutputSize(count));
+		count=resampler->Process(data, count, resampled.data(), resampled.size());
+		data=resampled.data();
+	}
+	samplesIn+=count;
+	while(count){
+		size_t n=std::min(count, opusFrame.size()-opusFrameUsed);
+		memcpy(&opusFrame[opusFrameUsed], data, n*sizeof(int16_t));
+		opusFrameUsed+=n;
+		data+=n;
+		count-=n;
+		if(opusFrameUsed==opusFrame.size())
+			EncodeOpusFrame(INT64_MAX);
+	}
+}
+
+void AudioRecorder::EncodeOpusFrame(int64_t endGranule){
+	opus_int32 length=opus_encode(opusEncoder, opusFrame.data(), (int)opusFrame.size(), opusPacket.data(), (opus_int32)opusPacket.size());
+	opusFrameUsed=0;
+	// The position advances even if the frame is lost so that the timing of the rest of the recording stays right
+	granule+=(int64_t)opusFrame.size()*(48000/opusSampleRate);
+	if(length<0){
+		if(writeErrors==0){
+			LOGE("Error encoding recording: %d", length);
+		}
+		writeErrors++;
+		return;
+	}
+	ogg->WritePacket(opusPacket.data(), (size_t)length, std::min(granule, endGranule));
+}
+
+void AudioRecorder::AppendOutput(const void* data, size_t length){
+	const unsigned char* bytes=reinterpret_cast<const unsigned char*>(data);
+	while(length){
+		size_t n=std::min(length, (size_t)CHUNK_SIZE-chunkUsed);
+		memcpy(chunk+chunkUsed, bytes, n);
+		chunkUsed+=n;
+		bytes+=n;
+		length-=n;
+		if(chunkUsed==CHUNK_SIZE){
+			WriteChunk(chunk, CHUNK_SIZE);
+			chunkUsed=0;
+		}
+	}
+}
+
+void AudioRecorder::WriteChunk(const unsigned char* data, size_t length){
+	if(fwrite(data, 1, length, file)!=length){
+		if(writeErrors==0)
+			LOGE("Error writing recording: %s", strerror(errno));
+		writeErrors++;
+		clearerr(file);
+		return;
+	}
+	bytesWritten+=length;
+}
+
+void AudioRecorder::Finish(){
+	if(ogg){
+		// Encode until the end of the input has come out of the encoder's lookahead, the granule position of the last
+		// packet tells the decoder to drop the padding
+		int64_t end=(int64_t)preSkip+(int64_t)samplesIn*(48000/opusSampleRate);
+		while(opusFrameUsed>0 || granule<end){
+			std::fill(opusFrame.begin()+opusFrameUsed, opusFrame.end(), 0);
+			EncodeOpusFrame(end);
+		}
+		ogg->Finish();
+	}
+#ifdef __linux__
+	// Neither the unaligned tail nor the header update are whole blocks
+	if(directIO)
+		fcntl(fileno(file), F_SETFL, fcntl(fileno(file), F_GETFL) & ~O_DIRECT);
+#endif
+	if(chunkUsed){
+		WriteChunk(chunk, chunkUsed);
+		chunkUsed=0;
+	}
+	if(format==FORMAT_WAV && dataSize+WAV_HEADER_SIZE-8<=0xFFFFFFFFU){
+		unsigned char size[4];
+		WriteLE32(size, (uint32_t)(dataSize+WAV_HEADER_SIZE-8));
+		bool ok=fseek(file, 4, SEEK_SET)==0 && fwrite(size, 1, 4, file)==4;
+		WriteLE32(size, (uint32_t)dataSize);
+		ok=ok && fseek(file, WAV_HEADER_SIZE-4, SEEK_SET)==0 && fwrite(size, 1, 4, file)==4;
+		if(!ok){
+			LOGW("Can't update WAV header: %s", strerror(errno));
+		}
+	}
+	fclose(file);
+}
@@ -0,0 +1,129 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_AUDIORECORDER_H
+#define LIBTGVOIP_AUDIORECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "OggOpus.h"
+#include "PolyphaseResampler.h"
+#include "../threading.h"
+#include "../utils.h"
+
+struct OpusEncoder;
+
+namespace tgvoip{ namespace audio{
+	/**
+	 * Records mono int16 audio to a file without ever blocking the thread that produces it.
+	 * Write() only copies the samples into a lock-free ring; a background thread drains it, encodes it if needed and
+	 * writes the file in large aligned chunks. If the ring is full because the disk stalls, the frame is dropped and
+	 * counted instead.
+	 */
+	class AudioRecorder{
+	public:
+		enum Format{
+			FORMAT_RAW,       // s16le PCM without a header
+			FORMAT_WAV,
+			FORMAT_OGG_OPUS
+		};
+
+		struct Stats{
+			uint64_t framesWritten;
+			uint64_t framesDropped;
+			uint64_t bytesWritten;
+			uint64_t writeErrors;
+		};
+
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(AudioRecorder);
+		/**
+		 * @param sampleRate of the audio passed to Write()
+		 * @param bitrate of the Opus encoder, ignored for the other formats
+		 * @param directIO bypass the page cache with O_DIRECT where the OS and file system support it
+		 * @return NULL if the file can't be created
+		 */
+		static AudioRecorder* Create(const std::string& path, Format format=FORMAT_RAW, unsigned int sampleRate=48000,
+									 int bitrate=32000, bool directIO=false);
+		/**
+		 * Closes the file if Close() wasn't called
+		 */
+		~AudioRecorder();
+		/**
+		 * Writes out everything that was queued and closes the file. Write() must not be called after this.
+		 */
+		void Close();
+		/**
+		 * Queue a frame. Never blocks, safe to call from an audio thread.
+		 * @return false if the frame was dropped because the writer fell behind
+		 */
+		bool Write(const int16_t* data, size_t count);
+		Stats GetStats() const;
+		Format GetFormat() const{
+			return format;
+		}
+		unsigned int GetSampleRate() const{
+			return sampleRate;
+		}
+
+	private:
+		AudioRecorder(FILE* file, Format format, unsigned int sampleRate, bool directIO);
+		bool InitializeOpus(int bitrate);
+		void RunThread();
+		void Drain();
+		void Encode(const int16_t* data, size_t count);
+		void EncodeOpusFrame(int64_t endGranule);
+		void AppendOutput(const void* data, size_t length);
+		void WriteChunk(const unsigned char* data, size_t length);
+		void Finish();
+
+		FILE* file;
+		Format format;
+		unsigned int sampleRate;
+		bool directIO;
+		Thread* thread;  // started by Create() once the headers are written
+		bool closed=false;
+		std::mutex mutex;
+		std::condition_variable cond;
+		bool running=true;
+
+		std::vector<int16_t> ring;
+		std::atomic<size_t> writePos{0};
+		std::atomic<size_t> readPos{0};
+
+		// Output is collected here and written only in whole chunks so that file offsets stay aligned
+		std::vector<unsigned char> chunkStorage;
+		unsigned char* chunk;
+		size_t chunkUsed=0;
+		uint64_t dataSize=0;     // of the PCM data, for the WAV header
+
+		// Only used by FORMAT_OGG_OPUS, always encoded at a rate Opus supports natively
+		::OpusEncoder* opusEncoder=NULL;
+		unsigned int opusSampleRate=48000;
+		std::unique_ptr<PolyphaseResampler> resampler;
+		std::vector<int16_t> resampled;
+		std::unique_ptr<OggWriter> ogg;
+		std::vector<int16_t> opusFrame;
+		size_t opusFrameUsed=0;
+		std::vector<unsigned char> opusPacket;
+		unsigned int preSkip=0;
+		int64_t granule=0;       // of the packets encoded so far at 48 kHz, including the pre-skip
+		uint64_t samplesIn=0;    // at the encoder's rate, to trim the padding of the last frame
+
+		std::atomic<uint64_t> framesWritten{0};
+		std::atomic<uint64_t> framesDropped{0};
+		std::atomic<uint64_t> bytesWritten{0};
+		std::atomic<uint64_t> writeErrors{0};
+	};
+}}
+
+#endif //LIBTGVOIP_AUDIORECORDER_H
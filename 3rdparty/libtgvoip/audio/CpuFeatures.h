@@ -0,0 +1,56 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_CPUFEATURES_H
+#define LIBTGVOIP_CPUFEATURES_H
+
+// Which SIMD kernels can be compiled in, and the runtime check for the ones that can't be assumed.
+// AVX2 code is compiled per function with TGVOIP_TARGET_AVX2 and must only be called if CpuHasAVX2().
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#define TGVOIP_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define TGVOIP_SIMD_AVX2
+#define TGVOIP_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER)
+#define TGVOIP_SIMD_AVX2
+#define TGVOIP_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TGVOIP_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace tgvoip{ namespace audio{
+#ifdef TGVOIP_SIMD_AVX2
+	inline bool CpuHasAVX2(){
+#if defined(__GNUC__) || defined(__clang__)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#else
+		int info[4];
+		__cpuid(info, 0);
+		if(info[0]<7)
+			return false;
+		__cpuid(info, 1);
+		bool osxsave=(info[2] & (1 << 27))!=0;
+		bool avx=(info[2] & (1 << 28))!=0;
+		if(!osxsave || !avx || (_xgetbv(0) & 6)!=6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5))!=0;
+#endif
+	}
+#endif
+}}
+
+#endif //LIBTGVOIP_CPUFEATURES_H
@@ -0,0 +1,192 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <sys/stat.h>
+#include <string.h>
+#include <algorithm>
+
+#include "MediaCache.h"
+#include "PolyphaseResampler.h"
+#include "../logging.h"
+
+using namespace tgvoip;
+using namespace tgvoip::audio;
+
+#define DEFAULT_CAPACITY (256*1024*1024)
+#define DECODE_CHUNK_SIZE 4800
+
+namespace{
+	class CachedFileReader : public AudioFileReader{
+	public:
+		CachedFileReader(std::shared_ptr<const std::vector<int16_t>> samples, unsigned int rate) : samples(samples){
+			sampleRate=rate;
+		}
+
+		virtual size_t Read(int16_t* data, size_t count) override{
+			size_t n=std::min(count, samples->size()-position);
+			memcpy(data, samples->data()+position, n*sizeof(int16_t));
+			position+=n;
+			return n;
+		}
+
+		virtual bool Rewind() override{
+			position=0;
+			return true;
+		}
+
+		virtual std::shared_ptr<const std::vector<int16_t>> ReadInPlace(size_t& offset) override{
+			offset=position;
+			position=samples->size();
+			return samples;
+		}
+
+	protected:
+		virtual bool Initialize(FILE* file) override{
+			return true;
+		}
+
+	private:
+		std::shared_ptr<const std::vector<int16_t>> samples;
+		size_t position=0;
+	};
+}
+
+MediaCache* MediaCache::GetSharedInstance(){
+	static MediaCache* instance=new MediaCache();
+	return instance;
+}
+
+MediaCache::MediaCache() : capacity(DEFAULT_CAPACITY){
+}
+
+AudioFileReader* MediaCache::Open(const std::string& path, unsigned int sampleRate){
+	struct stat st;
+	if(stat(path.c_str(), &st)!=0){
+		LOGE("Can't open %s for reading", path.c_str());
+		return NULL;
+	}
+	std::pair<std::string, unsigned int> key(path, sampleRate);
+	size_t limit;
+	{
+		MutexGuard m(mutex);
+		std::map<std::pair<std::string, unsigned int>, Entry>::iterator it=entries.find(key);
+		if(it!=entries.end() && it->second.mtime==st.st_mtime && it->second.fileSize==(int64_t)st.st_size){
+			it->second.lastUsed=++useCounter;
+			hits++;
+			return new CachedFileReader(it->second.samples, sampleRate);
+		}
+		if(it!=entries.end()){
+			// The file changed, readers that were opened before keep playing the old version
+			bytes-=it->second.samples->size()*sizeof(int16_t);
+			entries.erase(it);
+		}
+		misses++;
+		size_t pinned=GetPinnedBytes();
+		limit=capacity>pinned ? capacity-pinned : 0;
+	}
+
+	// Decoding is done without holding the lock, if two calls miss the same file at once it's simply decoded twice
+	Samples samples;
+	if(limit)
+		samples=Decode(path, sampleRate, limit);
+	if(!samples)
+		return AudioFileReader::Open(path, sampleRate);
+
+	MutexGuard m(mutex);
+	std::map<std::pair<std::string, unsigned int>, Entry>::iterator existing=entries.find(key);
+	if(existing!=entries.end()){
+		// someone else decoded it at the same time
+		bytes-=existing->second.samples->size()*sizeof(int16_t);
+		entries.erase(existing);
+	}
+	size_t size=samples->size()*sizeof(int16_t);
+	if(!Evict(size)){
+		LOGW("Media cache is full of files in use (%u of %u bytes), streaming %s from disk", (unsigned int)bytes, (unsigned int)capacity, path.c_str());
+		return AudioFileReader::Open(path, sampleRate);
+	}
+	Entry& entry=entries[key];
+	entry.samples=samples;
+	entry.mtime=st.st_mtime;
+	entry.fileSize=(int64_t)st.st_size;
+	entry.lastUsed=++useCounter;
+	bytes+=size;
+	return new CachedFileReader(samples, sampleRate);
+}
+
+void MediaCache::SetCapacity(size_t bytes){
+	MutexGuard m(mutex);
+	capacity=bytes;
+	if(!Evict(0))
+		LOGW("Media cache: %u bytes of files in use exceed the new capacity of %u bytes, they're evicted once they're no longer played", (unsigned int)this->bytes, (unsigned int)capacity);
+}
+
+MediaCache::Stats MediaCache::GetStats(){
+	MutexGuard m(mutex);
+	return Stats{hits, misses, entries.size(), bytes};
+}
+
+MediaCache::Samples MediaCache::Decode(const std::string& path, unsigned int sampleRate, size_t limit){
+	std::unique_ptr<AudioFileReader> reader(AudioFileReader::Open(path, sampleRate));
+	if(!reader)
+		return NULL;
+	std::unique_ptr<PolyphaseResampler> resampler;
+	if(reader->GetSampleRate()!=sampleRate)
+		resampler.reset(new PolyphaseResampler(reader->GetSampleRate(), sampleRate));
+	std::shared_ptr<std::vector<int16_t>> samples=std::make_shared<std::vector<int16_t>>();
+	std::vector<int16_t> buffer(DECODE_CHUNK_SIZE);
+	std::vector<int16_t> resampled;
+	size_t n;
+	while((n=reader->Read(buffer.data(), buffer.size()))>0){
+		if(resampler){
+			resampled.resize(resampler->GetMaxOutputSize(n));
+			n=resampler->Process(buffer.data(), n, resampled.data(), resampled.size());
+			samples->insert(samples->end(), resampled.begin(), resampled.begin()+n);
+		}else{
+			samples->insert(samples->end(), buffer.begin(), buffer.begin()+n);
+		}
+		if(samples->size()*sizeof(int16_t)>limit){
+			LOGI("%s is too large for the media cache, streaming it from disk", path.c_str());
+			return NULL;
+		}
+	}
+	if(resampler){
+		// the end of the file is still in the filter
+		resampled.resize(resampler->GetMaxFlushSize());
+		n=resampler->Flush(resampled.data(), resampled.size());
+		samples->insert(samples->end(), resampled.begin(), resampled.begin()+n);
+	}
+	samples->shrink_to_fit();
+	return samples;
+}
+
+size_t MediaCache::GetPinnedBytes(){
+	// mutex must be held
+	size_t pinned=0;
+	for(std::map<std::pair<std::string, unsigned int>, Entry>::iterator it=entries.begin();it!=entries.end();++it){
+		if(it->second.samples.use_count()>1)
+			pinned+=it->second.samples->size()*sizeof(int16_t);
+	}
+	return pinned;
+}
+
+bool MediaCache::Evict(size_t room){
+	// mutex must be held
+	if(room>capacity)
+		return false;
+	while(bytes>capacity-room){
+		std::map<std::pair<std::string, unsigned int>, Entry>::iterator oldest=entries.end();
+		for(std::map<std::pair<std::string, unsigned int>, Entry>::iterator it=entries.begin();it!=entries.end();++it){
+			// Entries that readers still point to would stay in memory anyway
+			if(it->second.samples.use_count()==1 && (oldest==entries.end() || it->second.lastUsed<oldest->second.lastUsed))
+				oldest=it;
+		}
+		if(oldest==entries.end())
+			return false;
+		bytes-=oldest->second.samples->size()*sizeof(int16_t);
+		entries.erase(oldest);
+	}
+	return true;
+}
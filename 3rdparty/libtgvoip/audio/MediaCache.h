@@ -0,0 +1,82 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_MEDIACACHE_H
+#define LIBTGVOIP_MEDIACACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "AudioFileReader.h"
+#include "../threading.h"
+#include "../utils.h"
+
+namespace tgvoip{ namespace audio{
+	/**
+	 * Process-wide cache of decoded audio files, so that a prompt or hold loop played by many calls is read from disk,
+	 * decoded and resampled once. Readers returned by Open() are cursors into the shared samples that keep them alive;
+	 * reading and rewinding them is a memcpy with no system calls.
+	 * Files are keyed by path and sample rate, and decoded again when their modification time or size change.
+	 * Entries that no reader uses are evicted, least recently used first, when the cache grows past its capacity. Entries
+	 * in use can't be, so a file that doesn't fit next to them is streamed from disk instead of growing the cache.
+	 */
+	class MediaCache{
+	public:
+		struct Stats{
+			uint64_t hits;
+			uint64_t misses;
+			size_t entries;
+			size_t bytes;
+		};
+
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(MediaCache);
+		static MediaCache* GetSharedInstance();
+		/**
+		 * Decodes the file on a miss, which may take a while for long files, on the calling thread.
+		 * Files that don't fit into the cache at all are streamed from disk like AudioFileReader::Open() does.
+		 * @param sampleRate the samples are converted to this rate, which is also assumed for raw PCM files
+		 * @return NULL if the file can't be opened or its header is invalid
+		 */
+		AudioFileReader* Open(const std::string& path, unsigned int sampleRate);
+		/**
+		 * @param bytes of decoded audio to keep, 0 disables caching
+		 */
+		void SetCapacity(size_t bytes);
+		Stats GetStats();
+
+	private:
+		typedef std::shared_ptr<const std::vector<int16_t>> Samples;
+		struct Entry{
+			Samples samples;
+			time_t mtime;
+			int64_t fileSize;
+			uint64_t lastUsed;
+		};
+
+		MediaCache();
+		Samples Decode(const std::string& path, unsigned int sampleRate, size_t limit);
+		/**
+		 * @return whether room more bytes fit into the capacity now
+		 */
+		bool Evict(size_t room);
+		size_t GetPinnedBytes();
+
+		Mutex mutex;
+		std::map<std::pair<std::string, unsigned int>, Entry> entries;
+		size_t capacity;
+		size_t bytes=0;
+		uint64_t useCounter=0;
+		uint64_t hits=0;
+		uint64_t misses=0;
+	};
+}}
+
+#endif //LIBTGVOIP_MEDIACACHE_H
@@ -0,0 +1,149 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include "MixerKernels.h"
+#include "CpuFeatures.h"
+#include "../logging.h"
+
+using namespace tgvoip::audio;
+
+namespace{
+	void AccumulateScalar(float* out, const int16_t* in, float gain, size_t count){
+		if(gain!=1.0f){
+			for(size_t i=0;i<count;i++){
+				out[i]+=(float)in[i]*gain;
+			}
+		}else{
+			for(size_t i=0;i<count;i++){
+				out[i]+=(float)in[i];
+			}
+		}
+	}
+
+	void StoreScalar(int16_t* out, const float* in, size_t count){
+		for(size_t i=0;i<count;i++){
+			if(in[i]>32767.0f)
+				out[i]=INT16_MAX;
+			else if(in[i]<-32768.0f)
+				out[i]=INT16_MIN;
+			else
+				out[i]=(int16_t)in[i];
+		}
+	}
+
+#ifdef TGVOIP_SIMD_SSE2
+	void AccumulateSSE2(float* out, const int16_t* in, float gain, size_t count){
+		__m128 k=_mm_set1_ps(gain);
+		size_t i=0;
+		for(;i+8<=count;i+=8){
+			__m128i s=_mm_loadu_si128(reinterpret_cast<const __m128i*>(in+i));
+			// sign-extend int16 to int32 by unpacking into the high halves and shifting back down
+			__m128 lo=_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+			__m128 hi=_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+			_mm_storeu_ps(out+i, _mm_add_ps(_mm_loadu_ps(out+i), _mm_mul_ps(lo, k)));
+			_mm_storeu_ps(out+i+4, _mm_add_ps(_mm_loadu_ps(out+i+4), _mm_mul_ps(hi, k)));
+		}
+		AccumulateScalar(out+i, in+i, gain, count-i);
+	}
+
+	void StoreSSE2(int16_t* out, const float* in, size_t count){
+		__m128 max=_mm_set1_ps(32767.0f);
+		__m128 min=_mm_set1_ps(-32768.0f);
+		size_t i=0;
+		for(;i+8<=count;i+=8){
+			__m128i lo=_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in+i), min), max));
+			__m128i hi=_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in+i+4), min), max));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out+i), _mm_packs_epi32(lo, hi));
+		}
+		StoreScalar(out+i, in+i, count-i);
+	}
+#endif
+
+#ifdef TGVOIP_SIMD_AVX2
+	// No FMA: a fused multiply-add rounds differently from the scalar code
+	TGVOIP_TARGET_AVX2 void AccumulateAVX2(float* out, const int16_t* in, float gain, size_t count){
+		__m256 k=_mm256_set1_ps(gain);
+		size_t i=0;
+		for(;i+16<=count;i+=16){
+			__m256i s=_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in+i)));
+			__m256i s2=_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in+i+8)));
+			_mm256_storeu_ps(out+i, _mm256_add_ps(_mm256_loadu_ps(out+i), _mm256_mul_ps(_mm256_cvtepi32_ps(s), k)));
+			_mm256_storeu_ps(out+i+8, _mm256_add_ps(_mm256_loadu_ps(out+i+8), _mm256_mul_ps(_mm256_cvtepi32_ps(s2), k)));
+		}
+		AccumulateScalar(out+i, in+i, gain, count-i);
+	}
+
+	TGVOIP_TARGET_AVX2 void StoreAVX2(int16_t* out, const float* in, size_t count){
+		__m256 max=_mm256_set1_ps(32767.0f);
+		__m256 min=_mm256_set1_ps(-32768.0f);
+		size_t i=0;
+		for(;i+16<=count;i+=16){
+			__m256i lo=_mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in+i), min), max));
+			__m256i hi=_mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in+i+8), min), max));
+			// packs works within 128-bit lanes, so the 64-bit quarters come out as lo0 hi0 lo1 hi1
+			__m256i packed=_mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out+i), packed);
+		}
+		StoreScalar(out+i, in+i, count-i);
+	}
+#endif
+
+#ifdef TGVOIP_SIMD_NEON
+	void AccumulateNEON(float* out, const int16_t* in, float gain, size_t count){
+		float32x4_t k=vdupq_n_f32(gain);
+		size_t i=0;
+		for(;i+8<=count;i+=8){
+			int16x8_t s=vld1q_s16(in+i);
+			float32x4_t lo=vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+			float32x4_t hi=vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+			vst1q_f32(out+i, vaddq_f32(vld1q_f32(out+i), vmulq_f32(lo, k)));
+			vst1q_f32(out+i+4, vaddq_f32(vld1q_f32(out+i+4), vmulq_f32(hi, k)));
+		}
+		AccumulateScalar(out+i, in+i, gain, count-i);
+	}
+
+	void StoreNEON(int16_t* out, const float* in, size_t count){
+		size_t i=0;
+		for(;i+8<=count;i+=8){
+			// vcvtq truncates and saturates to int32, vqmovn saturates to int16
+			int16x4_t lo=vqmovn_s32(vcvtq_s32_f32(vld1q_f32(in+i)));
+			int16x4_t hi=vqmovn_s32(vcvtq_s32_f32(vld1q_f32(in+i+4)));
+			vst1q_s16(out+i, vcombine_s16(lo, hi));
+		}
+		StoreScalar(out+i, in+i, count-i);
+	}
+#endif
+
+	const MixerKernels scalarKernels{AccumulateScalar, StoreScalar, "scalar"};
+
+	const MixerKernels& SelectKernels(){
+		const MixerKernels* kernels=&scalarKernels;
+#ifdef TGVOIP_SIMD_SSE2
+		static const MixerKernels sse2{AccumulateSSE2, StoreSSE2, "sse2"};
+		kernels=&sse2;
+#endif
+#ifdef TGVOIP_SIMD_AVX2
+		static const MixerKernels avx2{AccumulateAVX2, StoreAVX2, "avx2"};
+		if(CpuHasAVX2())
+			kernels=&avx2;
+#endif
+#ifdef TGVOIP_SIMD_NEON
+		static const MixerKernels neon{AccumulateNEON, StoreNEON, "neon"};
+		kernels=&neon;
+#endif
+		LOGV("Using %s mixer kernels", kernels->name);
+		return *kernels;
+	}
+}
+
+const MixerKernels& MixerKernels::Get(){
+	static const MixerKernels& kernels=SelectKernels();
+	return kernels;
+}
+
+const MixerKernels& MixerKernels::GetScalar(){
+	return scalarKernels;
+}
@@ -0,0 +1,36 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_MIXERKERNELS_H
+#define LIBTGVOIP_MIXERKERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace tgvoip{ namespace audio{
+	/**
+	 * Inner loops of AudioMixer. Every implementation produces bit-identical results to the scalar one.
+	 */
+	struct MixerKernels{
+		/**
+		 * out[i]+=in[i]*gain
+		 */
+		void (*accumulate)(float* out, const int16_t* in, float gain, size_t count);
+		/**
+		 * out[i]=in[i], truncated towards zero and saturated to the int16 range
+		 */
+		void (*store)(int16_t* out, const float* in, size_t count);
+		const char* name;
+
+		/**
+		 * @return the fastest implementation the CPU supports, picked once at first use
+		 */
+		static const MixerKernels& Get();
+		static const MixerKernels& GetScalar();
+	};
+}}
+
+#endif //LIBTGVOIP_MIXERKERNELS_H
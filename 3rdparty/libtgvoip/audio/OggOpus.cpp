@@ -0,0 +1,262 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include "OggOpus.h"
+#include "../logging.h"
+#include <string.h>
+
+using namespace tgvoip::audio;
+
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_FLAG_CONTINUED 0x01
+#define OGG_FLAG_BEGINNING_OF_STREAM 0x02
+#define OGG_FLAG_END_OF_STREAM 0x04
+#define OGG_MAX_SEGMENTS 255
+// Pages are ended at about this size, which is around a second of speech at typical bitrates
+#define OGG_TARGET_PAGE_SIZE 4096
+
+namespace{
+	uint16_t ReadLE16(const unsigned char* p){
+		return (uint16_t)(p[0] | (p[1] << 8));
+	}
+
+	uint32_t ReadLE32(const unsigned char* p){
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	int64_t ReadLE64(const unsigned char* p){
+		return (int64_t)((uint64_t)ReadLE32(p) | ((uint64_t)ReadLE32(p+4) << 32));
+	}
+
+	void WriteLE16(unsigned char* p, uint16_t value){
+		p[0]=(unsigned char)value;
+		p[1]=(unsigned char)(value >> 8);
+	}
+
+	void WriteLE32(unsigned char* p, uint32_t value){
+		WriteLE16(p, (uint16_t)value);
+		WriteLE16(p+2, (uint16_t)(value >> 16));
+	}
+
+	void WriteLE64(unsigned char* p, int64_t value){
+		WriteLE32(p, (uint32_t)value);
+		WriteLE32(p+4, (uint32_t)((uint64_t)value >> 32));
+	}
+}
+
+bool OpusHead::Parse(const unsigned char* data, size_t length){
+	if(length<19 || memcmp(data, "OpusHead", 8)!=0)
+		return false;
+	// Only the major version is checked, minor versions are backwards compatible
+	if((data[8] >> 4)!=0)
+		return false;
+	channels=data[9];
+	preSkip=ReadLE16(data+10);
+	inputSampleRate=ReadLE32(data+12);
+	outputGain=(int16_t)ReadLE16(data+16);
+	mappingFamily=data[18];
+	if(mappingFamily!=0){
+		if(length<21)
+			return false;
+		streamCount=data[19];
+	}else{
+		streamCount=1;
+	}
+	return channels>0 && streamCount>0;
+}
+
+void OpusHead::Serialize(std::vector<unsigned char>& data) const{
+	data.resize(19);
+	memcpy(data.data(), "OpusHead", 8);
+	data[8]=1;
+	data[9]=(unsigned char)channels;
+	WriteLE16(&data[10], (uint16_t)preSkip);
+	WriteLE32(&data[12], inputSampleRate);
+	WriteLE16(&data[16], (uint16_t)outputGain);
+	data[18]=0;
+}
+
+OggReader::OggReader(FILE* file) : file(file){
+}
+
+OggReader::~OggReader(){
+	fclose(file);
+}
+
+uint32_t OggReader::Checksum(const unsigned char* data, size_t length){
+	// CRC-32 with polynomial 0x04C11DB7, no reflection, zero initial value and no final xor
+	static const std::vector<uint32_t> table=[]{
+		std::vector<uint32_t> t(256);
+		for(uint32_t i=0;i<256;i++){
+			uint32_t r=i << 24;
+			for(int j=0;j<8;j++){
+				r=(r & 0x80000000U) ? ((r << 1) ^ 0x04C11DB7U) : (r << 1);
+			}
+			t[i]=r;
+		}
+		return t;
+	}();
+	uint32_t crc=0;
+	for(size_t i=0;i<length;i++){
+		crc=(crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xFF];
+	}
+	return crc;
+}
+
+bool OggReader::ReadPage(){
+	for(;;){
+		if(fread(header, 1, OGG_PAGE_HEADER_SIZE, file)!=OGG_PAGE_HEADER_SIZE)
+			return false;
+		if(memcmp(header, "OggS", 4)!=0 || header[4]!=0){
+			LOGW("OggReader: not an Ogg page");
+			return false;
+		}
+		unsigned int segments=header[26];
+		if(fread(lacing, 1, segments, file)!=segments)
+			return false;
+		size_t size=0;
+		for(unsigned int i=0;i<segments;i++){
+			size+=lacing[i];
+		}
+		pageData.resize(size);
+		if(size && fread(pageData.data(), 1, size, file)!=size)
+			return false;
+
+		uint32_t pageSerial=ReadLE32(header+14);
+		if(!haveSerial){
+			serial=pageSerial;
+			haveSerial=true;
+		}
+		if(pageSerial!=serial)
+			continue;
+
+		uint32_t expectedChecksum=ReadLE32(header+22);
+		memset(header+22, 0, 4);
+		std::vector<unsigned char> page(header, header+OGG_PAGE_HEADER_SIZE);
+		page.insert(page.end(), lacing, lacing+segments);
+		page.insert(page.end(), pageData.begin(), pageData.end());
+		if(Checksum(page.data(), page.size())!=expectedChecksum){
+			LOGW("OggReader: bad page checksum, skipping page");
+			partial.clear();
+			continue;
+		}
+
+		bool continued=(header[5] & OGG_FLAG_CONTINUED)!=0;
+		// A packet that began on a page we didn't get can't be completed, and one that's not continued is lost
+		skipContinued=continued && partial.empty();
+		if(!continued)
+			partial.clear();
+		segmentCount=segments;
+		segmentIndex=0;
+		dataOffset=0;
+		pageGranule=ReadLE64(header+6);
+		pageEndsStream=(header[5] & OGG_FLAG_END_OF_STREAM)!=0;
+		return true;
+	}
+}
+
+bool OggReader::ReadPacket(std::vector<unsigned char>& packet, int64_t* granule){
+	for(;;){
+		while(segmentIndex<segmentCount){
+			unsigned int length=lacing[segmentIndex++];
+			if(!skipContinued)
+				partial.insert(partial.end(), pageData.begin()+dataOffset, pageData.begin()+dataOffset+length);
+			dataOffset+=length;
+			if(length==255)
+				continue;
+			if(skipContinued){
+				skipContinued=false;
+				continue;
+			}
+			packet.swap(partial);
+			partial.clear();
+			bool last=segmentIndex==segmentCount;
+			if(granule)
+				*granule=last ? pageGranule : -1;
+			endOfStream=last && pageEndsStream;
+			return true;
+		}
+		if(pageEndsStream || !ReadPage())
+			return false;
+	}
+}
+
+bool OggReader::Rewind(){
+	haveSerial=false;
+	segmentCount=segmentIndex=0;
+	dataOffset=0;
+	pageGranule=-1;
+	pageEndsStream=false;
+	endOfStream=false;
+	skipContinued=false;
+	partial.clear();
+	return fseek(file, 0, SEEK_SET)==0;
+}
+
+OggWriter::OggWriter(uint32_t serial, std::function<void(const unsigned char*, size_t)> output) : output(output), serial(serial){
+}
+
+bool OggWriter::WritePacket(const unsigned char* data, size_t length, int64_t granule){
+	// A packet of n bytes takes n/255+1 lacing values, the last one being less than 255
+	size_t segments=length/255+1;
+	if(segments>OGG_MAX_SEGMENTS){
+		LOGW("OggWriter: %u byte packet doesn't fit into a page", (unsigned int)length);
+		return false;
+	}
+	// The page is only ended before the next packet so that the last packet always goes onto the end of stream page
+	if(lacing.size()+segments>OGG_MAX_SEGMENTS || pageData.size()>=OGG_TARGET_PAGE_SIZE)
+		WritePage(false);
+	for(size_t i=0;i<segments-1;i++){
+		lacing.push_back(255);
+	}
+	lacing.push_back((unsigned char)(length%255));
+	pageData.insert(pageData.end(), data, data+length);
+	this->granule=granule;
+	return true;
+}
+
+void OggWriter::Flush(){
+	if(!lacing.empty())
+		WritePage(false);
+}
+
+void OggWriter::WriteOpusHeaders(const OpusHead& head){
+	std::vector<unsigned char> packet;
+	head.Serialize(packet);
+	WritePacket(packet.data(), packet.size(), 0);
+	Flush();
+	static const char vendor[]="libtgvoip";
+	// Vendor string followed by a comment count of zero
+	packet.assign(8+4+sizeof(vendor)-1+4, 0);
+	memcpy(packet.data(), "OpusTags", 8);
+	WriteLE32(&packet[8], sizeof(vendor)-1);
+	memcpy(&packet[12], vendor, sizeof(vendor)-1);
+	WritePacket(packet.data(), packet.size(), 0);
+	Flush();
+}
+
+void OggWriter::Finish(){
+	// The last page may be empty if the stream ended right after a flush
+	WritePage(true);
+}
+
+void OggWriter::WritePage(bool endOfStream){
+	page.resize(OGG_PAGE_HEADER_SIZE);
+	memcpy(page.data(), "OggS", 4);
+	page[4]=0;
+	page[5]=(unsigned char)((sequence==0 ? OGG_FLAG_BEGINNING_OF_STREAM : 0) | (endOfStream ? OGG_FLAG_END_OF_STREAM : 0));
+	WriteLE64(&page[6], granule);
+	WriteLE32(&page[14], serial);
+	WriteLE32(&page[18], sequence++);
+	WriteLE32(&page[22], 0);
+	page[26]=(unsigned char)lacing.size();
+	page.insert(page.end(), lacing.begin(), lacing.end());
+	page.insert(page.end(), pageData.begin(), pageData.end());
+	WriteLE32(&page[22], OggReader::Checksum(page.data(), page.size()));
+	output(page.data(), page.size());
+	lacing.clear();
+	pageData.clear();
+}
@@ -0,0 +1,123 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_OGGOPUS_H
+#define LIBTGVOIP_OGGOPUS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <vector>
+#include "../utils.h"
+
+namespace tgvoip{ namespace audio{
+	/**
+	 * The identification header of an Ogg/Opus stream (RFC 7845, section 5.1)
+	 */
+	struct OpusHead{
+		unsigned int channels=1;
+		unsigned int preSkip=0;          // samples at 48 kHz to drop from the start of the decoded stream
+		uint32_t inputSampleRate=48000;  // informational only, Opus always decodes at 48 kHz
+		int16_t outputGain=0;            // Q7.8 dB
+		unsigned int mappingFamily=0;
+		unsigned int streamCount=1;      // Opus streams multiplexed in each packet, always 1 for mapping family 0
+
+		bool Parse(const unsigned char* data, size_t length);
+		/**
+		 * Only mapping family 0 can be written
+		 */
+		void Serialize(std::vector<unsigned char>& data) const;
+	};
+
+	/**
+	 * Reads the packets of the first logical bitstream of an Ogg file.
+	 * Pages with a bad checksum are skipped along with any packet that spans them.
+	 */
+	class OggReader{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(OggReader);
+		/**
+		 * @param file opened for reading, positioned at the first page. Is closed by the reader.
+		 */
+		explicit OggReader(FILE* file);
+		~OggReader();
+		/**
+		 * @param granule set to the granule position of the page if the packet is the last one that ends on it, -1 otherwise
+		 * @return false at the end of the stream
+		 */
+		bool ReadPacket(std::vector<unsigned char>& packet, int64_t* granule=NULL);
+		/**
+		 * @return whether the packet last returned by ReadPacket ends the logical stream
+		 */
+		bool IsEndOfStream() const{
+			return endOfStream;
+		}
+		bool Rewind();
+
+		static uint32_t Checksum(const unsigned char* data, size_t length);
+
+	private:
+		bool ReadPage();
+
+		FILE* file;
+		bool haveSerial=false;
+		uint32_t serial=0;
+		unsigned char header[27];
+		unsigned char lacing[255];
+		unsigned int segmentCount=0;
+		unsigned int segmentIndex=0;
+		std::vector<unsigned char> pageData;
+		size_t dataOffset=0;
+		int64_t pageGranule=-1;
+		bool pageEndsStream=false;
+		bool endOfStream=false;
+		std::vector<unsigned char> partial;
+		bool skipContinued=false;
+	};
+
+	/**
+	 * Packs the packets of a single logical bitstream into Ogg pages.
+	 * Packets never span pages, so every page carries the granule position of its last packet.
+	 */
+	class OggWriter{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(OggWriter);
+		/**
+		 * @param output called with every complete page
+		 */
+		OggWriter(uint32_t serial, std::function<void(const unsigned char*, size_t)> output);
+		/**
+		 * @param granule position at the end of this packet
+		 * @return false if the packet is too large to fit into a page
+		 */
+		bool WritePacket(const unsigned char* data, size_t length, int64_t granule);
+		/**
+		 * Ends the current page early. The Ogg/Opus headers must each be on a page of their own.
+		 */
+		void Flush();
+		/**
+		 * Writes the OpusHead and an OpusTags packet without comments, each on its own page. Must be called first.
+		 */
+		void WriteOpusHeaders(const OpusHead& head);
+		/**
+		 * Writes the last page with the end of stream flag. Nothing can be written after this.
+		 */
+		void Finish();
+
+	private:
+		void WritePage(bool endOfStream);
+
+		std::function<void(const unsigned char*, size_t)> output;
+		uint32_t serial;
+		uint32_t sequence=0;
+		int64_t granule=0;
+		std::vector<unsigned char> lacing;
+		std::vector<unsigned char> pageData;
+		std::vector<unsigned char> page;
+	};
+}}
+
+#endif //LIBTGVOIP_OGGOPUS_H
@@ -0,0 +1,174 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <sys/stat.h>
+#include <string.h>
+
+#include "OpusPromptCache.h"
+#include "MediaCache.h"
+#include "../logging.h"
+#if defined HAVE_CONFIG_H || defined TGVOIP_USE_INSTALLED_OPUS
+#include <opus/opus.h>
+#else
+#include "opus.h"
+#endif
+
+using namespace tgvoip;
+using namespace tgvoip::audio;
+
+#define DECODE_CHUNK_SIZE 4800
+// Same as the buffer OpusEncoder encodes into
+#define MAX_PACKET_SIZE 4096
+
+namespace{
+	// Whether a suits a stream with this frame duration and bitrate better than b
+	bool IsBetterMatch(const tgvoip::audio::EncodedPrompt& a, const tgvoip::audio::EncodedPrompt& b, uint32_t frameDuration, uint32_t maxBitrate){
+		if((a.frameDuration==frameDuration)!=(b.frameDuration==frameDuration))
+			return a.frameDuration==frameDuration;
+		if((a.bitrate<=maxBitrate)!=(b.bitrate<=maxBitrate))
+			return a.bitrate<=maxBitrate;
+		return a.bitrate<=maxBitrate ? a.bitrate>b.bitrate : a.bitrate<b.bitrate;
+	}
+}
+
+OpusPromptCache* OpusPromptCache::GetSharedInstance(){
+	static OpusPromptCache* instance=new OpusPromptCache();
+	return instance;
+}
+
+OpusPromptCache::OpusPromptCache(){
+}
+
+std::shared_ptr<const EncodedPrompt> OpusPromptCache::Register(const std::string& path, unsigned int sampleRate, uint32_t frameDuration, uint32_t bitrate){
+	switch(sampleRate){
+		case 8000:
+		case 12000:
+		case 16000:
+		case 24000:
+		case 48000:
+			break;
+		default:
+			LOGE("Can't encode prompts at %u Hz", sampleRate);
+			return NULL;
+	}
+	if(frameDuration==0 || frameDuration%20!=0 || frameDuration>120){
+		LOGE("Can't encode prompts into %u ms frames", frameDuration);
+		return NULL;
+	}
+	struct stat st;
+	if(stat(path.c_str(), &st)!=0){
+		LOGE("Can't open %s for reading", path.c_str());
+		return NULL;
+	}
+	Key key(path, sampleRate, frameDuration, bitrate);
+	{
+		MutexGuard m(mutex);
+		std::map<Key, Entry>::iterator it=entries.find(key);
+		if(it!=entries.end() && it->second.mtime==st.st_mtime && it->second.fileSize==(int64_t)st.st_size)
+			return it->second.prompt;
+	}
+
+	// Encoding is done without holding the lock so that lookups by running calls aren't held up
+	std::shared_ptr<const EncodedPrompt> prompt=Encode(path, sampleRate, frameDuration, bitrate);
+	if(!prompt)
+		return NULL;
+	MutexGuard m(mutex);
+	Entry& entry=entries[key];
+	if(entry.prompt)
+		bytes-=GetSize(*entry.prompt);
+	entry.prompt=prompt;
+	entry.mtime=st.st_mtime;
+	entry.fileSize=(int64_t)st.st_size;
+	bytes+=GetSize(*prompt);
+	return prompt;
+}
+
+std::shared_ptr<const EncodedPrompt> OpusPromptCache::Find(const std::string& path, unsigned int sampleRate, uint32_t frameDuration, uint32_t maxBitrate){
+	MutexGuard m(mutex);
+	std::shared_ptr<const EncodedPrompt> best;
+	for(std::map<Key, Entry>::iterator it=entries.lower_bound(Key(path, sampleRate, 0, 0));it!=entries.end();++it){
+		if(std::get<0>(it->first)!=path || std::get<1>(it->first)!=sampleRate)
+			break;
+		if(!best || IsBetterMatch(*it->second.prompt, *best, frameDuration, maxBitrate))
+			best=it->second.prompt;
+	}
+	return best;
+}
+
+void OpusPromptCache::Unregister(const std::string& path){
+	MutexGuard m(mutex);
+	std::map<Key, Entry>::iterator it=entries.lower_bound(Key(path, 0, 0, 0));
+	while(it!=entries.end() && std::get<0>(it->first)==path){
+		bytes-=GetSize(*it->second.prompt);
+		it=entries.erase(it);
+	}
+}
+
+OpusPromptCache::Stats OpusPromptCache::GetStats(){
+	MutexGuard m(mutex);
+	return Stats{entries.size(), bytes};
+}
+
+std::shared_ptr<EncodedPrompt> OpusPromptCache::Encode(const std::string& path, unsigned int sampleRate, uint32_t frameDuration, uint32_t bitrate){
+	// The decoded samples usually come from the media cache, where play() can find them too
+	std::unique_ptr<AudioFileReader> reader(MediaCache::GetSharedInstance()->Open(path, sampleRate));
+	if(!reader)
+		return NULL;
+	std::shared_ptr<EncodedPrompt> prompt=std::make_shared<EncodedPrompt>();
+	prompt->path=path;
+	prompt->sampleRate=sampleRate;
+	prompt->frameDuration=frameDuration;
+	prompt->bitrate=bitrate;
+	prompt->frameSize=sampleRate*frameDuration/1000;
+	std::vector<int16_t>& samples=prompt->samples;
+	size_t n;
+	do{
+		size_t offset=samples.size();
+		samples.resize(offset+DECODE_CHUNK_SIZE);
+		n=reader->Read(samples.data()+offset, DECODE_CHUNK_SIZE);
+		samples.resize(offset+n);
+	}while(n>0);
+	if(samples.empty()){
+		LOGE("%s has no audio", path.c_str());
+		return NULL;
+	}
+	samples.resize((samples.size()+prompt->frameSize-1)/prompt->frameSize*prompt->frameSize, 0);
+	samples.shrink_to_fit();
+
+	// Same settings as the live encoder, so that switching between the two isn't audible
+	int error;
+	::OpusEncoder* enc=opus_encoder_create((opus_int32)sampleRate, 1, OPUS_APPLICATION_VOIP, &error);
+	if(!enc){
+		LOGE("Error creating Opus encoder: %d", error);
+		return NULL;
+	}
+	opus_encoder_ctl(enc, OPUS_SET_COMPLEXITY(10));
+	opus_encoder_ctl(enc, OPUS_SET_PACKET_LOSS_PERC(1));
+	opus_encoder_ctl(enc, OPUS_SET_INBAND_FEC(1));
+	opus_encoder_ctl(enc, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+	opus_encoder_ctl(enc, OPUS_SET_BANDWIDTH(OPUS_BANDWIDTH_FULLBAND));
+	opus_encoder_ctl(enc, OPUS_SET_BITRATE((opus_int32)bitrate));
+	unsigned char buffer[MAX_PACKET_SIZE];
+	prompt->offsets.push_back(0);
+	for(size_t offset=0;offset<samples.size();offset+=prompt->frameSize){
+		opus_int32 length=opus_encode(enc, samples.data()+offset, (int)prompt->frameSize, buffer, sizeof(buffer));
+		if(length<=0){
+			LOGE("Error encoding %s: %d", path.c_str(), length);
+			opus_encoder_destroy(enc);
+			return NULL;
+		}
+		prompt->packets.insert(prompt->packets.end(), buffer, buffer+length);
+		prompt->offsets.push_back(prompt->packets.size());
+	}
+	opus_encoder_destroy(enc);
+	prompt->packets.shrink_to_fit();
+	LOGI("Encoded %s into %u frames of %u ms, %u bytes", path.c_str(), (unsigned int)prompt->GetFrameCount(), frameDuration, (unsigned int)prompt->packets.size());
+	return prompt;
+}
+
+size_t OpusPromptCache::GetSize(const EncodedPrompt& prompt){
+	return prompt.packets.size()+prompt.samples.size()*sizeof(int16_t)+prompt.offsets.size()*sizeof(size_t);
+}
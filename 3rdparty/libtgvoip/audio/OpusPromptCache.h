@@ -0,0 +1,94 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_OPUSPROMPTCACHE_H
+#define LIBTGVOIP_OPUSPROMPTCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "../threading.h"
+#include "../utils.h"
+
+namespace tgvoip{ namespace audio{
+	/**
+	 * An audio file encoded once into Opus frames of the duration and bitrate an outgoing call stream uses, so that
+	 * OpusEncoder can send them without processing or encoding anything. The decoded samples are kept as well, for
+	 * when the prompt has to be mixed with other audio and encoded live after all.
+	 */
+	struct EncodedPrompt{
+		std::string path;
+		unsigned int sampleRate;
+		uint32_t frameDuration;
+		uint32_t bitrate;
+		size_t frameSize;              // samples per frame
+		std::vector<int16_t> samples;  // padded with silence to a whole number of frames
+		std::vector<unsigned char> packets;
+		std::vector<size_t> offsets;   // where each packet starts in packets, followed by the end of the last one
+
+		size_t GetFrameCount() const{
+			return offsets.size()-1;
+		}
+	};
+
+	/**
+	 * Process-wide registry of pre-encoded prompts, shared by all calls.
+	 * The same file can be registered for several sample rates, frame durations and bitrates.
+	 */
+	class OpusPromptCache{
+	public:
+		struct Stats{
+			size_t prompts;
+			size_t bytes;  // of packets and samples
+		};
+
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(OpusPromptCache);
+		static OpusPromptCache* GetSharedInstance();
+		/**
+		 * Decodes and encodes the file on the calling thread, unless it's already registered with the same parameters
+		 * and hasn't changed since.
+		 * @param sampleRate the capture rate of the calls that will play it: 8000, 12000, 16000, 24000 or 48000
+		 * @param frameDuration in ms, a multiple of 20 up to 120
+		 * @return NULL if the file can't be read or encoded
+		 */
+		std::shared_ptr<const EncodedPrompt> Register(const std::string& path, unsigned int sampleRate, uint32_t frameDuration, uint32_t bitrate);
+		/**
+		 * Looks up a registered prompt, preferring the highest bitrate that doesn't exceed maxBitrate. When there's none
+		 * with this frame duration, one with another duration is returned, which can only be mixed and encoded live.
+		 * @return NULL if the file isn't registered for this sample rate
+		 */
+		std::shared_ptr<const EncodedPrompt> Find(const std::string& path, unsigned int sampleRate, uint32_t frameDuration, uint32_t maxBitrate);
+		/**
+		 * Removes all versions of the file. Calls that are playing it keep their copy until they're done.
+		 */
+		void Unregister(const std::string& path);
+		Stats GetStats();
+
+	private:
+		// path, sample rate, frame duration, bitrate
+		typedef std::tuple<std::string, unsigned int, uint32_t, uint32_t> Key;
+		struct Entry{
+			std::shared_ptr<const EncodedPrompt> prompt;
+			time_t mtime;
+			int64_t fileSize;
+		};
+
+		OpusPromptCache();
+		static std::shared_ptr<EncodedPrompt> Encode(const std::string& path, unsigned int sampleRate, uint32_t frameDuration, uint32_t bitrate);
+		static size_t GetSize(const EncodedPrompt& prompt);
+
+		Mutex mutex;
+		std::map<Key, Entry> entries;
+		size_t bytes=0;
+	};
+}}
+
+#endif //LIBTGVOIP_OPUSPROMPTCACHE_H
@@ -0,0 +1,229 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include "PolyphaseResampler.h"
+#include "CpuFeatures.h"
+#include "../threading.h"
+#include "../logging.h"
+
+using namespace tgvoip;
+using namespace tgvoip::audio;
+
+// Filter taps per phase when upsampling; scaled up by the decimation factor when downsampling so the transition band stays as narrow
+#define BASE_TAPS 32
+// Passband edge relative to the lower of the two Nyquist frequencies
+#define CUTOFF 0.92
+#define KAISER_BETA 8.0
+
+struct PolyphaseResampler::FilterBank{
+	unsigned int upFactor;
+	unsigned int downFactor;
+	size_t taps;                // per phase, a multiple of 8
+	std::vector<float> coeffs;  // upFactor phases of taps coefficients each
+};
+
+namespace{
+	unsigned int gcd(unsigned int a, unsigned int b){
+		while(b){
+			unsigned int t=a%b;
+			a=b;
+			b=t;
+		}
+		return a;
+	}
+
+	double BesselI0(double x){
+		double sum=1.0, term=1.0;
+		for(int k=1;k<50;k++){
+			term*=(x/(2.0*k))*(x/(2.0*k));
+			sum+=term;
+			if(term<sum*1e-12)
+				break;
+		}
+		return sum;
+	}
+
+	float DotScalar(const float* a, const float* b, size_t count){
+		float sum=0.0f;
+		for(size_t i=0;i<count;i++){
+			sum+=a[i]*b[i];
+		}
+		return sum;
+	}
+
+#ifdef TGVOIP_SIMD_SSE2
+	float DotSSE2(const float* a, const float* b, size_t count){
+		__m128 acc0=_mm_setzero_ps();
+		__m128 acc1=_mm_setzero_ps();
+		for(size_t i=0;i<count;i+=8){
+			acc0=_mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+			acc1=_mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a+i+4), _mm_loadu_ps(b+i+4)));
+		}
+		acc0=_mm_add_ps(acc0, acc1);
+		acc0=_mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+		acc0=_mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+		return _mm_cvtss_f32(acc0);
+	}
+#endif
+
+#ifdef TGVOIP_SIMD_AVX2
+	TGVOIP_TARGET_AVX2 float DotAVX2(const float* a, const float* b, size_t count){
+		__m256 acc=_mm256_setzero_ps();
+		for(size_t i=0;i<count;i+=8){
+			acc=_mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i)));
+		}
+		__m128 sum=_mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+		sum=_mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum=_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		return _mm_cvtss_f32(sum);
+	}
+#endif
+
+#ifdef TGVOIP_SIMD_NEON
+	float DotNEON(const float* a, const float* b, size_t count){
+		float32x4_t acc0=vdupq_n_f32(0.0f);
+		float32x4_t acc1=vdupq_n_f32(0.0f);
+		for(size_t i=0;i<count;i+=8){
+			acc0=vmlaq_f32(acc0, vld1q_f32(a+i), vld1q_f32(b+i));
+			acc1=vmlaq_f32(acc1, vld1q_f32(a+i+4), vld1q_f32(b+i+4));
+		}
+		acc0=vaddq_f32(acc0, acc1);
+		float32x2_t sum=vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+		return vget_lane_f32(vpadd_f32(sum, sum), 0);
+	}
+#endif
+
+	typedef float (*DotFunction)(const float*, const float*, size_t);
+
+	// count is always a multiple of 8
+	DotFunction SelectDot(){
+		DotFunction dot=DotScalar;
+#ifdef TGVOIP_SIMD_SSE2
+		dot=DotSSE2;
+#endif
+#ifdef TGVOIP_SIMD_AVX2
+		if(CpuHasAVX2())
+			dot=DotAVX2;
+#endif
+#ifdef TGVOIP_SIMD_NEON
+		dot=DotNEON;
+#endif
+		return dot;
+	}
+
+	const DotFunction dotProduct=SelectDot();
+}
+
+std::shared_ptr<const PolyphaseResampler::FilterBank> PolyphaseResampler::GetFilterBank(unsigned int upFactor, unsigned int downFactor){
+	// Shared by every resampler with the same ratio; a bank is freed once the last of them goes away
+	static Mutex banksMutex;
+	static std::map<std::pair<unsigned int, unsigned int>, std::weak_ptr<const FilterBank>> banks;
+	MutexGuard m(banksMutex);
+	std::shared_ptr<const FilterBank> existing=banks[std::make_pair(upFactor, downFactor)].lock();
+	if(existing)
+		return existing;
+
+	std::shared_ptr<FilterBank> bank=std::make_shared<FilterBank>();
+	bank->upFactor=upFactor;
+	bank->downFactor=downFactor;
+	// Cutoff in cycles per input sample, scaled down when the output rate is lower
+	double ratio=std::min(1.0, (double)upFactor/downFactor);
+	double cutoff=0.5*CUTOFF*ratio;
+	size_t taps=(size_t)ceil(BASE_TAPS/ratio);
+	taps=(taps+7) & ~(size_t)7;
+	bank->taps=taps;
+	bank->coeffs.resize(taps*upFactor);
+	double halfWidth=taps/2.0;
+	double windowNorm=BesselI0(KAISER_BETA);
+	for(unsigned int p=0;p<upFactor;p++){
+		float* phaseCoeffs=&bank->coeffs[p*taps];
+		double sum=0.0;
+		for(size_t k=0;k<taps;k++){
+			// Distance between the output position and the input sample this tap is applied to
+			double t=(double)p/upFactor+halfWidth-1.0-k;
+			double sinc=t==0.0 ? 1.0 : sin(2.0*M_PI*cutoff*t)/(M_PI*t);
+			double x=t/halfWidth;
+			double window=fabs(x)>=1.0 ? 0.0 : BesselI0(KAISER_BETA*sqrt(1.0-x*x))/windowNorm;
+			phaseCoeffs[k]=(float)(sinc*window);
+			sum+=phaseCoeffs[k];
+		}
+		// Exactly unity gain at DC for every phase, otherwise the phases' ripple shows up as a tone at the input rate
+		for(size_t k=0;k<taps;k++){
+			phaseCoeffs[k]=(float)(phaseCoeffs[k]/sum);
+		}
+	}
+	LOGV("Created resampler filter bank %u/%u: %u phases x %u taps", upFactor, downFactor, upFactor, (unsigned int)taps);
+	banks[std::make_pair(upFactor, downFactor)]=bank;
+	return bank;
+}
+
+PolyphaseResampler::PolyphaseResampler(unsigned int inputRate, unsigned int outputRate) : inputRate(inputRate), outputRate(outputRate){
+	assert(inputRate>0 && outputRate>0);
+	unsigned int g=gcd(inputRate, outputRate);
+	bank=GetFilterBank(outputRate/g, inputRate/g);
+	Reset();
+}
+
+PolyphaseResampler::~PolyphaseResampler(){
+}
+
+void PolyphaseResampler::Reset(){
+	// Zeros before the first sample so that the first output is centered on it
+	history.assign(bank->taps/2-1, 0.0f);
+	readPos=0;
+	phase=0;
+}
+
+size_t PolyphaseResampler::Flush(int16_t* out, size_t outLen){
+	// Zeros after the last sample so that the last output is centered on it, like the first one
+	std::vector<int16_t> zeros(bank->taps/2, 0);
+	size_t produced=Process(zeros.data(), zeros.size(), out, outLen);
+	Reset();
+	return produced;
+}
+
+size_t PolyphaseResampler::GetMaxFlushSize() const{
+	return GetMaxOutputSize(bank->taps/2);
+}
+
+size_t PolyphaseResampler::GetMaxOutputSize(size_t inLen) const{
+	size_t buffered=history.size()-readPos+inLen;
+	return buffered*bank->upFactor/bank->downFactor+1;
+}
+
+size_t PolyphaseResampler::Process(const int16_t* in, size_t inLen, int16_t* out, size_t outLen){
+	history.reserve(history.size()+inLen);
+	for(size_t i=0;i<inLen;i++){
+		history.push_back((float)in[i]);
+	}
+
+	const size_t taps=bank->taps;
+	const unsigned int up=bank->upFactor;
+	const unsigned int down=bank->downFactor;
+	const float* coeffs=bank->coeffs.data();
+	size_t produced=0;
+	while(produced<outLen && readPos+taps<=history.size()){
+		float sample=dotProduct(&history[readPos], coeffs+phase*taps, taps);
+		sample=std::min(32767.0f, std::max(-32768.0f, sample));
+		out[produced++]=(int16_t)lrintf(sample);
+		phase+=down;
+		readPos+=phase/up;
+		phase%=up;
+	}
+	// Drop what the filter no longer needs
+	if(readPos>0){
+		size_t consumed=std::min(readPos, history.size());
+		history.erase(history.begin(), history.begin()+consumed);
+		readPos-=consumed;
+	}
+	return produced;
+}
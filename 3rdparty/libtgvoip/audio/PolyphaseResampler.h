@@ -0,0 +1,67 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_POLYPHASERESAMPLER_H
+#define LIBTGVOIP_POLYPHASERESAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "../utils.h"
+
+namespace tgvoip{ namespace audio{
+	/**
+	 * Streaming sample rate converter for mono int16 audio using a Kaiser-windowed sinc filter split into polyphase banks.
+	 * The conversion ratio is reduced to L/M; one filter phase is precomputed for each of the L output positions between two input
+	 * samples and shared by all resamplers with the same rates. Filter state is kept between Process() calls, so a stream can be
+	 * fed in chunks of any size without clicks at chunk boundaries.
+	 */
+	class PolyphaseResampler{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(PolyphaseResampler);
+		PolyphaseResampler(unsigned int inputRate, unsigned int outputRate);
+		~PolyphaseResampler();
+		/**
+		 * Convert the next chunk of the stream.
+		 * @return number of samples written to out. Input that doesn't fit into outLen stays buffered for the next call.
+		 */
+		size_t Process(const int16_t* in, size_t inLen, int16_t* out, size_t outLen);
+		/**
+		 * @return the most samples Process() can produce for inLen input samples
+		 */
+		size_t GetMaxOutputSize(size_t inLen) const;
+		/**
+		 * Forget the stream history, e.g. when starting a new unrelated stream.
+		 */
+		void Reset();
+		/**
+		 * End the stream: write the samples still held back by the filter, then Reset().
+		 * @return number of samples written to out, at most GetMaxFlushSize()
+		 */
+		size_t Flush(int16_t* out, size_t outLen);
+		size_t GetMaxFlushSize() const;
+		unsigned int GetInputRate() const{
+			return inputRate;
+		}
+		unsigned int GetOutputRate() const{
+			return outputRate;
+		}
+
+	private:
+		struct FilterBank;
+		static std::shared_ptr<const FilterBank> GetFilterBank(unsigned int upFactor, unsigned int downFactor);
+
+		unsigned int inputRate;
+		unsigned int outputRate;
+		std::shared_ptr<const FilterBank> bank;
+		std::vector<float> history;
+		size_t readPos;
+		unsigned int phase;
+	};
+}}
+
+#endif //LIBTGVOIP_POLYPHASERESAMPLER_H
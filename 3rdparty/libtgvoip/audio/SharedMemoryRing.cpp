@@ -0,0 +1,169 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for memfd_create
+#endif
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+
+#include "SharedMemoryRing.h"
+#include "../logging.h"
+
+using namespace tgvoip;
+using namespace tgvoip::audio;
+
+#define DATA_OFFSET 4096
+// About 43 minutes at 48 kHz, positions are 64-bit so this only bounds the size of the file
+#define MAX_CAPACITY (1 << 27)
+
+static_assert(sizeof(SharedMemoryRing::Header)<=DATA_OFFSET, "the header must fit before the samples");
+#if defined(__GCC_ATOMIC_LLONG_LOCK_FREE)
+static_assert(__GCC_ATOMIC_LLONG_LOCK_FREE==2, "ring positions are shared with another process");
+#endif
+
+SharedMemoryRing* SharedMemoryRing::Create(Role role, unsigned int sampleRate, size_t capacity){
+#ifdef __linux__
+	if(capacity==0 || capacity>MAX_CAPACITY){
+		LOGE("Invalid shared memory ring capacity %u", (unsigned int)capacity);
+		return NULL;
+	}
+	size_t roundedCapacity=1;
+	while(roundedCapacity<capacity)
+		roundedCapacity<<=1;
+	size_t size=DATA_OFFSET+roundedCapacity*sizeof(int16_t);
+
+	int memoryFD=memfd_create("tgvoip-pcm", MFD_CLOEXEC);
+	if(memoryFD<0){
+		LOGE("memfd_create failed: %s", strerror(errno));
+		return NULL;
+	}
+	if(ftruncate(memoryFD, (off_t)size)!=0){
+		LOGE("Can't resize shared memory ring: %s", strerror(errno));
+		close(memoryFD);
+		return NULL;
+	}
+	void* memory=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFD, 0);
+	if(memory==MAP_FAILED){
+		LOGE("Can't map shared memory ring: %s", strerror(errno));
+		close(memoryFD);
+		return NULL;
+	}
+	int eventFD=eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(eventFD<0){
+		LOGE("eventfd failed: %s", strerror(errno));
+		munmap(memory, size);
+		close(memoryFD);
+		return NULL;
+	}
+
+	// The file is zero-filled, which is also the initial state of the atomics
+	Header* header=new (memory) Header();
+	header->magic=MAGIC;
+	header->version=VERSION;
+	header->sampleRate=sampleRate;
+	header->capacity=(uint32_t)roundedCapacity;
+	header->dataOffset=DATA_OFFSET;
+	return new SharedMemoryRing(role, memoryFD, eventFD, memory, size, sampleRate, roundedCapacity);
+#else
+	LOGE("Shared memory rings are only supported on Linux");
+	return NULL;
+#endif
+}
+
+SharedMemoryRing::SharedMemoryRing(Role role, int memoryFD, int eventFD, void* memory, size_t size, unsigned int sampleRate,
+		size_t capacity) : role(role), memoryFD(memoryFD), eventFD(eventFD), memory(memory), size(size), sampleRate(sampleRate),
+		capacity(capacity){
+	header=reinterpret_cast<Header*>(memory);
+	data=reinterpret_cast<int16_t*>(reinterpret_cast<unsigned char*>(memory)+DATA_OFFSET);
+}
+
+SharedMemoryRing::~SharedMemoryRing(){
+#ifdef __linux__
+	// The other process keeps its mapping and descriptors, the memory is freed when it lets go of them too
+	munmap(memory, size);
+	close(memoryFD);
+	close(eventFD);
+#endif
+}
+
+bool SharedMemoryRing::Write(const int16_t* samples, size_t count){
+	assert(role==PRODUCER);
+	uint64_t w=position;
+	uint64_t r=header->readPos.load(std::memory_order_acquire);
+	if(w-r>capacity){
+		Reset(r);
+		r=w;
+	}
+	if(capacity-(size_t)(w-r)<count){
+		header->overruns.fetch_add(count, std::memory_order_relaxed);
+		return false;
+	}
+	size_t offset=(size_t)(w & (capacity-1));
+	size_t first=std::min(count, capacity-offset);
+	memcpy(data+offset, samples, first*sizeof(int16_t));
+	memcpy(data, samples+first, (count-first)*sizeof(int16_t));
+	position=w+count;
+	header->writePos.store(position, std::memory_order_release);
+	Notify();
+	return true;
+}
+
+size_t SharedMemoryRing::Read(int16_t* samples, size_t count){
+	assert(role==CONSUMER);
+	uint64_t r=position;
+	uint64_t w=header->writePos.load(std::memory_order_acquire);
+	if(w-r>capacity){
+		Reset(w);
+		w=r;
+	}
+	size_t available=std::min(count, (size_t)(w-r));
+	size_t offset=(size_t)(r & (capacity-1));
+	size_t first=std::min(available, capacity-offset);
+	memcpy(samples, data+offset, first*sizeof(int16_t));
+	memcpy(samples+first, data, (available-first)*sizeof(int16_t));
+	memset(samples+available, 0, (count-available)*sizeof(int16_t));
+	if(available<count)
+		header->underruns.fetch_add(count-available, std::memory_order_relaxed);
+	if(available){
+		position=r+available;
+		header->readPos.store(position, std::memory_order_release);
+		Notify();
+	}
+	return available;
+}
+
+void SharedMemoryRing::Reset(uint64_t otherPosition){
+	// Also covers positions that went backwards, w-r wraps around then. Only the first time is logged, a peer that keeps
+	// corrupting the ring would flood the log otherwise
+	if(!corrupt){
+		LOGE("Shared memory ring is corrupt: our position %llu, the other one %llu, capacity %u in the header and %u here; resetting it",
+			 (unsigned long long)position, (unsigned long long)otherPosition, header->capacity, (unsigned int)capacity);
+		corrupt=true;
+	}
+	header->capacity=(uint32_t)capacity;
+	header->sampleRate=sampleRate;
+	header->writePos.store(position, std::memory_order_release);
+	header->readPos.store(position, std::memory_order_release);
+	Notify();
+}
+
+void SharedMemoryRing::Notify(){
+#ifdef __linux__
+	// Fails with EAGAIN only if the counter is about to overflow, i.e. the other process isn't reading it at all
+	uint64_t one=1;
+	ssize_t written=write(eventFD, &one, sizeof(one));
+	(void)written;
+#endif
+}
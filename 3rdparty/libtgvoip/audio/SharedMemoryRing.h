@@ -0,0 +1,114 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_SHAREDMEMORYRING_H
+#define LIBTGVOIP_SHAREDMEMORYRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "../utils.h"
+
+namespace tgvoip{ namespace audio{
+	/**
+	 * Single-producer single-consumer ring of 16-bit mono PCM in an anonymous shared memory file (memfd), so that audio
+	 * can be exchanged with another process without copying it through sockets. One side is this process, the other one
+	 * maps the file descriptor it received (e.g. over a unix socket or by inheriting it) and follows the same protocol:
+	 *
+	 * - The file starts with a Header, the samples start at Header::dataOffset.
+	 * - Positions are free-running sample counters, the sample at position p is at index p & (capacity-1).
+	 * - Only the producer stores writePos and only the consumer stores readPos, both with release semantics after the
+	 *   samples were copied, and load the other one with acquire semantics.
+	 * - This process writes an 8-byte 1 to the eventfd every time it moves its own position, so that the other process
+	 *   can wait for data (or for free space) with poll or epoll instead of spinning.
+	 *
+	 * This process never blocks on the ring: a frame that doesn't fit is dropped and missing samples are read as silence.
+	 * Nothing the other process writes to the header is trusted: the capacity and this process' own position are kept
+	 * privately, and positions further apart than the capacity are treated as a corrupt ring, which is logged and reset
+	 * to empty. Only Linux is supported.
+	 */
+	class SharedMemoryRing{
+	public:
+		static const uint32_t MAGIC=0x52504754; // "TGPR"
+		static const uint32_t VERSION=1;
+
+		struct Header{
+			uint32_t magic;
+			uint32_t version;
+			uint32_t sampleRate;
+			uint32_t capacity;    // in samples, a power of 2
+			uint64_t dataOffset;  // in bytes from the start of the file, page-aligned
+			alignas(64) std::atomic<uint64_t> writePos;
+			alignas(64) std::atomic<uint64_t> readPos;
+			alignas(64) std::atomic<uint64_t> overruns;   // samples the producer dropped because the ring was full
+			std::atomic<uint64_t> underruns;              // samples the consumer wanted but found missing
+		};
+
+		enum Role{
+			PRODUCER, // this process writes, e.g. the audio a call receives
+			CONSUMER  // this process reads, e.g. the audio a call sends
+		};
+
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(SharedMemoryRing);
+		/**
+		 * @param capacity in samples, rounded up to a power of 2
+		 * @return NULL if the memory or the eventfd can't be created
+		 */
+		static SharedMemoryRing* Create(Role role, unsigned int sampleRate, size_t capacity);
+		~SharedMemoryRing();
+		/**
+		 * Only for PRODUCER rings. Writes all of the samples or, if they don't fit, none and counts them as an overrun.
+		 */
+		bool Write(const int16_t* data, size_t count);
+		/**
+		 * Only for CONSUMER rings. Fills the rest of the buffer with silence when fewer samples are available and counts
+		 * them as an underrun.
+		 * @return samples that were actually read
+		 */
+		size_t Read(int16_t* data, size_t count);
+		int GetMemoryFD() const{
+			return memoryFD;
+		}
+		int GetEventFD() const{
+			return eventFD;
+		}
+		size_t GetSize() const{
+			return size;
+		}
+		unsigned int GetSampleRate() const{
+			return sampleRate;
+		}
+		size_t GetCapacity() const{
+			return capacity;
+		}
+		uint64_t GetOverruns() const{
+			return header->overruns.load(std::memory_order_relaxed);
+		}
+		uint64_t GetUnderruns() const{
+			return header->underruns.load(std::memory_order_relaxed);
+		}
+
+	private:
+		SharedMemoryRing(Role role, int memoryFD, int eventFD, void* memory, size_t size, unsigned int sampleRate, size_t capacity);
+		void Notify();
+		void Reset(uint64_t otherPosition);
+
+		Role role;
+		int memoryFD;
+		int eventFD;
+		void* memory;
+		size_t size;
+		Header* header;
+		int16_t* data;
+		// Private copies of what's in the header
+		unsigned int sampleRate;
+		size_t capacity;
+		uint64_t position=0;  // writePos for a producer, readPos for a consumer
+		bool corrupt=false;   // was logged already
+	};
+}}
+
+#endif //LIBTGVOIP_SHAREDMEMORYRING_H
@@ -17,6 +17,8 @@
 #include "../../logging.h"
 #include "../../VoIPController.h"
 #include "../../Buffers.h"
+#include "../../Clock.h"
+#include "../../NetworkSocketLoopback.h"
 
 #ifdef __ANDROID__
 #include <jni.h>
@@ -519,6 +521,26 @@ bool NetworkSocketPosix::Select(std::vector<NetworkSocket *> &readFds, std::vect
 
 	int maxfd=canceller ? canceller->pipeRead : 0;
 
+	// A loopback socket that already has a packet due is returned without a syscall; for delayed packets select()
+	// gets a timeout instead of the socket polling
+	double loopbackTimeout=-1.0;
+	std::vector<NetworkSocket*> readyLoopbacks;
+	for(NetworkSocket*& s:readFds){
+		NetworkSocketLoopback* sl=dynamic_cast<NetworkSocketLoopback*>(s);
+		if(sl && sl->PrepareSelect(loopbackTimeout))
+			readyLoopbacks.push_back(s);
+	}
+	if(!readyLoopbacks.empty()){
+		double now=VoIPController::GetCurrentTime();
+		for(NetworkSocket*& s:readyLoopbacks){
+			s->lastSuccessfulOperationTime=now;
+		}
+		readFds=readyLoopbacks;
+		writeFds.clear();
+		errorFds.clear();
+		return true;
+	}
+
 	for(NetworkSocket*& s:readFds){
 		int sfd=GetDescriptorFromSocket(s);
 		if(sfd==0){
@@ -559,7 +581,15 @@ bool NetworkSocketPosix::Select(std::vector<NetworkSocket *> &readFds, std::vect
 			maxfd=sfd;
 	}
 
-	select(maxfd+1, &readSet, &writeSet, &errorSet, NULL);
+	if(loopbackTimeout>=0.0){
+		double realTimeout=Clock::ToRealDuration(loopbackTimeout);
+		timeval tv;
+		tv.tv_sec=(time_t)realTimeout;
+		tv.tv_usec=(suseconds_t)((realTimeout-(double)tv.tv_sec)*1000000.0)+1;
+		select(maxfd+1, &readSet, &writeSet, &errorSet, &tv);
+	}else{
+		select(maxfd+1, &readSet, &writeSet, &errorSet, NULL);
+	}
 
 	if(canceller && FD_ISSET(canceller->pipeRead, &readSet) && !anyFailed){
 		char c;
@@ -573,9 +603,14 @@ bool NetworkSocketPosix::Select(std::vector<NetworkSocket *> &readFds, std::vect
 	std::vector<NetworkSocket*>::iterator itr=readFds.begin();
 	while(itr!=readFds.end()){
 		int sfd=GetDescriptorFromSocket(*itr);
-		if(FD_ISSET(sfd, &readSet))
+		bool readable=FD_ISSET(sfd, &readSet);
+		// A loopback socket may also be due because select() timed out waiting for its delayed packet
+		NetworkSocketLoopback* sl=dynamic_cast<NetworkSocketLoopback*>(*itr);
+		if(sl && !anyFailed)
+			readable=sl->FinishSelect(readable);
+		if(readable)
 			(*itr)->lastSuccessfulOperationTime=VoIPController::GetCurrentTime();
-		if(sfd==0 || !FD_ISSET(sfd, &readSet) || !(*itr)->OnReadyToReceive()){
+		if(sfd==0 || !readable || !(*itr)->OnReadyToReceive()){
 			itr=readFds.erase(itr);
 		}else{
 			++itr;
@@ -639,5 +674,8 @@ int NetworkSocketPosix::GetDescriptorFromSocket(NetworkSocket *socket){
 	NetworkSocketWrapper* sw=dynamic_cast<NetworkSocketWrapper*>(socket);
 	if(sw)
 		return GetDescriptorFromSocket(sw->GetWrapped());
+	NetworkSocketLoopback* sl=dynamic_cast<NetworkSocketLoopback*>(socket);
+	if(sl)
+		return sl->GetDescriptor();
 	return 0;
 }
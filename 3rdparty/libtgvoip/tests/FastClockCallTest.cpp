@@ -0,0 +1,185 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+// Runs a call between two controllers in this process, connected through NetworkSocketLoopback, on a clock that
+// is 20 times faster than realtime, and checks that it gets established, that audio arrives both ways, that the
+// clock never goes backwards when its rate is changed mid-call and that the whole thing takes a fraction of the
+// simulated time. Then checks that a listen-only call, which has no encoder, still fails with ERROR_TIMEOUT when its
+// peer disappears. Exits with 0 on success, so CI can run it. Build from the libtgvoip directory with
+// c++ -std=c++14 -DTGVOIP_USE_CALLBACK_AUDIO_IO -I. tests/FastClockCallTest.cpp <build dir>/liblib_tgvoip.a -lopus -lssl -lcrypto -lpthread -o fast_clock_call_test
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <random>
+#include "Clock.h"
+#include "NetworkSocketLoopback.h"
+#include "VoIPController.h"
+
+using namespace tgvoip;
+
+#define CLOCK_RATE 20.0
+#define CONNECT_TIMEOUT 10.0  // clock seconds
+#define CALL_DURATION 30.0    // clock seconds
+#define FRAME_DURATION 0.02   // of the callback audio I/O
+
+namespace{
+	struct Side{
+		VoIPController* ctrl=NULL;
+		std::atomic<int> state{0};
+		std::atomic<unsigned int> framesReceived{0};  // that weren't silent
+		double phase=0.0;
+	};
+
+	void OnStateChanged(VoIPController* ctrl, int state){
+		reinterpret_cast<Side*>(ctrl->implData)->state=state;
+	}
+
+	void Setup(Side& side, const char* key, bool outgoing, unsigned char lastTagByte, bool listenOnly=false){
+		side.ctrl=new VoIPController();
+		side.ctrl->implData=&side;
+		VoIPController::Config cfg;
+		cfg.initTimeout=CONNECT_TIMEOUT;
+		cfg.recvTimeout=CONNECT_TIMEOUT;
+		cfg.enableAEC=cfg.enableNS=cfg.enableAGC=false;
+		cfg.enableCallUpgrade=false;
+		cfg.listenOnly=listenOnly;
+		side.ctrl->SetConfig(cfg);
+		VoIPController::Callbacks callbacks{};
+		callbacks.connectionStateChanged=OnStateChanged;
+		side.ctrl->SetCallbacks(callbacks);
+		Side* s=&side;
+		side.ctrl->SetAudioDataCallbacks([s](int16_t* buf, size_t size){
+			for(size_t i=0;i<size;i++){
+				buf[i]=(int16_t)(8000.0*sin(s->phase));
+				s->phase+=2.0*M_PI*440.0/48000.0;
+			}
+			s->phase=fmod(s->phase, 2.0*M_PI);
+		}, [s](int16_t* buf, size_t size){
+			for(size_t i=0;i<size;i++){
+				if(abs(buf[i])>1000){
+					s->framesReceived++;
+					break;
+				}
+			}
+		}, nullptr);
+		side.ctrl->SetEncryptionKey(const_cast<char*>(key), outgoing);
+		unsigned char tag[16]={0};
+		tag[15]=lastTagByte;
+		std::vector<Endpoint> endpoints;
+		endpoints.emplace_back(1, 1, IPv4Address("10.0.0.1"), IPv6Address("::0"), Endpoint::Type::UDP_RELAY, tag);
+		side.ctrl->SetRemoteEndpoints(endpoints, false, VoIPController::GetConnectionMaxLayer());
+	}
+
+	bool Check(bool condition, const char* what){
+		printf("%s: %s\n", condition ? "ok" : "FAILED", what);
+		return condition;
+	}
+
+	void Connect(Side& a, Side& b, NetworkSocketLoopback** socketB, bool listenOnly){
+		char key[256];
+		std::minstd_rand rng(1);
+		for(size_t i=0;i<sizeof(key);i++)
+			key[i]=(char)rng();
+		Setup(a, key, true, 0, listenOnly);
+		Setup(b, key, false, 1);
+		NetworkSocketLoopback* socketA;
+		NetworkSocketLoopback::CreatePair(&socketA, socketB, IPv4Address("10.0.0.1"), 1);
+		a.ctrl->SetUdpSocket(socketA);
+		b.ctrl->SetUdpSocket(*socketB);
+	}
+
+	bool TestCall(ScaledClock& clock){
+		Side a, b;
+		NetworkSocketLoopback* socketB;
+		Connect(a, b, &socketB, false);
+
+		double realStart=VoIPController::GetMonotonicTime();
+		double start=VoIPController::GetCurrentTime();
+		a.ctrl->Start();
+		b.ctrl->Start();
+		a.ctrl->Connect();
+		b.ctrl->Connect();
+		while(VoIPController::GetCurrentTime()-start<CONNECT_TIMEOUT && (a.state!=STATE_ESTABLISHED || b.state!=STATE_ESTABLISHED)){
+			Clock::Sleep(0.1);
+		}
+		bool ok=Check(a.state==STATE_ESTABLISHED && b.state==STATE_ESTABLISHED, "call established");
+
+		// Change the rate back and forth mid-call; time must keep going forward
+		double callStart=VoIPController::GetCurrentTime();
+		double last=callStart;
+		bool monotonic=true;
+		while(ok && VoIPController::GetCurrentTime()-callStart<CALL_DURATION){
+			double elapsed=VoIPController::GetCurrentTime()-callStart;
+			clock.SetRate(elapsed>CALL_DURATION/3 && elapsed<CALL_DURATION*2/3 ? CLOCK_RATE/2 : CLOCK_RATE);
+			Clock::Sleep(0.05);
+			double now=VoIPController::GetCurrentTime();
+			monotonic=monotonic && now>=last;
+			last=now;
+		}
+		double realDuration=VoIPController::GetMonotonicTime()-realStart;
+		a.ctrl->Stop();
+		b.ctrl->Stop();
+
+		if(ok){
+			// Two thirds of the call at full rate and one third at half of it
+			double expectedReal=(CONNECT_TIMEOUT+CALL_DURATION*4/3)/CLOCK_RATE;
+			unsigned int frames=(unsigned int)(CALL_DURATION/FRAME_DURATION);
+			printf("%.1f clock seconds took %.2f real seconds, received %u and %u of %u frames\n",
+				   VoIPController::GetCurrentTime()-start, realDuration, (unsigned int)a.framesReceived, (unsigned int)b.framesReceived, frames);
+			ok=Check(monotonic, "clock never went backwards") && ok;
+			ok=Check(realDuration<expectedReal, "faster than realtime") && ok;
+			ok=Check(a.framesReceived>frames/2 && b.framesReceived>frames/2, "audio received both ways") && ok;
+		}
+
+		delete a.ctrl;
+		delete b.ctrl;
+		return ok;
+	}
+
+	bool TestListenOnlyTimeout(ScaledClock& clock){
+		clock.SetRate(CLOCK_RATE);
+		Side a, b;
+		NetworkSocketLoopback* socketB;
+		Connect(a, b, &socketB, true);
+		double start=VoIPController::GetCurrentTime();
+		a.ctrl->Start();
+		b.ctrl->Start();
+		a.ctrl->Connect();
+		b.ctrl->Connect();
+		while(VoIPController::GetCurrentTime()-start<CONNECT_TIMEOUT && a.state!=STATE_ESTABLISHED){
+			Clock::Sleep(0.1);
+		}
+		bool ok=Check(a.state==STATE_ESTABLISHED, "listen-only call established");
+
+		if(ok){
+			// The peer goes silent, as if it crashed
+			NetworkSocketLoopback::Impairment impairment;
+			impairment.loss=1.0;
+			socketB->SetImpairment(impairment);
+			double dropped=VoIPController::GetCurrentTime();
+			while(VoIPController::GetCurrentTime()-dropped<CONNECT_TIMEOUT*2 && a.state!=STATE_FAILED){
+				Clock::Sleep(0.1);
+			}
+			ok=Check(a.state==STATE_FAILED && a.ctrl->GetLastError()==ERROR_TIMEOUT, "listen-only call fails when the peer is gone");
+		}
+		a.ctrl->Stop();
+		b.ctrl->Stop();
+		delete a.ctrl;
+		delete b.ctrl;
+		return ok;
+	}
+}
+
+int main(){
+	ScaledClock clock(CLOCK_RATE);
+	Clock::Install(&clock);
+	bool ok=TestCall(clock);
+	ok=TestListenOnlyTimeout(clock) && ok;
+	Clock::Install(NULL);
+	return ok ? 0 : 1;
+}
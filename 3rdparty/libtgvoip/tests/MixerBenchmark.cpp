@@ -0,0 +1,72 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+// Compares the AudioMixer kernels picked for this CPU against the scalar ones for 1 to 32 inputs
+// and checks that both produce the same output. Build from the libtgvoip directory with
+// c++ -std=c++11 -O2 -I. tests/MixerBenchmark.cpp audio/MixerKernels.cpp logging.cpp -o mixer_benchmark -lpthread
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "audio/MixerKernels.h"
+
+using namespace tgvoip::audio;
+
+#define FRAME_SIZE 960
+#define ITERATIONS 20000
+
+namespace{
+	struct Result{
+		double nsPerFrame;
+		std::vector<int16_t> output;
+	};
+
+	Result Run(const MixerKernels& kernels, const std::vector<std::vector<int16_t>>& inputs, const std::vector<float>& gains){
+		Result r;
+		r.output.resize(FRAME_SIZE);
+		float out[FRAME_SIZE];
+		std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+		for(int i=0;i<ITERATIONS;i++){
+			memset(out, 0, sizeof(out));
+			for(size_t j=0;j<inputs.size();j++){
+				kernels.accumulate(out, inputs[j].data(), gains[j], FRAME_SIZE);
+			}
+			kernels.store(r.output.data(), out, FRAME_SIZE);
+		}
+		std::chrono::duration<double, std::nano> elapsed=std::chrono::steady_clock::now()-start;
+		r.nsPerFrame=elapsed.count()/ITERATIONS;
+		return r;
+	}
+}
+
+int main(){
+	const MixerKernels& best=MixerKernels::Get();
+	const MixerKernels& scalar=MixerKernels::GetScalar();
+	printf("kernels: %s\n", best.name);
+	printf("%6s %14s %14s %8s\n", "inputs", "scalar ns/frm", "simd ns/frm", "speedup");
+	std::minstd_rand rng(42);
+	std::uniform_int_distribution<int> sample(INT16_MIN, INT16_MAX);
+	std::uniform_real_distribution<float> gain(0.2f, 1.5f);
+	bool allMatch=true;
+	for(int n=1;n<=32;n*=2){
+		std::vector<std::vector<int16_t>> inputs(n, std::vector<int16_t>(FRAME_SIZE));
+		std::vector<float> gains(n);
+		for(int j=0;j<n;j++){
+			for(int16_t& s:inputs[j])
+				s=(int16_t)sample(rng);
+			// the mixer uses a gain of exactly 1 for most inputs
+			gains[j]=j%2==0 ? 1.0f : gain(rng);
+		}
+		Result s=Run(scalar, inputs, gains);
+		Result v=Run(best, inputs, gains);
+		bool match=s.output==v.output;
+		allMatch=allMatch && match;
+		printf("%6d %14.1f %14.1f %7.2fx%s\n", n, s.nsPerFrame, v.nsPerFrame, s.nsPerFrame/v.nsPerFrame, match ? "" : "  OUTPUT MISMATCH");
+	}
+	return allMatch ? 0 : 1;
+}
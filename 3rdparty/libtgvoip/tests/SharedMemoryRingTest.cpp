@@ -0,0 +1,134 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+// Plays the other process of a SharedMemoryRing through a second mapping of its memfd: exchanges samples with both
+// roles, then corrupts the header (a huge or non-power-of-2 capacity, positions further apart than the capacity or
+// going backwards) and checks that this side neither crashes nor copies garbage, and that the ring works again after
+// it was reset. Exits with 0 on success. Linux only, best run under AddressSanitizer. Build from the libtgvoip
+// directory with
+// c++ -std=c++11 -fsanitize=address -I. tests/SharedMemoryRingTest.cpp audio/SharedMemoryRing.cpp logging.cpp -o shared_memory_ring_test -lpthread
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+#include "audio/SharedMemoryRing.h"
+
+using namespace tgvoip::audio;
+
+#define CAPACITY 1024
+#define FRAME_SIZE 480
+
+namespace{
+	struct Peer{
+		SharedMemoryRing::Header* header;
+		int16_t* data;
+		size_t size;
+
+		explicit Peer(SharedMemoryRing* ring){
+			size=ring->GetSize();
+			void* memory=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->GetMemoryFD(), 0);
+			header=reinterpret_cast<SharedMemoryRing::Header*>(memory);
+			data=reinterpret_cast<int16_t*>(reinterpret_cast<unsigned char*>(memory)+header->dataOffset);
+		}
+
+		~Peer(){
+			munmap(header, size);
+		}
+
+		// Follows the protocol with the capacity it saw when it attached
+		void Write(const int16_t* samples, size_t count){
+			uint64_t w=header->writePos.load(std::memory_order_relaxed);
+			for(size_t i=0;i<count;i++)
+				data[(w+i) & (CAPACITY-1)]=samples[i];
+			header->writePos.store(w+count, std::memory_order_release);
+		}
+
+		size_t Read(int16_t* samples, size_t count){
+			uint64_t r=header->readPos.load(std::memory_order_relaxed);
+			uint64_t w=header->writePos.load(std::memory_order_acquire);
+			size_t available=std::min(count, (size_t)(w-r));
+			for(size_t i=0;i<available;i++)
+				samples[i]=data[(r+i) & (CAPACITY-1)];
+			header->readPos.store(r+available, std::memory_order_release);
+			return available;
+		}
+	};
+
+	std::vector<int16_t> Frame(int16_t value){
+		return std::vector<int16_t>(FRAME_SIZE, value);
+	}
+
+	bool IsFilledWith(const std::vector<int16_t>& frame, int16_t value){
+		for(int16_t s:frame){
+			if(s!=value)
+				return false;
+		}
+		return true;
+	}
+
+	bool Check(bool condition, const char* what){
+		printf("%s: %s\n", condition ? "ok" : "FAILED", what);
+		return condition;
+	}
+
+	bool TestConsumer(){
+		SharedMemoryRing* ring=SharedMemoryRing::Create(SharedMemoryRing::CONSUMER, 48000, CAPACITY);
+		if(!Check(ring!=NULL, "consumer ring created"))
+			return false;
+		Peer peer(ring);
+		std::vector<int16_t> frame(FRAME_SIZE);
+
+		peer.Write(Frame(1).data(), FRAME_SIZE);
+		bool ok=Check(ring->Read(frame.data(), FRAME_SIZE)==FRAME_SIZE && IsFilledWith(frame, 1), "consumer reads what the peer wrote");
+
+		peer.header->capacity=0x7fffffff;
+		peer.header->writePos.fetch_add(1000000000);
+		ok=Check(ring->Read(frame.data(), FRAME_SIZE)==0 && IsFilledWith(frame, 0), "consumer reads silence when the peer is far ahead") && ok;
+		ok=Check(peer.header->capacity==CAPACITY && peer.header->writePos==peer.header->readPos, "consumer resets the header") && ok;
+
+		peer.header->capacity=1000;
+		peer.header->writePos.fetch_sub(10);
+		ok=Check(ring->Read(frame.data(), FRAME_SIZE)==0 && IsFilledWith(frame, 0), "consumer reads silence when the peer goes backwards") && ok;
+		ok=Check(ring->GetCapacity()==CAPACITY, "consumer keeps its own capacity") && ok;
+
+		peer.Write(Frame(2).data(), FRAME_SIZE);
+		ok=Check(ring->Read(frame.data(), FRAME_SIZE)==FRAME_SIZE && IsFilledWith(frame, 2), "consumer works again after the reset") && ok;
+		delete ring;
+		return ok;
+	}
+
+	bool TestProducer(){
+		SharedMemoryRing* ring=SharedMemoryRing::Create(SharedMemoryRing::PRODUCER, 48000, CAPACITY);
+		if(!Check(ring!=NULL, "producer ring created"))
+			return false;
+		Peer peer(ring);
+		std::vector<int16_t> frame(FRAME_SIZE);
+
+		bool ok=Check(ring->Write(Frame(1).data(), FRAME_SIZE), "producer writes");
+		ok=Check(peer.Read(frame.data(), FRAME_SIZE)==FRAME_SIZE && IsFilledWith(frame, 1), "peer reads what the producer wrote") && ok;
+
+		// A big write that only fits if the peer's position is believed
+		std::vector<int16_t> big(CAPACITY*4, 3);
+		peer.header->capacity=CAPACITY*64;
+		peer.header->readPos.fetch_add(CAPACITY*8);
+		ok=Check(!ring->Write(big.data(), big.size()), "producer drops what doesn't fit into its own capacity") && ok;
+		ok=Check(peer.header->capacity==CAPACITY && peer.header->writePos==peer.header->readPos, "producer resets the header") && ok;
+
+		peer.header->readPos.fetch_sub(CAPACITY*2);
+		ok=Check(ring->Write(Frame(4).data(), FRAME_SIZE), "producer writes after the peer went backwards") && ok;
+		ok=Check(peer.Read(frame.data(), FRAME_SIZE)==FRAME_SIZE && IsFilledWith(frame, 4), "peer reads what the producer wrote after the reset") && ok;
+		delete ring;
+		return ok;
+	}
+}
+
+int main(){
+	bool ok=TestConsumer();
+	ok=TestProducer() && ok;
+	return ok ? 0 : 1;
+}
@@ -22,14 +22,115 @@
 #include "_tgvoip.h"
 #include <iostream>
 #include <utility>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 // #include <chrono>
 
 Endpoint::Endpoint(int64_t id, std::string ip, std::string ipv6, uint16_t port, const std::string &peer_tag)
     : id(id), ip(std::move(ip)), ipv6(std::move(ipv6)), port(port), peer_tag(peer_tag) {}
 
+CallHost::CallHost(unsigned int workers) {
+    host = new tgvoip::CallHost(workers);
+}
+
+CallHost::~CallHost() {
+    // workers may be blocked on the GIL inside an audio callback
+    py::gil_scoped_release release;
+    delete host;
+}
+
+unsigned int CallHost::get_workers() {
+    return host->GetWorkerCount();
+}
+
+CallHostStats CallHost::get_stats() {
+    tgvoip::CallHost::Stats stats = host->GetStats();
+    return CallHostStats {stats.tasksExecuted, stats.tasksStolen, stats.activeStrands};
+}
+
+EncoderGroup::EncoderGroup(std::vector<uint32_t> bitrates, uint32_t frame_duration, int expected_loss) {
+    group = new tgvoip::EncoderGroup(std::move(bitrates), frame_duration, expected_loss);
+    group->SetSource(std::bind(&EncoderGroup::read_frame, this, std::placeholders::_1, std::placeholders::_2));
+    group->Start();
+}
+
+EncoderGroup::~EncoderGroup() {
+    {
+        // calls leaving the group restart their own audio capture
+        py::gil_scoped_release release;
+        delete group;
+    }
+    for (VoIPController *call : calls)
+        call->encoder_group = nullptr;
+    clear_play_queue();
+}
+
+bool EncoderGroup::add_call(VoIPController &call) {
+    if (call.encoder_group == this)
+        return true;
+    if (call.encoder_group != nullptr) {
+        std::cerr << "Call is already in another encoder group" << std::endl;
+        return false;
+    }
+    if (!group->AddCall(call.ctrl))
+        return false;
+    call.encoder_group = this;
+    calls.insert(&call);
+    return true;
+}
+
+void EncoderGroup::remove_call(VoIPController &call) {
+    if (call.encoder_group != this)
+        return;
+    {
+        py::gil_scoped_release release;
+        group->RemoveCall(call.ctrl);
+    }
+    call.encoder_group = nullptr;
+    calls.erase(&call);
+}
+
+bool EncoderGroup::play(std::string &path) {
+    tgvoip::audio::AudioFileReader *reader;
+    {
+        py::gil_scoped_release release;
+        reader = tgvoip::audio::MediaCache::GetSharedInstance()->Open(path, 48000);
+    }
+    if (reader == nullptr) {
+        std::cerr << "Unable to open file " << path << " for reading" << std::endl;
+        return false;
+    }
+    tgvoip::MutexGuard m(input_mutex);
+    if (!file_player)
+        file_player.reset(new tgvoip::audio::AudioFilePlayer(48000));
+    file_player->Play(reader);
+    return true;
+}
+
+void EncoderGroup::clear_play_queue() {
+    tgvoip::MutexGuard m(input_mutex);
+    if (file_player)
+        file_player->ClearQueue();
+}
+
+EncoderGroupStats EncoderGroup::get_stats() {
+    tgvoip::EncoderGroup::Stats stats = group->GetStats();
+    return EncoderGroupStats {stats.framesEncoded, stats.framesSent};
+}
+
+void EncoderGroup::read_frame(int16_t *buf, size_t size) {
+    tgvoip::MutexGuard m(input_mutex);
+    if (file_player)
+        file_player->Read(buf, size);
+}
+
 VoIPController::VoIPController() {
     ctrl = nullptr;
-    output_file = nullptr;
     native_io = false;
 }
 
@@ -53,6 +154,9 @@ callbacks.connectionStateChanged = [](tgvoip::VoIPController *ctrl, int state) {
         return;  // ← Prevent callback execution
     }
     
+    if (voip_ctrl->queue_event(CALL_EVENT_STATE_CHANGED, state))
+        return;
+
     try {
         voip_ctrl->_handle_state_change(CallState(state));
     } catch (...) {
@@ -60,7 +164,9 @@ callbacks.connectionStateChanged = [](tgvoip::VoIPController *ctrl, int state) {
     }
 };
     callbacks.signalBarCountChanged = [](tgvoip::VoIPController *ctrl, int count) {
-        ((VoIPController *)ctrl->implData)->_handle_signal_bars_change(count);
+        VoIPController *voip_ctrl = (VoIPController *)ctrl->implData;
+        if (!voip_ctrl->queue_event(CALL_EVENT_SIGNAL_BARS_CHANGED, count))
+            voip_ctrl->_handle_signal_bars_change(count);
     };
     callbacks.groupCallKeyReceived = nullptr;
     callbacks.groupCallKeySent = nullptr;
@@ -73,7 +179,7 @@ callbacks.connectionStateChanged = [](tgvoip::VoIPController *ctrl, int state) {
             [this](int16_t *buf, size_t size) {
                 this->recv_audio_frame(buf, size);
             },
-            [](int16_t *buf, size_t size) {}
+            nullptr
     );
 
     if (!persistent_state_file.empty()) {
@@ -96,6 +202,11 @@ callbacks.connectionStateChanged = [](tgvoip::VoIPController *ctrl, int state) {
 
 VoIPController::~VoIPController() {
     is_shutting_down = true;
+    unbridge();
+    unset_stream_output_file();
+    stop_rtp_bridge();
+    if (encoder_group != nullptr)
+        encoder_group->remove_call(*this);
     // Release GIL BEFORE stopping - prevents deadlock
     {
         py::gil_scoped_release release;  // ← ADD THIS
@@ -113,6 +224,7 @@ VoIPController::~VoIPController() {
     clear_play_queue();
     clear_hold_queue();
     unset_output_file();
+    disable_event_queue();
     if (!persistent_state_file.empty()) {
         FILE *f = fopen(persistent_state_file.c_str(), "w");
         if (f) {
@@ -167,6 +279,47 @@ void VoIPController::set_mic_mute(bool mute) {
     ctrl->SetMicMute(mute);
 }
 
+bool VoIPController::set_call_host(CallHost &host) {
+    if (!ctrl->SetCallHost(host.host)) {
+        std::cerr << "Call host must be set once, before the controller is started" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool VoIPController::connect_loopback(VoIPController &peer, const std::string &relay_ip, uint16_t relay_port) {
+    tgvoip::NetworkSocketLoopback *socket, *peer_socket;
+    tgvoip::NetworkSocketLoopback::CreatePair(&socket, &peer_socket, tgvoip::IPv4Address(relay_ip), relay_port);
+    if (!ctrl->SetUdpSocket(socket)) {
+        delete socket;
+        delete peer_socket;
+        std::cerr << "Loopback must be connected before the controllers are started" << std::endl;
+        return false;
+    }
+    loopback = socket;
+    if (!peer.ctrl->SetUdpSocket(peer_socket)) {
+        delete peer_socket;
+        std::cerr << "Loopback must be connected before the controllers are started" << std::endl;
+        return false;
+    }
+    peer.loopback = peer_socket;
+    return true;
+}
+
+bool VoIPController::set_loopback_impairment(double delay, double jitter, double loss, double reorder) {
+    if (loopback == nullptr) {
+        std::cerr << "Controller is not connected through loopback" << std::endl;
+        return false;
+    }
+    tgvoip::NetworkSocketLoopback::Impairment impairment;
+    impairment.delay = delay;
+    impairment.jitter = jitter;
+    impairment.loss = loss;
+    impairment.reorder = reorder;
+    loopback->SetImpairment(impairment);
+    return true;
+}
+
 void VoIPController::set_config(double init_timeout, double recv_timeout, DataSaving data_saving_mode, bool enable_aec,
                                 bool enable_ns, bool enable_agc,
 #ifndef _WIN32
@@ -174,7 +327,8 @@ void VoIPController::set_config(double init_timeout, double recv_timeout, DataSa
 #else
                                 const std::wstring &log_file_path, const std::wstring &status_dump_path,
 #endif
-                                bool log_packet_stats) {
+                                bool log_packet_stats, unsigned int capture_sample_rate, bool listen_only,
+                                bool send_only) {
     tgvoip::VoIPController::Config cfg;
     cfg.initTimeout = init_timeout;
     cfg.recvTimeout = recv_timeout;
@@ -188,7 +342,20 @@ void VoIPController::set_config(double init_timeout, double recv_timeout, DataSa
     if (!status_dump_path.empty())
         cfg.statsDumpFilePath = status_dump_path;
     cfg.logPacketStats = log_packet_stats;
+    cfg.audioCaptureSampleRate = capture_sample_rate;
+    cfg.listenOnly = listen_only;
+    cfg.sendOnly = send_only;
     ctrl->SetConfig(cfg);
+    // the input mutex is held by the audio thread while it waits for the GIL
+    py::gil_scoped_release release;
+    tgvoip::MutexGuard m(input_mutex);
+    this->capture_sample_rate = capture_sample_rate;
+    update_input_resampler();
+    std::shared_ptr<BridgeLink> link = std::atomic_load(&bridge_link);
+    if (link) {
+        tgvoip::MutexGuard lm(link->mutex);
+        link->set_capture_rate(bridge_side, capture_sample_rate);
+    }
 }
 
 void VoIPController::debug_ctl(int request, int param) {
@@ -214,6 +381,45 @@ Stats VoIPController::get_stats() {
     };
 }
 
+CallStats VoIPController::get_call_stats() {
+    tgvoip::VoIPController::CallStats s;
+    ctrl->GetCallStats(&s);
+    CallStats stats {
+        s.traffic.bytesSentWifi,
+        s.traffic.bytesSentMobile,
+        s.traffic.bytesRecvdWifi,
+        s.traffic.bytesRecvdMobile,
+        CallState(s.state),
+        s.signalBars,
+        s.rtt,
+        s.minRtt,
+        s.jitterDelay,
+        s.jitterMinPackets,
+        s.jitter,
+        s.packetsSent,
+        s.packetsReceived,
+        s.sendLossCount,
+        s.recvLossCount,
+        {},
+        s.expectedLossPercent,
+        s.audioBitrate,
+        s.inflightBytes,
+        s.congestionWindow,
+        s.unsentPackets,
+        s.extraEcLevel,
+        s.currentEndpointID,
+        s.currentEndpointType,
+        s.currentEndpointRtt,
+    };
+    static_assert(sizeof(s.sendLossHistory) == sizeof(stats.send_loss_history), "send loss history size mismatch");
+    memcpy(stats.send_loss_history.data(), s.sendLossHistory, sizeof(s.sendLossHistory));
+    return stats;
+}
+
+void VoIPController::set_metrics_label(const std::string &label) {
+    ctrl->SetMetricsLabel(label);
+}
+
 std::string VoIPController::get_debug_log() {
     return ctrl->GetDebugLog();
 }
@@ -258,6 +464,132 @@ std::string VoIPController::get_current_audio_output_id() {
     return ctrl->GetCurrentAudioOutputID();
 } */
 
+void BridgeLink::set_capture_rate(int side, unsigned int rate) {
+    capture_rates[side] = rate;
+    resamplers[1 - side].reset(rate == 48000 ? nullptr : new tgvoip::audio::PolyphaseResampler(48000, rate));
+    pcm[1 - side].clear();
+}
+
+bool VoIPController::bridge(VoIPController &peer) {
+    if (&peer == this) {
+        std::cerr << "Can't bridge a call with itself" << std::endl;
+        return false;
+    }
+    if (std::atomic_load(&bridge_link) || std::atomic_load(&peer.bridge_link)) {
+        std::cerr << "Call is already bridged" << std::endl;
+        return false;
+    }
+    tgvoip::CallBridge *tmp = tgvoip::CallBridge::Create(ctrl, peer.ctrl);
+    if (!tmp) {
+        std::cerr << "Call audio is already fed by an encoder group or an RTP bridge" << std::endl;
+        return false;
+    }
+    auto link = std::make_shared<BridgeLink>();
+    link->sides[0] = this;
+    link->sides[1] = &peer;
+    link->bridge.reset(tmp);
+    {
+        // the input mutexes are held by audio threads that wait for the GIL
+        py::gil_scoped_release release;
+        {
+            tgvoip::MutexGuard m(input_mutex);
+            link->set_capture_rate(0, capture_sample_rate);
+        }
+        tgvoip::MutexGuard m(peer.input_mutex);
+        link->set_capture_rate(1, peer.capture_sample_rate);
+    }
+    bridge_side = 0;
+    peer.bridge_side = 1;
+    std::atomic_store(&bridge_link, link);
+    std::atomic_store(&peer.bridge_link, link);
+    return true;
+}
+
+void VoIPController::unbridge() {
+    std::shared_ptr<BridgeLink> link = std::atomic_exchange(&bridge_link, std::shared_ptr<BridgeLink>());
+    if (!link)
+        return;
+    VoIPController *peer = link->sides[1 - bridge_side];
+    std::atomic_store(&peer->bridge_link, std::shared_ptr<BridgeLink>());
+    // other threads may still hold the link, but the bridge must go now: it needs both controllers
+    std::unique_ptr<tgvoip::CallBridge> bridge;
+    {
+        tgvoip::MutexGuard m(link->mutex);
+        bridge = std::move(link->bridge);
+    }
+    {
+        // waits for taps that are running on the receive threads
+        py::gil_scoped_release release;
+        bridge.reset();
+    }
+}
+
+bool VoIPController::is_bridge_forwarding() {
+    std::shared_ptr<BridgeLink> link = std::atomic_load(&bridge_link);
+    if (!link)
+        return false;
+    tgvoip::MutexGuard m(link->mutex);
+    if (!link->bridge)
+        return false;
+    return bridge_side == 0 ? link->bridge->IsForwardingBToA() : link->bridge->IsForwardingAToB();
+}
+
+bool VoIPController::set_input_sample_rate(unsigned int rate) {
+    if (rate < 8000 || rate > 192000) {
+        std::cerr << "Unsupported input sample rate " << rate << std::endl;
+        return false;
+    }
+    // the input mutex is held by the audio thread while it waits for the GIL
+    py::gil_scoped_release release;
+    tgvoip::MutexGuard m(input_mutex);
+    if (shm_input && shm_input->GetSampleRate() != rate) {
+        std::cerr << "Can't change the input sample rate while shared memory I/O is enabled" << std::endl;
+        return false;
+    }
+    input_sample_rate = rate;
+    update_input_resampler();
+    if (file_player)
+        file_player->SetSampleRate(rate);
+    return true;
+}
+
+bool VoIPController::set_output_sample_rate(unsigned int rate) {
+    if (rate < 8000 || rate > 192000) {
+        std::cerr << "Unsupported output sample rate " << rate << std::endl;
+        return false;
+    }
+    // the output mutex is held by the audio thread while it waits for the GIL
+    py::gil_scoped_release release;
+    tgvoip::MutexGuard m(output_mutex);
+    if (recorder && recorder->GetFormat() != tgvoip::audio::AudioRecorder::FORMAT_RAW
+        && recorder->GetSampleRate() != rate) {
+        std::cerr << "Can't change the output sample rate while recording to a WAV or Ogg/Opus file" << std::endl;
+        return false;
+    }
+    if (shm_output && shm_output->GetSampleRate() != rate) {
+        std::cerr << "Can't change the output sample rate while shared memory I/O is enabled" << std::endl;
+        return false;
+    }
+    output_sample_rate = rate;
+    output_resampler.reset(rate == 48000 ? nullptr : new tgvoip::audio::PolyphaseResampler(48000, rate));
+    return true;
+}
+
+void VoIPController::update_input_resampler() {
+    if (input_sample_rate == capture_sample_rate)
+        input_resampler.reset();
+    else
+        input_resampler.reset(new tgvoip::audio::PolyphaseResampler(input_sample_rate, capture_sample_rate));
+    resampled_input.clear();
+}
+
+tgvoip::audio::AudioFilePlayer *VoIPController::get_file_player() {
+    // input_mutex must be held
+    if (!file_player)
+        file_player.reset(new tgvoip::audio::AudioFilePlayer(input_sample_rate));
+    return file_player.get();
+}
+
 void VoIPController::_handle_state_change(CallState state) {
     throw py::not_implemented_error();
 }
@@ -267,8 +599,46 @@ void VoIPController::_handle_signal_bars_change(int count) {
 }
 
 void VoIPController::send_audio_frame(int16_t *buf, size_t size) {
+    std::shared_ptr<BridgeLink> link = std::atomic_load(&bridge_link);
+    if (link) {
+        tgvoip::MutexGuard m(link->mutex);
+        std::deque<int16_t> &pcm = link->pcm[1 - bridge_side];
+        size_t available = std::min(size, pcm.size());
+        std::copy(pcm.begin(), pcm.begin() + available, buf);
+        pcm.erase(pcm.begin(), pcm.begin() + available);
+        memset(buf + available, 0, sizeof(int16_t) * (size - available));
+        return;
+    }
+
     tgvoip::MutexGuard m(input_mutex);
 
+    if (!input_resampler) {
+        pull_input(buf, size);
+        return;
+    }
+
+    // pull 20 ms chunks at the application's rate until there's a whole frame at the capture rate
+    size_t chunk = input_resampler->GetInputRate() / 50;
+    std::vector<int16_t> in(chunk);
+    while (resampled_input.size() < size) {
+        std::fill(in.begin(), in.end(), 0);
+        pull_input(in.data(), chunk);
+        size_t offset = resampled_input.size();
+        resampled_input.resize(offset + input_resampler->GetMaxOutputSize(chunk));
+        size_t produced = input_resampler->Process(in.data(), chunk, resampled_input.data() + offset,
+                resampled_input.size() - offset);
+        resampled_input.resize(offset + produced);
+    }
+    std::copy(resampled_input.begin(), resampled_input.begin() + size, buf);
+    resampled_input.erase(resampled_input.begin(), resampled_input.begin() + size);
+}
+
+void VoIPController::pull_input(int16_t *buf, size_t size) {
+    if (shm_input) {
+        shm_input->Read(buf, size);
+        return;
+    }
+
     if (native_io) {
         this->_send_audio_frame_native_impl(buf, size);
         return;
@@ -286,24 +656,9 @@ void VoIPController::send_audio_frame(int16_t *buf, size_t size) {
 char *VoIPController::_send_audio_frame_impl(unsigned long len) { return (char *)""; }
 
 void VoIPController::_send_audio_frame_native_impl(int16_t *buf, size_t size) {
-    if (!input_files.empty()) {
-        size_t read_size = fread(buf, sizeof(int16_t), size, input_files.front());
-        if (read_size != size) {
-            fclose(input_files.front());
-            input_files.pop();
-            size_t read_offset = read_size % size;
-            memset(buf + read_offset, 0, size - read_offset);
-        }
-    } else if (!hold_files.empty()) {
-        size_t read_size = fread(buf, sizeof(int16_t), size, hold_files.front());
-        if (read_size != size) {
-            fseek(hold_files.front(), 0, SEEK_SET);
-            hold_files.push(hold_files.front());
-            hold_files.pop();
-            size_t read_offset = read_size % size;
-            memset(buf + read_offset, 0, size - read_offset);
-        }
-    }
+    // files are decoded ahead of time on the player's thread, this only copies samples
+    if (file_player)
+        file_player->Read(buf, size);
 }
 
 void VoIPController::recv_audio_frame(int16_t *buf, size_t size) {
@@ -312,6 +667,40 @@ void VoIPController::recv_audio_frame(int16_t *buf, size_t size) {
     if (buf == nullptr)
         return;
 
+    std::shared_ptr<BridgeLink> link = std::atomic_load(&bridge_link);
+    if (link) {
+        tgvoip::MutexGuard m(link->mutex);
+        std::deque<int16_t> &pcm = link->pcm[bridge_side];
+        tgvoip::audio::PolyphaseResampler *resampler = link->resamplers[bridge_side].get();
+        if (resampler) {
+            link->resampled.resize(resampler->GetMaxOutputSize(size));
+            size_t produced = resampler->Process(buf, size, link->resampled.data(), link->resampled.size());
+            pcm.insert(pcm.end(), link->resampled.begin(), link->resampled.begin() + produced);
+        } else {
+            pcm.insert(pcm.end(), buf, buf + size);
+        }
+        // keep at most 200 ms of backlog in case the other side isn't consuming
+        size_t max_backlog = link->capture_rates[1 - bridge_side] / 5;
+        if (pcm.size() > max_backlog)
+            pcm.erase(pcm.begin(), pcm.begin() + (pcm.size() - max_backlog));
+        return;
+    }
+
+    if (output_resampler) {
+        resampled_output.resize(output_resampler->GetMaxOutputSize(size));
+        size_t produced = output_resampler->Process(buf, size, resampled_output.data(), resampled_output.size());
+        push_output(resampled_output.data(), produced);
+        return;
+    }
+    push_output(buf, size);
+}
+
+void VoIPController::push_output(int16_t *buf, size_t size) {
+    if (shm_output) {
+        shm_output->Write(buf, size);
+        return;
+    }
+
     if (native_io) {
         this->_recv_audio_frame_native_impl(buf, size);
         return;
@@ -328,12 +717,8 @@ void VoIPController::recv_audio_frame(int16_t *buf, size_t size) {
 void VoIPController::_recv_audio_frame_impl(const py::bytes &frame) {}
 
 void VoIPController::_recv_audio_frame_native_impl(int16_t *buf, size_t size) {
-    if (output_file != nullptr) {
-        size_t written_size = fwrite(buf, sizeof(int16_t), size, output_file);
-        if (written_size != size) {
-            std::cerr << "Written size (" << written_size << ") does not match expected (" << size << ")" << std::endl;
-        }
-    }
+    if (recorder)
+        recorder->Write(buf, size);
 }
 
 std::string VoIPController::get_version(const py::object& /* cls */) {
@@ -344,6 +729,87 @@ int VoIPController::connection_max_layer(const py::object& /* cls */) {
     return tgvoip::VoIPController::GetConnectionMaxLayer();
 }
 
+void VoIPController::set_clock_rate(double rate) {
+    // one clock for the process, re-anchored on every change so that time never jumps in running calls. Once
+    // installed it stays installed, at 1.0 it just follows the system clock from where it is
+    static tgvoip::ScaledClock *clock = nullptr;
+    if (!clock) {
+        if (rate == 1.0)
+            return;
+        clock = new tgvoip::ScaledClock(rate);
+        tgvoip::Clock::Install(clock);
+        return;
+    }
+    clock->SetRate(rate);
+}
+
+void VoIPController::set_cpu_budget(double cores) {
+    tgvoip::CpuGovernor::GetSharedInstance()->SetBudget(cores);
+}
+
+CpuGovernorStats VoIPController::get_cpu_governor_stats() {
+    tgvoip::CpuGovernor::Stats stats = tgvoip::CpuGovernor::GetSharedInstance()->GetStats();
+    return CpuGovernorStats {stats.budget, stats.load, stats.clients, stats.degradedClients, stats.degradations,
+                             stats.restorations};
+}
+
+CpuDegradation VoIPController::get_cpu_degradation() {
+    tgvoip::CpuGovernor::Degradation d = ctrl->GetCpuDegradation();
+    return CpuDegradation {d.level, d.maxComplexity, d.secondaryEncoderDisabled, d.nsDisabled, d.aecDisabled};
+}
+
+void VoIPController::set_media_cache_capacity(size_t bytes) {
+    tgvoip::audio::MediaCache::GetSharedInstance()->SetCapacity(bytes);
+}
+
+MediaCacheStats VoIPController::get_media_cache_stats() {
+    tgvoip::audio::MediaCache::Stats stats = tgvoip::audio::MediaCache::GetSharedInstance()->GetStats();
+    return MediaCacheStats {stats.hits, stats.misses, stats.entries, stats.bytes};
+}
+
+bool VoIPController::register_prompt(std::string &path, unsigned int sample_rate, uint32_t frame_duration,
+        uint32_t bitrate) {
+    std::shared_ptr<const tgvoip::audio::EncodedPrompt> prompt;
+    {
+        py::gil_scoped_release release;
+        prompt = tgvoip::audio::OpusPromptCache::GetSharedInstance()->Register(path, sample_rate, frame_duration,
+                bitrate);
+    }
+    if (!prompt) {
+        std::cerr << "Unable to encode file " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void VoIPController::unregister_prompt(std::string &path) {
+    tgvoip::audio::OpusPromptCache::GetSharedInstance()->Unregister(path);
+}
+
+uint16_t VoIPController::start_metrics_http_server(uint16_t port, const std::string &address) {
+    uint16_t bound_port = tgvoip::MetricsExporter::GetSharedInstance()->StartHttpServer(address, port);
+    if (!bound_port)
+        std::cerr << "Unable to serve metrics on " << address << ":" << port << std::endl;
+    return bound_port;
+}
+
+bool VoIPController::start_metrics_file(const std::string &path, double interval) {
+    if (!tgvoip::MetricsExporter::GetSharedInstance()->StartFileWriter(path, interval)) {
+        std::cerr << "Unable to write metrics to " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void VoIPController::stop_metrics_exporter() {
+    py::gil_scoped_release release;
+    tgvoip::MetricsExporter::GetSharedInstance()->Stop();
+}
+
+std::string VoIPController::get_metrics() {
+    return tgvoip::MetricsExporter::GetSharedInstance()->Format();
+}
+
 bool VoIPController::_native_io_get() {
     return native_io;
 }
@@ -353,63 +819,336 @@ void VoIPController::_native_io_set(bool status) {
 }
 
 bool VoIPController::play(std::string &path) {
-    FILE *tmp = fopen(path.c_str(), "rb");
-    if (tmp == nullptr) {
+    // the input mutex is held by the audio thread while it waits for the GIL, and decoding a file that isn't cached
+    // yet may take a while
+    py::gil_scoped_release release;
+    unsigned int rate;
+    {
+        tgvoip::MutexGuard m(input_mutex);
+        rate = input_sample_rate;
+    }
+    tgvoip::audio::AudioFileReader *reader = tgvoip::audio::MediaCache::GetSharedInstance()->Open(path, rate);
+    if (reader == nullptr) {
         std::cerr << "Unable to open file " << path << " for reading" << std::endl;
         return false;
     }
     tgvoip::MutexGuard m(input_mutex);
-    input_files.push(tmp);
+    get_file_player()->Play(reader);
     return true;
 }
 
 void VoIPController::play_on_hold(std::vector<std::string> &paths) {
-    clear_hold_queue();
-    tgvoip::MutexGuard m(input_mutex);
+    // same as play()
+    py::gil_scoped_release release;
+    unsigned int rate;
+    {
+        tgvoip::MutexGuard m(input_mutex);
+        rate = input_sample_rate;
+    }
+    std::vector<tgvoip::audio::AudioFileReader *> readers;
     for (auto &path : paths) {
-        FILE *tmp = fopen(path.c_str(), "rb");
-        if (tmp == nullptr) {
+        tgvoip::audio::AudioFileReader *reader = tgvoip::audio::MediaCache::GetSharedInstance()->Open(path, rate);
+        if (reader == nullptr) {
             std::cerr << "Unable to open file " << path << " for reading" << std::endl;
         } else {
-            hold_files.push(tmp);
+            readers.push_back(reader);
         }
     }
+    tgvoip::MutexGuard m(input_mutex);
+    get_file_player()->SetHold(readers);
 }
 
-bool VoIPController::set_output_file(std::string &path) {
-    FILE *tmp = fopen(path.c_str(), "wb");
+bool VoIPController::play_prompt(std::string &path) {
+    unsigned int rate;
+    {
+        // the input mutex is held by the audio thread while it waits for the GIL
+        py::gil_scoped_release release;
+        tgvoip::MutexGuard m(input_mutex);
+        rate = capture_sample_rate;
+    }
+    std::shared_ptr<const tgvoip::audio::EncodedPrompt> prompt;
+    prompt = tgvoip::audio::OpusPromptCache::GetSharedInstance()->Find(path, rate, ctrl->GetOutgoingAudioFrameDuration(),
+            ctrl->GetAudioTargetBitrate());
+    if (!prompt) {
+        // not registered for this call's capture rate, decode and encode it live like any other file
+        return play(path);
+    }
+    ctrl->PlayEncodedPrompt(prompt);
+    return true;
+}
+
+void VoIPController::clear_prompts() {
+    ctrl->ClearEncodedPrompts();
+}
+
+PromptStats VoIPController::get_prompt_stats() {
+    tgvoip::VoIPController::EncodedPromptStats stats = ctrl->GetEncodedPromptStats();
+    return PromptStats {stats.framesSent, stats.framesMixed};
+}
+
+bool VoIPController::set_output_file(std::string &path, bool direct_io, RecordingFormat format, int bitrate) {
+    unsigned int rate;
+    {
+        tgvoip::MutexGuard m(output_mutex);
+        rate = output_sample_rate;
+    }
+    // the Opus encoder is set up here, after that the headers and all encoding are handled by the recorder's thread
+    tgvoip::audio::AudioRecorder *tmp = tgvoip::audio::AudioRecorder::Create(
+            path, (tgvoip::audio::AudioRecorder::Format) format, rate, bitrate, direct_io);
     if (tmp == nullptr) {
         std::cerr << "Unable to open file " << path << " for writing" << std::endl;
         return false;
     }
     unset_output_file();
     tgvoip::MutexGuard m(output_mutex);
-    output_file = tmp;
+    recorder.reset(tmp);
+    return true;
+}
+
+bool VoIPController::enable_shared_memory_io(unsigned int capacity_ms) {
+    disable_shared_memory_io();
+    unsigned int in_rate, out_rate;
+    {
+        tgvoip::MutexGuard m(input_mutex);
+        in_rate = input_sample_rate;
+    }
+    {
+        tgvoip::MutexGuard m(output_mutex);
+        out_rate = output_sample_rate;
+    }
+    // the call reads what the other process writes into the input ring and writes what it receives into the output one
+    std::unique_ptr<tgvoip::audio::SharedMemoryRing> in(tgvoip::audio::SharedMemoryRing::Create(
+            tgvoip::audio::SharedMemoryRing::CONSUMER, in_rate, (size_t) in_rate * capacity_ms / 1000));
+    std::unique_ptr<tgvoip::audio::SharedMemoryRing> out(tgvoip::audio::SharedMemoryRing::Create(
+            tgvoip::audio::SharedMemoryRing::PRODUCER, out_rate, (size_t) out_rate * capacity_ms / 1000));
+    if (!in || !out) {
+        std::cerr << "Unable to create shared memory rings" << std::endl;
+        return false;
+    }
+    {
+        tgvoip::MutexGuard m(input_mutex);
+        shm_input.swap(in);
+    }
+    tgvoip::MutexGuard m(output_mutex);
+    shm_output.swap(out);
     return true;
 }
 
+void VoIPController::disable_shared_memory_io() {
+    std::unique_ptr<tgvoip::audio::SharedMemoryRing> in, out;
+    {
+        tgvoip::MutexGuard m(input_mutex);
+        in.swap(shm_input);
+    }
+    tgvoip::MutexGuard m(output_mutex);
+    out.swap(shm_output);
+}
+
+static SharedMemoryRingInfo get_ring_info(const tgvoip::audio::SharedMemoryRing &ring) {
+    return SharedMemoryRingInfo {ring.GetMemoryFD(), ring.GetEventFD(), ring.GetSize(), ring.GetSampleRate(),
+                                 ring.GetCapacity(), ring.GetOverruns(), ring.GetUnderruns()};
+}
+
+std::vector<SharedMemoryRingInfo> VoIPController::get_shared_memory_rings() {
+    std::vector<SharedMemoryRingInfo> rings;
+    {
+        tgvoip::MutexGuard m(input_mutex);
+        if (!shm_input)
+            return rings;
+        rings.push_back(get_ring_info(*shm_input));
+    }
+    tgvoip::MutexGuard m(output_mutex);
+    if (!shm_output)
+        return {};
+    rings.push_back(get_ring_info(*shm_output));
+    return rings;
+}
+
 void VoIPController::clear_play_queue() {
+    // same as play()
+    py::gil_scoped_release release;
     tgvoip::MutexGuard m(input_mutex);
-    while (!input_files.empty()) {
-        fclose(input_files.front());
-        input_files.pop();
-    }
+    if (file_player)
+        file_player->ClearQueue();
 }
 
 void VoIPController::clear_hold_queue() {
+    // same as play()
+    py::gil_scoped_release release;
     tgvoip::MutexGuard m(input_mutex);
-    while (!hold_files.empty()) {
-        fclose(hold_files.front());
-        hold_files.pop();
-    }
+    if (file_player)
+        file_player->ClearHold();
 }
 
 void VoIPController::unset_output_file() {
-    if (output_file != nullptr) {
+    std::unique_ptr<tgvoip::audio::AudioRecorder> old;
+    {
         tgvoip::MutexGuard m(output_mutex);
-        fclose(output_file);
-        output_file = nullptr;
+        old.swap(recorder);
+    }
+    if (!old)
+        return;
+    // flushing the queued frames may take a while, so the audio thread isn't held up by it
+    old->Close();
+    tgvoip::audio::AudioRecorder::Stats stats = old->GetStats();
+    tgvoip::MutexGuard m(output_mutex);
+    last_recording_stats = RecordingStats {stats.framesWritten, stats.framesDropped, stats.bytesWritten,
+                                           stats.writeErrors};
+}
+
+RecordingStats VoIPController::get_recording_stats() {
+    tgvoip::MutexGuard m(output_mutex);
+    if (!recorder)
+        return last_recording_stats;
+    tgvoip::audio::AudioRecorder::Stats stats = recorder->GetStats();
+    return RecordingStats {stats.framesWritten, stats.framesDropped, stats.bytesWritten, stats.writeErrors};
+}
+
+bool VoIPController::set_stream_output_file(std::string &path) {
+    tgvoip::OpusStreamRecorder *tmp = tgvoip::OpusStreamRecorder::Create(ctrl, path);
+    if (tmp == nullptr) {
+        std::cerr << "Unable to open file " << path << " for writing" << std::endl;
+        return false;
+    }
+    unset_stream_output_file();
+    stream_recorder.reset(tmp);
+    return true;
+}
+
+void VoIPController::unset_stream_output_file() {
+    if (!stream_recorder)
+        return;
+    stream_recorder->Close();
+    last_stream_recording_stats = get_stream_recording_stats();
+    stream_recorder.reset();
+}
+
+StreamRecordingStats VoIPController::get_stream_recording_stats() {
+    if (!stream_recorder)
+        return last_stream_recording_stats;
+    tgvoip::OpusStreamRecorder::Stats stats = stream_recorder->GetStats();
+    return StreamRecordingStats {stats.packetsWritten, stats.lostFrames, stats.latePackets, stats.packetsDropped,
+                                 stats.bytesWritten, stats.writeErrors};
+}
+
+uint16_t VoIPController::start_rtp_bridge(uint16_t local_port, const std::string &remote_address, uint16_t remote_port,
+        RtpCodec codec, int payload_type, unsigned int sample_rate, uint32_t packet_duration, uint32_t jitter_delay,
+        const std::string &local_address) {
+    tgvoip::RtpBridge::Config config;
+    config.codec = (tgvoip::RtpBridge::Codec) codec;
+    config.payloadType = payload_type;
+    config.sampleRate = sample_rate;
+    config.packetDuration = packet_duration;
+    config.jitterDelay = jitter_delay;
+    config.localAddress = local_address;
+    config.localPort = local_port;
+    config.remoteAddress = remote_address;
+    config.remotePort = remote_port;
+    // the old bridge has to give the call its audio back before the new one takes it over
+    stop_rtp_bridge();
+    tgvoip::RtpBridge *tmp = tgvoip::RtpBridge::Create(ctrl, config);
+    if (tmp == nullptr) {
+        std::cerr << "Unable to start RTP bridge on " << local_address << ":" << local_port << std::endl;
+        return 0;
+    }
+    rtp_bridge.reset(tmp);
+    return rtp_bridge->GetLocalPort();
+}
+
+void VoIPController::stop_rtp_bridge() {
+    if (!rtp_bridge)
+        return;
+    {
+        // joins the bridge's thread, which may be waiting on the call's audio threads that need the GIL
+        py::gil_scoped_release release;
+        rtp_bridge->Close();
     }
+    last_rtp_bridge_stats = get_rtp_bridge_stats();
+    rtp_bridge.reset();
+}
+
+RtpBridgeStats VoIPController::get_rtp_bridge_stats() {
+    if (!rtp_bridge)
+        return last_rtp_bridge_stats;
+    tgvoip::RtpBridge::Stats stats = rtp_bridge->GetStats();
+    return RtpBridgeStats {stats.packetsSent, stats.packetsReceived, stats.packetsLate, stats.packetsDropped,
+                           stats.framesPassedThrough, stats.framesTranscoded, stats.concealedMs};
+}
+
+int VoIPController::enable_event_queue() {
+    tgvoip::MutexGuard m(event_mutex);
+    if (event_fd >= 0)
+        return event_fd;
+#if defined(__linux__)
+    event_fd = event_write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(_WIN32)
+    int fds[2];
+    if (pipe(fds) == 0) {
+        for (int fd : fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        event_fd = fds[0];
+        event_write_fd = fds[1];
+    }
+#endif
+    if (event_fd < 0)
+        std::cerr << "Unable to create event queue descriptor" << std::endl;
+    return event_fd;
+}
+
+std::vector<CallEvent> VoIPController::disable_event_queue() {
+    std::vector<CallEvent> batch;
+    tgvoip::MutexGuard m(event_mutex);
+    if (event_fd < 0)
+        return batch;
+#ifndef _WIN32
+    if (event_write_fd != event_fd)
+        close(event_write_fd);
+    close(event_fd);
+#endif
+    event_fd = event_write_fd = -1;
+    // everything queued until now is handed back, later events are delivered directly
+    batch.swap(events);
+    return batch;
+}
+
+std::vector<CallEvent> VoIPController::drain_events() {
+    std::vector<CallEvent> batch;
+    tgvoip::MutexGuard m(event_mutex);
+#ifndef _WIN32
+    if (event_fd >= 0) {
+        // an eventfd is reset by a single read, a pipe has at most a byte per batch in it
+        char buf[64];
+        ssize_t n;
+        do {
+            n = read(event_fd, buf, sizeof(buf));
+        } while (n > 0 && event_fd != event_write_fd);
+    }
+#endif
+    batch.swap(events);
+    return batch;
+}
+
+bool VoIPController::queue_event(CallEventType type, int value) {
+    tgvoip::MutexGuard m(event_mutex);
+    if (event_fd < 0)
+        return false;
+    // only the latest signal bar count matters to a loop that hasn't caught up yet
+    if (type == CALL_EVENT_SIGNAL_BARS_CHANGED && !events.empty() && events.back().type == type) {
+        events.back().value = value;
+        return true;
+    }
+    events.push_back(CallEvent {type, value});
+    // the loop is woken once per batch, it drains everything queued until then
+    if (events.size() == 1) {
+#ifndef _WIN32
+        uint64_t one = 1;
+        ssize_t written = write(event_write_fd, &one, event_write_fd == event_fd ? sizeof(one) : 1);
+        (void) written;
+#endif
+    }
+    return true;
 }
 
 void VoIPServerConfig::set_config(std::string &json_str) {
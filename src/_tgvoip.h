@@ -23,11 +23,27 @@
 #define PYLIBTGVOIP_LIBRARY_H
 
 #include <iostream>
-#include <queue>
+#include <array>
+#include <deque>
+#include <memory>
+#include <set>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <VoIPController.h>
 #include <VoIPServerConfig.h>
+#include <CallHost.h>
+#include <NetworkSocketLoopback.h>
+#include <CallBridge.h>
+#include <EncoderGroup.h>
+#include <MetricsExporter.h>
+#include <OpusStreamRecorder.h>
+#include <RtpBridge.h>
+#include <audio/PolyphaseResampler.h>
+#include <audio/AudioFilePlayer.h>
+#include <audio/AudioRecorder.h>
+#include <audio/MediaCache.h>
+#include <audio/OpusPromptCache.h>
+#include <audio/SharedMemoryRing.h>
 
 namespace pybind11 {
     class not_implemented_error : public std::exception {};
@@ -72,6 +88,29 @@ enum CallError {
     ERROR_PROXY = tgvoip::ERROR_PROXY,
 };
 
+enum RecordingFormat {
+    RECORDING_FORMAT_RAW = tgvoip::audio::AudioRecorder::FORMAT_RAW,
+    RECORDING_FORMAT_WAV = tgvoip::audio::AudioRecorder::FORMAT_WAV,
+    RECORDING_FORMAT_OGG_OPUS = tgvoip::audio::AudioRecorder::FORMAT_OGG_OPUS,
+};
+
+enum CallEventType {
+    CALL_EVENT_STATE_CHANGED,
+    CALL_EVENT_SIGNAL_BARS_CHANGED,
+};
+
+enum RtpCodec {
+    RTP_CODEC_OPUS = tgvoip::RtpBridge::CODEC_OPUS,
+    RTP_CODEC_PCMU = tgvoip::RtpBridge::CODEC_PCMU,
+    RTP_CODEC_PCMA = tgvoip::RtpBridge::CODEC_PCMA,
+    RTP_CODEC_L16 = tgvoip::RtpBridge::CODEC_L16,
+};
+
+struct CallEvent {
+    CallEventType type;
+    int value;  // the CallState or the signal bar count
+};
+
 struct Stats {
     uint64_t bytes_sent_wifi;
     uint64_t bytes_sent_mobile;
@@ -79,6 +118,115 @@ struct Stats {
     uint64_t bytes_recvd_mobile;
 };
 
+struct CallStats {
+    uint64_t bytes_sent_wifi;
+    uint64_t bytes_sent_mobile;
+    uint64_t bytes_recvd_wifi;
+    uint64_t bytes_recvd_mobile;
+    CallState state;
+    int signal_bars;
+    double rtt;
+    double min_rtt;
+    double jitter_delay;
+    int jitter_min_packets;
+    double jitter;
+    uint32_t packets_sent;
+    uint32_t packets_received;
+    uint32_t send_loss_count;
+    uint32_t recv_loss_count;
+    std::array<uint32_t, 10> send_loss_history;
+    int expected_loss_percent;
+    uint32_t audio_bitrate;
+    uint32_t inflight_bytes;
+    uint32_t congestion_window;
+    uint32_t unsent_packets;
+    int extra_ec_level;
+    int64_t current_endpoint_id;
+    int current_endpoint_type;
+    double current_endpoint_rtt;
+};
+
+struct CallHostStats {
+    uint64_t tasks_executed;
+    uint64_t tasks_stolen;
+    uint32_t active_strands;
+};
+
+struct CpuGovernorStats {
+    double budget;
+    double load;
+    uint32_t calls;
+    uint32_t degraded_calls;
+    uint64_t degradations;
+    uint64_t restorations;
+};
+
+struct MediaCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    size_t entries;
+    size_t bytes;
+};
+
+struct PromptStats {
+    uint64_t frames_sent;
+    uint64_t frames_mixed;
+};
+
+struct SharedMemoryRingInfo {
+    int memory_fd;
+    int event_fd;
+    size_t size;
+    unsigned int sample_rate;
+    size_t capacity;
+    uint64_t overruns;
+    uint64_t underruns;
+};
+
+struct RecordingStats {
+    uint64_t frames_written;
+    uint64_t frames_dropped;
+    uint64_t bytes_written;
+    uint64_t write_errors;
+};
+
+struct StreamRecordingStats {
+    uint64_t packets_written;
+    uint64_t lost_frames;
+    uint64_t late_packets;
+    uint64_t packets_dropped;
+    uint64_t bytes_written;
+    uint64_t write_errors;
+};
+
+struct RtpBridgeStats {
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t packets_late;
+    uint64_t packets_dropped;
+    uint64_t frames_passed_through;
+    uint64_t frames_transcoded;
+    uint64_t concealed_ms;
+};
+
+struct CpuDegradation {
+    int level;
+    int max_complexity;
+    bool secondary_encoder_disabled;
+    bool ns_disabled;
+    bool aec_disabled;
+};
+
+class CallHost {
+public:
+    explicit CallHost(unsigned int workers);
+    ~CallHost();
+    unsigned int get_workers();
+    CallHostStats get_stats();
+
+    tgvoip::CallHost *host;
+};
+
 struct Endpoint {
     Endpoint(int64_t id, std::string ip, std::string ipv6, uint16_t port, const std::string &peer_tag);
     int64_t id;
@@ -88,6 +236,23 @@ struct Endpoint {
     py::bytes peer_tag;
 };
 
+class VoIPController;
+class EncoderGroup;
+
+struct BridgeLink {
+    std::unique_ptr<tgvoip::CallBridge> bridge;  // taken out under mutex when unbridging
+    VoIPController *sides[2];
+    tgvoip::Mutex mutex;
+    // audio decoded on side i, at the capture rate of the other side, waiting to be encoded by it. Used while transcoding
+    std::deque<int16_t> pcm[2];
+    // from the 48 kHz of side i's decoder to the other side's capture rate, null if that's 48 kHz too
+    std::unique_ptr<tgvoip::audio::PolyphaseResampler> resamplers[2];
+    unsigned int capture_rates[2];
+    std::vector<int16_t> resampled;
+
+    void set_capture_rate(int side, unsigned int rate);  // mutex must be held
+};
+
 class VoIPController {
 public:
     VoIPController();
@@ -102,6 +267,14 @@ public:
     std::string get_debug_string();
     void set_network_type(NetType type);
     void set_mic_mute(bool mute);
+    bool set_call_host(CallHost &host);
+    bool connect_loopback(VoIPController &peer, const std::string &relay_ip, uint16_t relay_port);
+    bool set_loopback_impairment(double delay, double jitter, double loss, double reorder);
+    bool bridge(VoIPController &peer);
+    void unbridge();
+    bool is_bridge_forwarding();
+    bool set_input_sample_rate(unsigned int rate);
+    bool set_output_sample_rate(unsigned int rate);
     void set_config(double recv_timeout, double init_timeout, DataSaving data_saving_mode, bool enable_aec,
             bool enable_ns, bool enable_agc,
 #ifndef _WIN32
@@ -109,11 +282,14 @@ public:
 #else
             const std::wstring &log_file_path, const std::wstring &status_dump_path,
 #endif
-            bool log_packet_stats);
+            bool log_packet_stats, unsigned int capture_sample_rate, bool listen_only,
+            bool send_only);
     void debug_ctl(int request, int param);
     long get_preferred_relay_id();
     CallError get_last_error();
     Stats get_stats();
+    CallStats get_call_stats();
+    void set_metrics_label(const std::string &label);
     std::string get_debug_log();
     void set_audio_output_gain_control_enabled(bool enabled);
     void set_echo_cancellation_strength(int strength);
@@ -137,30 +313,119 @@ public:
 
     static std::string get_version(const py::object& /* cls */);
     static int connection_max_layer(const py::object& /* cls */);
+    static void set_clock_rate(double rate);
+    static void set_cpu_budget(double cores);
+    static CpuGovernorStats get_cpu_governor_stats();
+    CpuDegradation get_cpu_degradation();
+    static void set_media_cache_capacity(size_t bytes);
+    static MediaCacheStats get_media_cache_stats();
+    static bool register_prompt(std::string &path, unsigned int sample_rate, uint32_t frame_duration, uint32_t bitrate);
+    static void unregister_prompt(std::string &path);
+    static uint16_t start_metrics_http_server(uint16_t port, const std::string &address);
+    static bool start_metrics_file(const std::string &path, double interval);
+    static void stop_metrics_exporter();
+    static std::string get_metrics();
 
     bool _native_io_get();
     void _native_io_set(bool status);
     bool play(std::string &path);
     void play_on_hold(std::vector<std::string> &path);
-    bool set_output_file(std::string &path);
+    bool play_prompt(std::string &path);
+    void clear_prompts();
+    PromptStats get_prompt_stats();
+    bool set_output_file(std::string &path, bool direct_io, RecordingFormat format, int bitrate);
     void clear_play_queue();
     void clear_hold_queue();
     void unset_output_file();
+    RecordingStats get_recording_stats();
+    bool set_stream_output_file(std::string &path);
+    void unset_stream_output_file();
+    StreamRecordingStats get_stream_recording_stats();
+    bool enable_shared_memory_io(unsigned int capacity_ms);
+    void disable_shared_memory_io();
+    std::vector<SharedMemoryRingInfo> get_shared_memory_rings();
+    uint16_t start_rtp_bridge(uint16_t local_port, const std::string &remote_address, uint16_t remote_port,
+            RtpCodec codec, int payload_type, unsigned int sample_rate, uint32_t packet_duration,
+            uint32_t jitter_delay, const std::string &local_address);
+    void stop_rtp_bridge();
+    RtpBridgeStats get_rtp_bridge_stats();
+    int enable_event_queue();
+    std::vector<CallEvent> disable_event_queue();
+    std::vector<CallEvent> drain_events();
     void _send_audio_frame_native_impl(int16_t *buf, size_t size);
     void _recv_audio_frame_native_impl(int16_t *buf, size_t size);
 
     std::string persistent_state_file;
 
 private:
+    friend class EncoderGroup;
     tgvoip::VoIPController *ctrl{};
+    tgvoip::NetworkSocketLoopback *loopback = nullptr;  // owned by ctrl
+    std::shared_ptr<BridgeLink> bridge_link;  // shared with the peer, accessed atomically
+    int bridge_side = 0;
+    EncoderGroup *encoder_group = nullptr;
     tgvoip::Mutex output_mutex;
     tgvoip::Mutex input_mutex;
+    unsigned int input_sample_rate = 48000;
+    unsigned int capture_sample_rate = 48000;
+    unsigned int output_sample_rate = 48000;
+    // converters between the application's rates and the ones libtgvoip runs at, null when the rates match
+    std::unique_ptr<tgvoip::audio::PolyphaseResampler> input_resampler;
+    std::unique_ptr<tgvoip::audio::PolyphaseResampler> output_resampler;
+    std::vector<int16_t> resampled_input;  // samples at the capture rate converted ahead of the next frame
+    std::vector<int16_t> resampled_output;
+
+    void update_input_resampler();
+    tgvoip::audio::AudioFilePlayer *get_file_player();
+    void pull_input(int16_t *buf, size_t size);
+    void push_output(int16_t *buf, size_t size);
 
     bool native_io = false;
     bool is_shutting_down = false;
-    std::queue<FILE*> input_files;
-    std::queue<FILE*> hold_files;
-    FILE *output_file = nullptr;
+    std::unique_ptr<tgvoip::audio::AudioFilePlayer> file_player;  // created by the first play() or play_on_hold()
+    // frames are written out on the recorder's thread so a stalled disk never delays playout
+    std::unique_ptr<tgvoip::audio::AudioRecorder> recorder;
+    RecordingStats last_recording_stats {};  // of the recorder that was unset last
+    std::unique_ptr<tgvoip::OpusStreamRecorder> stream_recorder;
+    StreamRecordingStats last_stream_recording_stats {};
+    // when set, they replace native and Python I/O; guarded by input_mutex and output_mutex
+    std::unique_ptr<tgvoip::audio::SharedMemoryRing> shm_input;
+    std::unique_ptr<tgvoip::audio::SharedMemoryRing> shm_output;
+    // exchanges the call's audio with a local RTP peer, which replaces all other audio I/O while it runs
+    std::unique_ptr<tgvoip::RtpBridge> rtp_bridge;
+    RtpBridgeStats last_rtp_bridge_stats {};
+    // while the queue is enabled, state and signal bar changes wait in it for the event loop instead of calling into
+    // Python on libtgvoip's threads; event_fd becomes readable when it isn't empty
+    tgvoip::Mutex event_mutex;
+    int event_fd = -1;
+    int event_write_fd = -1;  // same as event_fd for an eventfd, the other end for a pipe
+    std::vector<CallEvent> events;
+
+    bool queue_event(CallEventType type, int value);
+};
+
+struct EncoderGroupStats {
+    uint64_t frames_encoded;
+    uint64_t frames_sent;
+};
+
+class EncoderGroup {
+public:
+    EncoderGroup(std::vector<uint32_t> bitrates, uint32_t frame_duration, int expected_loss);
+    ~EncoderGroup();
+    bool add_call(VoIPController &call);
+    void remove_call(VoIPController &call);
+    bool play(std::string &path);
+    void clear_play_queue();
+    EncoderGroupStats get_stats();
+
+private:
+    void read_frame(int16_t *buf, size_t size);
+
+    tgvoip::EncoderGroup *group;
+    std::set<VoIPController *> calls;
+    tgvoip::Mutex input_mutex;
+    std::unique_ptr<tgvoip::audio::AudioFilePlayer> file_player;
 };
 
 class PyVoIPController : public VoIPController {
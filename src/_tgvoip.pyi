@@ -58,6 +58,24 @@ class CallError(Enum):
     PROXY = ...
 
 
+class RecordingFormat(Enum):
+    RAW = ...
+    WAV = ...
+    OGG_OPUS = ...
+
+
+class CallEventType(Enum):
+    STATE_CHANGED = ...
+    SIGNAL_BARS_CHANGED = ...
+
+
+class RtpCodec(Enum):
+    OPUS = ...
+    PCMU = ...
+    PCMA = ...
+    L16 = ...
+
+
 class Stats:
     bytes_sent_wifi = ...
     bytes_sent_mobile = ...
@@ -65,6 +83,122 @@ class Stats:
     bytes_recvd_mobile = ...
 
 
+class CallStats:
+    bytes_sent_wifi: int = ...
+    bytes_sent_mobile: int = ...
+    bytes_recvd_wifi: int = ...
+    bytes_recvd_mobile: int = ...
+    state: CallState = ...
+    signal_bars: int = ...
+    rtt: float = ...
+    min_rtt: float = ...
+    jitter_delay: float = ...
+    jitter_min_packets: int = ...
+    jitter: float = ...
+    packets_sent: int = ...
+    packets_received: int = ...
+    send_loss_count: int = ...
+    recv_loss_count: int = ...
+    send_loss_history: List[int] = ...
+    expected_loss_percent: int = ...
+    audio_bitrate: int = ...
+    inflight_bytes: int = ...
+    congestion_window: int = ...
+    unsent_packets: int = ...
+    extra_ec_level: int = ...
+    current_endpoint_id: int = ...
+    current_endpoint_type: int = ...
+    current_endpoint_rtt: float = ...
+
+
+class CallHostStats:
+    tasks_executed: int = ...
+    tasks_stolen: int = ...
+    active_strands: int = ...
+
+
+class CallHost:
+    workers: int = ...
+
+    def __init__(self, workers: int = 0): ...
+    def get_stats(self) -> CallHostStats: ...
+
+
+class CpuGovernorStats:
+    budget: float = ...
+    load: float = ...
+    calls: int = ...
+    degraded_calls: int = ...
+    degradations: int = ...
+    restorations: int = ...
+
+
+class CpuDegradation:
+    level: int = ...
+    max_complexity: int = ...
+    secondary_encoder_disabled: bool = ...
+    ns_disabled: bool = ...
+    aec_disabled: bool = ...
+
+
+class MediaCacheStats:
+    hits: int = ...
+    misses: int = ...
+    entries: int = ...
+    bytes: int = ...
+
+
+class PromptStats:
+    frames_sent: int = ...
+    frames_mixed: int = ...
+
+
+class SharedMemoryRing:
+    memory_fd: int = ...
+    event_fd: int = ...
+    size: int = ...
+    sample_rate: int = ...
+    capacity: int = ...
+    overruns: int = ...
+    underruns: int = ...
+
+
+class RecordingStats:
+    frames_written: int = ...
+    frames_dropped: int = ...
+    bytes_written: int = ...
+    write_errors: int = ...
+
+
+class StreamRecordingStats:
+    packets_written: int = ...
+    lost_frames: int = ...
+    late_packets: int = ...
+    packets_dropped: int = ...
+    bytes_written: int = ...
+    write_errors: int = ...
+
+
+class CallEvent:
+    type: CallEventType = ...
+    value: int = ...
+
+
+class RtpBridgeStats:
+    packets_sent: int = ...
+    packets_received: int = ...
+    packets_late: int = ...
+    packets_dropped: int = ...
+    frames_passed_through: int = ...
+    frames_transcoded: int = ...
+    concealed_ms: int = ...
+
+
+class EncoderGroupStats:
+    frames_encoded: int = ...
+    frames_sent: int = ...
+
+
 # class AudioInputDevice:
 #     _id = ...
 #     display_name = ...
@@ -99,13 +233,24 @@ class VoIPController:
     def get_debug_string(self) -> str: ...
     def set_network_type(self, _type: NetType) -> None: ...
     def set_mic_mute(self, mute: bool) -> None: ...
+    def set_call_host(self, host: CallHost) -> bool: ...
+    def connect_loopback(self, peer: VoIPController, relay_ip: str, relay_port: int) -> bool: ...
+    def set_loopback_impairment(self, delay: float, jitter: float, loss: float, reorder: float) -> bool: ...
+    def bridge(self, peer: VoIPController) -> bool: ...
+    def unbridge(self) -> None: ...
+    def is_bridge_forwarding(self) -> bool: ...
+    def set_input_sample_rate(self, rate: int) -> bool: ...
+    def set_output_sample_rate(self, rate: int) -> bool: ...
     def set_config(self, recv_timeout: float, init_timeout: float, data_saving_mode: DataSaving, enable_aec: bool,
                    enable_ns: bool, enable_agc: bool, log_file_path: str, status_dump_path: str,
-                   log_packet_stats: bool) -> None: ...
+                   log_packet_stats: bool, capture_sample_rate: int, listen_only: bool,
+                   send_only: bool) -> None: ...
     def debug_ctl(self, request: int, param: int) -> None: ...
     def get_preferred_relay_id(self) -> int: ...
     def get_last_error(self) -> CallError: ...
     def get_stats(self) -> Stats: ...
+    def get_call_stats(self) -> CallStats: ...
+    def set_metrics_label(self, label: str) -> None: ...
     def get_debug_log(self) -> str: ...
     def set_audio_output_gain_control_enabled(self, enabled: bool) -> None: ...
     def set_echo_cancellation_strength(self, strength: int) -> None: ...
@@ -123,6 +268,31 @@ class VoIPController:
     # def get_current_audio_input_id(self) -> str: ...
     # def get_current_audio_output_id(self) -> str: ...
 
+    @staticmethod
+    def set_clock_rate(rate: float) -> None: ...
+    @staticmethod
+    def set_cpu_budget(cores: float) -> None: ...
+    @staticmethod
+    def get_cpu_governor_stats() -> CpuGovernorStats: ...
+    def get_cpu_degradation(self) -> CpuDegradation: ...
+    @staticmethod
+    def set_media_cache_capacity(size: int) -> None: ...
+    @staticmethod
+    def get_media_cache_stats() -> MediaCacheStats: ...
+    @staticmethod
+    def register_prompt(path: str, sample_rate: int = 48000, frame_duration: int = 60,
+                        bitrate: int = 16000) -> bool: ...
+    @staticmethod
+    def unregister_prompt(path: str) -> None: ...
+    @staticmethod
+    def start_metrics_http_server(port: int = 0, address: str = '127.0.0.1') -> int: ...
+    @staticmethod
+    def start_metrics_file(path: str, interval: float = 15.0) -> bool: ...
+    @staticmethod
+    def stop_metrics_exporter() -> None: ...
+    @staticmethod
+    def get_metrics() -> str: ...
+
     def _native_io_get(self) -> bool: ...
 
     def _native_io_set(self, val: bool) -> None: ...
@@ -131,7 +301,14 @@ class VoIPController:
 
     def play_on_hold(self, paths: List[str]) -> None: ...
 
-    def set_output_file(self, path: str) -> bool: ...
+    def play_prompt(self, path: str) -> bool: ...
+
+    def clear_prompts(self) -> None: ...
+
+    def get_prompt_stats(self) -> PromptStats: ...
+
+    def set_output_file(self, path: str, direct_io: bool = False, format: RecordingFormat = ...,
+                        bitrate: int = 32000) -> bool: ...
 
     def clear_play_queue(self) -> None: ...
 
@@ -139,6 +316,35 @@ class VoIPController:
 
     def unset_output_file(self) -> None: ...
 
+    def get_recording_stats(self) -> RecordingStats: ...
+
+    def set_stream_output_file(self, path: str) -> bool: ...
+
+    def unset_stream_output_file(self) -> None: ...
+
+    def get_stream_recording_stats(self) -> StreamRecordingStats: ...
+
+    def enable_shared_memory_io(self, capacity_ms: int = 1000) -> bool: ...
+
+    def disable_shared_memory_io(self) -> None: ...
+
+    def get_shared_memory_rings(self) -> List[SharedMemoryRing]: ...
+
+    def start_rtp_bridge(self, local_port: int = 0, remote_address: str = '', remote_port: int = 0,
+                         codec: RtpCodec = ..., payload_type: int = -1, sample_rate: int = 16000,
+                         packet_duration: int = 20, jitter_delay: int = 60,
+                         local_address: str = '127.0.0.1') -> int: ...
+
+    def stop_rtp_bridge(self) -> None: ...
+
+    def get_rtp_bridge_stats(self) -> RtpBridgeStats: ...
+
+    def enable_event_queue(self) -> int: ...
+
+    def disable_event_queue(self) -> List[CallEvent]: ...
+
+    def drain_events(self) -> List[CallEvent]: ...
+
     def _handle_state_change(self, state: CallState) -> None:
         raise NotImplementedError()
 
@@ -149,6 +355,15 @@ class VoIPController:
     def _recv_audio_frame_impl(self, frame: bytes) -> None: ...
 
 
+class EncoderGroup:
+    def __init__(self, bitrates: List[int] = ..., frame_duration: int = ..., expected_loss: int = ...): ...
+    def add_call(self, call: VoIPController) -> bool: ...
+    def remove_call(self, call: VoIPController) -> None: ...
+    def play(self, path: str) -> bool: ...
+    def clear_play_queue(self) -> None: ...
+    def get_stats(self) -> EncoderGroupStats: ...
+
+
 class VoIPServerConfig:
     @staticmethod
     def set_config(json_string: str): ...
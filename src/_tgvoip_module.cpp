@@ -65,6 +65,24 @@ PYBIND11_MODULE(_tgvoip, m) {
             .value("ALWAYS", DataSaving::DATA_SAVING_ALWAYS)
             .export_values();
 
+    py::enum_<RecordingFormat>(m, "RecordingFormat")
+            .value("RAW", RecordingFormat::RECORDING_FORMAT_RAW)
+            .value("WAV", RecordingFormat::RECORDING_FORMAT_WAV)
+            .value("OGG_OPUS", RecordingFormat::RECORDING_FORMAT_OGG_OPUS)
+            .export_values();
+
+    py::enum_<CallEventType>(m, "CallEventType")
+            .value("STATE_CHANGED", CallEventType::CALL_EVENT_STATE_CHANGED)
+            .value("SIGNAL_BARS_CHANGED", CallEventType::CALL_EVENT_SIGNAL_BARS_CHANGED)
+            .export_values();
+
+    py::enum_<RtpCodec>(m, "RtpCodec")
+            .value("OPUS", RtpCodec::RTP_CODEC_OPUS)
+            .value("PCMU", RtpCodec::RTP_CODEC_PCMU)
+            .value("PCMA", RtpCodec::RTP_CODEC_PCMA)
+            .value("L16", RtpCodec::RTP_CODEC_L16)
+            .export_values();
+
     py::enum_<CallError>(m, "CallError")
             .value("UNKNOWN", CallError::ERROR_UNKNOWN)
             .value("INCOMPATIBLE", CallError::ERROR_INCOMPATIBLE)
@@ -88,6 +106,224 @@ PYBIND11_MODULE(_tgvoip, m) {
                 return repr.str();
             });
 
+    py::class_<CallStats>(m, "CallStats")
+            .def_readonly("bytes_sent_wifi", &CallStats::bytes_sent_wifi)
+            .def_readonly("bytes_sent_mobile", &CallStats::bytes_sent_mobile)
+            .def_readonly("bytes_recvd_wifi", &CallStats::bytes_recvd_wifi)
+            .def_readonly("bytes_recvd_mobile", &CallStats::bytes_recvd_mobile)
+            .def_readonly("state", &CallStats::state)
+            .def_readonly("signal_bars", &CallStats::signal_bars)
+            .def_readonly("rtt", &CallStats::rtt)
+            .def_readonly("min_rtt", &CallStats::min_rtt)
+            .def_readonly("jitter_delay", &CallStats::jitter_delay)
+            .def_readonly("jitter_min_packets", &CallStats::jitter_min_packets)
+            .def_readonly("jitter", &CallStats::jitter)
+            .def_readonly("packets_sent", &CallStats::packets_sent)
+            .def_readonly("packets_received", &CallStats::packets_received)
+            .def_readonly("send_loss_count", &CallStats::send_loss_count)
+            .def_readonly("recv_loss_count", &CallStats::recv_loss_count)
+            .def_readonly("send_loss_history", &CallStats::send_loss_history)
+            .def_readonly("expected_loss_percent", &CallStats::expected_loss_percent)
+            .def_readonly("audio_bitrate", &CallStats::audio_bitrate)
+            .def_readonly("inflight_bytes", &CallStats::inflight_bytes)
+            .def_readonly("congestion_window", &CallStats::congestion_window)
+            .def_readonly("unsent_packets", &CallStats::unsent_packets)
+            .def_readonly("extra_ec_level", &CallStats::extra_ec_level)
+            .def_readonly("current_endpoint_id", &CallStats::current_endpoint_id)
+            .def_readonly("current_endpoint_type", &CallStats::current_endpoint_type)
+            .def_readonly("current_endpoint_rtt", &CallStats::current_endpoint_rtt)
+            .def("__repr__", [](const CallStats &s) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.CallStats ";
+                repr << "state=" << s.state << " ";
+                repr << "signal_bars=" << s.signal_bars << " ";
+                repr << "rtt=" << s.rtt << " ";
+                repr << "jitter_delay=" << s.jitter_delay << " ";
+                repr << "send_loss_count=" << s.send_loss_count << " ";
+                repr << "recv_loss_count=" << s.recv_loss_count << " ";
+                repr << "audio_bitrate=" << s.audio_bitrate << " ";
+                repr << "current_endpoint_id=" << s.current_endpoint_id << ">";
+                return repr.str();
+            });
+
+    py::class_<CallHostStats>(m, "CallHostStats")
+            .def_readonly("tasks_executed", &CallHostStats::tasks_executed)
+            .def_readonly("tasks_stolen", &CallHostStats::tasks_stolen)
+            .def_readonly("active_strands", &CallHostStats::active_strands)
+            .def("__repr__", [](const CallHostStats &s) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.CallHostStats ";
+                repr << "tasks_executed=" << s.tasks_executed << " ";
+                repr << "tasks_stolen=" << s.tasks_stolen << " ";
+                repr << "active_strands=" << s.active_strands << ">";
+                return repr.str();
+            });
+
+    py::class_<CallHost>(m, "CallHost")
+            .def(py::init<unsigned int>(), py::arg("workers") = 0)
+            .def_property_readonly("workers", &CallHost::get_workers)
+            .def("get_stats", &CallHost::get_stats);
+
+    py::class_<CpuGovernorStats>(m, "CpuGovernorStats")
+            .def_readonly("budget", &CpuGovernorStats::budget)
+            .def_readonly("load", &CpuGovernorStats::load)
+            .def_readonly("calls", &CpuGovernorStats::calls)
+            .def_readonly("degraded_calls", &CpuGovernorStats::degraded_calls)
+            .def_readonly("degradations", &CpuGovernorStats::degradations)
+            .def_readonly("restorations", &CpuGovernorStats::restorations)
+            .def("__repr__", [](const CpuGovernorStats &s) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.CpuGovernorStats ";
+                repr << "budget=" << s.budget << " ";
+                repr << "load=" << s.load << " ";
+                repr << "calls=" << s.calls << " ";
+                repr << "degraded_calls=" << s.degraded_calls << " ";
+                repr << "degradations=" << s.degradations << " ";
+                repr << "restorations=" << s.restorations << ">";
+                return repr.str();
+            });
+
+    py::class_<CpuDegradation>(m, "CpuDegradation")
+            .def_readonly("level", &CpuDegradation::level)
+            .def_readonly("max_complexity", &CpuDegradation::max_complexity)
+            .def_readonly("secondary_encoder_disabled", &CpuDegradation::secondary_encoder_disabled)
+            .def_readonly("ns_disabled", &CpuDegradation::ns_disabled)
+            .def_readonly("aec_disabled", &CpuDegradation::aec_disabled)
+            .def("__repr__", [](const CpuDegradation &d) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.CpuDegradation ";
+                repr << "level=" << d.level << " ";
+                repr << "max_complexity=" << d.max_complexity << " ";
+                repr << "secondary_encoder_disabled=" << d.secondary_encoder_disabled << " ";
+                repr << "ns_disabled=" << d.ns_disabled << " ";
+                repr << "aec_disabled=" << d.aec_disabled << ">";
+                return repr.str();
+            });
+
+    py::class_<MediaCacheStats>(m, "MediaCacheStats")
+            .def_readonly("hits", &MediaCacheStats::hits)
+            .def_readonly("misses", &MediaCacheStats::misses)
+            .def_readonly("entries", &MediaCacheStats::entries)
+            .def_readonly("bytes", &MediaCacheStats::bytes)
+            .def("__repr__", [](const MediaCacheStats &s) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.MediaCacheStats ";
+                repr << "hits=" << s.hits << " ";
+                repr << "misses=" << s.misses << " ";
+                repr << "entries=" << s.entries << " ";
+                repr << "bytes=" << s.bytes << ">";
+                return repr.str();
+            });
+
+    py::class_<PromptStats>(m, "PromptStats")
+            .def_readonly("frames_sent", &PromptStats::frames_sent)
+            .def_readonly("frames_mixed", &PromptStats::frames_mixed)
+            .def("__repr__", [](const PromptStats &s) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.PromptStats ";
+                repr << "frames_sent=" << s.frames_sent << " ";
+                repr << "frames_mixed=" << s.frames_mixed << ">";
+                return repr.str();
+            });
+
+    py::class_<SharedMemoryRingInfo>(m, "SharedMemoryRing")
+            .def_readonly("memory_fd", &SharedMemoryRingInfo::memory_fd)
+            .def_readonly("event_fd", &SharedMemoryRingInfo::event_fd)
+            .def_readonly("size", &SharedMemoryRingInfo::size)
+            .def_readonly("sample_rate", &SharedMemoryRingInfo::sample_rate)
+            .def_readonly("capacity", &SharedMemoryRingInfo::capacity)
+            .def_readonly("overruns", &SharedMemoryRingInfo::overruns)
+            .def_readonly("underruns", &SharedMemoryRingInfo::underruns)
+            .def("__repr__", [](const SharedMemoryRingInfo &r) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.SharedMemoryRing ";
+                repr << "memory_fd=" << r.memory_fd << " ";
+                repr << "event_fd=" << r.event_fd << " ";
+                repr << "size=" << r.size << " ";
+                repr << "sample_rate=" << r.sample_rate << " ";
+                repr << "capacity=" << r.capacity << " ";
+                repr << "overruns=" << r.overruns << " ";
+                repr << "underruns=" << r.underruns << ">";
+                return repr.str();
+            });
+
+    py::class_<RecordingStats>(m, "RecordingStats")
+            .def_readonly("frames_written", &RecordingStats::frames_written)
+            .def_readonly("frames_dropped", &RecordingStats::frames_dropped)
+            .def_readonly("bytes_written", &RecordingStats::bytes_written)
+            .def_readonly("write_errors", &RecordingStats::write_errors)
+            .def("__repr__", [](const RecordingStats &s) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.RecordingStats ";
+                repr << "frames_written=" << s.frames_written << " ";
+                repr << "frames_dropped=" << s.frames_dropped << " ";
+                repr << "bytes_written=" << s.bytes_written << " ";
+                repr << "write_errors=" << s.write_errors << ">";
+                return repr.str();
+            });
+
+    py::class_<StreamRecordingStats>(m, "StreamRecordingStats")
+            .def_readonly("packets_written", &StreamRecordingStats::packets_written)
+            .def_readonly("lost_frames", &StreamRecordingStats::lost_frames)
+            .def_readonly("late_packets", &StreamRecordingStats::late_packets)
+            .def_readonly("packets_dropped", &StreamRecordingStats::packets_dropped)
+            .def_readonly("bytes_written", &StreamRecordingStats::bytes_written)
+            .def_readonly("write_errors", &StreamRecordingStats::write_errors)
+            .def("__repr__", [](const StreamRecordingStats &s) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.StreamRecordingStats ";
+                repr << "packets_written=" << s.packets_written << " ";
+                repr << "lost_frames=" << s.lost_frames << " ";
+                repr << "late_packets=" << s.late_packets << " ";
+                repr << "packets_dropped=" << s.packets_dropped << " ";
+                repr << "bytes_written=" << s.bytes_written << " ";
+                repr << "write_errors=" << s.write_errors << ">";
+                return repr.str();
+            });
+
+    py::class_<CallEvent>(m, "CallEvent")
+            .def_readonly("type", &CallEvent::type)
+            .def_readonly("value", &CallEvent::value)
+            .def("__repr__", [](const CallEvent &e) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.CallEvent ";
+                repr << "type=" << e.type << " ";
+                repr << "value=" << e.value << ">";
+                return repr.str();
+            });
+
+    py::class_<RtpBridgeStats>(m, "RtpBridgeStats")
+            .def_readonly("packets_sent", &RtpBridgeStats::packets_sent)
+            .def_readonly("packets_received", &RtpBridgeStats::packets_received)
+            .def_readonly("packets_late", &RtpBridgeStats::packets_late)
+            .def_readonly("packets_dropped", &RtpBridgeStats::packets_dropped)
+            .def_readonly("frames_passed_through", &RtpBridgeStats::frames_passed_through)
+            .def_readonly("frames_transcoded", &RtpBridgeStats::frames_transcoded)
+            .def_readonly("concealed_ms", &RtpBridgeStats::concealed_ms)
+            .def("__repr__", [](const RtpBridgeStats &s) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.RtpBridgeStats ";
+                repr << "packets_sent=" << s.packets_sent << " ";
+                repr << "packets_received=" << s.packets_received << " ";
+                repr << "packets_late=" << s.packets_late << " ";
+                repr << "packets_dropped=" << s.packets_dropped << " ";
+                repr << "frames_passed_through=" << s.frames_passed_through << " ";
+                repr << "frames_transcoded=" << s.frames_transcoded << " ";
+                repr << "concealed_ms=" << s.concealed_ms << ">";
+                return repr.str();
+            });
+
+    py::class_<EncoderGroupStats>(m, "EncoderGroupStats")
+            .def_readonly("frames_encoded", &EncoderGroupStats::frames_encoded)
+            .def_readonly("frames_sent", &EncoderGroupStats::frames_sent)
+            .def("__repr__", [](const EncoderGroupStats &s) {
+                std::ostringstream repr;
+                repr << "<_tgvoip.EncoderGroupStats ";
+                repr << "frames_encoded=" << s.frames_encoded << " ";
+                repr << "frames_sent=" << s.frames_sent << ">";
+                return repr.str();
+            });
+
     py::class_<Endpoint>(m, "Endpoint")
             .def(py::init<long long, const std::string &, const std::string &, int, const py::bytes &>())
             .def_readwrite("_id", &Endpoint::id)
@@ -140,11 +376,21 @@ PYBIND11_MODULE(_tgvoip, m) {
             .def("get_debug_string", &VoIPController::get_debug_string, "Get debug string")
             .def("set_network_type", &VoIPController::set_network_type, "Set network type")
             .def("set_mic_mute", &VoIPController::set_mic_mute)
+            .def("set_call_host", &VoIPController::set_call_host, py::keep_alive<1, 2>())
+            .def("connect_loopback", &VoIPController::connect_loopback)
+            .def("set_loopback_impairment", &VoIPController::set_loopback_impairment)
+            .def("bridge", &VoIPController::bridge)
+            .def("unbridge", &VoIPController::unbridge)
+            .def("is_bridge_forwarding", &VoIPController::is_bridge_forwarding)
+            .def("set_input_sample_rate", &VoIPController::set_input_sample_rate)
+            .def("set_output_sample_rate", &VoIPController::set_output_sample_rate)
             .def("set_config", &VoIPController::set_config)
             .def("debug_ctl", &VoIPController::debug_ctl)
             .def("get_preferred_relay_id", &VoIPController::get_preferred_relay_id)
             .def("get_last_error", &VoIPController::get_last_error)
             .def("get_stats", &VoIPController::get_stats)
+            .def("get_call_stats", &VoIPController::get_call_stats)
+            .def("set_metrics_label", &VoIPController::set_metrics_label)
             .def("get_debug_log", &VoIPController::get_debug_log)
             .def("set_audio_output_gain_control_enabled", &VoIPController::set_audio_output_gain_control_enabled)
             .def("set_echo_cancellation_strength", &VoIPController::set_echo_cancellation_strength)
@@ -167,15 +413,62 @@ PYBIND11_MODULE(_tgvoip, m) {
             .def("_native_io_set", &VoIPController::_native_io_set)
             .def("play", &VoIPController::play)
             .def("play_on_hold", &VoIPController::play_on_hold)
-            .def("set_output_file", &VoIPController::set_output_file)
+            .def("play_prompt", &VoIPController::play_prompt)
+            .def("clear_prompts", &VoIPController::clear_prompts)
+            .def("get_prompt_stats", &VoIPController::get_prompt_stats)
+            .def("set_output_file", &VoIPController::set_output_file, py::arg("path"), py::arg("direct_io") = false,
+                 py::arg("format") = RecordingFormat::RECORDING_FORMAT_RAW, py::arg("bitrate") = 32000)
             .def("clear_play_queue", &VoIPController::clear_play_queue)
             .def("clear_hold_queue", &VoIPController::clear_hold_queue)
             .def("unset_output_file", &VoIPController::unset_output_file)
+            .def("get_recording_stats", &VoIPController::get_recording_stats)
+            .def("set_stream_output_file", &VoIPController::set_stream_output_file)
+            .def("unset_stream_output_file", &VoIPController::unset_stream_output_file)
+            .def("get_stream_recording_stats", &VoIPController::get_stream_recording_stats)
+            .def("enable_shared_memory_io", &VoIPController::enable_shared_memory_io, py::arg("capacity_ms") = 1000)
+            .def("disable_shared_memory_io", &VoIPController::disable_shared_memory_io)
+            .def("get_shared_memory_rings", &VoIPController::get_shared_memory_rings)
+            .def("start_rtp_bridge", &VoIPController::start_rtp_bridge, py::arg("local_port") = 0,
+                 py::arg("remote_address") = "", py::arg("remote_port") = 0,
+                 py::arg("codec") = RtpCodec::RTP_CODEC_OPUS, py::arg("payload_type") = -1,
+                 py::arg("sample_rate") = 16000, py::arg("packet_duration") = 20, py::arg("jitter_delay") = 60,
+                 py::arg("local_address") = "127.0.0.1")
+            .def("stop_rtp_bridge", &VoIPController::stop_rtp_bridge)
+            .def("get_rtp_bridge_stats", &VoIPController::get_rtp_bridge_stats)
+            .def("enable_event_queue", &VoIPController::enable_event_queue)
+            .def("disable_event_queue", &VoIPController::disable_event_queue)
+            .def("drain_events", &VoIPController::drain_events)
+
+            .def_static("set_clock_rate", &VoIPController::set_clock_rate)
+            .def_static("set_cpu_budget", &VoIPController::set_cpu_budget)
+            .def_static("get_cpu_governor_stats", &VoIPController::get_cpu_governor_stats)
+            .def("get_cpu_degradation", &VoIPController::get_cpu_degradation)
+            .def_static("set_media_cache_capacity", &VoIPController::set_media_cache_capacity)
+            .def_static("get_media_cache_stats", &VoIPController::get_media_cache_stats)
+            .def_static("register_prompt", &VoIPController::register_prompt, py::arg("path"),
+                        py::arg("sample_rate") = 48000, py::arg("frame_duration") = 60, py::arg("bitrate") = 16000)
+            .def_static("unregister_prompt", &VoIPController::unregister_prompt)
+            .def_static("start_metrics_http_server", &VoIPController::start_metrics_http_server,
+                        py::arg("port") = 0, py::arg("address") = "127.0.0.1")
+            .def_static("start_metrics_file", &VoIPController::start_metrics_file, py::arg("path"),
+                        py::arg("interval") = 15.0)
+            .def_static("stop_metrics_exporter", &VoIPController::stop_metrics_exporter)
+            .def_static("get_metrics", &VoIPController::get_metrics)
 
             .def_readonly("persistent_state_file", &VoIPController::persistent_state_file)
             .def_property_readonly_static("LIBTGVOIP_VERSION", &VoIPController::get_version)
             .def_property_readonly_static("CONNECTION_MAX_LAYER", &VoIPController::connection_max_layer);
 
+    py::class_<EncoderGroup>(m, "EncoderGroup")
+            .def(py::init<std::vector<uint32_t>, uint32_t, int>(),
+                 py::arg("bitrates") = std::vector<uint32_t>{8000, 14000, 20000}, py::arg("frame_duration") = 60,
+                 py::arg("expected_loss") = 1)
+            .def("add_call", &EncoderGroup::add_call)
+            .def("remove_call", &EncoderGroup::remove_call)
+            .def("play", &EncoderGroup::play)
+            .def("clear_play_queue", &EncoderGroup::clear_play_queue)
+            .def("get_stats", &EncoderGroup::get_stats);
+
     py::class_<VoIPServerConfig>(m, "VoIPServerConfig")
             .def_static("set_config", &VoIPServerConfig::set_config);
 
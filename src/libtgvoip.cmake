@@ -34,9 +34,19 @@ else()
         BlockingQueue.h
         Buffers.cpp
         Buffers.h
+        CallBridge.cpp
+        CallBridge.h
+        CallHost.cpp
+        CallHost.h
+        CpuGovernor.cpp
+        CpuGovernor.h
+        Clock.cpp
+        Clock.h
         CongestionControl.cpp
         CongestionControl.h
         EchoCanceller.cpp
+        EncoderGroup.cpp
+        EncoderGroup.h
         EchoCanceller.h
         JitterBuffer.cpp
         JitterBuffer.h
@@ -44,10 +54,16 @@ else()
         logging.h
         MediaStreamItf.cpp
         MediaStreamItf.h
+        MetricsExporter.cpp
+        MetricsExporter.h
         OpusDecoder.cpp
         OpusDecoder.h
         OpusEncoder.cpp
         OpusEncoder.h
+        OpusStreamRecorder.cpp
+        OpusStreamRecorder.h
+        RtpBridge.cpp
+        RtpBridge.h
         threading.h
         TgVoip.cpp
         TgVoip.h
@@ -61,10 +77,31 @@ else()
         audio/AudioInput.h
         audio/AudioOutput.cpp
         audio/AudioOutput.h
+        audio/AudioFilePlayer.cpp
+        audio/AudioFilePlayer.h
+        audio/AudioFileReader.cpp
+        audio/AudioFileReader.h
+        audio/AudioRecorder.cpp
+        audio/AudioRecorder.h
+        audio/CpuFeatures.h
+        audio/MediaCache.cpp
+        audio/MediaCache.h
+        audio/MixerKernels.cpp
+        audio/MixerKernels.h
+        audio/OggOpus.cpp
+        audio/OggOpus.h
+        audio/OpusPromptCache.cpp
+        audio/OpusPromptCache.h
+        audio/PolyphaseResampler.cpp
+        audio/PolyphaseResampler.h
         audio/Resampler.cpp
         audio/Resampler.h
+        audio/SharedMemoryRing.cpp
+        audio/SharedMemoryRing.h
         NetworkSocket.cpp
         NetworkSocket.h
+        NetworkSocketLoopback.cpp
+        NetworkSocketLoopback.h
         PacketReassembler.cpp
         PacketReassembler.h
         MessageThread.cpp
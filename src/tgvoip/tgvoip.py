@@ -16,12 +16,13 @@
 # You should have received a copy of the GNU Lesser General Public License
 # along with PytgVoIP.  If not, see <http://www.gnu.org/licenses/>.
 
+import asyncio
 import json
 import os
 import sys
 from datetime import datetime
 from enum import Enum
-from typing import Union, List
+from typing import Optional, Tuple, Union, List
 
 #from _tgvoip import (
 #    NetType as _NetType,
@@ -65,9 +66,26 @@ _NetType = _tgvoip.NetType
 _DataSaving = _tgvoip.DataSaving
 _CallState = _tgvoip.CallState
 _CallError = _tgvoip.CallError
+_RecordingFormat = _tgvoip.RecordingFormat
+_RtpCodec = _tgvoip.RtpCodec
+_CallEventType = _tgvoip.CallEventType
+_CallEvent = _tgvoip.CallEvent
 Stats = _tgvoip.Stats
+CallStats = _tgvoip.CallStats
 Endpoint = _tgvoip.Endpoint
+CallHostStats = _tgvoip.CallHostStats
+_CallHost = _tgvoip.CallHost
 _VoIPController = _tgvoip.VoIPController
+CpuGovernorStats = _tgvoip.CpuGovernorStats
+CpuDegradation = _tgvoip.CpuDegradation
+MediaCacheStats = _tgvoip.MediaCacheStats
+PromptStats = _tgvoip.PromptStats
+SharedMemoryRing = _tgvoip.SharedMemoryRing
+RecordingStats = _tgvoip.RecordingStats
+StreamRecordingStats = _tgvoip.StreamRecordingStats
+RtpBridgeStats = _tgvoip.RtpBridgeStats
+EncoderGroupStats = _tgvoip.EncoderGroupStats
+_EncoderGroup = _tgvoip.EncoderGroup
 _VoIPServerConfig = _tgvoip.VoIPServerConfig
 
 from tgvoip.utils import get_real_elapsed_time
@@ -176,6 +194,63 @@ class CallError(Enum):
     PROXY = _CallError.PROXY
 
 
+class RecordingFormat(Enum):
+    """
+    An enumeration of output file formats for native I/O
+
+    Members:
+        * RAW = 0 - headerless s16le PCM
+        * WAV = 1 - s16le PCM with a WAV header
+        * OGG_OPUS = 2 - mono Opus in an Ogg container
+    """
+    RAW = _RecordingFormat.RAW
+    WAV = _RecordingFormat.WAV
+    OGG_OPUS = _RecordingFormat.OGG_OPUS
+
+
+class RtpCodec(Enum):
+    """
+    An enumeration of codecs of the RTP bridge
+
+    Members:
+        * OPUS = 0 - Opus at 48 kHz, passed through without transcoding whenever possible
+        * PCMU = 1 - G.711 µ-law at 8 kHz
+        * PCMA = 2 - G.711 A-law at 8 kHz
+        * L16 = 3 - big-endian 16-bit PCM
+    """
+    OPUS = _RtpCodec.OPUS
+    PCMU = _RtpCodec.PCMU
+    PCMA = _RtpCodec.PCMA
+    L16 = _RtpCodec.L16
+
+
+class CallHost(_CallHost):
+    """
+    A pool of worker threads shared by many calls. Timers, audio I/O, encoding and decoding of every controller attached
+    with :meth:`VoIPController.set_call_host` run on these workers instead of on dedicated per-call threads, so only
+    the receive thread of each call is left
+
+    Args:
+        workers (``int``, *optional*): Number of worker threads, defaults to the number of CPU cores
+
+    Attributes:
+        workers:
+            Number of worker threads
+    """
+
+    def __init__(self, workers: int = 0):
+        super().__init__(workers)
+
+    def get_stats(self) -> CallHostStats:
+        """
+        Get scheduler stats
+
+        Returns:
+            :class:`CallHostStats` object
+        """
+        return super().get_stats()
+
+
 class VoIPController(_VoIPController):
     """
     A wrapper around C++ wrapper for libtgvoip ``VoIPController``
@@ -201,6 +276,9 @@ class VoIPController(_VoIPController):
 
         signal_bars_changed_handlers
             ``list`` of signal bars count change callbacks, callbacks receive an ``int`` object as argument
+
+    Handlers are called on libtgvoip's threads unless the controller is attached to an asyncio loop with \
+    :meth:`attach_to_loop`, then they run on the loop's thread.
     """
 
     def __init__(self, persistent_state_file: str = '', debug=False, logs_dir='logs'):
@@ -212,6 +290,11 @@ class VoIPController(_VoIPController):
         self.recv_audio_frame_callback = lambda frame: ...
         self.call_state_changed_handlers = []
         self.signal_bars_changed_handlers = []
+        self._loop = None
+        self._event_fd = -1
+        self._state = None
+        self._state_waiters = []
+        self._signal_bars_waiters = []
         self._init()
 
     @property
@@ -319,6 +402,111 @@ class VoIPController(_VoIPController):
         """
         super().set_mic_mute(mute)
 
+    def set_call_host(self, host: CallHost) -> bool:
+        """
+        Run this call on a shared :class:`CallHost`: timers, audio I/O, encoding, decoding and echo cancellation run on \
+        the host's workers. Only the receive thread stays per call. Must be called once, before :meth:`start`
+
+        Args:
+            host (:class:`CallHost`): Host to attach to, kept alive as long as the controller
+
+        Returns:
+            ``bool`` whether the call was attached, ``False`` if it was already started or attached to a host
+        """
+        return super().set_call_host(host)
+
+    def connect_loopback(self, peer: 'VoIPController', relay_ip: str = '127.0.0.1', relay_port: int = 1) -> bool:
+        """
+        Connect this controller to another one in the same process without going through the network. \
+        Must be called before :meth:`start` of either controller
+
+        The link acts as a UDP reflector at ``relay_ip:relay_port``: pass an :class:`Endpoint` with that address to \
+        :meth:`set_remote_endpoints` of both controllers, with 16-byte peer tags that differ only in the lowest bit \
+        of the last byte
+
+        Args:
+            peer (:class:`VoIPController`): Controller on the other end
+            relay_ip (``str``, *optional*): IPv4 address of the emulated reflector
+            relay_port (``int``, *optional*): Port of the emulated reflector
+
+        Returns:
+            ``bool`` whether the controllers were connected (fails if either of them is already started)
+        """
+        return super().connect_loopback(peer, relay_ip, relay_port)
+
+    def set_loopback_impairment(self, delay: float = 0.0, jitter: float = 0.0, loss: float = 0.0,
+                                reorder: float = 0.0) -> bool:
+        """
+        Impair packets sent by this controller over a loopback link set up with :meth:`connect_loopback`
+
+        Args:
+            delay (``float``, *optional*): Delay added to every packet, in seconds
+            jitter (``float``, *optional*): Random extra delay up to this value, in seconds
+            loss (``float``, *optional*): Probability of dropping a packet, from ``0`` to ``1``
+            reorder (``float``, *optional*): Probability of a packet arriving after the next one, from ``0`` to ``1``
+
+        Returns:
+            ``bool`` whether the controller is connected through loopback
+        """
+        return super().set_loopback_impairment(delay, jitter, loss, reorder)
+
+    def bridge(self, peer: 'VoIPController') -> bool:
+        """
+        Connect the audio of this call to another one, in both directions
+
+        Opus frames received by one call are sent as-is by the other one, skipping decoding, echo cancellation and \
+        encoding. A direction where the frame durations of the two calls differ falls back to decoding and re-encoding \
+        natively, resampled to the ``capture_sample_rate`` of the encoding call. While bridged, neither call reads from or writes to files or Python callbacks
+
+        Args:
+            peer (:class:`VoIPController`): Controller of the other call
+
+        Returns:
+            ``bool`` whether the calls were bridged (fails if either of them is already bridged)
+        """
+        return super().bridge(peer)
+
+    def unbridge(self):
+        """
+        Disconnect the call from the one it was bridged to with :meth:`bridge` and restore normal audio processing on both
+        """
+        super().unbridge()
+
+    def is_bridge_forwarding(self) -> bool:
+        """
+        Returns:
+            ``bool`` whether audio sent by this call currently comes from the bridged call without transcoding
+        """
+        return super().is_bridge_forwarding()
+
+    def set_input_sample_rate(self, rate: int) -> bool:
+        """
+        Set the sample rate of the audio this call sends, either from files played with native I/O or returned by the \
+        callback set with :meth:`set_send_audio_frame_callback`, which is then asked for 20 ms of audio at that rate. \
+        Audio is converted to the ``capture_sample_rate`` passed to :meth:`set_config` if it differs. Defaults to 48000
+
+        Args:
+            rate (``int``): Sample rate in Hz, 8000 to 192000
+
+        Returns:
+            ``bool`` whether the rate is supported
+        """
+        return super().set_input_sample_rate(rate)
+
+    def set_output_sample_rate(self, rate: int) -> bool:
+        """
+        Set the sample rate of the audio this call receives, written to the output file with native I/O or passed to the \
+        callback set with :meth:`set_recv_audio_frame_callback`. Defaults to 48000. Fails while recording to a WAV or \
+        Ogg/Opus file at a different rate
+
+        Args:
+            rate (``int``): Sample rate in Hz, 8000 to 192000
+
+        Returns:
+            ``bool`` whether the rate is supported
+        """
+        return super().set_output_sample_rate(rate)
+
     def set_config(self,
                    recv_timeout: float,
                    init_timeout: float,
@@ -329,7 +517,10 @@ class VoIPController(_VoIPController):
                    enable_agc: bool = True,
                    log_file_path: str = None,
                    status_dump_path: str = None,
-                   log_packet_stats: bool = None):
+                   log_packet_stats: bool = None,
+                   capture_sample_rate: int = 48000,
+                   listen_only: bool = False,
+                   send_only: bool = False):
         """
         Set call config
 
@@ -361,6 +552,20 @@ class VoIPController(_VoIPController):
 
             log_packet_stats (``bool``, *optional*):
                 Whether to log packet stats, defaults to ``debug`` value
+
+            capture_sample_rate (``int``, *optional*):
+                Sample rate echo cancellation, noise suppression and the encoder run at: 8000, 16000, 24000 or 48000, \
+                defaults to 48000. Setting it to the rate of the sent audio (see :meth:`set_input_sample_rate`) avoids \
+                resampling it, and lower rates take less CPU. Must be set before the call is started
+
+            listen_only (``bool``, *optional*):
+                Only receive audio, defaults to ``False``. No capture, echo cancellation or encoding is set up and \
+                the mic stays muted for the whole call. Must be set before the call is started
+
+            send_only (``bool``, *optional*):
+                Only send audio, defaults to ``False``. Incoming audio is acknowledged and dropped without being \
+                decoded, the audio output is never started and echo cancellation is turned off. Must be set before \
+                the call is started
         """
         if log_file_path is None:
             if self.debug:
@@ -371,8 +576,11 @@ class VoIPController(_VoIPController):
             status_dump_path = self._get_log_file_path('voip_stats') if self.debug else ''
         if log_packet_stats is None:
             log_packet_stats = self.debug
+        if capture_sample_rate not in (8000, 16000, 24000, 48000):
+            raise ValueError('capture_sample_rate must be 8000, 16000, 24000 or 48000')
         super().set_config(recv_timeout, init_timeout, _DataSaving(data_saving_mode.value), enable_aec, enable_ns, enable_agc,
-                           log_file_path, status_dump_path, log_packet_stats)
+                           log_file_path, status_dump_path, log_packet_stats, capture_sample_rate,
+                           listen_only, send_only)
 
     def debug_ctl(self, request: int, param: int):
         """
@@ -415,6 +623,29 @@ class VoIPController(_VoIPController):
         """
         return super().get_stats()
 
+    def get_call_stats(self) -> CallStats:
+        """
+        Get a snapshot of the call's network and audio state: everything :meth:`get_debug_string` shows, as numbers. \
+        Filled in without formatting or parsing strings, so it's cheap enough to poll many calls often. The traffic \
+        counters and the state are current, the rest is refreshed once a second after the call is established, like \
+        the exported metrics. Times are in seconds, ``send_loss_history`` has the packets lost in each of the last 10 seconds, most recent first, and \
+        ``current_endpoint_type`` is 1 for P2P, 2 for LAN, 3 for UDP relays and 4 for TCP relays
+
+        Returns:
+            :class:`CallStats` object
+        """
+        return super().get_call_stats()
+
+    def set_metrics_label(self, label: str):
+        """
+        Set the value of the ``call`` label of this call's metrics, see :meth:`start_metrics_http_server`. Calls are \
+        numbered in the order they were created until they get a label
+
+        Args:
+            label (``str``): Label value, e.g. the call ID
+        """
+        super().set_metrics_label(label)
+
     def get_debug_log(self) -> str:
         """
         Get debug log
@@ -460,6 +691,169 @@ class VoIPController(_VoIPController):
         """
         return super().need_rate()
 
+    @staticmethod
+    def set_clock_rate(rate: float):
+        """
+        Make libtgvoip time run faster than realtime, for tests. Affects all controllers in the process, including \
+        running ones: time continues from where it is at the new rate, it never jumps
+
+        Args:
+            rate (``float``): Clock seconds per real second, ``1.0`` restores the system clock
+
+        Raises:
+            :class:`ValueError` if :attr:`rate` is not positive
+        """
+        if rate <= 0:
+            raise ValueError('rate must be positive')
+        _VoIPController.set_clock_rate(rate)
+
+    @staticmethod
+    def set_cpu_budget(cores: float):
+        """
+        Limit the CPU time all calls in the process may spend on processing and encoding sent audio. When the limit is \
+        exceeded, the most expensive call gets a lower Opus complexity, then loses its redundant low-bitrate stream, \
+        then noise suppression, then echo cancellation, one step per second; steps are undone once there's headroom \
+        again. See :meth:`get_cpu_degradation` for what was turned off in a call
+
+        Args:
+            cores (``float``): CPU cores' worth of processing time allowed, e.g. ``0.5``. ``0`` (the default) removes \
+            the limit and restores all calls
+
+        Raises:
+            :class:`ValueError` if :attr:`cores` is negative
+        """
+        if cores < 0:
+            raise ValueError('cores must not be negative')
+        _VoIPController.set_cpu_budget(cores)
+
+    @staticmethod
+    def get_cpu_governor_stats() -> CpuGovernorStats:
+        """
+        Get the current load and budget of the process-wide CPU governor
+
+        Returns:
+            :class:`CpuGovernorStats` object
+        """
+        return _VoIPController.get_cpu_governor_stats()
+
+    def get_cpu_degradation(self) -> CpuDegradation:
+        """
+        Get what the CPU governor currently reduced or turned off in this call, see :meth:`set_cpu_budget`
+
+        Returns:
+            :class:`CpuDegradation` object, ``level`` is 0 when the call runs at full quality
+        """
+        return super().get_cpu_degradation()
+
+    @staticmethod
+    def set_media_cache_capacity(size: int):
+        """
+        Set how much decoded audio the process-wide media cache may hold. Files passed to :meth:`play` and \
+        :meth:`play_on_hold` are decoded and resampled once and shared by all calls; files that changed on disk are \
+        decoded again. Entries no call is playing are evicted, least recently used first, past this size. Files larger \
+        than the whole cache are streamed from disk
+
+        Args:
+            size (``int``): Size in bytes, 256 MiB by default. ``0`` disables caching
+
+        Raises:
+            :class:`ValueError` if :attr:`size` is negative
+        """
+        if size < 0:
+            raise ValueError('size must not be negative')
+        _VoIPController.set_media_cache_capacity(size)
+
+    @staticmethod
+    def get_media_cache_stats() -> MediaCacheStats:
+        """
+        Get the hit counters and size of the process-wide media cache
+
+        Returns:
+            :class:`MediaCacheStats` object
+        """
+        return _VoIPController.get_media_cache_stats()
+
+    @staticmethod
+    def register_prompt(path: str, sample_rate: int = 48000, frame_duration: int = 60, bitrate: int = 16000) -> bool:
+        """
+        Encode a file into Opus frames once for all calls that play it with :meth:`play_prompt`. While nothing else \
+        is being sent, the frames go out as they are, without echo cancellation or encoding. A file can be registered \
+        for several frame durations and bitrates, each call picks the one that suits it best. Registering a file again \
+        only encodes it again if it changed on disk
+
+        Args:
+            path (``str``): File path, in any format :meth:`play` supports
+            sample_rate (``int``, *optional*): Capture sample rate of the calls that will play it
+            frame_duration (``int``, *optional*): Outgoing frame duration of those calls in milliseconds, a multiple \
+                of 20 up to 120
+            bitrate (``int``, *optional*): Opus bitrate in bits per second. Calls whose congestion control wants a \
+                lower bitrate encode the prompt live instead
+
+        Returns:
+            ``bool`` whether the file could be decoded and encoded
+        """
+        return _VoIPController.register_prompt(path, sample_rate, frame_duration, bitrate)
+
+    @staticmethod
+    def unregister_prompt(path: str) -> None:
+        """
+        Forget all encodings of a file registered with :meth:`register_prompt`. Calls that are playing it finish it
+
+        Args:
+            path (``str``): File path
+        """
+        _VoIPController.unregister_prompt(path)
+
+    @staticmethod
+    def start_metrics_http_server(port: int = 0, address: str = '127.0.0.1') -> int:
+        """
+        Serve the metrics of all calls in the process to HTTP GET requests in the OpenMetrics text format, for \
+        Prometheus and compatible scrapers. Each call has bytes, packets, losses, RTT, jitter, bitrate, queue depths \
+        and timer lateness labeled with ``call`` (see :meth:`set_metrics_label`), and there are process-wide totals \
+        that include the calls that already ended. Counters are atomics the call's threads update in place, so \
+        scraping never makes a call wait; gauges are refreshed once a second. Not available on Windows
+
+        Args:
+            port (``int``, *optional*): TCP port, 0 for any free one
+            address (``str``, *optional*): Local address to listen on
+
+        Returns:
+            ``int`` port the server listens on, 0 if it couldn't be started
+        """
+        return _VoIPController.start_metrics_http_server(port, address)
+
+    @staticmethod
+    def start_metrics_file(path: str, interval: float = 15.0) -> bool:
+        """
+        Write the metrics :meth:`start_metrics_http_server` serves to a file periodically, e.g. for node_exporter's \
+        textfile collector. The file is replaced atomically, so readers never see a partial one
+
+        Args:
+            path (``str``): File path
+            interval (``float``, *optional*): Seconds between writes
+
+        Returns:
+            ``bool`` whether the file could be written
+        """
+        return _VoIPController.start_metrics_file(path, interval)
+
+    @staticmethod
+    def stop_metrics_exporter() -> None:
+        """
+        Stop the HTTP server and the file writer
+        """
+        _VoIPController.stop_metrics_exporter()
+
+    @staticmethod
+    def get_metrics() -> str:
+        """
+        Get the metrics of all calls in the process without starting an exporter
+
+        Returns:
+            ``str`` in the OpenMetrics text format
+        """
+        return _VoIPController.get_metrics()
+
     @property
     def native_io(self) -> bool:
         """
@@ -484,6 +878,10 @@ class VoIPController(_VoIPController):
         """
         Add a file to play queue for native I/O
 
+        Ogg/Opus and WAV files are decoded natively, anything else is played as raw 16-bit signed PCM at the input \
+        sample rate (see :meth:`set_input_sample_rate`). Files are decoded once into a cache shared by all calls, see \
+        :meth:`set_media_cache_capacity`, so the first call to play a file may take a while.
+
         Args:
             path (``str``): File path
 
@@ -494,24 +892,62 @@ class VoIPController(_VoIPController):
 
     def play_on_hold(self, paths: List[str]) -> None:
         """
-        Replace the hold queue for native I/O
+        Replace the hold queue for native I/O. Hold files are played in a loop while the play queue is empty and \
+        support the same formats as :meth:`play`
 
         Args:
             paths (``list`` of ``str``): List of file paths
         """
         super().play_on_hold(paths)
 
-    def set_output_file(self, path: str) -> bool:
+    def play_prompt(self, path: str) -> bool:
+        """
+        Queue a file registered with :meth:`register_prompt`. Its pre-encoded frames replace the outgoing audio while \
+        the input is silent; when the input isn't silent, or the call's frame duration, bitrate or extra error \
+        correction don't match the encoding, the prompt is mixed into the input and encoded live. Works with native \
+        and Python I/O. Files that weren't registered for the call's capture sample rate are passed to :meth:`play`
+
+        Args:
+            path (``str``): File path
+
+        Returns:
+            ``bool`` whether the prompt was queued
+        """
+        return super().play_prompt(path)
+
+    def clear_prompts(self) -> None:
+        """
+        Stop the prompt that is playing and clear the prompt queue
+        """
+        super().clear_prompts()
+
+    def get_prompt_stats(self) -> PromptStats:
+        """
+        Get how many prompt frames were sent pre-encoded and how many had to be mixed and encoded live
+
+        Returns:
+            :class:`PromptStats` object
         """
-        Set output file for native I/O
+        return super().get_prompt_stats()
+
+    def set_output_file(self, path: str, direct_io: bool = False, format: RecordingFormat = RecordingFormat.RAW,
+                        bitrate: int = 32000) -> bool:
+        """
+        Set output file for native I/O. Frames are encoded and written to the file on a background thread, if the disk \
+        can't keep up they are dropped rather than delaying playout, see :meth:`get_recording_stats`. The file is \
+        recorded at the rate set with :meth:`set_output_sample_rate`, which can't be changed while recording to a WAV \
+        or Ogg/Opus file
 
         Args:
             path (``str``): File path
+            direct_io (``bool``, *optional*): Bypass the page cache with ``O_DIRECT`` where supported (Linux only)
+            format (:class:`RecordingFormat`, *optional*): File format, Ogg/Opus takes about a tenth of the space of PCM
+            bitrate (``int``, *optional*): Opus bitrate in bits per second, ignored for the other formats
 
         Returns:
             ``bool`` whether opening the file was successful. Output file is not replaced on failure.
         """
-        return super().set_output_file(path)
+        return super().set_output_file(path, direct_io, _RecordingFormat(format.value), bitrate)
 
     def clear_play_queue(self) -> None:
         """
@@ -527,22 +963,264 @@ class VoIPController(_VoIPController):
 
     def unset_output_file(self) -> None:
         """
-        Unset the output file for native I/O
+        Unset the output file for native I/O. Blocks until the queued frames are written
         """
         super().unset_output_file()
 
+    def get_recording_stats(self) -> RecordingStats:
+        """
+        Get counters of the current output file, or of the last one after it was unset
+
+        Returns:
+            :class:`RecordingStats` object
+        """
+        return super().get_recording_stats()
+
+    def set_stream_output_file(self, path: str) -> bool:
+        """
+        Record the audio received from the other side to an Ogg/Opus file without decoding it. Opus frames are written \
+        as they arrive from the network, lost frames are marked so players conceal them and the file keeps the call's \
+        timing. Unlike :meth:`set_output_file` this works without native I/O and in send-only or bridged calls, and \
+        costs almost no CPU
+
+        Args:
+            path (``str``): File path
+
+        Returns:
+            ``bool`` whether creating the file was successful. The current file is not replaced on failure.
+        """
+        return super().set_stream_output_file(path)
+
+    def unset_stream_output_file(self) -> None:
+        """
+        Stop recording the received audio stream and close the file
+        """
+        super().unset_stream_output_file()
+
+    def get_stream_recording_stats(self) -> StreamRecordingStats:
+        """
+        Get counters of the current stream recording, or of the last one after it was stopped
+
+        Returns:
+            :class:`StreamRecordingStats` object
+        """
+        return super().get_stream_recording_stats()
+
+    def enable_shared_memory_io(self, capacity_ms: int = 1000) -> bool:
+        """
+        Exchange the call's audio with another process through two shared memory rings instead of native or Python \
+        I/O. The call reads outgoing audio from the input ring at the input sample rate and writes received audio to \
+        the output ring at the output sample rate, without copying it through Python or taking the GIL. Pass the file \
+        descriptors from :meth:`get_shared_memory_rings` to the other process, e.g. with ``socket.send_fds()`` or \
+        ``pass_fds``. Neither sample rate can be changed while this is enabled. Linux only
+
+        Each ring is a memfd that starts with this header, followed by 16-bit mono samples at ``data_offset``::
+
+            uint32 magic ("TGPR"), version, sample_rate, capacity (samples, a power of 2)
+            uint64 data_offset
+            uint64 write_pos at offset 64, read_pos at offset 128, overruns at offset 192, underruns at offset 200
+
+        Positions count samples since the start; the sample at position ``p`` is at index ``p & (capacity - 1)``. The \
+        writer stores ``write_pos`` and the reader ``read_pos``, with release ordering after copying the samples. The \
+        call writes to the ring's eventfd whenever it moves its position, so the other process can wait on it with \
+        poll. Frames that don't fit into the output ring are dropped and missing input is read as silence
+
+        Args:
+            capacity_ms (``int``, *optional*): Size of each ring in milliseconds, rounded up to a power of 2 samples
+
+        Returns:
+            ``bool`` whether the rings were created. Replaces any rings created before
+        """
+        return super().enable_shared_memory_io(capacity_ms)
+
+    def disable_shared_memory_io(self) -> None:
+        """
+        Go back to native or Python I/O. The other process keeps its mappings until it closes them
+        """
+        super().disable_shared_memory_io()
+
+    def get_shared_memory_rings(self) -> Optional[Tuple[SharedMemoryRing, SharedMemoryRing]]:
+        """
+        Get the rings created by :meth:`enable_shared_memory_io`, with their current drop counters
+
+        Returns:
+            ``tuple`` of the input and the output :class:`SharedMemoryRing`, ``None`` if shared memory I/O is disabled
+        """
+        rings = super().get_shared_memory_rings()
+        return tuple(rings) if rings else None
+
+    def start_rtp_bridge(self, local_port: int = 0, remote_address: str = '', remote_port: int = 0,
+                         codec: RtpCodec = RtpCodec.OPUS, payload_type: int = -1, sample_rate: int = 16000,
+                         packet_duration: int = 20, jitter_delay: int = 60, local_address: str = '127.0.0.1') -> int:
+        """
+        Exchange the call's audio with a local RTP peer over UDP, e.g. a PBX like Asterisk or FreeSWITCH. Everything \
+        runs on a native thread without the GIL, and while the bridge runs the call doesn't capture, decode or play \
+        audio. With Opus, frames are passed through in both directions and only transcoded to conceal loss or when \
+        the peer's packets don't line up with the call's frames. G.711 and L16 are transcoded natively. Packets from \
+        the peer go through a jitter buffer with a fixed delay. Not available on Windows
+
+        Args:
+            local_port (``int``, *optional*): UDP port to receive on, 0 for any free port
+            remote_address (``str``, *optional*): Numeric address of the peer, empty to reply to wherever its first \
+            packet comes from
+            remote_port (``int``, *optional*): Port of the peer
+            codec (:class:`RtpCodec`, *optional*): Codec of the RTP stream in both directions
+            payload_type (``int``, *optional*): RTP payload type, -1 for 111 (Opus), 0 (PCMU), 8 (PCMA) or 96 (L16)
+            sample_rate (``int``, *optional*): Sample rate of L16: 8000, 12000, 16000, 24000 or 48000
+            packet_duration (``int``, *optional*): Milliseconds of audio in each G.711 or L16 packet sent to the peer
+            jitter_delay (``int``, *optional*): Milliseconds that packets from the peer are held back, up to 1000
+            local_address (``str``, *optional*): Numeric address to bind to
+
+        Returns:
+            ``int`` local port the bridge receives on, 0 on failure, also when the call is bridged with \
+            :meth:`bridge` or in an :class:`EncoderGroup`. Replaces the RTP bridge started before
+        """
+        return super().start_rtp_bridge(local_port, remote_address, remote_port, _RtpCodec(codec.value), payload_type,
+                                        sample_rate, packet_duration, jitter_delay, local_address)
+
+    def stop_rtp_bridge(self) -> None:
+        """
+        Stop the RTP bridge and give the call its own audio I/O back
+        """
+        super().stop_rtp_bridge()
+
+    def get_rtp_bridge_stats(self) -> RtpBridgeStats:
+        """
+        Get counters of the current RTP bridge, or of the last one after it was stopped
+
+        Returns:
+            :class:`RtpBridgeStats` object
+        """
+        return super().get_rtp_bridge_stats()
+
+    def attach_to_loop(self, loop: Optional[asyncio.AbstractEventLoop] = None) -> None:
+        """
+        Deliver state and signal bars changes on an asyncio loop instead of libtgvoip's threads. Changes are queued \
+        natively and wake the loop through a file descriptor, so handlers run on the loop's thread in batches and the \
+        call's threads never wait for the GIL. Required by :meth:`wait_for_state` and :meth:`wait_for_signal_bars`. \
+        Not available on Windows
+
+        Args:
+            loop (``asyncio.AbstractEventLoop``, *optional*): Loop to deliver changes on, the current one by default
+
+        Raises:
+            :class:`RuntimeError` if the event queue can't be created
+        """
+        if loop is None:
+            loop = asyncio.get_event_loop()
+        self.detach_from_loop()
+        fd = super().enable_event_queue()
+        if fd < 0:
+            raise RuntimeError('Unable to create event queue')
+        loop.add_reader(fd, self._dispatch_events)
+        self._loop = loop
+        self._event_fd = fd
+
+    def detach_from_loop(self) -> None:
+        """
+        Deliver changes on libtgvoip's threads again, after delivering the ones still queued. Pending \
+        :meth:`wait_for_state` and :meth:`wait_for_signal_bars` calls are cancelled. Must be called on the loop's thread
+        """
+        if self._loop is None:
+            return
+        self._loop.remove_reader(self._event_fd)
+        # stops queueing and returns what's left in one step, so nothing queued in between is lost
+        self._deliver_events(super().disable_event_queue())
+        self._loop = None
+        self._event_fd = -1
+        for _, future in self._state_waiters:
+            future.cancel()
+        for future in self._signal_bars_waiters:
+            future.cancel()
+
+    async def wait_for_state(self, *states: CallState, timeout: Optional[float] = None) -> CallState:
+        """
+        Wait until the call enters one of the given states
+
+        Args:
+            *states (:class:`CallState`): States to wait for, any change if none are given
+            timeout (``float``, *optional*): Seconds to wait at most
+
+        Returns:
+            :class:`CallState` the call entered. Returns right away if the call is in one of the states already
+
+        Raises:
+            :class:`RuntimeError` if the controller isn't attached to a loop with :meth:`attach_to_loop`
+            :class:`asyncio.TimeoutError` if the timeout expires
+        """
+        if self._loop is None:
+            raise RuntimeError('attach_to_loop() must be called first')
+        if self._state in states:
+            return self._state
+        waiter = (states, self._loop.create_future())
+        self._state_waiters.append(waiter)
+        try:
+            return await asyncio.wait_for(waiter[1], timeout)
+        finally:
+            self._state_waiters.remove(waiter)
+
+    async def wait_for_signal_bars(self, timeout: Optional[float] = None) -> int:
+        """
+        Wait for the next change of the signal bars count
+
+        Args:
+            timeout (``float``, *optional*): Seconds to wait at most
+
+        Returns:
+            ``int`` new signal bars count
+
+        Raises:
+            :class:`RuntimeError` if the controller isn't attached to a loop with :meth:`attach_to_loop`
+            :class:`asyncio.TimeoutError` if the timeout expires
+        """
+        if self._loop is None:
+            raise RuntimeError('attach_to_loop() must be called first')
+        future = self._loop.create_future()
+        self._signal_bars_waiters.append(future)
+        try:
+            return await asyncio.wait_for(future, timeout)
+        finally:
+            self._signal_bars_waiters.remove(future)
+
+    # event loop callback
+    def _dispatch_events(self):
+        self._deliver_events(super().drain_events())
+
+    def _deliver_events(self, events: List[_CallEvent]):
+        for event in events:
+            try:
+                if event.type == _CallEventType.STATE_CHANGED:
+                    self._handle_state_change(_CallState(event.value))
+                else:
+                    self._handle_signal_bars_change(event.value)
+            except Exception as e:
+                # the rest of the batch is still delivered
+                self._loop.call_exception_handler({
+                    'message': 'Exception in call event handler',
+                    'exception': e,
+                })
+
     # native code callback
     def _handle_state_change(self, state: _CallState):
         state = CallState(state)
+        self._state = state
 
         if state == CallState.ESTABLISHED and not self.start_time:
             self.start_time = get_real_elapsed_time()
 
+        for states, future in self._state_waiters:
+            if (not states or state in states) and not future.done():
+                future.set_result(state)
+
         for handler in self.call_state_changed_handlers:
             callable(handler) and handler(state)
 
     # native code callback
     def _handle_signal_bars_change(self, count: int):
+        for future in self._signal_bars_waiters:
+            if not future.done():
+                future.set_result(count)
+
         for handler in self.signal_bars_changed_handlers:
             callable(handler) and handler(count)
 
@@ -602,6 +1280,78 @@ class VoIPController(_VoIPController):
         return os.path.abspath(os.path.join(self.logs_dir, '{}.log'.format(call_id)))
 
 
+class EncoderGroup(_EncoderGroup):
+    """
+    Encodes one audio source once and sends it into many calls, e.g. for a bot that plays the same audio to everyone.
+    Instead of one encoder per call there is one per bitrate of the ``bitrates`` ladder, and each call is served by the
+    highest one that doesn't exceed the bitrate its congestion control asks for. Calls in the group don't capture or
+    encode audio of their own
+
+    Args:
+        bitrates (``list`` of ``int``, *optional*): Bitrate ladder in bits per second
+        frame_duration (``int``, *optional*): Duration of the encoded frames in ms, a multiple of 20 up to 120. Only calls that \
+            negotiated the same outgoing frame duration can join the group
+        expected_loss (``int``, *optional*): Percentage of packets the encoders expect to be lost, sets how much \
+            in-band FEC they add
+    """
+
+    def __init__(self, bitrates: List[int] = None, frame_duration: int = 60, expected_loss: int = 1):
+        if frame_duration not in (20, 40, 60, 80, 100, 120):
+            raise ValueError('frame_duration must be a multiple of 20 between 20 and 120')
+        if not 0 <= expected_loss <= 100:
+            raise ValueError('expected_loss must be between 0 and 100')
+        super().__init__(bitrates if bitrates is not None else [8000, 14000, 20000], frame_duration, expected_loss)
+
+    def add_call(self, call: VoIPController) -> bool:
+        """
+        Start sending the group's audio into a call
+
+        Args:
+            call (:class:`VoIPController`): Controller of the call
+
+        Returns:
+            ``bool`` whether the call was added. Fails if the call is in another group, is bridged, has an RTP bridge \
+            or uses a different frame duration
+        """
+        return super().add_call(call)
+
+    def remove_call(self, call: VoIPController):
+        """
+        Stop sending the group's audio into a call, the call goes back to its own audio input
+
+        Args:
+            call (:class:`VoIPController`): Controller of the call
+        """
+        super().remove_call(call)
+
+    def play(self, path: str) -> bool:
+        """
+        Add a file to the group's play queue. Same format as :meth:`VoIPController.play`
+
+        Args:
+            path (``str``): File path
+
+        Returns:
+            ``bool`` whether opening the file was successful. File is not added to queue on failure.
+        """
+        return super().play(path)
+
+    def clear_play_queue(self):
+        """
+        Clear the group's play queue
+        """
+        super().clear_play_queue()
+
+    def get_stats(self) -> EncoderGroupStats:
+        """
+        Get encoding stats
+
+        Returns:
+            :class:`EncoderGroupStats` object
+        """
+        return super().get_stats()
+
+
 class VoIPServerConfig(_VoIPServerConfig):
     """
     Global server config class. This class contains default config in its source
@@ -679,5 +1429,7 @@ class VoIPServerConfig(_VoIPServerConfig):
         })
 
 
-__all__ = ['NetType', 'DataSaving', 'CallState', 'CallError', 'Stats', 'Endpoint', 'VoIPController',
-           'VoIPServerConfig']
+__all__ = ['NetType', 'DataSaving', 'CallState', 'CallError', 'RecordingFormat', 'RtpCodec', 'Stats', 'CallStats',
+           'Endpoint', 'CallHost', 'CallHostStats', 'VoIPController', 'CpuGovernorStats', 'CpuDegradation',
+           'MediaCacheStats', 'PromptStats', 'SharedMemoryRing', 'RecordingStats', 'StreamRecordingStats',
+           'RtpBridgeStats', 'EncoderGroup', 'EncoderGroupStats', 'VoIPServerConfig']